@@ -10,6 +10,7 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <gio/gunixfdlist.h>
 
 #include <errno.h>
 #include <sys/types.h>
@@ -17,11 +18,14 @@
 #include <unistd.h>
 
 #include "gduapplication.h"
+#include "gducopyscheduler.h"
+#include "gducreatediskimagedialog.h"
 #include "gducreateformatdialog.h"
 #include "gdurestorediskimagedialog.h"
 #include "gdunewdiskimagedialog.h"
 #include "gduwindow.h"
 #include "gdulocaljob.h"
+#include "gdumultibenchmarkdialog.h"
 
 struct _GduApplication
 {
@@ -174,6 +178,20 @@ static GOptionEntry opt_entries[] = {
     {"format-device", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Format selected device"), NULL },
     {"xid", 0, 0, G_OPTION_ARG_INT, NULL, N_("Parent window XID for the format dialog"), "ID" },
     {"restore-disk-image", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Restore disk image"), "FILE" },
+    {"create-disk-image", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, NULL, N_("Create disk image of device (can be given several times)"), "DEVICE" },
+    {"disk-image-folder", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Folder to create disk images in"), "FOLDER" },
+    {"max-controller-rate", 0, 0, G_OPTION_ARG_INT, NULL, N_("Copy at most this many MB/s through each disk controller"), "RATE" },
+    {"benchmark", 0, 0, G_OPTION_ARG_FILENAME, NULL, N_("Benchmark device and print the results as JSON"), "DEVICE" },
+    {"benchmark-samples", 0, 0, G_OPTION_ARG_INT, NULL, N_("Number of transfer rate samples to take"), "NUMBER" },
+    {"benchmark-sample-size", 0, 0, G_OPTION_ARG_INT, NULL, N_("Size of each transfer rate sample in MiB"), "SIZE" },
+    {"benchmark-access-samples", 0, 0, G_OPTION_ARG_INT, NULL, N_("Number of access time samples to take"), "NUMBER" },
+    {"benchmark-write", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Also benchmark writing (the data on the device is put back)"), NULL },
+    {"benchmark-force", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Unmount and lock the device before benchmark writing"), NULL },
+    {"benchmark-no-queue-depth", 0, 0, G_OPTION_ARG_NONE, NULL, N_("Don't measure queue depth scaling"), NULL },
+    {"benchmark-workload", 0, 0, G_OPTION_ARG_STRING_ARRAY, NULL, N_("Workload to run (can be given several times, \"none\" for no workloads or \"help\" to list them)"), "WORKLOAD" },
+    {"benchmark-queue-depth", 0, 0, G_OPTION_ARG_INT, NULL, N_("Queue depth to run the workloads at"), "DEPTH" },
+    {"benchmark-sustained-write", 0, 0, G_OPTION_ARG_INT, NULL, N_("Also measure the sustained write rate, writing for this many seconds (0 for no limit)"), "SECONDS" },
+    {"benchmark-sustained-write-size", 0, 0, G_OPTION_ARG_INT, NULL, N_("Also measure the sustained write rate, writing at most this many GiB (0 for no limit)"), "GIB" },
     {NULL}
 };
 
@@ -183,6 +201,216 @@ gdu_application_set_options (GduApplication *app)
   g_application_add_main_option_entries (G_APPLICATION (app), opt_entries);
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Disk images of several devices can be created from the command
+ * line in one go. They are all copied at the same time, sharing a
+ * GduCopyScheduler which caps the bandwidth used per controller.
+ *
+ * No window is opened for this. If gnome-disks was already running,
+ * the application is held until the copies are done and the exit
+ * status is passed back to the calling process. Otherwise this is the
+ * calling process, so it waits for the copies right away and returns
+ * the exit status from the command-line handler - GApplication would
+ * otherwise ignore it.
+ */
+
+#define BATCH_PROGRESS_INTERVAL_SECONDS 5
+
+typedef struct
+{
+  GduApplication *app;
+  GApplicationCommandLine *command_line;
+  GduCopyScheduler *scheduler;
+  GMainLoop *loop; /* only for local command lines */
+  guint num_pending;
+  guint num_failed;
+  guint progress_timeout_id;
+} BatchData;
+
+typedef struct
+{
+  BatchData *batch;
+  gchar *device;
+} BatchJob;
+
+static gint
+batch_data_get_exit_status (BatchData *batch)
+{
+  return batch->num_failed > 0 ? 1 : 0;
+}
+
+static void
+batch_data_free (BatchData *batch)
+{
+  if (batch->progress_timeout_id != 0)
+    g_source_remove (batch->progress_timeout_id);
+  gdu_copy_scheduler_unref (batch->scheduler);
+  if (batch->loop != NULL)
+    g_main_loop_unref (batch->loop);
+  /* lets a remote calling process exit */
+  g_object_unref (batch->command_line);
+  g_free (batch);
+}
+
+static void
+batch_data_maybe_finish (BatchData *batch)
+{
+  if (batch->num_pending > 0)
+    return;
+
+  if (batch->loop != NULL)
+    {
+      /* gdu_application_create_disk_images() takes it from here */
+      g_main_loop_quit (batch->loop);
+    }
+  else
+    {
+      g_application_command_line_set_exit_status (batch->command_line, batch_data_get_exit_status (batch));
+      g_application_release (G_APPLICATION (batch->app));
+      batch_data_free (batch);
+    }
+}
+
+static gboolean
+on_batch_progress (gpointer user_data)
+{
+  BatchData *batch = user_data;
+  guint64 completed_bytes;
+  guint64 total_bytes;
+  gchar *s;
+  gchar *s2;
+
+  gdu_copy_scheduler_get_progress (batch->scheduler, &completed_bytes, &total_bytes);
+  if (total_bytes > 0)
+    {
+      s = g_format_size (completed_bytes);
+      s2 = g_format_size (total_bytes);
+      /* Translators: Progress of creating several disk images from the command line.
+       *              The %u is the number of disk images still being created.
+       *              The %.1f is the percentage done (ex. 13.0).
+       *              The first %s is the amount of data copied (ex. "1.2 TB").
+       *              The second %s is the total amount of data to copy (ex. "6.0 TB").
+       */
+      g_application_command_line_print (batch->command_line,
+                                        _("Creating %u disk images: %.1f%% (%s of %s)\n"),
+                                        batch->num_pending,
+                                        100.0 * completed_bytes / total_bytes,
+                                        s, s2);
+      g_free (s2);
+      g_free (s);
+    }
+  return TRUE; /* keep source */
+}
+
+static void
+batch_job_cb (GduApplication *app,
+              GAsyncResult   *res,
+              gpointer        user_data)
+{
+  BatchJob *job = user_data;
+  BatchData *batch = job->batch;
+  GFile *image_file = NULL;
+  GError *error = NULL;
+  gchar *path;
+
+  if (gdu_create_disk_image_dialog_run_unattended_finish (app, res, &image_file, &error))
+    {
+      path = g_file_get_parse_name (image_file);
+      g_application_command_line_print (batch->command_line,
+                                        _("Created disk image of %s: %s\n"),
+                                        job->device, path);
+      g_free (path);
+    }
+  else
+    {
+      g_application_command_line_printerr (batch->command_line,
+                                           _("Error creating disk image of %s: %s\n"),
+                                           job->device, error->message);
+      g_clear_error (&error);
+      batch->num_failed++;
+    }
+  g_clear_object (&image_file);
+
+  batch->num_pending--;
+  g_free (job->device);
+  g_free (job);
+  batch_data_maybe_finish (batch);
+}
+
+/* Returns the exit status for local command lines */
+static gint
+gdu_application_create_disk_images (GduApplication          *app,
+                                    GApplicationCommandLine *command_line,
+                                    const gchar * const     *devices,
+                                    const gchar             *folder_path,
+                                    gint                     max_controller_rate)
+{
+  BatchData *batch;
+  GFile *folder;
+  gint ret = 0;
+  guint n;
+
+  batch = g_new0 (BatchData, 1);
+  batch->app = app;
+  batch->command_line = g_object_ref (command_line);
+  batch->scheduler = gdu_copy_scheduler_new ((guint64) MAX (max_controller_rate, 0) * 1000 * 1000);
+  folder = g_file_new_for_commandline_arg_and_cwd (folder_path,
+                                                   g_application_command_line_get_cwd (command_line));
+
+  for (n = 0; devices[n] != NULL; n++)
+    {
+      UDisksObject *object;
+      gchar *error_message = NULL;
+      BatchJob *job;
+
+      object = gdu_application_object_from_block_device (app, devices[n], &error_message);
+      if (object == NULL)
+        {
+          g_application_command_line_printerr (command_line, "%s\n", error_message);
+          g_free (error_message);
+          batch->num_failed++;
+          continue;
+        }
+
+      job = g_new0 (BatchJob, 1);
+      job->batch = batch;
+      job->device = g_strdup (devices[n]);
+      batch->num_pending++;
+      gdu_create_disk_image_dialog_run_unattended (app,
+                                                   object,
+                                                   folder,
+                                                   batch->scheduler,
+                                                   (GAsyncReadyCallback) batch_job_cb,
+                                                   job);
+      g_object_unref (object);
+    }
+
+  if (batch->num_pending > 0)
+    batch->progress_timeout_id = g_timeout_add_seconds (BATCH_PROGRESS_INTERVAL_SECONDS,
+                                                        on_batch_progress,
+                                                        batch);
+  g_object_unref (folder);
+
+  if (g_application_command_line_get_is_remote (command_line))
+    {
+      g_application_hold (G_APPLICATION (app));
+      batch_data_maybe_finish (batch);
+    }
+  else
+    {
+      if (batch->num_pending > 0)
+        {
+          batch->loop = g_main_loop_new (NULL, FALSE);
+          g_main_loop_run (batch->loop);
+        }
+      ret = batch_data_get_exit_status (batch);
+      batch_data_free (batch);
+    }
+
+  return ret;
+}
+
 /* called in primary instance */
 static gint
 gdu_application_command_line (GApplication            *_app,
@@ -195,6 +423,9 @@ gdu_application_command_line (GApplication            *_app,
   gchar *error_message = NULL;
   gboolean opt_format = FALSE;
   const gchar *opt_restore_disk_image = NULL;
+  const gchar **opt_create_disk_images = NULL;
+  const gchar *opt_disk_image_folder = NULL;
+  gint opt_max_controller_rate = 0;
   gint opt_xid = -1;
   GVariantDict *options;
 
@@ -204,6 +435,9 @@ gdu_application_command_line (GApplication            *_app,
   g_variant_dict_lookup (options, "format-device", "b", &opt_format);
   g_variant_dict_lookup (options, "xid", "i", &opt_xid);
   g_variant_dict_lookup (options, "restore-disk-image", "^&ay", &opt_restore_disk_image);
+  g_variant_dict_lookup (options, "create-disk-image", "^a&ay", &opt_create_disk_images);
+  g_variant_dict_lookup (options, "disk-image-folder", "^&ay", &opt_disk_image_folder);
+  g_variant_dict_lookup (options, "max-controller-rate", "i", &opt_max_controller_rate);
  
   if (opt_format && opt_block_device == NULL)
     {
@@ -217,8 +451,31 @@ gdu_application_command_line (GApplication            *_app,
       goto out;
     }
 
+  if (opt_create_disk_images != NULL &&
+      (opt_xid != -1 || opt_block_device != NULL || opt_restore_disk_image != NULL))
+    {
+      g_application_command_line_printerr (command_line, _("--create-disk-image can't be used together with --block-device, --restore-disk-image or --xid\n"));
+      goto out;
+    }
+
+  if (opt_create_disk_images != NULL && opt_disk_image_folder == NULL)
+    {
+      g_application_command_line_printerr (command_line, _("--create-disk-image must be used together with --disk-image-folder\n"));
+      goto out;
+    }
+
   gdu_application_ensure_client (app);
 
+  if (opt_create_disk_images != NULL)
+    {
+      ret = gdu_application_create_disk_images (app,
+                                                command_line,
+                                                opt_create_disk_images,
+                                                opt_disk_image_folder,
+                                                opt_max_controller_rate);
+      goto out;
+    }
+
   if (opt_block_device != NULL)
     {
       object_to_select = gdu_application_object_from_block_device (app, opt_block_device, &error_message);
@@ -276,12 +533,453 @@ gdu_application_command_line (GApplication            *_app,
   ret = 0;
 
  out:
+  g_free (opt_create_disk_images);
   g_clear_object (&object_to_select);
   return ret;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* The benchmark can be run from the command line, e.g. in CI. It runs
+ * in the process it was started in, before GTK is initialized, so it
+ * works without a display. The results are printed to stdout as JSON.
+ */
+
+static void
+on_benchmark_progress (GduBenchmark *benchmark,
+                       gpointer      user_data)
+{
+  GduBenchmarkPhase *last_phase = user_data;
+  GduBenchmarkPhase phase;
+
+  gdu_benchmark_lock (benchmark);
+  phase = benchmark->phase;
+  gdu_benchmark_unlock (benchmark);
+
+  if (phase == *last_phase)
+    return;
+  *last_phase = phase;
+
+  switch (phase)
+    {
+    case GDU_BENCHMARK_PHASE_NONE:
+      break;
+    case GDU_BENCHMARK_PHASE_TRANSFER_RATE:
+      g_printerr ("%s\n", C_("benchmark-updated", "Measuring transfer rate…"));
+      break;
+    case GDU_BENCHMARK_PHASE_ACCESS_TIME:
+      g_printerr ("%s\n", C_("benchmark-updated", "Measuring access time…"));
+      break;
+    case GDU_BENCHMARK_PHASE_QUEUE_DEPTH:
+      g_printerr ("%s\n", C_("benchmark-updated", "Measuring queue depth scaling…"));
+      break;
+    case GDU_BENCHMARK_PHASE_WORKLOADS:
+      g_printerr ("%s\n", C_("benchmark-updated", "Measuring workloads…"));
+      break;
+    case GDU_BENCHMARK_PHASE_SUSTAINED_WRITE:
+      g_printerr ("%s\n", C_("benchmark-updated", "Measuring sustained write rate…"));
+      break;
+    }
+}
+
+static gboolean
+parse_benchmark_options (GduBenchmark  *benchmark,
+                         GVariantDict  *options,
+                         gboolean      *out_list_workloads,
+                         GError       **error)
+{
+  gboolean ret = FALSE;
+  const GduBenchmarkWorkload *workloads;
+  guint num_workloads;
+  const gchar **opt_workloads = NULL;
+  gint value;
+  guint n;
+
+  *out_list_workloads = FALSE;
+
+  if (g_variant_dict_lookup (options, "benchmark-samples", "i", &value))
+    {
+      if (value < 1)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       _("--benchmark-samples must be at least 1"));
+          goto out;
+        }
+      benchmark->num_samples = value;
+    }
+  if (g_variant_dict_lookup (options, "benchmark-sample-size", "i", &value))
+    {
+      if (value < 1)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       _("--benchmark-sample-size must be at least 1"));
+          goto out;
+        }
+      benchmark->sample_size_mib = value;
+    }
+  if (g_variant_dict_lookup (options, "benchmark-access-samples", "i", &value))
+    {
+      if (value < 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       _("--benchmark-access-samples can't be negative"));
+          goto out;
+        }
+      benchmark->num_access_samples = value;
+    }
+  if (g_variant_dict_lookup (options, "benchmark-queue-depth", "i", &value))
+    {
+      if (value < 1)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       _("--benchmark-queue-depth must be at least 1"));
+          goto out;
+        }
+      benchmark->workload_queue_depth = value;
+    }
+  benchmark->do_write = g_variant_dict_contains (options, "benchmark-write");
+  benchmark->do_queue_depth = !g_variant_dict_contains (options, "benchmark-no-queue-depth");
+  if (g_variant_dict_contains (options, "benchmark-force") && !benchmark->do_write)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   _("--benchmark-force must be used together with --benchmark-write"));
+      goto out;
+    }
+
+  /* the sustained write stops at whichever limit is given - or at the end of the device */
+  if (g_variant_dict_contains (options, "benchmark-sustained-write") ||
+      g_variant_dict_contains (options, "benchmark-sustained-write-size"))
+    {
+      if (!benchmark->do_write)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                       _("--benchmark-sustained-write must be used together with --benchmark-write"));
+          goto out;
+        }
+      benchmark->do_sustained_write = TRUE;
+      benchmark->sustained_write_duration_sec = 0;
+      benchmark->sustained_write_size_gib = 0;
+      if (g_variant_dict_lookup (options, "benchmark-sustained-write", "i", &value))
+        {
+          if (value < 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("--benchmark-sustained-write can't be negative"));
+              goto out;
+            }
+          benchmark->sustained_write_duration_sec = value;
+        }
+      if (g_variant_dict_lookup (options, "benchmark-sustained-write-size", "i", &value))
+        {
+          if (value < 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("--benchmark-sustained-write-size can't be negative"));
+              goto out;
+            }
+          benchmark->sustained_write_size_gib = value;
+        }
+    }
+
+  /* like the benchmark dialog, run all workloads by default - except the writing ones if not writing */
+  workloads = gdu_benchmark_get_workloads (&num_workloads);
+  benchmark->workloads = 0;
+  if (g_variant_dict_lookup (options, "benchmark-workload", "^a&s", &opt_workloads))
+    {
+      for (n = 0; opt_workloads[n] != NULL; n++)
+        {
+          gint index;
+
+          if (g_strcmp0 (opt_workloads[n], "help") == 0)
+            {
+              *out_list_workloads = TRUE;
+              ret = TRUE;
+              goto out;
+            }
+          if (g_strcmp0 (opt_workloads[n], "none") == 0)
+            continue;
+
+          index = gdu_benchmark_lookup_workload (opt_workloads[n]);
+          if (index < 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("Unknown workload %s"), opt_workloads[n]);
+              goto out;
+            }
+          if (workloads[index].read_percentage < 100 && !benchmark->do_write)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           _("Workload %s must be used together with --benchmark-write"), opt_workloads[n]);
+              goto out;
+            }
+          benchmark->workloads |= (1 << index);
+        }
+    }
+  else
+    {
+      for (n = 0; n < num_workloads; n++)
+        {
+          if (workloads[n].read_percentage < 100 && !benchmark->do_write)
+            continue;
+          benchmark->workloads |= (1 << n);
+        }
+    }
+
+  ret = TRUE;
+
+ out:
+  g_free (opt_workloads);
+  return ret;
+}
+
+static void
+append_benchmark_device_json (GString      *str,
+                              UDisksClient *client,
+                              const gchar  *device,
+                              UDisksBlock  *block)
+{
+  UDisksDrive *drive;
+
+  g_string_append (str, "\"device\":");
+  gdu_utils_append_json_string (str, device);
+  g_string_append (str, ",\"block_device\":");
+  gdu_utils_append_json_string (str, udisks_block_get_preferred_device (block));
+  g_string_append (str, ",\"drive\":");
+  drive = udisks_client_get_drive_for_block (client, block);
+  if (drive != NULL)
+    {
+      g_string_append (str, "{\"vendor\":");
+      gdu_utils_append_json_string (str, udisks_drive_get_vendor (drive));
+      g_string_append (str, ",\"model\":");
+      gdu_utils_append_json_string (str, udisks_drive_get_model (drive));
+      g_string_append (str, ",\"serial\":");
+      gdu_utils_append_json_string (str, udisks_drive_get_serial (drive));
+      g_string_append (str, ",\"revision\":");
+      gdu_utils_append_json_string (str, udisks_drive_get_revision (drive));
+      g_string_append_c (str, '}');
+      g_object_unref (drive);
+    }
+  else
+    {
+      g_string_append (str, "null");
+    }
+}
+
+/* Like gdu_utils_is_in_use() but also counts active swap and running
+ * jobs on the device or anything on it.
+ */
+static gboolean
+benchmark_device_is_in_use (GduApplication *app,
+                            UDisksObject   *object)
+{
+  GList *objects;
+  GList *l;
+  gboolean ret = FALSE;
+
+  if (gdu_utils_is_in_use (app->client, object))
+    return TRUE;
+
+  objects = gdu_utils_get_all_contained_objects (app->client, object);
+  objects = g_list_prepend (objects, g_object_ref (object));
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksObject *object_iter = UDISKS_OBJECT (l->data);
+      UDisksSwapspace *swapspace;
+      GList *jobs;
+
+      swapspace = udisks_object_peek_swapspace (object_iter);
+      if (swapspace != NULL && udisks_swapspace_get_active (swapspace))
+        {
+          ret = TRUE;
+          break;
+        }
+
+      jobs = udisks_client_get_jobs_for_object (app->client, object_iter);
+      if (jobs != NULL)
+        {
+          g_list_free_full (jobs, g_object_unref);
+          ret = TRUE;
+          break;
+        }
+    }
+  g_list_free_full (objects, g_object_unref);
+  return ret;
+}
+
+typedef struct
+{
+  GMainLoop *loop;
+  gboolean success;
+  GError **error;
+} BenchmarkUnuseData;
+
+static void
+benchmark_ensure_unused_cb (GObject      *source_object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
+{
+  BenchmarkUnuseData *data = user_data;
+
+  data->success = gdu_utils_ensure_unused_finish (UDISKS_CLIENT (source_object), res, data->error);
+  g_main_loop_quit (data->loop);
+}
+
+/* Unmounts and locks everything on the device, for --benchmark-force */
+static gboolean
+benchmark_ensure_unused (GduApplication  *app,
+                         UDisksObject    *object,
+                         GError         **error)
+{
+  BenchmarkUnuseData data = {0};
+
+  data.loop = g_main_loop_new (NULL, FALSE);
+  data.error = error;
+  gdu_utils_ensure_unused_silently (app->client,
+                                    object,
+                                    benchmark_ensure_unused_cb,
+                                    NULL, /* GCancellable */
+                                    &data);
+  g_main_loop_run (data.loop);
+  g_main_loop_unref (data.loop);
+  return data.success;
+}
+
+static gint
+gdu_application_run_benchmark (GduApplication *app,
+                               const gchar    *device,
+                               GVariantDict   *options)
+{
+  gint ret = 1;
+  GduBenchmark *benchmark;
+  GduBenchmarkPhase last_phase = GDU_BENCHMARK_PHASE_NONE;
+  UDisksObject *object = NULL;
+  UDisksBlock *block;
+  UDisksDrive *drive;
+  GVariantBuilder options_builder;
+  GVariant *fd_index = NULL;
+  GUnixFDList *fd_list = NULL;
+  gchar *error_message = NULL;
+  gboolean list_workloads;
+  GError *error = NULL;
+  GString *str = NULL;
+  gint fd = -1;
+  guint n;
+
+  benchmark = gdu_benchmark_new ();
+  if (!parse_benchmark_options (benchmark, options, &list_workloads, &error))
+    goto out;
+
+  if (list_workloads)
+    {
+      const GduBenchmarkWorkload *workloads;
+      guint num_workloads;
+
+      workloads = gdu_benchmark_get_workloads (&num_workloads);
+      for (n = 0; n < num_workloads; n++)
+        g_print ("%-16s %s\n", workloads[n].id, gettext (workloads[n].name));
+      ret = 0;
+      goto out;
+    }
+
+  gdu_application_ensure_client (app);
+  object = gdu_application_object_from_block_device (app, device, &error_message);
+  if (object == NULL)
+    {
+      g_printerr ("%s\n", error_message);
+      g_free (error_message);
+      goto out;
+    }
+  block = udisks_object_peek_block (object);
+
+  if (benchmark->do_write && udisks_block_get_read_only (block))
+    {
+      g_printerr (_("Device %s is read-only, can't use --benchmark-write\n"), device);
+      goto out;
+    }
+
+  /* writing to a device that is in use may corrupt data, even if the
+   * data is put back, so only do it if asked to unmount first
+   */
+  if (benchmark->do_write && g_variant_dict_contains (options, "benchmark-force"))
+    {
+      if (!benchmark_ensure_unused (app, object, &error))
+        goto out;
+    }
+  if (benchmark->do_write && benchmark_device_is_in_use (app, object))
+    {
+      g_printerr (_("Device %s or something on it is in use, can't use --benchmark-write (use --benchmark-force to unmount it first)\n"), device);
+      goto out;
+    }
+
+  g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (benchmark->do_write));
+  if (!udisks_block_call_open_for_benchmark_sync (block,
+                                                  g_variant_builder_end (&options_builder),
+                                                  NULL, /* fd_list */
+                                                  &fd_index,
+                                                  &fd_list,
+                                                  NULL, /* GCancellable */
+                                                  &error))
+    goto out;
+
+  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), &error);
+  if (fd == -1)
+    goto out;
+
+  drive = udisks_client_get_drive_for_block (app->client, block);
+  if (drive != NULL)
+    {
+      gdu_benchmark_set_firmware_revision (benchmark, udisks_drive_get_revision (drive));
+      g_object_unref (drive);
+    }
+
+  gdu_benchmark_set_progress_func (benchmark, on_benchmark_progress, &last_phase);
+  if (!gdu_benchmark_run (benchmark, fd, NULL, &error))
+    goto out;
+
+  str = g_string_new ("{");
+  append_benchmark_device_json (str, app->client, device, block);
+  g_string_append (str, ",\"benchmark\":");
+  gdu_benchmark_append_json (benchmark, str);
+  g_string_append (str, "}\n");
+  g_print ("%s", str->str);
+
+  ret = 0;
+
+ out:
+  if (error != NULL)
+    {
+      g_printerr (_("Error benchmarking %s: %s\n"), device, error->message);
+      g_clear_error (&error);
+    }
+  if (str != NULL)
+    g_string_free (str, TRUE);
+  if (fd != -1)
+    close (fd);
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  g_clear_object (&object);
+  gdu_benchmark_free (benchmark);
+  return ret;
+}
+
+/* called in the local instance, before registering or GTK is initialized */
+static gint
+gdu_application_handle_local_options (GApplication *_app,
+                                      GVariantDict *options)
+{
+  GduApplication *app = GDU_APPLICATION (_app);
+  const gchar *opt_benchmark = NULL;
+
+  if (!g_variant_dict_lookup (options, "benchmark", "^&ay", &opt_benchmark))
+    return -1; /* carry on as usual */
+
+  return gdu_application_run_benchmark (app, opt_benchmark, options);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static void
 gdu_application_activate (GApplication *_app)
 {
@@ -315,6 +1013,15 @@ attach_disk_image_activated (GSimpleAction *action,
   gdu_window_show_attach_disk_image (app->window);
 }
 
+static void
+benchmark_drives_activated (GSimpleAction *action,
+                            GVariant      *parameter,
+                            gpointer       user_data)
+{
+  GduApplication *app = GDU_APPLICATION (user_data);
+  gdu_multi_benchmark_dialog_show (app->window);
+}
+
 static void
 shortcuts_activated (GSimpleAction *action,
                      GVariant      *parameter,
@@ -394,6 +1101,7 @@ static GActionEntry app_entries[] =
 {
   { "new_disk_image", new_disk_image_activated, NULL, NULL, NULL },
   { "attach_disk_image", attach_disk_image_activated, NULL, NULL, NULL },
+  { "benchmark_drives", benchmark_drives_activated, NULL, NULL, NULL },
   { "shortcuts", shortcuts_activated, NULL, NULL, NULL },
   { "help", help_activated, NULL, NULL, NULL },
   { "about", about_activated, NULL, NULL, NULL },
@@ -450,6 +1158,7 @@ gdu_application_class_init (GduApplicationClass *klass)
   application_class->command_line = gdu_application_command_line;
   application_class->activate     = gdu_application_activate;
   application_class->startup      = gdu_application_startup;
+  application_class->handle_local_options = gdu_application_handle_local_options;
 }
 
 GApplication *
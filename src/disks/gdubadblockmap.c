@@ -0,0 +1,307 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include "gdubadblockmap.h"
+
+/* Keeps track of the parts of a device that could not be read, as a
+ * sorted list of non-overlapping ranges. Ranges that are next to each
+ * other and have the same state are merged so a large unreadable area
+ * is a single entry instead of one per sector. Everything not in the
+ * list is GDU_BLOCK_STATE_GOOD.
+ */
+
+typedef struct
+{
+  guint64 offset;
+  guint64 length;
+  GduBlockState state;
+} Range;
+
+struct GduBadBlockMap
+{
+  /* of Range, sorted by offset */
+  GArray *ranges;
+};
+
+GduBadBlockMap *
+gdu_bad_block_map_new (void)
+{
+  GduBadBlockMap *map;
+
+  map = g_new0 (GduBadBlockMap, 1);
+  map->ranges = g_array_new (FALSE, FALSE, sizeof (Range));
+  return map;
+}
+
+void
+gdu_bad_block_map_free (GduBadBlockMap *map)
+{
+  g_array_unref (map->ranges);
+  g_free (map);
+}
+
+/**
+ * gdu_bad_block_map_set:
+ * @map: A #GduBadBlockMap.
+ * @offset: The offset of the range.
+ * @length: The length of the range.
+ * @state: The new state of the range.
+ *
+ * Sets the state of the given range, replacing whatever was recorded
+ * for it before.
+ */
+void
+gdu_bad_block_map_set (GduBadBlockMap *map,
+                       guint64         offset,
+                       guint64         length,
+                       GduBlockState   state)
+{
+  guint64 end = offset + length;
+  Range range;
+  guint n;
+
+  if (length == 0)
+    return;
+
+  /* Cut the range out of what's there... */
+  n = 0;
+  while (n < map->ranges->len)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+      guint64 r_end = r->offset + r->length;
+
+      if (r_end <= offset)
+        {
+          n++;
+          continue;
+        }
+      if (r->offset >= end)
+        break;
+
+      if (r->offset < offset && r_end > end)
+        {
+          /* split in two */
+          Range tail = *r;
+          tail.offset = end;
+          tail.length = r_end - end;
+          r->length = offset - r->offset;
+          g_array_insert_val (map->ranges, n + 1, tail);
+          n++;
+          break;
+        }
+      else if (r->offset < offset)
+        {
+          r->length = offset - r->offset;
+          n++;
+        }
+      else if (r_end > end)
+        {
+          r->length = r_end - end;
+          r->offset = end;
+          break;
+        }
+      else
+        {
+          g_array_remove_index (map->ranges, n);
+        }
+    }
+
+  /* ... and put it in at the right place, merging with the neighbours */
+  if (state == GDU_BLOCK_STATE_GOOD)
+    return;
+
+  range.offset = offset;
+  range.length = length;
+  range.state = state;
+  g_array_insert_val (map->ranges, n, range);
+
+  if (n + 1 < map->ranges->len)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+      Range *next = &g_array_index (map->ranges, Range, n + 1);
+      if (next->state == state && next->offset == end)
+        {
+          r->length += next->length;
+          g_array_remove_index (map->ranges, n + 1);
+        }
+    }
+  if (n > 0)
+    {
+      Range *prev = &g_array_index (map->ranges, Range, n - 1);
+      Range *r = &g_array_index (map->ranges, Range, n);
+      if (prev->state == state && prev->offset + prev->length == offset)
+        {
+          prev->length += r->length;
+          g_array_remove_index (map->ranges, n);
+        }
+    }
+}
+
+/* Returns: The number of bytes in @state, which can't be GDU_BLOCK_STATE_GOOD */
+guint64
+gdu_bad_block_map_get_num_bytes (GduBadBlockMap *map,
+                                 GduBlockState   state)
+{
+  guint64 ret = 0;
+  guint n;
+
+  g_return_val_if_fail (state != GDU_BLOCK_STATE_GOOD, 0);
+
+  for (n = 0; n < map->ranges->len; n++)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+      if (r->state == state)
+        ret += r->length;
+    }
+  return ret;
+}
+
+guint
+gdu_bad_block_map_get_num_ranges (GduBadBlockMap *map)
+{
+  return map->ranges->len;
+}
+
+void
+gdu_bad_block_map_get_range (GduBadBlockMap *map,
+                             guint           index,
+                             guint64        *out_offset,
+                             guint64        *out_length,
+                             GduBlockState  *out_state)
+{
+  Range *r;
+
+  g_return_if_fail (index < map->ranges->len);
+
+  r = &g_array_index (map->ranges, Range, index);
+  if (out_offset != NULL)
+    *out_offset = r->offset;
+  if (out_length != NULL)
+    *out_length = r->length;
+  if (out_state != NULL)
+    *out_state = r->state;
+}
+
+/* Returns: TRUE if a range in @state was found - the first one is returned */
+gboolean
+gdu_bad_block_map_find (GduBadBlockMap *map,
+                        GduBlockState   state,
+                        guint64        *out_offset,
+                        guint64        *out_length)
+{
+  guint n;
+
+  for (n = 0; n < map->ranges->len; n++)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+      if (r->state == state)
+        {
+          *out_offset = r->offset;
+          *out_length = r->length;
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+/* Returns: The number of bytes in @state between @offset and @offset + @length */
+guint64
+gdu_bad_block_map_count (GduBadBlockMap *map,
+                         guint64         offset,
+                         guint64         length,
+                         GduBlockState   state)
+{
+  guint64 end = offset + length;
+  guint64 ret = 0;
+  guint n;
+
+  g_return_val_if_fail (state != GDU_BLOCK_STATE_GOOD, 0);
+
+  for (n = 0; n < map->ranges->len; n++)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+
+      if (r->offset >= end)
+        break;
+      if (r->state == state && r->offset + r->length > offset)
+        ret += MIN (r->offset + r->length, end) - MAX (r->offset, offset);
+    }
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+append_mapfile_line (GString *str,
+                     guint64  offset,
+                     guint64  length,
+                     gchar    status)
+{
+  g_string_append_printf (str,
+                          "0x%08" G_GINT64_MODIFIER "X  0x%08" G_GINT64_MODIFIER "X  %c\n",
+                          offset, length, status);
+}
+
+/**
+ * gdu_bad_block_map_to_mapfile:
+ * @map: A #GduBadBlockMap.
+ * @size: The size of the device.
+ * @num_bytes_completed: How far the device was read, e.g. @size unless the copy was interrupted.
+ *
+ * Formats @map as a ddrescue(1) map file, so the device can be
+ * examined with the tools that understand those - or ddrescue can
+ * be used to retry the bad blocks and fill them in, or to finish
+ * reading the device.
+ *
+ * Returns: The contents of the map file. Free with g_free().
+ */
+gchar *
+gdu_bad_block_map_to_mapfile (GduBadBlockMap *map,
+                              guint64         size,
+                              guint64         num_bytes_completed)
+{
+  GString *str;
+  guint64 end;
+  guint64 pos = 0;
+  guint n;
+
+  end = MIN (num_bytes_completed, size);
+
+  str = g_string_new ("# Mapfile. Created by GNOME Disks\n");
+  g_string_append (str, "# current_pos  current_status  current_pass\n");
+  g_string_append_printf (str, "0x%08" G_GINT64_MODIFIER "X     %c               1\n",
+                          end,
+                          end < size || gdu_bad_block_map_get_num_bytes (map, GDU_BLOCK_STATE_UNTRIED) > 0 ? '?' : '+');
+  g_string_append (str, "#      pos        size  status\n");
+
+  /* The ranges in between are good. Untried ranges are what ddrescue
+   * calls non-trimmed: a read error happened somewhere in them.
+   */
+  for (n = 0; n < map->ranges->len && pos < end; n++)
+    {
+      Range *r = &g_array_index (map->ranges, Range, n);
+
+      if (r->offset > pos)
+        append_mapfile_line (str, pos, MIN (r->offset, end) - pos, '+');
+      if (r->offset < end)
+        append_mapfile_line (str, r->offset, MIN (r->offset + r->length, end) - r->offset,
+                             r->state == GDU_BLOCK_STATE_UNTRIED ? '*' : '-');
+      pos = r->offset + r->length;
+    }
+  if (pos < end)
+    append_mapfile_line (str, pos, end - pos, '+');
+
+  /* what was never read is what ddrescue calls non-tried */
+  if (end < size)
+    append_mapfile_line (str, end, size - end, '?');
+
+  return g_string_free (str, FALSE);
+}
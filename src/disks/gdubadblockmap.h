@@ -0,0 +1,46 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_BAD_BLOCK_MAP_H__
+#define __GDU_BAD_BLOCK_MAP_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduBadBlockMap *gdu_bad_block_map_new            (void);
+void            gdu_bad_block_map_free           (GduBadBlockMap  *map);
+void            gdu_bad_block_map_set            (GduBadBlockMap  *map,
+                                                  guint64          offset,
+                                                  guint64          length,
+                                                  GduBlockState    state);
+guint64         gdu_bad_block_map_get_num_bytes  (GduBadBlockMap  *map,
+                                                  GduBlockState    state);
+guint           gdu_bad_block_map_get_num_ranges (GduBadBlockMap  *map);
+void            gdu_bad_block_map_get_range      (GduBadBlockMap  *map,
+                                                  guint            index,
+                                                  guint64         *out_offset,
+                                                  guint64         *out_length,
+                                                  GduBlockState   *out_state);
+gboolean        gdu_bad_block_map_find           (GduBadBlockMap  *map,
+                                                  GduBlockState    state,
+                                                  guint64         *out_offset,
+                                                  guint64         *out_length);
+guint64         gdu_bad_block_map_count          (GduBadBlockMap  *map,
+                                                  guint64          offset,
+                                                  guint64          length,
+                                                  GduBlockState    state);
+gchar          *gdu_bad_block_map_to_mapfile     (GduBadBlockMap  *map,
+                                                  guint64          size,
+                                                  guint64          num_bytes_completed);
+
+G_END_DECLS
+
+#endif /* __GDU_BAD_BLOCK_MAP_H__ */
@@ -15,8 +15,6 @@
 #include <gio/gunixoutputstream.h>
 
 #include <glib-unix.h>
-#include <sys/ioctl.h>
-#include <linux/fs.h>
 
 #include <math.h>
 
@@ -26,20 +24,6 @@
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-typedef struct {
-  guint64 offset;
-  gdouble value;
-} BMSample;
-
-/* ---------------------------------------------------------------------------------------------------- */
-
-typedef enum {
-  BM_STATE_NONE,
-  BM_STATE_OPENING_DEVICE,
-  BM_STATE_TRANSFER_RATE,
-  BM_STATE_ACCESS_TIME,
-} BMState;
-
 typedef struct
 {
   volatile gint ref_count;
@@ -55,6 +39,8 @@ typedef struct
   GtkWidget *dialog;
 
   GtkWidget *graph_drawing_area;
+  GtkWidget *queue_depth_drawing_area;
+  GtkWidget *sustained_write_drawing_area;
 
   GtkWidget *device_label;
   GtkWidget *updated_label;
@@ -62,6 +48,16 @@ typedef struct
   GtkWidget *read_rate_label;
   GtkWidget *write_rate_label;
   GtkWidget *access_time_label;
+  GtkWidget *queue_depth_label;
+  GtkWidget *queue_depth_title_label;
+  GtkWidget *workloads_label;
+  GtkWidget *workloads_title_label;
+  GtkWidget *sustained_write_label;
+  GtkWidget *sustained_write_title_label;
+  GtkWidget *latency_label;
+  GtkWidget *latency_title_label;
+  GtkWidget *history_label;
+  GtkWidget *history_title_label;
 
   GtkWidget *start_benchmark_button;
   GtkWidget *stop_benchmark_button;
@@ -70,27 +66,16 @@ typedef struct
 
   /* ---- */
 
-  /* retrieved from preferences dialog */
-  gint bm_num_samples;
-  gint bm_sample_size_mib;
-  gboolean bm_do_write;
-  gint bm_num_access_samples;
+  GduBenchmark *benchmark;
+  GPtrArray *history; /* earlier runs, oldest first, excluding the one in benchmark */
 
   /* must hold bm_lock when reading/writing these */
   GThread *bm_thread;
   GCancellable *bm_cancellable;
   gboolean bm_in_progress;
-  BMState bm_state;
   GError *bm_error; /* set by benchmark thread on termination */
+  gboolean bm_finished; /* set by benchmark thread on termination */
   gboolean bm_update_timeout_pending;
-
-  gint64 bm_time_benchmarked_usec; /* 0 if never benchmarked, otherwise micro-seconds since Epoch */
-  guint64 bm_size;
-  guint64 bm_sample_size;
-  GArray *bm_read_samples;
-  GArray *bm_write_samples;
-  GArray *bm_access_time_samples;
-
 } DialogData;
 
 G_LOCK_DEFINE (bm_lock);
@@ -100,19 +85,37 @@ static const struct {
   const gchar *name;
 } widget_mapping[] = {
   {G_STRUCT_OFFSET (DialogData, graph_drawing_area), "graph-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, queue_depth_drawing_area), "queue-depth-drawing-area"},
+  {G_STRUCT_OFFSET (DialogData, sustained_write_drawing_area), "sustained-write-drawing-area"},
   {G_STRUCT_OFFSET (DialogData, device_label), "device-label"},
   {G_STRUCT_OFFSET (DialogData, updated_label), "updated-label"},
   {G_STRUCT_OFFSET (DialogData, sample_size_label), "sample-size-label"},
   {G_STRUCT_OFFSET (DialogData, read_rate_label), "read-rate-label"},
   {G_STRUCT_OFFSET (DialogData, write_rate_label), "write-rate-label"},
   {G_STRUCT_OFFSET (DialogData, access_time_label), "access-time-label"},
+  {G_STRUCT_OFFSET (DialogData, queue_depth_label), "queue-depth-label"},
+  {G_STRUCT_OFFSET (DialogData, queue_depth_title_label), "queue-depth-title-label"},
+  {G_STRUCT_OFFSET (DialogData, workloads_label), "workloads-label"},
+  {G_STRUCT_OFFSET (DialogData, workloads_title_label), "workloads-title-label"},
+  {G_STRUCT_OFFSET (DialogData, sustained_write_label), "sustained-write-label"},
+  {G_STRUCT_OFFSET (DialogData, sustained_write_title_label), "sustained-write-title-label"},
+  {G_STRUCT_OFFSET (DialogData, latency_label), "latency-label"},
+  {G_STRUCT_OFFSET (DialogData, latency_title_label), "latency-title-label"},
+  {G_STRUCT_OFFSET (DialogData, history_label), "history-label"},
+  {G_STRUCT_OFFSET (DialogData, history_title_label), "history-title-label"},
   {0, NULL}
 };
 
+/* earlier runs drawn behind the latest one in the transfer rate graph */
+#define HISTORY_NUM_OVERLAID_RUNS 5
+
+/* how much worse than the previous run a result must be to be flagged */
+#define REGRESSION_THRESHOLD 0.10
+
 static void update_dialog (DialogData *data);
 
-static gboolean maybe_load_data (DialogData  *data,
-                                 GError     **error);
+static gboolean load_history (DialogData  *data,
+                              GError     **error);
 
 /* ---------------------------------------------------------------------------------------------------- */
 
@@ -139,9 +142,8 @@ dialog_data_unref (DialogData *data)
       g_clear_object (&data->window);
       g_clear_object (&data->builder);
 
-      g_array_unref (data->bm_read_samples);
-      g_array_unref (data->bm_write_samples);
-      g_array_unref (data->bm_access_time_samples);
+      gdu_benchmark_free (data->benchmark);
+      g_clear_pointer (&data->history, g_ptr_array_unref);
       g_clear_object (&data->bm_cancellable);
       g_clear_error (&data->bm_error);
 
@@ -181,7 +183,7 @@ get_max_min_avg (GArray  *array,
 
   for (n = 0; n < array->len; n++)
     {
-      BMSample *s = &g_array_index (array, BMSample, n);
+      GduBenchmarkSample *s = &g_array_index (array, GduBenchmarkSample, n);
       if (s->value > max)
         max = s->value;
       if (s->value < min)
@@ -245,6 +247,8 @@ on_drawing_area_draw (GtkWidget      *widget,
   gdouble read_transfer_rate_max = 0.0;
   gdouble write_transfer_rate_max = 0.0;
   gdouble access_time_max = 0.0;
+  guint first_overlaid_run;
+  guint m;
   gdouble prev_x;
   gdouble prev_y;
   GtkStyleContext *context;
@@ -253,22 +257,22 @@ on_drawing_area_draw (GtkWidget      *widget,
   GdkRGBA fg;
   PangoLayout *layout;
 
-  G_LOCK (bm_lock);
+  gdu_benchmark_lock (data->benchmark);
 
   //g_print ("drawing: %d %d %d\n",
-  //         data->bm_read_samples->len,
-  //         data->bm_write_samples->len,
-  //         data->bm_access_time_samples->len);
+  //         data->benchmark->read_samples->len,
+  //         data->benchmark->write_samples->len,
+  //         data->benchmark->access_time_samples->len);
 
-  get_max_min_avg (data->bm_read_samples,
+  get_max_min_avg (data->benchmark->read_samples,
                    &read_transfer_rate_max,
                    NULL,
                    NULL);
-  get_max_min_avg (data->bm_write_samples,
+  get_max_min_avg (data->benchmark->write_samples,
                    &write_transfer_rate_max,
                    NULL,
                    NULL);
-  get_max_min_avg (data->bm_access_time_samples,
+  get_max_min_avg (data->benchmark->access_time_samples,
                    &access_time_max,
                    NULL,
                    NULL);
@@ -276,6 +280,15 @@ on_drawing_area_draw (GtkWidget      *widget,
   max_speed = MAX (read_transfer_rate_max, write_transfer_rate_max);
   max_time = access_time_max;
 
+  first_overlaid_run = data->history->len - MIN (data->history->len, HISTORY_NUM_OVERLAID_RUNS);
+  for (m = first_overlaid_run; m < data->history->len; m++)
+    {
+      GduBenchmark *run = data->history->pdata[m];
+      get_max_min_avg (run->read_samples, &read_transfer_rate_max, NULL, NULL);
+      get_max_min_avg (run->write_samples, &write_transfer_rate_max, NULL, NULL);
+      max_speed = MAX (max_speed, MAX (read_transfer_rate_max, write_transfer_rate_max));
+    }
+
   if (max_speed == 0)
     max_speed = 100 * 1000 * 1000;
 
@@ -511,14 +524,50 @@ on_drawing_area_draw (GtkWidget      *widget,
       cairo_stroke (cr);
     }
 
+  /* draw earlier runs, faintly, so changes stand out */
+  cairo_set_line_width (cr, 1.0);
+  for (m = first_overlaid_run; m < data->history->len; m++)
+    {
+      GduBenchmark *run = data->history->pdata[m];
+
+      if (run->size == 0)
+        continue;
+
+      cairo_set_source_rgba (cr, 0.5, 0.5, 1.0, 0.3);
+      for (n = 0; n < run->read_samples->len; n++)
+        {
+          GduBenchmarkSample *sample = &g_array_index (run->read_samples, GduBenchmarkSample, n);
+          x = gx + gw * sample->offset / run->size;
+          y = gy + gh - gh * sample->value / max_visible_speed;
+          if (n == 0)
+            cairo_move_to (cr, x, y);
+          else
+            cairo_line_to (cr, x, y);
+        }
+      cairo_stroke (cr);
+
+      cairo_set_source_rgba (cr, 1.0, 0.5, 0.5, 0.3);
+      for (n = 0; n < run->write_samples->len; n++)
+        {
+          GduBenchmarkSample *sample = &g_array_index (run->write_samples, GduBenchmarkSample, n);
+          x = gx + gw * sample->offset / run->size;
+          y = gy + gh - gh * sample->value / max_visible_speed;
+          if (n == 0)
+            cairo_move_to (cr, x, y);
+          else
+            cairo_line_to (cr, x, y);
+        }
+      cairo_stroke (cr);
+    }
+
   /* draw read graph */
   cairo_set_source_rgb (cr, 0.5, 0.5, 1.0);
   cairo_set_line_width (cr, 1.5);
-  for (n = 0; n < data->bm_read_samples->len; n++)
+  for (n = 0; n < data->benchmark->read_samples->len; n++)
     {
-      BMSample *sample = &g_array_index (data->bm_read_samples, BMSample, n);
+      GduBenchmarkSample *sample = &g_array_index (data->benchmark->read_samples, GduBenchmarkSample, n);
 
-      x = gx + gw * sample->offset / data->bm_size;
+      x = gx + gw * sample->offset / data->benchmark->size;
       y = gy + gh - gh * sample->value / max_visible_speed;
 
       if (n == 0)
@@ -531,10 +580,10 @@ on_drawing_area_draw (GtkWidget      *widget,
   /* draw write graph */
   cairo_set_source_rgb (cr, 1.0, 0.5, 0.5);
   cairo_set_line_width (cr, 1.5);
-  for (n = 0; n < data->bm_write_samples->len; n++)
+  for (n = 0; n < data->benchmark->write_samples->len; n++)
     {
-      BMSample *sample = &g_array_index (data->bm_write_samples, BMSample, n);
-      x = gx + gw * sample->offset / data->bm_size;
+      GduBenchmarkSample *sample = &g_array_index (data->benchmark->write_samples, GduBenchmarkSample, n);
+      x = gx + gw * sample->offset / data->benchmark->size;
       y = gy + gh - gh * sample->value / max_visible_speed;
 
       if (n == 0)
@@ -546,11 +595,11 @@ on_drawing_area_draw (GtkWidget      *widget,
 
   /* draw access time dots + lines */
   cairo_set_line_width (cr, 0.5);
-  for (n = 0; n < data->bm_access_time_samples->len; n++)
+  for (n = 0; n < data->benchmark->access_time_samples->len; n++)
     {
-      BMSample *sample = &g_array_index (data->bm_access_time_samples, BMSample, n);
+      GduBenchmarkSample *sample = &g_array_index (data->benchmark->access_time_samples, GduBenchmarkSample, n);
 
-      x = gx + gw * sample->offset / data->bm_size;
+      x = gx + gw * sample->offset / data->benchmark->size;
       y = gy + gh - gh * sample->value / max_visible_time;
 
       /*g_debug ("time = %f @ %f", point->value, x);*/
@@ -642,7 +691,7 @@ on_drawing_area_draw (GtkWidget      *widget,
         g_strfreev (y_left_markers);
         g_strfreev (y_right_markers);
 
-  G_UNLOCK (bm_lock);
+  gdu_benchmark_unlock (data->benchmark);
 
   /* propagate event further */
   return FALSE;
@@ -683,195 +732,1012 @@ format_transfer_rate_and_num_samples (gdouble bytes_per_sec,
   return ret;
 }
 
-
-static void
-update_updated_label (DialogData *data)
+static gchar *
+format_iops (gdouble iops)
 {
-  gchar *s = NULL;
-
-  G_LOCK (bm_lock);
-  switch (data->bm_state)
-    {
-    case BM_STATE_NONE:
-      if (data->bm_time_benchmarked_usec > 0)
-        {
-          gint64 now_usec;
-          gchar *s2;
-          GDateTime *time_benchmarked_dt;
-          GDateTime *time_benchmarked_dt_local;
-          gchar *time_benchmarked_str;
-
-          now_usec = g_get_real_time ();
-
-          time_benchmarked_dt = g_date_time_new_from_unix_utc (data->bm_time_benchmarked_usec / G_USEC_PER_SEC);
-          time_benchmarked_dt_local = g_date_time_to_local (time_benchmarked_dt);
-          time_benchmarked_str = g_date_time_format (time_benchmarked_dt_local, "%c");
-
-          s = gdu_utils_format_duration_usec ((now_usec - data->bm_time_benchmarked_usec),
-                                              GDU_FORMAT_DURATION_FLAGS_NO_SECONDS);
-          /* Translators: The first %s is the date and time the benchmark took place in the preferred
-           * format for the locale (e.g. "%c" for strftime()/g_date_time_format()), for example
-           * "Tue 12 Jun 2012 03:57:08 PM EDT". The second %s is how long ago that is from right
-           * now, for example "3 days" or "2 hours" or "12 minutes".
-           */
-          s2 = g_strdup_printf (C_("benchmark-updated", "%s (%s ago)"),
-                                time_benchmarked_str,
-                                s);
-          gtk_label_set_text (GTK_LABEL (data->updated_label), s2);
-          g_free (s2);
-          g_free (s);
-          g_free (time_benchmarked_str);
-          g_date_time_unref (time_benchmarked_dt_local);
-          g_date_time_unref (time_benchmarked_dt);
-        }
-      else
-        {
-          gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "No benchmark data available"));
-        }
-      break;
-
-    case BM_STATE_OPENING_DEVICE:
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "Opening Device…"));
-      break;
-
-    case BM_STATE_TRANSFER_RATE:
-      s = g_strdup_printf (C_("benchmark-updated", "Measuring transfer rate (%2.1f%% complete)…"),
-                           data->bm_read_samples->len * 100.0 / data->bm_num_samples);
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
-      g_free (s);
-      break;
-
-    case BM_STATE_ACCESS_TIME:
-      s = g_strdup_printf (C_("benchmark-updated", "Measuring access time (%2.1f%% complete)…"),
-                           data->bm_access_time_samples->len * 100.0 / data->bm_num_access_samples);
-      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
-      g_free (s);
-      break;
+  /* Translators: IOPS means "I/O operations per second" and %.0f the number of them (in thousands for the second string) */
+  if (iops >= 10000.0)
+    return g_strdup_printf (C_("benchmark-iops", "%.0fk IOPS"), iops / 1000.0);
+  return g_strdup_printf (C_("benchmark-iops", "%.0f IOPS"), iops);
+}
 
-    default:
-      g_assert_not_reached ();
-    }
-  G_UNLOCK (bm_lock);
+/* rounds up to 1, 2 or 5 times a power of ten */
+static gdouble
+round_up_for_axis (gdouble value)
+{
+  gdouble base;
+
+  if (value <= 0.0)
+    return 1.0;
+
+  base = pow (10.0, floor (log10 (value)));
+  if (value <= base)
+    return base;
+  else if (value <= 2.0 * base)
+    return 2.0 * base;
+  else if (value <= 5.0 * base)
+    return 5.0 * base;
+  return 10.0 * base;
 }
 
-/* returns NULL if it doesn't make sense to load/save benchmark data (removable media,
- * non-drive devices etc.)
- */
-static gchar *
-get_bm_filename (DialogData *data)
+static gboolean
+on_queue_depth_drawing_area_draw (GtkWidget      *widget,
+                                  cairo_t        *cr,
+                                  gpointer        user_data)
 {
-  gchar *ret = NULL;
-  gchar *bench_dir = NULL;
-  const gchar *id = NULL;
+  DialogData *data = user_data;
+  GtkAllocation allocation;
+  gdouble width, height;
+  gdouble gx, gy, gw, gh;
+  gdouble x, y;
+  gdouble x_marker_height;
+  gdouble max_iops = 0.0;
+  gdouble max_visible_iops;
+  guint num_y_markers = 5;
+  gchar **y_left_markers;
+  gchar **y_right_markers;
+  GPtrArray *p;
+  GPtrArray *p2;
+  GtkStyleContext *context;
+  PangoFontDescription *font_desc;
+  gint size;
+  GdkRGBA fg;
+  PangoLayout *layout;
+  PangoRectangle extents;
+  guint num_samples;
+  guint n;
 
-  id = udisks_block_get_id (data->block);
-  if (id == NULL || strlen (id) == 0)
-    goto out;
+  gdu_benchmark_lock (data->benchmark);
 
-  bench_dir = g_strdup_printf ("%s/gnome-disks/benchmarks", g_get_user_cache_dir ());
-  if (g_mkdir_with_parents (bench_dir, 0777) != 0)
+  num_samples = data->benchmark->queue_depth_samples->len;
+  for (n = 0; n < num_samples; n++)
     {
-      g_warning ("Error creating directory %s: %m", bench_dir);
-      goto out;
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      max_iops = MAX (max_iops, sample->iops);
     }
+  max_visible_iops = round_up_for_axis (max_iops);
 
-  ret = g_strdup_printf ("%s/%s.gnome-disks-benchmark", bench_dir, id);
+  /* throughput on the left (like the transfer rate graph), IOPS on the right */
+  p = g_ptr_array_new ();
+  p2 = g_ptr_array_new ();
+  for (n = 0; n <= num_y_markers; n++)
+    {
+      gdouble iops = n * max_visible_iops / num_y_markers;
+      g_ptr_array_add (p, format_transfer_rate (iops * gdu_benchmark_get_queue_depth_block_size ()));
+      g_ptr_array_add (p2, format_iops (iops));
+    }
+  g_ptr_array_add (p, NULL);
+  g_ptr_array_add (p2, NULL);
+  y_left_markers = (gchar **) g_ptr_array_free (p, FALSE);
+  y_right_markers = (gchar **) g_ptr_array_free (p2, FALSE);
 
- out:
-  g_free (bench_dir);
-  return ret;
-}
+  gtk_widget_get_allocation (widget, &allocation);
+  width = allocation.width;
+  height = allocation.height;
 
-static void
-update_dialog (DialogData *data)
-{
-  GError *error = NULL;
-  GdkWindow *window = NULL;
-  gdouble read_avg = 0.0;
-  gdouble write_avg = 0.0;
-  gdouble access_time_avg = 0.0;
-  gchar *s = NULL;
-  UDisksDrive *drive = NULL;
-  UDisksObjectInfo *info = NULL;
+  context = gtk_widget_get_style_context (widget);
+  gtk_style_context_get_color (context, GTK_STATE_FLAG_NORMAL, &fg);
+  gtk_style_context_get (context,
+                         GTK_STATE_FLAG_NORMAL,
+                         GTK_STYLE_PROPERTY_FONT,
+                         &font_desc,
+                         NULL);
+  size = pango_font_description_get_size (font_desc);
+  if (pango_font_description_get_size_is_absolute (font_desc))
+    size *= PANGO_SCALE;
+  pango_font_description_set_size (font_desc, PANGO_SCALE_X_SMALL * size);
+  layout = pango_cairo_create_layout (cr);
+  pango_layout_set_font_description (layout, font_desc);
+  pango_font_description_free (font_desc);
 
-  G_LOCK (bm_lock);
-  if (data->bm_error != NULL)
+  /* make room for the markers on all sides */
+  gx = 0;
+  gw = width;
+  for (n = 0; n <= num_y_markers; n++)
     {
-      error = data->bm_error;
-      data->bm_error = NULL;
+      pango_layout_set_text (layout, y_left_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      gx = MAX (gx, ceil (extents.width / PANGO_SCALE) + 2 * 3);
+      pango_layout_set_text (layout, y_right_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      gw = MIN (gw, width - (ceil (extents.width / PANGO_SCALE) + 2 * 3));
     }
-  G_UNLOCK (bm_lock);
+  gw -= gx;
+  x_marker_height = ceil (extents.height / PANGO_SCALE) + 10;
+  gy = ceil (extents.height / PANGO_SCALE / 2.0);
+  gh = height - gy - x_marker_height;
 
-  /* first of all, present an error if something went wrong */
-  if (error != NULL)
+  /* y markers */
+  for (n = 0; n <= num_y_markers; n++)
     {
-      if (!data->closed)
-        {
-          if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
-            gdu_utils_show_error (GTK_WINDOW (data->window), C_("benchmarking", "An error occurred"), error);
-        }
-      g_clear_error (&error);
+      y = gy + gh - gh * n / num_y_markers;
 
-      /* and reload old data */
-      if (!maybe_load_data (data, &error))
-        {
-          /* not worth complaining in dialog about */
-          g_warning ("Error loading cached data: %s (%s, %d)",
-                     error->message, g_quark_to_string (error->domain), error->code);
-          g_clear_error (&error);
-        }
+      gdk_cairo_set_source_rgba (cr, &fg);
+      pango_layout_set_text (layout, y_left_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      cairo_move_to (cr,
+                     gx / 2.0 - extents.width/PANGO_SCALE/2,
+                     y - extents.height/PANGO_SCALE/2);
+      pango_cairo_show_layout (cr, layout);
+
+      pango_layout_set_text (layout, y_right_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      cairo_move_to (cr,
+                     gx + gw + (width - (gx + gw))/2.0 - extents.width/PANGO_SCALE/2,
+                     y - extents.height/PANGO_SCALE/2);
+      pango_cairo_show_layout (cr, layout);
     }
 
-  update_updated_label (data);
+  /* x markers - the queue depths are spaced evenly */
+  for (n = 0; n < num_samples; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      gchar *s;
 
-  /* disk / device label */
-  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->block);
-  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
-  gtk_label_set_text (GTK_LABEL (data->device_label), udisks_object_info_get_one_liner (info));
-  g_free (s);
+      x = gx + gw * (n + 0.5) / num_samples;
+      y = gy + gh + x_marker_height/2.0;
 
-  G_LOCK (bm_lock);
+      /* Translators: This is used in the benchmark graph - %u is the queue depth */
+      s = g_strdup_printf (C_("benchmark-graph", "QD %u"), sample->queue_depth);
+      pango_layout_set_text (layout, s, -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      cairo_move_to (cr,
+                     x - extents.width/PANGO_SCALE/2,
+                     y - extents.height/PANGO_SCALE/2);
+      gdk_cairo_set_source_rgba (cr, &fg);
+      pango_cairo_show_layout (cr, layout);
+      g_free (s);
+    }
 
-  if (data->bm_in_progress)
+  g_object_unref (layout);
+
+  /* fill graph area and draw the grid, clipping to it */
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_rectangle (cr, gx + 0.5, gy + 0.5, gw, gh);
+  cairo_fill_preserve (cr);
+  cairo_set_source_rgba (cr, 0, 0, 0, 0.25);
+  cairo_set_line_width (cr, 1.0);
+  cairo_stroke_preserve (cr);
+  cairo_clip (cr);
+  for (n = 1; n < num_y_markers; n++)
     {
+      y = gy + ceil (n * gh / num_y_markers);
+      cairo_move_to (cr, gx + 0.5, y + 0.5);
+      cairo_line_to (cr, gx + gw + 0.5, y + 0.5);
+      cairo_stroke (cr);
+    }
 
-      gtk_widget_hide (data->start_benchmark_button);
-      gtk_widget_show (data->stop_benchmark_button);
+  /* Both axes are scaled the same since the block size is fixed so
+   * a single line shows throughput and IOPS
+   */
+  cairo_set_source_rgb (cr, 0.5, 0.5, 1.0);
+  cairo_set_line_width (cr, 1.5);
+  for (n = 0; n < num_samples; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+
+      x = gx + gw * (n + 0.5) / num_samples;
+      y = gy + gh - gh * sample->iops / max_visible_iops;
+
+      if (n == 0)
+        cairo_move_to (cr, x, y);
+      else
+        cairo_line_to (cr, x, y);
     }
-  else
+  cairo_stroke (cr);
+  for (n = 0; n < num_samples; n++)
     {
-      gtk_widget_show (data->start_benchmark_button);
-      gtk_widget_hide (data->stop_benchmark_button);
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+
+      x = gx + gw * (n + 0.5) / num_samples;
+      y = gy + gh - gh * sample->iops / max_visible_iops;
+      cairo_arc (cr, x, y, 2.5, 0, 2 * M_PI);
+      cairo_fill (cr);
     }
 
-  get_max_min_avg (data->bm_read_samples,
-                   NULL, NULL, &read_avg);
-  get_max_min_avg (data->bm_write_samples,
-                   NULL, NULL, &write_avg);
-  get_max_min_avg (data->bm_access_time_samples,
-                   NULL, NULL, &access_time_avg);
+  g_strfreev (y_left_markers);
+  g_strfreev (y_right_markers);
 
-  G_UNLOCK (bm_lock);
+  gdu_benchmark_unlock (data->benchmark);
 
-  if (data->bm_sample_size == 0)
-    s = g_strdup ("–");
-  else
-    s = g_format_size_full (data->bm_sample_size, G_FORMAT_SIZE_IEC_UNITS | G_FORMAT_SIZE_LONG_FORMAT);
-  gtk_label_set_markup (GTK_LABEL (data->sample_size_label), s);
-  g_free (s);
+  /* propagate event further */
+  return FALSE;
+}
 
-  if (read_avg == 0.0)
-    s = g_strdup ("–");
-  else
-    s = format_transfer_rate_and_num_samples (read_avg, data->bm_read_samples->len);
-  gtk_label_set_markup (GTK_LABEL (data->read_rate_label), s);
-  g_free (s);
+/* how much was written after @usec of writing, assuming a constant rate within each sample */
+static gdouble
+sustained_write_bytes_at (GArray  *samples,
+                          gdouble  usec)
+{
+  gint64 prev_usec = 0;
+  guint64 prev_bytes = 0;
+  guint n;
 
-  if (write_avg == 0.0)
-    s = g_strdup ("–");
-  else
-    s = format_transfer_rate_and_num_samples (write_avg, data->bm_write_samples->len);
-  gtk_label_set_markup (GTK_LABEL (data->write_rate_label), s);
+  for (n = 0; n < samples->len; n++)
+    {
+      GduBenchmarkSustainedSample *sample = &g_array_index (samples, GduBenchmarkSustainedSample, n);
+      if (usec <= sample->time_usec)
+        return prev_bytes + (sample->bytes_written - prev_bytes) * (usec - prev_usec) / MAX (sample->time_usec - prev_usec, 1);
+      prev_usec = sample->time_usec;
+      prev_bytes = sample->bytes_written;
+    }
+  return prev_bytes;
+}
+
+static gboolean
+on_sustained_write_drawing_area_draw (GtkWidget      *widget,
+                                      cairo_t        *cr,
+                                      gpointer        user_data)
+{
+  DialogData *data = user_data;
+  GArray *samples;
+  GtkAllocation allocation;
+  gdouble width, height;
+  gdouble gx, gy, gw, gh;
+  gdouble x, y;
+  gdouble x_marker_height;
+  gdouble max_rate = 0.0;
+  gdouble max_visible_rate;
+  gdouble max_usec = 1.0;
+  gdouble burst_rate;
+  gdouble sustained_rate;
+  gint collapse;
+  guint num_y_markers = 5;
+  guint num_x_markers = 5;
+  static const gdouble collapse_dash[] = {4.0, 2.0};
+  gchar **y_markers;
+  gchar **x_markers;
+  GPtrArray *p;
+  GtkStyleContext *context;
+  PangoFontDescription *font_desc;
+  gint size;
+  GdkRGBA fg;
+  PangoLayout *layout;
+  PangoRectangle extents;
+  guint n;
+
+  gdu_benchmark_lock (data->benchmark);
+
+  samples = data->benchmark->sustained_write_samples;
+  for (n = 0; n < samples->len; n++)
+    {
+      GduBenchmarkSustainedSample *sample = &g_array_index (samples, GduBenchmarkSustainedSample, n);
+      max_rate = MAX (max_rate, sample->value);
+      max_usec = MAX (max_usec, sample->time_usec);
+    }
+  max_visible_rate = round_up_for_axis (max_rate);
+  collapse = gdu_benchmark_find_sustained_write_collapse (data->benchmark, &burst_rate, &sustained_rate);
+
+  p = g_ptr_array_new ();
+  for (n = 0; n <= num_y_markers; n++)
+    g_ptr_array_add (p, format_transfer_rate (n * max_visible_rate / num_y_markers));
+  g_ptr_array_add (p, NULL);
+  y_markers = (gchar **) g_ptr_array_free (p, FALSE);
+
+  /* time spent writing with how much was written by then below it */
+  p = g_ptr_array_new ();
+  for (n = 0; n <= num_x_markers; n++)
+    {
+      gdouble usec = n * max_usec / num_x_markers;
+      gchar *s;
+      s = g_format_size ((guint64) sustained_write_bytes_at (samples, usec));
+      /* Translators: This is used in the sustained write graph - %.0f is the number of seconds
+       * spent writing and %s how much was written by then, e.g. "42 GB"
+       */
+      g_ptr_array_add (p, g_strdup_printf (C_("benchmark-graph", "%.0f s\n%s"), usec / G_USEC_PER_SEC, s));
+      g_free (s);
+    }
+  g_ptr_array_add (p, NULL);
+  x_markers = (gchar **) g_ptr_array_free (p, FALSE);
+
+  gtk_widget_get_allocation (widget, &allocation);
+  width = allocation.width;
+  height = allocation.height;
+
+  context = gtk_widget_get_style_context (widget);
+  gtk_style_context_get_color (context, GTK_STATE_FLAG_NORMAL, &fg);
+  gtk_style_context_get (context,
+                         GTK_STATE_FLAG_NORMAL,
+                         GTK_STYLE_PROPERTY_FONT,
+                         &font_desc,
+                         NULL);
+  size = pango_font_description_get_size (font_desc);
+  if (pango_font_description_get_size_is_absolute (font_desc))
+    size *= PANGO_SCALE;
+  pango_font_description_set_size (font_desc, PANGO_SCALE_X_SMALL * size);
+  layout = pango_cairo_create_layout (cr);
+  pango_layout_set_font_description (layout, font_desc);
+  pango_layout_set_alignment (layout, PANGO_ALIGN_CENTER);
+  pango_font_description_free (font_desc);
+
+  /* make room for the markers - the last x marker is centered on the right edge */
+  gx = 0;
+  for (n = 0; n <= num_y_markers; n++)
+    {
+      pango_layout_set_text (layout, y_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      gx = MAX (gx, ceil (extents.width / PANGO_SCALE) + 2 * 3);
+    }
+  gy = ceil (extents.height / PANGO_SCALE / 2.0);
+  pango_layout_set_text (layout, x_markers[num_x_markers], -1);
+  pango_layout_get_extents (layout, NULL, &extents);
+  gw = width - gx - ceil (extents.width / PANGO_SCALE / 2.0) - 3;
+  x_marker_height = ceil (extents.height / PANGO_SCALE) + 10;
+  gh = height - gy - x_marker_height;
+
+  /* y markers */
+  for (n = 0; n <= num_y_markers; n++)
+    {
+      y = gy + gh - gh * n / num_y_markers;
+
+      gdk_cairo_set_source_rgba (cr, &fg);
+      pango_layout_set_text (layout, y_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      cairo_move_to (cr,
+                     gx / 2.0 - extents.width/PANGO_SCALE/2,
+                     y - extents.height/PANGO_SCALE/2);
+      pango_cairo_show_layout (cr, layout);
+    }
+
+  /* x markers */
+  for (n = 0; n <= num_x_markers; n++)
+    {
+      x = gx + gw * n / num_x_markers;
+      y = gy + gh + x_marker_height/2.0;
+
+      gdk_cairo_set_source_rgba (cr, &fg);
+      pango_layout_set_text (layout, x_markers[n], -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      cairo_move_to (cr,
+                     x - extents.width/PANGO_SCALE/2,
+                     y - extents.height/PANGO_SCALE/2);
+      pango_cairo_show_layout (cr, layout);
+    }
+
+  /* fill graph area and draw the grid, clipping to it */
+  cairo_save (cr);
+  cairo_set_source_rgb (cr, 1, 1, 1);
+  cairo_rectangle (cr, gx + 0.5, gy + 0.5, gw, gh);
+  cairo_fill_preserve (cr);
+  cairo_set_source_rgba (cr, 0, 0, 0, 0.25);
+  cairo_set_line_width (cr, 1.0);
+  cairo_stroke_preserve (cr);
+  cairo_clip (cr);
+  for (n = 1; n < num_y_markers; n++)
+    {
+      y = gy + ceil (n * gh / num_y_markers);
+      cairo_move_to (cr, gx + 0.5, y + 0.5);
+      cairo_line_to (cr, gx + gw + 0.5, y + 0.5);
+      cairo_stroke (cr);
+    }
+  for (n = 1; n < num_x_markers; n++)
+    {
+      x = gx + ceil (n * gw / num_x_markers);
+      cairo_move_to (cr, x + 0.5, gy + 0.5);
+      cairo_line_to (cr, x + 0.5, gy + gh + 0.5);
+      cairo_stroke (cr);
+    }
+
+  /* same color as the write rate in the transfer rate graph */
+  cairo_set_source_rgb (cr, 1.0, 0.5, 0.5);
+  cairo_set_line_width (cr, 1.5);
+  for (n = 0; n < samples->len; n++)
+    {
+      GduBenchmarkSustainedSample *sample = &g_array_index (samples, GduBenchmarkSustainedSample, n);
+
+      x = gx + gw * sample->time_usec / max_usec;
+      y = gy + gh - gh * sample->value / max_visible_rate;
+
+      if (n == 0)
+        cairo_move_to (cr, x, y);
+      else
+        cairo_line_to (cr, x, y);
+    }
+  cairo_stroke (cr);
+
+  /* mark where the rate collapsed and the rates before and after */
+  if (collapse > 0)
+    {
+      GduBenchmarkSustainedSample *sample = &g_array_index (samples, GduBenchmarkSustainedSample, collapse - 1);
+      gdouble collapse_x;
+      gchar *s;
+      gchar *s2;
+
+      collapse_x = gx + gw * sample->time_usec / max_usec;
+
+      cairo_set_source_rgba (cr, 0.5, 0.0, 0.0, 0.5);
+      cairo_set_line_width (cr, 1.0);
+      y = gy + gh - gh * burst_rate / max_visible_rate;
+      cairo_move_to (cr, gx, y);
+      cairo_line_to (cr, collapse_x, y);
+      y = gy + gh - gh * sustained_rate / max_visible_rate;
+      cairo_move_to (cr, collapse_x, y);
+      cairo_line_to (cr, gx + gw, y);
+      cairo_stroke (cr);
+
+      cairo_set_source_rgb (cr, 0.8, 0.0, 0.0);
+      cairo_set_dash (cr, collapse_dash, G_N_ELEMENTS (collapse_dash), 0.0);
+      cairo_move_to (cr, floor (collapse_x) + 0.5, gy);
+      cairo_line_to (cr, floor (collapse_x) + 0.5, gy + gh);
+      cairo_stroke (cr);
+      cairo_set_dash (cr, NULL, 0, 0.0);
+
+      s = g_format_size (sample->bytes_written);
+      /* Translators: This is used in the sustained write graph to mark where the transfer rate
+       * dropped - %s is how much was written until then, e.g. "42 GB"
+       */
+      s2 = g_strdup_printf (C_("benchmark-graph", "Dropped after %s"), s);
+      pango_layout_set_text (layout, s2, -1);
+      pango_layout_get_extents (layout, NULL, &extents);
+      /* to the right of the line, unless there's no room */
+      x = collapse_x + 3;
+      if (x + extents.width / PANGO_SCALE > gx + gw)
+        x = collapse_x - 3 - extents.width / PANGO_SCALE;
+      cairo_move_to (cr, x, gy + 3);
+      pango_cairo_show_layout (cr, layout);
+      g_free (s2);
+      g_free (s);
+    }
+  cairo_restore (cr);
+
+  g_object_unref (layout);
+  g_strfreev (y_markers);
+  g_strfreev (x_markers);
+
+  gdu_benchmark_unlock (data->benchmark);
+
+  /* propagate event further */
+  return FALSE;
+}
+
+
+static gchar *
+format_latency (guint64 usec)
+{
+  return g_strdup_printf (C_("benchmark-access-time", "%.2f msec"), usec / 1000.0);
+}
+
+static void
+append_latency_line (GString             *str,
+                     const gchar         *name,
+                     GduLatencyHistogram *histogram)
+{
+  gchar *p50, *p90, *p99, *p999, *max;
+
+  if (histogram == NULL || gdu_latency_histogram_get_count (histogram) == 0)
+    return;
+
+  p50 = format_latency (gdu_latency_histogram_get_percentile (histogram, 50.0));
+  p90 = format_latency (gdu_latency_histogram_get_percentile (histogram, 90.0));
+  p99 = format_latency (gdu_latency_histogram_get_percentile (histogram, 99.0));
+  p999 = format_latency (gdu_latency_histogram_get_percentile (histogram, 99.9));
+  max = format_latency (gdu_latency_histogram_get_max (histogram));
+  if (str->len > 0)
+    g_string_append_c (str, '\n');
+  /* Translators: The first %s is the benchmark phase, e.g. "Access Time" or "Random 4 KiB Read".
+   * The others are latencies, e.g. "0.52 msec" - the median, 90th, 99th and 99.9th percentile
+   * and the maximum
+   */
+  g_string_append_printf (str, C_("benchmark-latency", "%s: p50 %s, p90 %s, p99 %s, p99.9 %s, max %s"),
+                          name, p50, p90, p99, p999, max);
+  g_free (max);
+  g_free (p999);
+  g_free (p99);
+  g_free (p90);
+  g_free (p50);
+}
+
+
+static void
+update_updated_label (DialogData *data)
+{
+  gchar *s = NULL;
+  gboolean in_progress;
+  gdouble progress;
+
+  G_LOCK (bm_lock);
+  in_progress = data->bm_in_progress;
+  G_UNLOCK (bm_lock);
+
+  gdu_benchmark_lock (data->benchmark);
+  progress = gdu_benchmark_get_phase_progress (data->benchmark) * 100.0;
+  switch (data->benchmark->phase)
+    {
+    case GDU_BENCHMARK_PHASE_NONE:
+      if (in_progress)
+        {
+          gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "Opening Device…"));
+        }
+      else if (data->benchmark->time_benchmarked_usec > 0)
+        {
+          gint64 now_usec;
+          gchar *s2;
+          GDateTime *time_benchmarked_dt;
+          GDateTime *time_benchmarked_dt_local;
+          gchar *time_benchmarked_str;
+
+          now_usec = g_get_real_time ();
+
+          time_benchmarked_dt = g_date_time_new_from_unix_utc (data->benchmark->time_benchmarked_usec / G_USEC_PER_SEC);
+          time_benchmarked_dt_local = g_date_time_to_local (time_benchmarked_dt);
+          time_benchmarked_str = g_date_time_format (time_benchmarked_dt_local, "%c");
+
+          s = gdu_utils_format_duration_usec ((now_usec - data->benchmark->time_benchmarked_usec),
+                                              GDU_FORMAT_DURATION_FLAGS_NO_SECONDS);
+          /* Translators: The first %s is the date and time the benchmark took place in the preferred
+           * format for the locale (e.g. "%c" for strftime()/g_date_time_format()), for example
+           * "Tue 12 Jun 2012 03:57:08 PM EDT". The second %s is how long ago that is from right
+           * now, for example "3 days" or "2 hours" or "12 minutes".
+           */
+          s2 = g_strdup_printf (C_("benchmark-updated", "%s (%s ago)"),
+                                time_benchmarked_str,
+                                s);
+          gtk_label_set_text (GTK_LABEL (data->updated_label), s2);
+          g_free (s2);
+          g_free (s);
+          g_free (time_benchmarked_str);
+          g_date_time_unref (time_benchmarked_dt_local);
+          g_date_time_unref (time_benchmarked_dt);
+        }
+      else
+        {
+          gtk_label_set_markup (GTK_LABEL (data->updated_label), C_("benchmark-updated", "No benchmark data available"));
+        }
+      break;
+
+    case GDU_BENCHMARK_PHASE_TRANSFER_RATE:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring transfer rate (%2.1f%% complete)…"),
+                           progress);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case GDU_BENCHMARK_PHASE_ACCESS_TIME:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring access time (%2.1f%% complete)…"),
+                           progress);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case GDU_BENCHMARK_PHASE_QUEUE_DEPTH:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring queue depth scaling (%2.1f%% complete)…"),
+                           progress);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case GDU_BENCHMARK_PHASE_WORKLOADS:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring workloads (%2.1f%% complete)…"),
+                           progress);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    case GDU_BENCHMARK_PHASE_SUSTAINED_WRITE:
+      s = g_strdup_printf (C_("benchmark-updated", "Measuring sustained write rate (%2.1f%% complete)…"),
+                           progress);
+      gtk_label_set_markup (GTK_LABEL (data->updated_label), s);
+      g_free (s);
+      break;
+
+    }
+  gdu_benchmark_unlock (data->benchmark);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef struct
+{
+  gdouble read_avg;
+  gdouble write_avg;
+  gdouble access_time_avg;
+  gdouble best_iops;
+  gdouble sustained_write_rate;
+} Summary;
+
+/* @out must be zeroed - and the lock of @benchmark held if it's being run */
+static void
+get_summary (GduBenchmark *benchmark,
+             Summary      *out)
+{
+  guint n;
+
+  get_max_min_avg (benchmark->read_samples, NULL, NULL, &out->read_avg);
+  get_max_min_avg (benchmark->write_samples, NULL, NULL, &out->write_avg);
+  get_max_min_avg (benchmark->access_time_samples, NULL, NULL, &out->access_time_avg);
+  for (n = 0; n < benchmark->queue_depth_samples->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      out->best_iops = MAX (out->best_iops, sample->iops);
+    }
+  if (benchmark->sustained_write_samples->len > 0)
+    gdu_benchmark_find_sustained_write_collapse (benchmark, NULL, &out->sustained_write_rate);
+}
+
+static gchar *
+format_access_time (gdouble seconds)
+{
+  return g_strdup_printf (C_("benchmark-access-time", "%.2f msec"), seconds * 1000.0);
+}
+
+static void
+append_regression_line (GString      *str,
+                        const gchar  *name,
+                        gdouble       value,
+                        gdouble       previous_value,
+                        gboolean      lower_is_better,
+                        gchar      *(*format_func) (gdouble))
+{
+  gdouble change;
+  gchar *s;
+  gchar *s2;
+
+  /* not measured in one of the runs */
+  if (value <= 0.0 || previous_value <= 0.0)
+    return;
+
+  change = value / previous_value - 1.0;
+  if (lower_is_better ? change <= REGRESSION_THRESHOLD : change >= -REGRESSION_THRESHOLD)
+    return;
+
+  s = format_func (value);
+  s2 = format_func (previous_value);
+  if (str->len > 0)
+    g_string_append_c (str, '\n');
+  /* Translators: The first %s is what got worse, e.g. "Average Read Rate", the second and third
+   * %s are the results of the latest and the previous run, e.g. "412.3 MB/s" and "530.1 MB/s",
+   * and %+.0f is the difference in percent, e.g. "-22"
+   */
+  g_string_append_printf (str, C_("benchmark-history", "%s: %s, was %s (%+.0f%%)"),
+                          name, s, s2, change * 100.0);
+  g_free (s2);
+  g_free (s);
+}
+
+static void
+append_small_line (gchar       **markup,
+                   const gchar  *text)
+{
+  gchar *s = *markup;
+  gchar *escaped_text;
+
+  /* s is already markup, only text needs escaping */
+  escaped_text = g_markup_escape_text (text, -1);
+  *markup = g_strconcat (s, "\n<small>", escaped_text, "</small>", NULL);
+  g_free (escaped_text);
+  g_free (s);
+}
+
+/* Whether the results of @a and @b can be compared - that is, if both
+ * were run with the same parameters. Workloads are matched one by one
+ * so the set of workloads may differ.
+ */
+static gboolean
+same_parameters (GduBenchmark *a,
+                 GduBenchmark *b)
+{
+  return (a->num_samples == b->num_samples &&
+          a->sample_size_mib == b->sample_size_mib &&
+          a->do_write == b->do_write &&
+          a->num_access_samples == b->num_access_samples &&
+          a->do_queue_depth == b->do_queue_depth &&
+          a->workload_queue_depth == b->workload_queue_depth &&
+          a->do_sustained_write == b->do_sustained_write &&
+          a->sustained_write_duration_sec == b->sustained_write_duration_sec &&
+          a->sustained_write_size_gib == b->sustained_write_size_gib);
+}
+
+/* Compares the latest run with the most recent earlier run with the
+ * same parameters. Returns NULL if there's nothing to compare.
+ */
+static gchar *
+format_history (DialogData *data)
+{
+  GduBenchmark *previous;
+  gchar *ret;
+  Summary latest_summary = {0};
+  Summary previous_summary = {0};
+  GString *str;
+  gchar *s;
+  gchar *s2;
+  GDateTime *dt;
+  GDateTime *dt_local;
+  guint n;
+  guint m;
+
+  if (data->benchmark->time_benchmarked_usec == 0)
+    return NULL;
+  previous = NULL;
+  for (n = data->history->len; n > 0; n--)
+    {
+      if (same_parameters (data->benchmark, data->history->pdata[n - 1]))
+        {
+          previous = data->history->pdata[n - 1];
+          break;
+        }
+    }
+  if (previous == NULL)
+    return NULL;
+
+  get_summary (data->benchmark, &latest_summary);
+  get_summary (previous, &previous_summary);
+
+  str = g_string_new (NULL);
+  append_regression_line (str, C_("benchmark-history", "Average Read Rate"),
+                          latest_summary.read_avg, previous_summary.read_avg,
+                          FALSE, format_transfer_rate);
+  append_regression_line (str, C_("benchmark-history", "Average Write Rate"),
+                          latest_summary.write_avg, previous_summary.write_avg,
+                          FALSE, format_transfer_rate);
+  append_regression_line (str, C_("benchmark-history", "Average Access Time"),
+                          latest_summary.access_time_avg, previous_summary.access_time_avg,
+                          TRUE, format_access_time);
+  append_regression_line (str, C_("benchmark-history", "Queue Depth Scaling"),
+                          latest_summary.best_iops, previous_summary.best_iops,
+                          FALSE, format_iops);
+  for (n = 0; n < data->benchmark->workload_results->len; n++)
+    {
+      GduBenchmarkWorkloadResult *result = &g_array_index (data->benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+      for (m = 0; m < previous->workload_results->len; m++)
+        {
+          GduBenchmarkWorkloadResult *previous_result = &g_array_index (previous->workload_results, GduBenchmarkWorkloadResult, m);
+          if (previous_result->workload == result->workload &&
+              previous_result->queue_depth == result->queue_depth)
+            append_regression_line (str, gettext (result->workload->name),
+                                    result->iops, previous_result->iops,
+                                    FALSE, format_iops);
+        }
+    }
+  append_regression_line (str, C_("benchmark-history", "Sustained Write Rate"),
+                          latest_summary.sustained_write_rate, previous_summary.sustained_write_rate,
+                          FALSE, format_transfer_rate);
+
+  if (str->len > 0)
+    ret = g_markup_printf_escaped ("<b>%s</b>", str->str);
+  else
+    ret = g_markup_escape_text (C_("benchmark-history", "No regressions"), -1);
+  g_string_free (str, TRUE);
+
+  dt = g_date_time_new_from_unix_utc (previous->time_benchmarked_usec / G_USEC_PER_SEC);
+  dt_local = g_date_time_to_local (dt);
+  s = g_date_time_format (dt_local, "%c");
+  /* Translators: %s is the date and time of the previous benchmark in the preferred format
+   * for the locale, e.g. "Tue 12 Jun 2012 03:57:08 PM EDT"
+   */
+  s2 = g_strdup_printf (C_("benchmark-history", "compared with the run on %s"), s);
+  append_small_line (&ret, s2);
+  g_free (s2);
+  g_free (s);
+  g_date_time_unref (dt_local);
+  g_date_time_unref (dt);
+
+  /* a different firmware or kernel explains a lot of changes */
+  if (data->benchmark->firmware_revision != NULL && previous->firmware_revision != NULL &&
+      g_strcmp0 (data->benchmark->firmware_revision, previous->firmware_revision) != 0)
+    {
+      /* Translators: The %s are firmware revisions, e.g. "3B2QEXM7" and "4B2QEXM7" */
+      s = g_strdup_printf (C_("benchmark-history", "firmware was updated from %s to %s"),
+                           previous->firmware_revision, data->benchmark->firmware_revision);
+      append_small_line (&ret, s);
+      g_free (s);
+    }
+  if (data->benchmark->kernel_version != NULL && previous->kernel_version != NULL &&
+      g_strcmp0 (data->benchmark->kernel_version, previous->kernel_version) != 0)
+    {
+      /* Translators: The %s are kernel versions, e.g. "3.8.4" and "3.9.0" */
+      s = g_strdup_printf (C_("benchmark-history", "kernel was updated from %s to %s"),
+                           previous->kernel_version, data->benchmark->kernel_version);
+      append_small_line (&ret, s);
+      g_free (s);
+    }
+
+  return ret;
+}
+
+static void
+update_dialog (DialogData *data)
+{
+  GError *error = NULL;
+  GdkWindow *window = NULL;
+  gdouble read_avg = 0.0;
+  gdouble write_avg = 0.0;
+  gdouble access_time_avg = 0.0;
+  GduBenchmarkQueueDepthSample best_queue_depth = {0};
+  gboolean queue_depth_async;
+  GString *workloads_str;
+  GString *latency_str;
+  gchar *sustained_write_str = NULL;
+  gchar *history_str = NULL;
+  gboolean in_progress;
+  gboolean finished;
+  guint n;
+  gchar *s = NULL;
+  UDisksDrive *drive = NULL;
+  UDisksObjectInfo *info = NULL;
+
+  G_LOCK (bm_lock);
+  if (data->bm_error != NULL)
+    {
+      error = data->bm_error;
+      data->bm_error = NULL;
+    }
+  finished = data->bm_finished;
+  data->bm_finished = FALSE;
+  G_UNLOCK (bm_lock);
+
+  /* first of all, present an error if something went wrong */
+  if (error != NULL)
+    {
+      if (!data->closed)
+        {
+          if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+            gdu_utils_show_error (GTK_WINDOW (data->window), C_("benchmarking", "An error occurred"), error);
+        }
+      g_clear_error (&error);
+    }
+
+  /* pick up the new run - or, if something went wrong, reload the old one */
+  if (finished)
+    {
+      if (!load_history (data, &error))
+        {
+          /* not worth complaining in dialog about */
+          g_warning ("Error loading cached data: %s (%s, %d)",
+                     error->message, g_quark_to_string (error->domain), error->code);
+          g_clear_error (&error);
+        }
+    }
+
+  update_updated_label (data);
+
+  /* disk / device label */
+  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->block);
+  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
+  gtk_label_set_text (GTK_LABEL (data->device_label), udisks_object_info_get_one_liner (info));
+  g_free (s);
+
+  G_LOCK (bm_lock);
+
+  in_progress = data->bm_in_progress;
+  if (data->bm_in_progress)
+    {
+
+      gtk_widget_hide (data->start_benchmark_button);
+      gtk_widget_show (data->stop_benchmark_button);
+    }
+  else
+    {
+      gtk_widget_show (data->start_benchmark_button);
+      gtk_widget_hide (data->stop_benchmark_button);
+    }
+  G_UNLOCK (bm_lock);
+
+  gdu_benchmark_lock (data->benchmark);
+  get_max_min_avg (data->benchmark->read_samples,
+                   NULL, NULL, &read_avg);
+  get_max_min_avg (data->benchmark->write_samples,
+                   NULL, NULL, &write_avg);
+  get_max_min_avg (data->benchmark->access_time_samples,
+                   NULL, NULL, &access_time_avg);
+
+  for (n = 0; n < data->benchmark->queue_depth_samples->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      if (sample->iops > best_queue_depth.iops)
+        best_queue_depth = *sample;
+    }
+  queue_depth_async = data->benchmark->queue_depth_async;
+
+  workloads_str = g_string_new (NULL);
+  for (n = 0; n < data->benchmark->workload_results->len; n++)
+    {
+      GduBenchmarkWorkloadResult *result = &g_array_index (data->benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+      gchar *s2;
+      gchar *s3;
+      gchar *s4;
+
+      s2 = format_iops (result->iops);
+      s3 = format_transfer_rate (result->bytes_per_sec);
+      s4 = g_strdup_printf (C_("benchmark-access-time", "%.2f msec"), result->latency * 1000.0);
+      if (workloads_str->len > 0)
+        g_string_append_c (workloads_str, '\n');
+      /* Translators: The first %s is the name of the workload, e.g. "Random 4 KiB Read", followed
+       * by the number of I/O operations per second, the transfer rate and the average latency
+       */
+      g_string_append_printf (workloads_str, C_("benchmark-workload", "%s: %s, %s, %s"),
+                              gettext (result->workload->name), s2, s3, s4);
+      g_free (s4);
+      g_free (s3);
+      g_free (s2);
+    }
+  if (data->benchmark->workload_results->len > 0)
+    {
+      gchar *s2;
+      /* Translators: %u is the number of requests that were in flight at the same time */
+      s2 = g_strdup_printf (C_("benchmark-workload", "at queue depth %u"),
+                            g_array_index (data->benchmark->workload_results, GduBenchmarkWorkloadResult, 0).queue_depth);
+      g_string_append_printf (workloads_str, "\n<small>%s</small>", s2);
+      g_free (s2);
+    }
+
+  if (data->benchmark->sustained_write_samples->len > 0)
+    {
+      GArray *samples = data->benchmark->sustained_write_samples;
+      gdouble burst_rate;
+      gdouble sustained_rate;
+      gint collapse;
+      gchar *s2;
+      gchar *s3;
+      gchar *s4;
+
+      collapse = gdu_benchmark_find_sustained_write_collapse (data->benchmark, &burst_rate, &sustained_rate);
+      if (collapse > 0)
+        {
+          s2 = format_transfer_rate (burst_rate);
+          s3 = g_format_size (g_array_index (samples, GduBenchmarkSustainedSample, collapse - 1).bytes_written);
+          s4 = format_transfer_rate (sustained_rate);
+          /* Translators: The first and last %s are transfer rates, e.g. "1.8 GB/s" and "450 MB/s".
+           * The second %s is how much was written before the transfer rate dropped, e.g. "42 GB"
+           */
+          sustained_write_str = g_strdup_printf (C_("benchmark-sustained-write", "%s for the first %s, then %s"),
+                                                 s2, s3, s4);
+        }
+      else
+        {
+          s2 = format_transfer_rate (sustained_rate);
+          s3 = g_format_size (g_array_index (samples, GduBenchmarkSustainedSample, samples->len - 1).bytes_written);
+          s4 = g_strdup_printf (C_("benchmark-sustained-write", "did not drop while writing %s"), s3);
+          sustained_write_str = g_strdup_printf ("%s <small>(%s)</small>", s2, s4);
+        }
+      g_free (s4);
+      g_free (s3);
+      g_free (s2);
+    }
+
+  latency_str = g_string_new (NULL);
+  append_latency_line (latency_str, C_("benchmark-latency", "Read"), data->benchmark->read_latency);
+  append_latency_line (latency_str, C_("benchmark-latency", "Write"), data->benchmark->write_latency);
+  append_latency_line (latency_str, C_("benchmark-latency", "Access Time"), data->benchmark->access_time_latency);
+  for (n = 0; n < data->benchmark->queue_depth_samples->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (data->benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      /* Translators: %u is the queue depth */
+      s = g_strdup_printf (C_("benchmark-latency", "Queue Depth %u"), sample->queue_depth);
+      append_latency_line (latency_str, s, sample->latency_histogram);
+      g_free (s);
+    }
+  for (n = 0; n < data->benchmark->workload_results->len; n++)
+    {
+      GduBenchmarkWorkloadResult *result = &g_array_index (data->benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+      append_latency_line (latency_str, gettext (result->workload->name), result->latency_histogram);
+    }
+  s = NULL;
+
+  /* comparing with a run that's only partially done would be misleading */
+  if (!in_progress)
+    history_str = format_history (data);
+
+  gdu_benchmark_unlock (data->benchmark);
+
+  if (data->benchmark->sample_size == 0)
+    s = g_strdup ("–");
+  else
+    s = g_format_size_full (data->benchmark->sample_size, G_FORMAT_SIZE_IEC_UNITS | G_FORMAT_SIZE_LONG_FORMAT);
+  gtk_label_set_markup (GTK_LABEL (data->sample_size_label), s);
+  g_free (s);
+
+  if (read_avg == 0.0)
+    s = g_strdup ("–");
+  else
+    s = format_transfer_rate_and_num_samples (read_avg, data->benchmark->read_samples->len);
+  gtk_label_set_markup (GTK_LABEL (data->read_rate_label), s);
+  g_free (s);
+
+  if (write_avg == 0.0)
+    s = g_strdup ("–");
+  else
+    s = format_transfer_rate_and_num_samples (write_avg, data->benchmark->write_samples->len);
+  gtk_label_set_markup (GTK_LABEL (data->write_rate_label), s);
   g_free (s);
 
   if (access_time_avg == 0.0)
@@ -887,8 +1753,8 @@ update_dialog (DialogData *data)
       s3 = g_strdup_printf (g_dngettext (GETTEXT_PACKAGE,
                                          "%u sample",
                                          "%u samples",
-                                         data->bm_access_time_samples->len),
-                            data->bm_access_time_samples->len);
+                                         data->benchmark->access_time_samples->len),
+                            data->benchmark->access_time_samples->len);
       s = g_strdup_printf ("%s <small>(%s)</small>", s2, s3);
       g_free (s3);
       g_free (s2);
@@ -896,230 +1762,153 @@ update_dialog (DialogData *data)
   gtk_label_set_markup (GTK_LABEL (data->access_time_label), s);
   g_free (s);
 
-
-  window = gtk_widget_get_window (data->graph_drawing_area);
-  if (window != NULL)
-    gdk_window_invalidate_rect (window, NULL, TRUE);
-
-  g_clear_object (&drive);
-  g_clear_object (&info);
-}
-
-
-/* called every second (on the second) */
-static gboolean
-on_timeout (gpointer user_data)
-{
-  DialogData *data = user_data;
-  update_updated_label (data);
-  return TRUE; /* keep timeout around */
-}
-
-/* ---------------------------------------------------------------------------------------------------- */
-
-static void
-samples_from_gvariant (GArray   *array,
-                       GVariant *variant)
-{
-  GVariantIter iter;
-  BMSample sample;
-
-  g_array_set_size (array, 0);
-
-  g_variant_iter_init (&iter, variant);
-  while (g_variant_iter_next (&iter, "(td)", &sample.offset, &sample.value))
+  if (best_queue_depth.queue_depth == 0)
     {
-      g_array_append_val (array, sample);
+      gtk_widget_hide (data->queue_depth_title_label);
+      gtk_widget_hide (data->queue_depth_label);
+      gtk_widget_hide (data->queue_depth_drawing_area);
     }
-}
-
-static gboolean
-maybe_load_data (DialogData  *data,
-                 GError     **error)
-{
-  gboolean ret = FALSE;
-  gchar *filename = NULL;
-  GVariant *value = NULL;
-  gchar *variant_data = NULL;
-  gsize variant_size;
-  GError *local_error = NULL;
-  GVariant *read_samples_variant = NULL;
-  GVariant *write_samples_variant = NULL;
-  GVariant *access_time_samples_variant = NULL;
-  gint32 version;
-  gint64 timestamp_usec;
-  guint64 device_size;
-  guint64 sample_size;
-
-  filename = get_bm_filename (data);
-  if (filename == NULL)
-    {
-      /* all good since we don't want to load data for this device */
-      ret = TRUE;
-      goto out;
-    }
-
-  if (!g_file_get_contents (filename,
-                            &variant_data,
-                            &variant_size,
-                            &local_error))
-    {
-      if (local_error->domain == G_FILE_ERROR && local_error->code == G_FILE_ERROR_NOENT)
+  else
+    {
+      gchar *s2;
+      gchar *s3;
+      s2 = format_iops (best_queue_depth.iops);
+      s3 = format_transfer_rate (best_queue_depth.bytes_per_sec);
+      /* Translators: The first %s is the number of I/O operations per second, e.g. "450k IOPS",
+       * the second %s is the transfer rate, e.g. "1.8 GB/s" and %u is the queue depth
+       */
+      s = g_strdup_printf (C_("benchmark-queue-depth", "%s (%s) at queue depth %u"),
+                           s2, s3, best_queue_depth.queue_depth);
+      if (!queue_depth_async)
         {
-          /* don't complain about a missing file */
-          g_clear_error (&local_error);
-          ret = TRUE;
-          goto out;
+          gchar *s4 = s;
+          s = g_strdup_printf ("%s <small>(%s)</small>",
+                               s4,
+                               C_("benchmark-queue-depth", "requests could not be queued on this system"));
+          g_free (s4);
         }
-      g_propagate_error (error, local_error);
-      goto out;
+      gtk_label_set_markup (GTK_LABEL (data->queue_depth_label), s);
+      g_free (s3);
+      g_free (s2);
+      g_free (s);
+      gtk_widget_show (data->queue_depth_title_label);
+      gtk_widget_show (data->queue_depth_label);
+      gtk_widget_show (data->queue_depth_drawing_area);
     }
 
-  value = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
-                                   variant_data,
-                                   variant_size,
-                                   FALSE,
-                                   NULL, NULL);
-
-  if (!g_variant_lookup (value, "version", "i", &version))
+  if (workloads_str->len == 0)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No version key");
-      goto out;
+      gtk_widget_hide (data->workloads_title_label);
+      gtk_widget_hide (data->workloads_label);
     }
-  if (version != 1)
+  else
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "Cannot decode version %d data", version);
-      goto out;
+      gtk_label_set_markup (GTK_LABEL (data->workloads_label), workloads_str->str);
+      gtk_widget_show (data->workloads_title_label);
+      gtk_widget_show (data->workloads_label);
     }
+  g_string_free (workloads_str, TRUE);
 
-  if (!g_variant_lookup (value, "timestamp-usec", "x", &timestamp_usec))
+  if (sustained_write_str == NULL)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No timestamp-usec");
-      goto out;
+      gtk_widget_hide (data->sustained_write_title_label);
+      gtk_widget_hide (data->sustained_write_label);
+      gtk_widget_hide (data->sustained_write_drawing_area);
     }
-
-  if (!g_variant_lookup (value, "device-size", "t", &device_size))
+  else
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No device-size");
-      goto out;
+      gtk_label_set_markup (GTK_LABEL (data->sustained_write_label), sustained_write_str);
+      gtk_widget_show (data->sustained_write_title_label);
+      gtk_widget_show (data->sustained_write_label);
+      gtk_widget_show (data->sustained_write_drawing_area);
     }
+  g_free (sustained_write_str);
 
-  if (!g_variant_lookup (value, "read-samples", "@a(td)", &read_samples_variant))
+  if (latency_str->len == 0)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No read-samples");
-      goto out;
+      gtk_widget_hide (data->latency_title_label);
+      gtk_widget_hide (data->latency_label);
     }
-
-  if (!g_variant_lookup (value, "write-samples", "@a(td)", &write_samples_variant))
+  else
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No write-samples");
-      goto out;
+      gtk_label_set_text (GTK_LABEL (data->latency_label), latency_str->str);
+      gtk_widget_show (data->latency_title_label);
+      gtk_widget_show (data->latency_label);
     }
+  g_string_free (latency_str, TRUE);
 
-  if (!g_variant_lookup (value, "access-time-samples", "@a(td)", &access_time_samples_variant))
+  if (history_str == NULL)
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No access-time-samples");
-      goto out;
+      gtk_widget_hide (data->history_title_label);
+      gtk_widget_hide (data->history_label);
     }
-
-  if (!g_variant_lookup (value, "sample-size", "t", &sample_size))
+  else
     {
-      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                   "No sample-size");
-      goto out;
+      gtk_label_set_markup (GTK_LABEL (data->history_label), history_str);
+      gtk_widget_show (data->history_title_label);
+      gtk_widget_show (data->history_label);
     }
+  g_free (history_str);
 
-  data->bm_time_benchmarked_usec = timestamp_usec;
-  data->bm_size = device_size;
-  data->bm_sample_size = sample_size;
-  samples_from_gvariant (data->bm_read_samples, read_samples_variant);
-  samples_from_gvariant (data->bm_write_samples, write_samples_variant);
-  samples_from_gvariant (data->bm_access_time_samples, access_time_samples_variant);
-
-  ret = TRUE;
+  window = gtk_widget_get_window (data->graph_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->queue_depth_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
+  window = gtk_widget_get_window (data->sustained_write_drawing_area);
+  if (window != NULL)
+    gdk_window_invalidate_rect (window, NULL, TRUE);
 
- out:
-  if (read_samples_variant != NULL)
-    g_variant_unref (read_samples_variant);
-  if (write_samples_variant != NULL)
-    g_variant_unref (write_samples_variant);
-  if (access_time_samples_variant != NULL)
-    g_variant_unref (access_time_samples_variant);
-  if (value != NULL)
-    g_variant_unref (value);
-  g_free (variant_data);
-  g_free (filename);
-  return ret;
+  g_clear_object (&drive);
+  g_clear_object (&info);
 }
 
-/* ---------------------------------------------------------------------------------------------------- */
 
-static GVariant *
-samples_to_gvariant (GArray *array)
+/* called every second (on the second) */
+static gboolean
+on_timeout (gpointer user_data)
 {
-  guint n;
-  GVariantBuilder builder;
-
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(td)"));
-  for (n = 0; n < array->len; n++)
-    {
-      BMSample *s = &g_array_index (array, BMSample, n);
-      g_variant_builder_add (&builder, "(td)", s->offset, s->value);
-    }
-
-  return g_variant_builder_end (&builder);
+  DialogData *data = user_data;
+  update_updated_label (data);
+  return TRUE; /* keep timeout around */
 }
 
+/* ---------------------------------------------------------------------------------------------------- */
 
+/* loads the latest run into data->benchmark and the ones before it into data->history */
 static gboolean
-maybe_save_data (DialogData  *data,
-                 GError     **error)
+load_history (DialogData  *data,
+              GError     **error)
 {
   gboolean ret = FALSE;
-  gchar *filename = NULL;
-  GVariantBuilder builder;
+  GPtrArray *runs;
+  GduBenchmark *latest;
   GVariant *value = NULL;
-  gconstpointer variant_data;
-  gsize variant_size;
-
-  filename = get_bm_filename (data);
-  if (filename == NULL)
-    {
-      /* all good since we don't want to save data for this device */
-      ret = TRUE;
-      goto out;
-    }
-
-  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
-  g_variant_builder_add (&builder, "{sv}", "version", g_variant_new_int32 (1));
-  g_variant_builder_add (&builder, "{sv}", "timestamp-usec", g_variant_new_int64 (data->bm_time_benchmarked_usec));
-  g_variant_builder_add (&builder, "{sv}", "device-size", g_variant_new_uint64 (data->bm_size));
-  g_variant_builder_add (&builder, "{sv}", "sample-size", g_variant_new_uint64 (data->bm_sample_size));
-  g_variant_builder_add (&builder, "{sv}", "read-samples", samples_to_gvariant (data->bm_read_samples));
-  g_variant_builder_add (&builder, "{sv}", "write-samples", samples_to_gvariant (data->bm_write_samples));
-  g_variant_builder_add (&builder, "{sv}", "access-time-samples", samples_to_gvariant (data->bm_access_time_samples));
-  value = g_variant_builder_end (&builder);
-
-  variant_data = g_variant_get_data (value);
-  variant_size = g_variant_get_size (value);
-
-  if (!g_file_set_contents (filename,
-                            variant_data,
-                            variant_size,
-                            error))
+
+  runs = gdu_benchmark_history_load (udisks_block_get_id (data->block), error);
+  if (runs == NULL)
     goto out;
 
+  if (runs->len > 0)
+    {
+      latest = runs->pdata[runs->len - 1];
+      value = g_variant_ref_sink (gdu_benchmark_to_gvariant (latest));
+      if (!gdu_benchmark_set_from_gvariant (data->benchmark, value, error))
+        goto out;
+      g_ptr_array_remove_index (runs, runs->len - 1);
+    }
+
+  g_ptr_array_unref (data->history);
+  data->history = g_ptr_array_ref (runs);
+
+  ret = TRUE;
+
  out:
   if (value != NULL)
     g_variant_unref (value);
-  g_free (filename);
+  if (runs != NULL)
+    g_ptr_array_unref (runs);
   return ret;
 }
 
@@ -1153,6 +1942,15 @@ bmt_schedule_update (DialogData *data)
   G_UNLOCK (bm_lock);
 }
 
+/* called from the benchmark thread */
+static void
+on_benchmark_progress (GduBenchmark *benchmark,
+                       gpointer      user_data)
+{
+  DialogData *data = user_data;
+  bmt_schedule_update (data);
+}
+
 static gpointer
 benchmark_thread (gpointer user_data)
 {
@@ -1160,13 +1958,7 @@ benchmark_thread (gpointer user_data)
   GVariant *fd_index = NULL;
   GUnixFDList *fd_list = NULL;
   GError *error = NULL;
-  guchar *buffer_unaligned = NULL;
-  guchar *buffer = NULL;
-  GRand *rand = NULL;
   int fd = -1;
-  gint n;
-  long page_size;
-  guint64 disk_size;
   GVariantBuilder options_builder;
   guint inhibit_cookie;
 
@@ -1180,7 +1972,7 @@ benchmark_thread (gpointer user_data)
                                             C_("create-inhibit-message", "Benchmarking device"));
 
   g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
-  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (data->bm_do_write));
+  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (data->benchmark->do_write));
 
   if (!udisks_block_call_open_for_benchmark_sync (data->block,
                                                   g_variant_builder_end (&options_builder),
@@ -1194,275 +1986,29 @@ benchmark_thread (gpointer user_data)
   fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), NULL);
   g_clear_object (&fd_list);
 
-  /* We can't use udisks_block_get_size() because the media may have
-   * changed and udisks may not have noticed. TODO: maybe have a
-   * Block.GetSize() method instead...
-   */
-  if (ioctl (fd, BLKGETSIZE64, &disk_size) != 0)
-    {
-      g_set_error (&error,
-                   G_IO_ERROR,
-                   g_io_error_from_errno (errno),
-                   C_("benchmarking", "Error getting size of device: %m"));
-      goto out;
-    }
-
-  page_size = sysconf (_SC_PAGESIZE);
-  if (page_size < 1)
-    {
-      g_set_error (&error,
-                   G_IO_ERROR,
-                   g_io_error_from_errno (errno),
-                   C_("benchmarking", "Error getting page size: %m\n"));
-      goto out;
-    }
-
-  buffer_unaligned = g_new0 (guchar, data->bm_sample_size_mib*1024*1024 + page_size);
-  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
-
-  /* transfer rate... */
-  G_LOCK (bm_lock);
-  data->bm_size = disk_size;
-  data->bm_sample_size = data->bm_sample_size_mib*1024*1024;
-  data->bm_state = BM_STATE_TRANSFER_RATE;
-  G_UNLOCK (bm_lock);
-  for (n = 0; n < data->bm_num_samples; n++)
-    {
-      gchar *s, *s2;
-      gint64 begin_usec;
-      gint64 end_usec;
-      gint64 offset;
-      ssize_t num_read;
-      BMSample sample = {0};
-
-      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &error))
-        goto out;
-
-      /* figure out offset and align to page-size */
-      offset = n * disk_size / data->bm_num_samples;
-      offset &= ~(page_size - 1);
-
-      if (lseek (fd, offset, SEEK_SET) != offset)
-        {
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %lld"),
-                       (long long int) offset);
-          goto out;
-        }
-      if (read (fd, buffer, page_size) != page_size)
-        {
-          s = g_format_size_full (page_size, G_FORMAT_SIZE_LONG_FORMAT);
-          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error pre-reading %s from offset %s"),
-                       s, s2);
-          g_free (s2);
-          g_free (s);
-          goto out;
-        }
-      if (lseek (fd, offset, SEEK_SET) != offset)
-        {
-          s = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %s"),
-                       s);
-          g_free (s);
-          goto out;
-        }
-      begin_usec = g_get_monotonic_time ();
-      num_read = read (fd, buffer, data->bm_sample_size_mib*1024*1024);
-      if (G_UNLIKELY (num_read < 0))
-        {
-          s = g_format_size_full (data->bm_sample_size_mib * 1024 * 1024, G_FORMAT_SIZE_LONG_FORMAT);
-          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error reading %s from offset %s"),
-                       s, s2);
-          g_free (s2);
-          g_free (s);
-          goto out;
-        }
-      end_usec = g_get_monotonic_time ();
-
-      sample.offset = offset;
-      sample.value = ((gdouble) G_USEC_PER_SEC) * num_read / (end_usec - begin_usec);
-      G_LOCK (bm_lock);
-      g_array_append_val (data->bm_read_samples, sample);
-      G_UNLOCK (bm_lock);
-
-      bmt_schedule_update (data);
-
-      if (data->bm_do_write)
-        {
-          ssize_t num_written;
-
-          /* and now write the same block again... */
-          if (lseek (fd, offset, SEEK_SET) != offset)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error seeking to offset %lld"),
-                           (long long int) offset);
-              goto out;
-            }
-          if (read (fd, buffer, page_size) != page_size)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
-                           (long long int) page_size,
-                           (long long int) offset);
-              goto out;
-            }
-          if (lseek (fd, offset, SEEK_SET) != offset)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error seeking to offset %lld"),
-                           (long long int) offset);
-              goto out;
-            }
-          begin_usec = g_get_monotonic_time ();
-          num_written = write (fd, buffer, num_read);
-          if (G_UNLIKELY (num_written < 0))
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
-                           (long long int) num_read,
-                           (long long int) offset);
-              goto out;
-            }
-          if (num_written != num_read)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Expected to write %lld bytes, only wrote %lld: %m"),
-                           (long long int) num_read,
-                           (long long int) num_written);
-              goto out;
-            }
-          if (fsync (fd) != 0)
-            {
-              g_set_error (&error,
-                           G_IO_ERROR,
-                           g_io_error_from_errno (errno),
-                           C_("benchmarking", "Error syncing (at offset %lld): %m"),
-                           (long long int) offset);
-              goto out;
-            }
-          end_usec = g_get_monotonic_time ();
-
-          sample.offset = offset;
-          sample.value = ((gdouble) G_USEC_PER_SEC) * num_written / (end_usec - begin_usec);
-          G_LOCK (bm_lock);
-          g_array_append_val (data->bm_write_samples, sample);
-          G_UNLOCK (bm_lock);
-
-          bmt_schedule_update (data);
-        }
-    }
-
-  /* access time... */
-  G_LOCK (bm_lock);
-  data->bm_state = BM_STATE_ACCESS_TIME;
-  G_UNLOCK (bm_lock);
-  rand = g_rand_new_with_seed (42); /* want this to be deterministic (per size) so it's repeatable */
-  for (n = 0; n < data->bm_num_access_samples; n++)
-    {
-      gint64 begin_usec;
-      gint64 end_usec;
-      gint64 offset;
-      ssize_t num_read;
-      BMSample sample = {0};
-
-      if (g_cancellable_set_error_if_cancelled (data->bm_cancellable, &error))
-        goto out;
-
-      offset = (guint64) g_rand_double_range (rand, 0, (gdouble) disk_size);
-      offset &= ~(page_size - 1);
-
-      if (lseek (fd, offset, SEEK_SET) != offset)
-        {
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error seeking to offset %lld: %m"),
-                       (long long int) offset);
-          goto out;
-        }
-
-      begin_usec = g_get_monotonic_time ();
-      num_read = read (fd, buffer, page_size);
-      if (G_UNLIKELY (num_read < 0))
-        {
-          g_set_error (&error,
-                       G_IO_ERROR,
-                       g_io_error_from_errno (errno),
-                       C_("benchmarking", "Error reading %lld bytes from offset %lld"),
-                       (long long int) page_size,
-                       (long long int) offset);
-          goto out;
-        }
-      end_usec = g_get_monotonic_time ();
-
-      sample.offset = offset;
-      sample.value = (end_usec - begin_usec) / ((gdouble) G_USEC_PER_SEC);
-      G_LOCK (bm_lock);
-      g_array_append_val (data->bm_access_time_samples, sample);
-      G_UNLOCK (bm_lock);
-
-      bmt_schedule_update (data);
-    }
+  if (!gdu_benchmark_run (data->benchmark, fd, data->bm_cancellable, &error))
+    goto out;
 
-  G_LOCK (bm_lock);
-  data->bm_time_benchmarked_usec = g_get_real_time ();
-  G_UNLOCK (bm_lock);
-  if (!maybe_save_data (data, &error))
+  if (!gdu_benchmark_history_append (udisks_block_get_id (data->block), data->benchmark, &error))
     goto out;
 
  out:
-  if (rand != NULL)
-    g_rand_free (rand);
   g_clear_object (&fd_list);
 
   if (fd_index != NULL)
     g_variant_unref (fd_index);
   if (fd != -1)
     close (fd);
-  g_free (buffer_unaligned);
-  data->bm_in_progress = FALSE;
-  data->bm_thread = NULL;
-  data->bm_state = BM_STATE_NONE;
 
   if (inhibit_cookie > 0)
     gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)), inhibit_cookie);
 
-  if (error != NULL)
-    {
-      G_LOCK (bm_lock);
-      data->bm_error = error;
-      g_array_set_size (data->bm_read_samples, 0);
-      g_array_set_size (data->bm_write_samples, 0);
-      g_array_set_size (data->bm_access_time_samples, 0);
-      data->bm_time_benchmarked_usec = 0;
-      data->bm_sample_size = 0;
-      data->bm_size = 0;
-      G_UNLOCK (bm_lock);
-    }
+  G_LOCK (bm_lock);
+  data->bm_in_progress = FALSE;
+  data->bm_thread = NULL;
+  data->bm_error = error;
+  data->bm_finished = TRUE;
+  G_UNLOCK (bm_lock);
 
   bmt_schedule_update (data);
 
@@ -1481,13 +2027,31 @@ abort_benchmark (DialogData *data)
 static void
 start_benchmark2 (DialogData *data)
 {
+  UDisksDrive *drive;
+  GVariant *value;
+
+  /* keep showing the previous run behind the new one - replaced by what's
+   * saved when the new run is done
+   */
+  if (data->benchmark->time_benchmarked_usec > 0)
+    {
+      GduBenchmark *previous = gdu_benchmark_new ();
+      value = g_variant_ref_sink (gdu_benchmark_to_gvariant (data->benchmark));
+      if (gdu_benchmark_set_from_gvariant (previous, value, NULL))
+        g_ptr_array_add (data->history, previous);
+      else
+        gdu_benchmark_free (previous);
+      g_variant_unref (value);
+    }
+
   data->bm_in_progress = TRUE;
-  data->bm_state = BM_STATE_OPENING_DEVICE;
   g_clear_error (&data->bm_error);
-  g_array_set_size (data->bm_read_samples, 0);
-  g_array_set_size (data->bm_write_samples, 0);
-  g_array_set_size (data->bm_access_time_samples, 0);
-  data->bm_time_benchmarked_usec = 0;
+  gdu_benchmark_clear (data->benchmark);
+
+  drive = udisks_client_get_drive_for_block (gdu_window_get_client (data->window), data->block);
+  gdu_benchmark_set_firmware_revision (data->benchmark, drive != NULL ? udisks_drive_get_revision (drive) : NULL);
+  g_clear_object (&drive);
+
   g_cancellable_reset (data->bm_cancellable);
 
   data->bm_thread = g_thread_new ("benchmark-thread",
@@ -1517,11 +2081,21 @@ start_benchmark (DialogData *data)
   GtkWidget *sample_size_spinbutton;
   GtkWidget *write_checkbutton;
   GtkWidget *num_access_samples_spinbutton;
+  GtkWidget *queue_depth_checkbutton;
+  GtkWidget *workloads_grid;
+  GtkWidget *workload_queue_depth_spinbutton;
+  GtkWidget *sustained_write_checkbutton;
+  GtkWidget *sustained_write_duration_spinbutton;
+  GtkWidget *sustained_write_size_spinbutton;
+  GtkWidget **workload_checkbuttons;
+  const GduBenchmarkWorkload *workloads;
+  guint num_workloads;
   gint response;
+  guint n;
 
   g_assert (!data->bm_in_progress);
   g_assert (data->bm_thread == NULL);
-  g_assert_cmpint (data->bm_state, ==, BM_STATE_NONE);
+  g_assert_cmpint (data->benchmark->phase, ==, GDU_BENCHMARK_PHASE_NONE);
 
   dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (data->window),
                                                    "benchmark-dialog.ui",
@@ -1534,6 +2108,39 @@ start_benchmark (DialogData *data)
   sample_size_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sample-size-spinbutton"));
   write_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "write-checkbutton"));
   num_access_samples_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "num-access-samples-spinbutton"));
+  queue_depth_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "queue-depth-checkbutton"));
+  workloads_grid = GTK_WIDGET (gtk_builder_get_object (builder, "workloads-grid"));
+  workload_queue_depth_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "workload-queue-depth-spinbutton"));
+  sustained_write_checkbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-write-checkbutton"));
+  sustained_write_duration_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-write-duration-spinbutton"));
+  sustained_write_size_spinbutton = GTK_WIDGET (gtk_builder_get_object (builder, "sustained-write-size-spinbutton"));
+
+  workloads = gdu_benchmark_get_workloads (&num_workloads);
+  workload_checkbuttons = g_new0 (GtkWidget *, num_workloads);
+
+  /* one check button per workload - the ones writing need the write-benchmark */
+  for (n = 0; n < num_workloads; n++)
+    {
+      workload_checkbuttons[n] = gtk_check_button_new_with_label (gettext (workloads[n].name));
+      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (workload_checkbuttons[n]), TRUE);
+      gtk_grid_attach (GTK_GRID (workloads_grid), workload_checkbuttons[n], 1, n + 1, 1, 1);
+      gtk_widget_show (workload_checkbuttons[n]);
+      if (workloads[n].read_percentage < 100)
+        g_object_bind_property (write_checkbutton, "active",
+                                workload_checkbuttons[n], "sensitive",
+                                G_BINDING_SYNC_CREATE);
+    }
+
+  /* the sustained write needs the write-benchmark too */
+  g_object_bind_property (write_checkbutton, "active",
+                          sustained_write_checkbutton, "sensitive",
+                          G_BINDING_SYNC_CREATE);
+  g_object_bind_property (sustained_write_checkbutton, "active",
+                          sustained_write_duration_spinbutton, "sensitive",
+                          G_BINDING_SYNC_CREATE);
+  g_object_bind_property (sustained_write_checkbutton, "active",
+                          sustained_write_size_spinbutton, "sensitive",
+                          G_BINDING_SYNC_CREATE);
 
   /* if device is read-only, uncheck the "perform write-test"
    * check-button and also make it insensitive
@@ -1558,17 +2165,31 @@ start_benchmark (DialogData *data)
   if (response != GTK_RESPONSE_OK)
     goto out;
 
-  data->bm_num_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_samples_spinbutton));
-  data->bm_sample_size_mib = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sample_size_spinbutton));
-  data->bm_do_write = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (write_checkbutton));
-  data->bm_num_access_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_access_samples_spinbutton));
+  data->benchmark->num_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_samples_spinbutton));
+  data->benchmark->sample_size_mib = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sample_size_spinbutton));
+  data->benchmark->do_write = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (write_checkbutton));
+  data->benchmark->num_access_samples = gtk_spin_button_get_value (GTK_SPIN_BUTTON (num_access_samples_spinbutton));
+  data->benchmark->do_queue_depth = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (queue_depth_checkbutton));
+  data->benchmark->workload_queue_depth = gtk_spin_button_get_value (GTK_SPIN_BUTTON (workload_queue_depth_spinbutton));
+  data->benchmark->do_sustained_write = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (sustained_write_checkbutton));
+  data->benchmark->sustained_write_duration_sec = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sustained_write_duration_spinbutton));
+  data->benchmark->sustained_write_size_gib = gtk_spin_button_get_value (GTK_SPIN_BUTTON (sustained_write_size_spinbutton));
+  data->benchmark->workloads = 0;
+  for (n = 0; n < num_workloads; n++)
+    {
+      if (!gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (workload_checkbuttons[n])))
+        continue;
+      if (workloads[n].read_percentage < 100 && !data->benchmark->do_write)
+        continue;
+      data->benchmark->workloads |= (1 << n);
+    }
 
-  //g_print ("num_samples=%d\n", data->bm_num_samples);
-  //g_print ("sample_size=%d MB\n", data->bm_sample_size_mib);
-  //g_print ("do_write=%d\n", data->bm_do_write);
-  //g_print ("num_access_samples=%d\n", data->bm_num_access_samples);
+  //g_print ("num_samples=%d\n", data->benchmark->num_samples);
+  //g_print ("sample_size=%d MB\n", data->benchmark->sample_size_mib);
+  //g_print ("do_write=%d\n", data->benchmark->do_write);
+  //g_print ("num_access_samples=%d\n", data->benchmark->num_access_samples);
 
-  if (data->bm_do_write)
+  if (data->benchmark->do_write)
     {
       /* ensure the device is unused (e.g. unmounted) before formatting it... */
       gdu_window_ensure_unused (data->window,
@@ -1585,6 +2206,7 @@ start_benchmark (DialogData *data)
  out:
   gtk_widget_destroy (dialog);
   g_clear_object (&builder);
+  g_free (workload_checkbuttons);
   update_dialog (data);
 }
 
@@ -1606,15 +2228,9 @@ gdu_benchmark_dialog_show (GduWindow    *window,
   data->window = g_object_ref (window);
   data->bm_cancellable = g_cancellable_new ();
 
-  data->bm_read_samples = g_array_new (FALSE, /* zero-terminated */
-                                       FALSE, /* clear */
-                                       sizeof (BMSample));
-  data->bm_write_samples = g_array_new (FALSE, /* zero-terminated */
-                                        FALSE, /* clear */
-                                        sizeof (BMSample));
-  data->bm_access_time_samples = g_array_new (FALSE, /* zero-terminated */
-                                              FALSE, /* clear */
-                                              sizeof (BMSample));
+  data->benchmark = gdu_benchmark_new ();
+  data->history = g_ptr_array_new_with_free_func ((GDestroyNotify) gdu_benchmark_free);
+  gdu_benchmark_set_progress_func (data->benchmark, on_benchmark_progress, data);
 
   data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
                                                          "benchmark-dialog.ui",
@@ -1637,16 +2253,32 @@ gdu_benchmark_dialog_show (GduWindow    *window,
                     G_CALLBACK (on_drawing_area_draw),
                     data);
 
-  /* set minimum size for the graph */
+  g_signal_connect (data->queue_depth_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_queue_depth_drawing_area_draw),
+                    data);
+
+  g_signal_connect (data->sustained_write_drawing_area,
+                    "draw",
+                    G_CALLBACK (on_sustained_write_drawing_area_draw),
+                    data);
+
+  /* set minimum size for the graphs */
   gtk_widget_set_size_request (data->graph_drawing_area,
                                600,
                                300);
+  gtk_widget_set_size_request (data->queue_depth_drawing_area,
+                               600,
+                               150);
+  gtk_widget_set_size_request (data->sustained_write_drawing_area,
+                               600,
+                               200);
 
   /* need this to update the "Updated" value */
   timeout_id = g_timeout_add_seconds (1, on_timeout, data);
 
   /* see if we have cached data */
-  if (!maybe_load_data (data, &error))
+  if (!load_history (data, &error))
     {
       /* not worth complaining in dialog about */
       g_warning ("Error loading cached data: %s (%s, %d)",
@@ -0,0 +1,222 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gducheckpoint.h"
+#include "gdubadblockmap.h"
+
+/* A checkpoint journal is kept next to a disk image while it is being
+ * created, so an interrupted copy can be resumed instead of starting
+ * over. It is a key file, e.g.
+ *
+ *   [Checkpoint]
+ *   DeviceSize=500107862016
+ *   DeviceSerial=S2R5NX0H612345
+ *   Offset=123480309760
+ *   BadBlocks=1048576+65536*;2097152+512-;
+ *   ChecksumBlockSize=67108864
+ *   ChecksumBlocks=3b7e72ed...;9f86d081...;
+ *
+ * The journal is only written after the disk image data before
+ * Offset has reached the disk, so it never claims more than what is
+ * actually there.
+ *
+ * BadBlocks is the part of the GduBadBlockMap before Offset, as
+ * offset+length followed by '*' for ranges still to be retried and
+ * '-' for unreadable ones, like the block status in ddrescue(1) map
+ * files.
+ */
+
+#define GROUP "Checkpoint"
+
+/**
+ * gdu_checkpoint_new:
+ * @device_size: The size of the device.
+ * @device_serial: (allow-none): The serial number of the drive or %NULL.
+ *
+ * Creates a new checkpoint at offset 0.
+ *
+ * Returns: A #GduCheckpoint. Free with gdu_checkpoint_free().
+ */
+GduCheckpoint *
+gdu_checkpoint_new (guint64      device_size,
+                    const gchar *device_serial)
+{
+  GduCheckpoint *checkpoint;
+
+  checkpoint = g_new0 (GduCheckpoint, 1);
+  checkpoint->device_size = device_size;
+  checkpoint->device_serial = g_strdup (device_serial != NULL ? device_serial : "");
+  return checkpoint;
+}
+
+void
+gdu_checkpoint_free (GduCheckpoint *checkpoint)
+{
+  g_free (checkpoint->device_serial);
+  g_strfreev (checkpoint->checksum_block_digests);
+  g_free (checkpoint);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_checkpoint_to_data:
+ * @checkpoint: A #GduCheckpoint.
+ * @bad_blocks: The #GduBadBlockMap of the device.
+ * @out_length: Return location for the length of the result.
+ *
+ * Serializes @checkpoint so it can be written to the journal, see
+ * gdu_checkpoint_get_file_for_image(). Bad blocks at or after the
+ * offset are left out since they will be read again on resume.
+ *
+ * Returns: The contents of the journal. Free with g_free().
+ */
+gchar *
+gdu_checkpoint_to_data (GduCheckpoint  *checkpoint,
+                        GduBadBlockMap *bad_blocks,
+                        gsize          *out_length)
+{
+  GKeyFile *key_file;
+  GString *str;
+  gchar *ret;
+  guint n;
+
+  key_file = g_key_file_new ();
+  g_key_file_set_uint64 (key_file, GROUP, "DeviceSize", checkpoint->device_size);
+  g_key_file_set_string (key_file, GROUP, "DeviceSerial", checkpoint->device_serial);
+  g_key_file_set_uint64 (key_file, GROUP, "Offset", checkpoint->offset);
+
+  str = g_string_new (NULL);
+  for (n = 0; n < gdu_bad_block_map_get_num_ranges (bad_blocks); n++)
+    {
+      guint64 offset;
+      guint64 length;
+      GduBlockState state;
+
+      gdu_bad_block_map_get_range (bad_blocks, n, &offset, &length, &state);
+      if (offset >= checkpoint->offset)
+        break;
+      length = MIN (length, checkpoint->offset - offset);
+      g_string_append_printf (str, "%" G_GUINT64_FORMAT "+%" G_GUINT64_FORMAT "%c;",
+                              offset, length,
+                              state == GDU_BLOCK_STATE_UNTRIED ? '*' : '-');
+    }
+  if (str->len > 0)
+    g_key_file_set_value (key_file, GROUP, "BadBlocks", str->str);
+  g_string_free (str, TRUE);
+
+  if (checkpoint->checksum_block_digests != NULL)
+    {
+      g_key_file_set_uint64 (key_file, GROUP, "ChecksumBlockSize", checkpoint->checksum_block_size);
+      g_key_file_set_string_list (key_file, GROUP, "ChecksumBlocks",
+                                  (const gchar * const *) checkpoint->checksum_block_digests,
+                                  g_strv_length (checkpoint->checksum_block_digests));
+    }
+
+  ret = g_key_file_to_data (key_file, out_length, NULL);
+  g_key_file_unref (key_file);
+  return ret;
+}
+
+/**
+ * gdu_checkpoint_load:
+ * @file: A journal, see gdu_checkpoint_to_data().
+ * @bad_blocks: The #GduBadBlockMap to add the bad blocks from the journal to.
+ * @error: Return location for error or %NULL.
+ *
+ * Loads a checkpoint.
+ *
+ * Returns: A #GduCheckpoint or %NULL if @error is set.
+ */
+GduCheckpoint *
+gdu_checkpoint_load (GFile           *file,
+                     GduBadBlockMap  *bad_blocks,
+                     GError         **error)
+{
+  GduCheckpoint *ret = NULL;
+  GduCheckpoint *checkpoint = NULL;
+  GKeyFile *key_file;
+  gchar *contents = NULL;
+  gsize length;
+  gchar *serial = NULL;
+  gchar **ranges = NULL;
+  guint n;
+
+  key_file = g_key_file_new ();
+  if (!g_file_load_contents (file, NULL, &contents, &length, NULL, error))
+    goto out;
+  if (!g_key_file_load_from_data (key_file, contents, length, G_KEY_FILE_NONE, error))
+    goto out;
+
+  serial = g_key_file_get_string (key_file, GROUP, "DeviceSerial", NULL);
+  checkpoint = gdu_checkpoint_new (g_key_file_get_uint64 (key_file, GROUP, "DeviceSize", NULL), serial);
+  checkpoint->offset = g_key_file_get_uint64 (key_file, GROUP, "Offset", NULL);
+  if (!g_key_file_has_key (key_file, GROUP, "Offset", NULL) ||
+      checkpoint->device_size == 0 ||
+      checkpoint->offset > checkpoint->device_size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("The checkpoint file is damaged"));
+      goto out;
+    }
+
+  ranges = g_key_file_get_string_list (key_file, GROUP, "BadBlocks", NULL, NULL);
+  for (n = 0; ranges != NULL && ranges[n] != NULL; n++)
+    {
+      gchar *endp;
+      guint64 range_offset;
+      guint64 range_length;
+
+      range_offset = g_ascii_strtoull (ranges[n], &endp, 10);
+      if (*endp != '+')
+        continue;
+      range_length = g_ascii_strtoull (endp + 1, &endp, 10);
+      gdu_bad_block_map_set (bad_blocks, range_offset, range_length,
+                             *endp == '*' ? GDU_BLOCK_STATE_UNTRIED : GDU_BLOCK_STATE_BAD);
+    }
+
+  checkpoint->checksum_block_size = g_key_file_get_uint64 (key_file, GROUP, "ChecksumBlockSize", NULL);
+  if (checkpoint->checksum_block_size > 0)
+    checkpoint->checksum_block_digests = g_key_file_get_string_list (key_file, GROUP, "ChecksumBlocks", NULL, NULL);
+
+  ret = checkpoint;
+  checkpoint = NULL;
+
+ out:
+  if (checkpoint != NULL)
+    gdu_checkpoint_free (checkpoint);
+  g_strfreev (ranges);
+  g_free (serial);
+  g_free (contents);
+  g_key_file_unref (key_file);
+  return ret;
+}
+
+/* Returns: The journal for @image_file, i.e. with ".gdu-checkpoint" appended */
+GFile *
+gdu_checkpoint_get_file_for_image (GFile *image_file)
+{
+  GFile *parent;
+  GFile *ret;
+  gchar *basename;
+  gchar *name;
+
+  parent = g_file_get_parent (image_file);
+  basename = g_file_get_basename (image_file);
+  name = g_strdup_printf ("%s.gdu-checkpoint", basename);
+  ret = g_file_get_child (parent, name);
+  g_free (name);
+  g_free (basename);
+  g_object_unref (parent);
+  return ret;
+}
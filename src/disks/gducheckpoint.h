@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_CHECKPOINT_H__
+#define __GDU_CHECKPOINT_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+struct GduCheckpoint
+{
+  /* the device the disk image is of */
+  guint64 device_size;
+  gchar *device_serial;
+
+  /* everything before this offset is in the disk image */
+  guint64 offset;
+
+  /* checksums of the blocks before @offset, see GduImageChecksum */
+  guint64 checksum_block_size;
+  gchar **checksum_block_digests;
+};
+
+GduCheckpoint *gdu_checkpoint_new                (guint64         device_size,
+                                                  const gchar    *device_serial);
+GduCheckpoint *gdu_checkpoint_load               (GFile          *file,
+                                                  GduBadBlockMap *bad_blocks,
+                                                  GError        **error);
+void           gdu_checkpoint_free               (GduCheckpoint  *checkpoint);
+gchar         *gdu_checkpoint_to_data            (GduCheckpoint  *checkpoint,
+                                                  GduBadBlockMap *bad_blocks,
+                                                  gsize          *out_length);
+GFile         *gdu_checkpoint_get_file_for_image (GFile          *image_file);
+
+G_END_DECLS
+
+#endif /* __GDU_CHECKPOINT_H__ */
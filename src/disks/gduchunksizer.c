@@ -0,0 +1,207 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "gduchunksizer.h"
+#include "gduestimator.h"
+
+/* Picks the size of the chunks the copy loops read and write.
+ *
+ * USB sticks, SATA SSDs and NVMe drives all have different sweet
+ * spots so we start from what the device says is its optimal I/O size
+ * and then tune at runtime: the chunk size is doubled as long as that
+ * makes things noticeably faster. If the first step up doesn't help,
+ * we try going down instead. Once the gains level off we settle on
+ * the best size seen.
+ *
+ * Sizes are always multiples of the physical block size so they work
+ * with O_DIRECT.
+ */
+
+/* Don't go below this, system call overhead dominates */
+#define MIN_CHUNK_SIZE (64 * 1024)
+
+/* The default if the device gives no hint */
+#define DEFAULT_CHUNK_SIZE (1 * 1024 * 1024)
+
+/* Number of estimator samples (i.e. 200 ms intervals) to measure each size over */
+#define SAMPLES_PER_STEP 5
+
+/* A step must improve throughput by at least this much to count */
+#define MIN_GAIN_PERCENT 5
+
+struct GduChunkSizer
+{
+  gsize min_size;
+  gsize max_size;
+  gsize initial_size;
+  gsize size;
+
+  gsize best_size;
+  guint64 best_bytes_per_sec;
+
+  /* +1 when growing, -1 when shrinking, 0 when settled */
+  gint direction;
+  guint num_samples;
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_chunk_sizer_new:
+ * @fd: A file descriptor for the block device being copied to or from.
+ * @max_size: The largest chunk size to use, e.g. the size of the buffers.
+ *
+ * Creates a new chunk sizer, seeded from the BLKIOOPT and BLKPBSZGET
+ * hints of @fd.
+ *
+ * Returns: A #GduChunkSizer. Free with gdu_chunk_sizer_free().
+ */
+GduChunkSizer *
+gdu_chunk_sizer_new (gint  fd,
+                     gsize max_size)
+{
+  GduChunkSizer *sizer;
+  guint io_opt = 0;
+  guint physical_block_size = 0;
+  gsize size;
+
+  if (ioctl (fd, BLKPBSZGET, &physical_block_size) != 0 || physical_block_size < 512)
+    physical_block_size = 512;
+  if (ioctl (fd, BLKIOOPT, &io_opt) != 0)
+    io_opt = 0;
+
+  sizer = g_new0 (GduChunkSizer, 1);
+  sizer->max_size = max_size - max_size % physical_block_size;
+  sizer->min_size = MIN (MAX (MIN_CHUNK_SIZE, physical_block_size), sizer->max_size);
+
+  /* E.g. the stripe width of a RAID - growing from there keeps chunks
+   * a multiple of it
+   */
+  if (io_opt > 0 && io_opt % physical_block_size == 0)
+    size = io_opt;
+  else
+    size = DEFAULT_CHUNK_SIZE;
+  while (size < sizer->min_size)
+    size *= 2;
+  size = MIN (size, sizer->max_size);
+
+  sizer->initial_size = size;
+  sizer->size = size;
+  sizer->direction = size < sizer->max_size ? 1 : -1;
+
+  return sizer;
+}
+
+void
+gdu_chunk_sizer_free (GduChunkSizer *sizer)
+{
+  g_free (sizer);
+}
+
+gsize
+gdu_chunk_sizer_get_size (GduChunkSizer *sizer)
+{
+  return sizer->size;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+try_step (GduChunkSizer *sizer)
+{
+  gsize next_size;
+
+  if (sizer->direction > 0)
+    next_size = sizer->size * 2;
+  else
+    next_size = sizer->size / 2;
+
+  if (next_size > sizer->max_size || next_size < sizer->min_size)
+    return FALSE;
+
+  sizer->size = next_size;
+  return TRUE;
+}
+
+static void
+settle (GduChunkSizer *sizer)
+{
+  sizer->size = sizer->best_size;
+  sizer->direction = 0;
+}
+
+/**
+ * gdu_chunk_sizer_update:
+ * @sizer: A #GduChunkSizer.
+ * @estimator: The #GduEstimator for the copy.
+ *
+ * Call this after every gdu_estimator_add_sample() call. The result
+ * of gdu_chunk_sizer_get_size() may change afterwards.
+ */
+void
+gdu_chunk_sizer_update (GduChunkSizer *sizer,
+                        GduEstimator  *estimator)
+{
+  guint64 bytes_per_sec;
+
+  if (sizer->direction == 0)
+    return;
+
+  /* The first interval at a new size still has chunks of the old size
+   * in flight, so skip it
+   */
+  sizer->num_samples++;
+  if (sizer->num_samples <= SAMPLES_PER_STEP)
+    return;
+  sizer->num_samples = 0;
+
+  bytes_per_sec = gdu_estimator_get_recent_bytes_per_sec (estimator, SAMPLES_PER_STEP);
+
+  if (sizer->best_bytes_per_sec == 0)
+    {
+      /* First measurement, at the initial size */
+      sizer->best_size = sizer->size;
+      sizer->best_bytes_per_sec = bytes_per_sec;
+      if (!try_step (sizer))
+        {
+          sizer->direction = -sizer->direction;
+          if (!try_step (sizer))
+            settle (sizer);
+        }
+    }
+  else if (bytes_per_sec > sizer->best_bytes_per_sec + sizer->best_bytes_per_sec * MIN_GAIN_PERCENT / 100)
+    {
+      /* Worth it, keep going */
+      sizer->best_size = sizer->size;
+      sizer->best_bytes_per_sec = bytes_per_sec;
+      if (!try_step (sizer))
+        settle (sizer);
+    }
+  else if (sizer->direction > 0 && sizer->best_size == sizer->initial_size)
+    {
+      /* Growing didn't help at all, see if smaller chunks do better */
+      sizer->size = sizer->initial_size;
+      sizer->direction = -1;
+      if (!try_step (sizer))
+        settle (sizer);
+    }
+  else
+    {
+      /* Gains leveled off */
+      settle (sizer);
+    }
+
+  g_debug ("chunk size %" G_GSIZE_FORMAT " bytes (%" G_GUINT64_FORMAT " bytes/sec measured)",
+           sizer->size, bytes_per_sec);
+}
@@ -0,0 +1,27 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_CHUNK_SIZER_H__
+#define __GDU_CHUNK_SIZER_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduChunkSizer *gdu_chunk_sizer_new      (gint           fd,
+                                         gsize          max_size);
+void           gdu_chunk_sizer_free     (GduChunkSizer *sizer);
+gsize          gdu_chunk_sizer_get_size (GduChunkSizer *sizer);
+void           gdu_chunk_sizer_update   (GduChunkSizer *sizer,
+                                         GduEstimator  *estimator);
+
+G_END_DECLS
+
+#endif /* __GDU_CHUNK_SIZER_H__ */
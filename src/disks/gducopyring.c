@@ -0,0 +1,326 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <unistd.h>
+
+#include "gducopyring.h"
+
+/* A fixed set of page-aligned buffers circulating between a producer
+ * thread (typically reading from a device) and a consumer thread
+ * (typically writing to a file). The producer takes free buffers,
+ * fills them and submits them; the consumer takes filled buffers in
+ * submission order, drains them and releases them back to the free
+ * list. This allows reads and writes to overlap while bounding the
+ * amount of memory in flight.
+ *
+ * There may be several consumers, e.g. when writing the same data to
+ * several devices. Each of them gets every filled buffer and a buffer
+ * is only free again once all of them have released it. A consumer
+ * that fails can detach so it doesn't hold up the others.
+ */
+
+struct GduCopyRing
+{
+  GMutex lock;
+  GCond cond;
+
+  guchar *memory_unaligned;
+  GduCopyBuffer *buffers;
+  guint num_buffers;
+
+  /* must hold lock when reading/writing these */
+  GQueue free_queue;
+  /* one queue per consumer, NULL once detached */
+  GQueue **filled_queues;
+  guint num_consumers;
+  guint num_attached;
+  gboolean finished;
+  gboolean aborted;
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_copy_ring_new:
+ * @num_buffers: Number of buffers in the ring, at least 2.
+ * @buffer_size: Size of each buffer.
+ *
+ * Allocates a new ring with @num_buffers page-aligned buffers of
+ * @buffer_size bytes each and a single consumer.
+ *
+ * Returns: A #GduCopyRing. Free with gdu_copy_ring_free().
+ */
+GduCopyRing *
+gdu_copy_ring_new (guint num_buffers,
+                   gsize buffer_size)
+{
+  return gdu_copy_ring_new_with_consumers (num_buffers, buffer_size, 1);
+}
+
+/**
+ * gdu_copy_ring_new_with_consumers:
+ * @num_buffers: Number of buffers in the ring, at least 2.
+ * @buffer_size: Size of each buffer.
+ * @num_consumers: Number of consumers, numbered from 0.
+ *
+ * Like gdu_copy_ring_new() but every filled buffer goes to each of
+ * @num_consumers consumers, see gdu_copy_ring_acquire_filled_for_consumer().
+ *
+ * Returns: A #GduCopyRing. Free with gdu_copy_ring_free().
+ */
+GduCopyRing *
+gdu_copy_ring_new_with_consumers (guint num_buffers,
+                                  gsize buffer_size,
+                                  guint num_consumers)
+{
+  GduCopyRing *ring;
+  gsize page_size;
+  gsize stride;
+  guchar *memory;
+  guint n;
+
+  g_return_val_if_fail (num_buffers >= 2, NULL);
+  g_return_val_if_fail (buffer_size > 0, NULL);
+  g_return_val_if_fail (num_consumers >= 1, NULL);
+
+  page_size = sysconf (_SC_PAGESIZE);
+  stride = (buffer_size + page_size - 1) & (~(page_size - 1));
+
+  ring = g_new0 (GduCopyRing, 1);
+  g_mutex_init (&ring->lock);
+  g_cond_init (&ring->cond);
+  g_queue_init (&ring->free_queue);
+  ring->num_consumers = num_consumers;
+  ring->num_attached = num_consumers;
+  ring->filled_queues = g_new0 (GQueue *, num_consumers);
+  for (n = 0; n < num_consumers; n++)
+    ring->filled_queues[n] = g_queue_new ();
+
+  ring->num_buffers = num_buffers;
+  ring->buffers = g_new0 (GduCopyBuffer, num_buffers);
+  ring->memory_unaligned = g_new0 (guchar, stride * num_buffers + page_size);
+  memory = (guchar*) (((gintptr) (ring->memory_unaligned + page_size)) & (~(page_size - 1)));
+  for (n = 0; n < num_buffers; n++)
+    {
+      ring->buffers[n].data = memory + n * stride;
+      ring->buffers[n].size = buffer_size;
+      g_queue_push_tail (&ring->free_queue, &ring->buffers[n]);
+    }
+
+  return ring;
+}
+
+void
+gdu_copy_ring_free (GduCopyRing *ring)
+{
+  guint n;
+
+  g_queue_clear (&ring->free_queue);
+  for (n = 0; n < ring->num_consumers; n++)
+    {
+      if (ring->filled_queues[n] != NULL)
+        g_queue_free (ring->filled_queues[n]);
+    }
+  g_free (ring->filled_queues);
+  g_free (ring->memory_unaligned);
+  g_free (ring->buffers);
+  g_cond_clear (&ring->cond);
+  g_mutex_clear (&ring->lock);
+  g_free (ring);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_copy_ring_acquire_free:
+ * @ring: A #GduCopyRing.
+ *
+ * Called by the producer to get a buffer to fill, blocking until one
+ * is available.
+ *
+ * Returns: A buffer or %NULL if the ring was aborted or all consumers
+ * have detached.
+ */
+GduCopyBuffer *
+gdu_copy_ring_acquire_free (GduCopyRing *ring)
+{
+  GduCopyBuffer *ret = NULL;
+
+  g_mutex_lock (&ring->lock);
+  while (!ring->aborted && ring->num_attached > 0 && g_queue_is_empty (&ring->free_queue))
+    g_cond_wait (&ring->cond, &ring->lock);
+  if (!ring->aborted && ring->num_attached > 0)
+    ret = g_queue_pop_head (&ring->free_queue);
+  g_mutex_unlock (&ring->lock);
+
+  return ret;
+}
+
+void
+gdu_copy_ring_submit (GduCopyRing   *ring,
+                      GduCopyBuffer *buffer)
+{
+  guint n;
+
+  g_mutex_lock (&ring->lock);
+  buffer->ref_count = 0;
+  for (n = 0; n < ring->num_consumers; n++)
+    {
+      if (ring->filled_queues[n] != NULL)
+        {
+          g_queue_push_tail (ring->filled_queues[n], buffer);
+          buffer->ref_count++;
+        }
+    }
+  if (buffer->ref_count == 0)
+    g_queue_push_tail (&ring->free_queue, buffer);
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+void
+gdu_copy_ring_finish (GduCopyRing *ring)
+{
+  g_mutex_lock (&ring->lock);
+  ring->finished = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_copy_ring_acquire_filled:
+ * @ring: A #GduCopyRing.
+ *
+ * Called by the consumer to get the next filled buffer, blocking
+ * until one is available.
+ *
+ * Returns: A buffer or %NULL if the producer has finished and all
+ * buffers have been consumed, or if the ring was aborted. Use
+ * gdu_copy_ring_is_aborted() to tell the two apart.
+ */
+GduCopyBuffer *
+gdu_copy_ring_acquire_filled (GduCopyRing *ring)
+{
+  return gdu_copy_ring_acquire_filled_for_consumer (ring, 0);
+}
+
+/* Like gdu_copy_ring_acquire_filled() for one of several consumers */
+GduCopyBuffer *
+gdu_copy_ring_acquire_filled_for_consumer (GduCopyRing *ring,
+                                           guint        consumer)
+{
+  GduCopyBuffer *ret = NULL;
+  GQueue *queue;
+
+  g_return_val_if_fail (consumer < ring->num_consumers, NULL);
+
+  g_mutex_lock (&ring->lock);
+  queue = ring->filled_queues[consumer];
+  g_assert (queue != NULL);
+  while (!ring->aborted && !ring->finished && g_queue_is_empty (queue))
+    g_cond_wait (&ring->cond, &ring->lock);
+  if (!ring->aborted)
+    ret = g_queue_pop_head (queue);
+  g_mutex_unlock (&ring->lock);
+
+  return ret;
+}
+
+static void
+release_locked (GduCopyRing   *ring,
+                GduCopyBuffer *buffer)
+{
+  /* buffers the producer never submitted have no references */
+  if (buffer->ref_count > 0 && --buffer->ref_count > 0)
+    return;
+  buffer->offset = 0;
+  buffer->length = 0;
+  buffer->hole = FALSE;
+  g_queue_push_tail (&ring->free_queue, buffer);
+  g_cond_broadcast (&ring->cond);
+}
+
+void
+gdu_copy_ring_release (GduCopyRing   *ring,
+                       GduCopyBuffer *buffer)
+{
+  g_mutex_lock (&ring->lock);
+  release_locked (ring, buffer);
+  g_mutex_unlock (&ring->lock);
+}
+
+/**
+ * gdu_copy_ring_detach:
+ * @ring: A #GduCopyRing.
+ * @consumer: The consumer.
+ *
+ * Called by a consumer that gives up, e.g. on error. Buffers still
+ * queued for it are released and it won't get any more. If it was
+ * the last consumer, the producer's gdu_copy_ring_acquire_free()
+ * returns %NULL.
+ *
+ * Buffers the consumer already acquired must still be released.
+ */
+void
+gdu_copy_ring_detach (GduCopyRing *ring,
+                      guint        consumer)
+{
+  GduCopyBuffer *buffer;
+  GQueue *queue;
+
+  g_return_if_fail (consumer < ring->num_consumers);
+
+  g_mutex_lock (&ring->lock);
+  queue = ring->filled_queues[consumer];
+  if (queue != NULL)
+    {
+      while ((buffer = g_queue_pop_head (queue)) != NULL)
+        release_locked (ring, buffer);
+      g_queue_free (queue);
+      ring->filled_queues[consumer] = NULL;
+      ring->num_attached--;
+      g_cond_broadcast (&ring->cond);
+    }
+  g_mutex_unlock (&ring->lock);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_copy_ring_abort:
+ * @ring: A #GduCopyRing.
+ *
+ * Wakes up both sides and makes all further acquire calls return
+ * %NULL. Either side may call this, e.g. on error - though with
+ * several consumers, a consumer should use gdu_copy_ring_detach().
+ */
+void
+gdu_copy_ring_abort (GduCopyRing *ring)
+{
+  g_mutex_lock (&ring->lock);
+  ring->aborted = TRUE;
+  g_cond_broadcast (&ring->cond);
+  g_mutex_unlock (&ring->lock);
+}
+
+gboolean
+gdu_copy_ring_is_aborted (GduCopyRing *ring)
+{
+  gboolean ret;
+
+  g_mutex_lock (&ring->lock);
+  ret = ring->aborted;
+  g_mutex_unlock (&ring->lock);
+
+  return ret;
+}
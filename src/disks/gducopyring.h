@@ -0,0 +1,67 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_COPY_RING_H__
+#define __GDU_COPY_RING_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+/**
+ * GduCopyBuffer:
+ * @data: Page-aligned memory of @size bytes.
+ * @size: The capacity of @data.
+ * @offset: The offset on the device that @data corresponds to.
+ * @length: The number of valid bytes in @data.
+ * @hole: If %TRUE, @data is not filled in and the @length bytes at
+ *   @offset are all zeroes - @length may be bigger than @size.
+ *
+ * A buffer handed back and forth between the producer and the
+ * consumers of a #GduCopyRing.
+ */
+struct GduCopyBuffer
+{
+  guchar   *data;
+  gsize     size;
+  guint64   offset;
+  guint64   length;
+  gboolean  hole;
+
+  /*< private >*/
+  guint     ref_count;
+};
+
+GduCopyRing   *gdu_copy_ring_new             (guint          num_buffers,
+                                              gsize          buffer_size);
+GduCopyRing   *gdu_copy_ring_new_with_consumers (guint        num_buffers,
+                                                 gsize        buffer_size,
+                                                 guint        num_consumers);
+void           gdu_copy_ring_free            (GduCopyRing   *ring);
+
+GduCopyBuffer *gdu_copy_ring_acquire_free    (GduCopyRing   *ring);
+void           gdu_copy_ring_submit          (GduCopyRing   *ring,
+                                              GduCopyBuffer *buffer);
+void           gdu_copy_ring_finish          (GduCopyRing   *ring);
+
+GduCopyBuffer *gdu_copy_ring_acquire_filled  (GduCopyRing   *ring);
+GduCopyBuffer *gdu_copy_ring_acquire_filled_for_consumer (GduCopyRing *ring,
+                                                          guint        consumer);
+void           gdu_copy_ring_release         (GduCopyRing   *ring,
+                                              GduCopyBuffer *buffer);
+void           gdu_copy_ring_detach          (GduCopyRing   *ring,
+                                              guint          consumer);
+
+void           gdu_copy_ring_abort           (GduCopyRing   *ring);
+gboolean       gdu_copy_ring_is_aborted      (GduCopyRing   *ring);
+
+G_END_DECLS
+
+#endif /* __GDU_COPY_RING_H__ */
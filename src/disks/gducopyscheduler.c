@@ -0,0 +1,243 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+
+#include "gducopyscheduler.h"
+
+/* Coordinates disk images being created from several devices at the
+ * same time, see gdu_create_disk_image_dialog_run_unattended().
+ *
+ * Devices on the same controller (e.g. the HBA of a drive shelf or a
+ * USB host controller) share its bandwidth, so the total throughput
+ * of the copies through each controller can be capped - leaving room
+ * for whatever else the machine is doing. Each copy reserves time on
+ * its controller for every chunk it writes and waits for its turn.
+ *
+ * The scheduler also adds up the progress of all the copies.
+ *
+ * All functions are thread-safe.
+ */
+
+/* Don't let a controller save up unused bandwidth for longer than this */
+#define MAX_BURST_USEC (G_USEC_PER_SEC / 2)
+
+/* How often a waiting copy checks if it's been cancelled */
+#define WAIT_INTERVAL_USEC (G_USEC_PER_SEC / 10)
+
+struct GduCopyScheduler
+{
+  volatile gint ref_count;
+  guint64 max_bytes_per_sec;
+
+  GMutex lock;
+
+  /* controller -> gint64 *, the time the bandwidth is reserved until */
+  GHashTable *controllers;
+
+  guint64 total_bytes;
+  guint64 completed_bytes;
+};
+
+/**
+ * gdu_copy_scheduler_new:
+ * @max_bytes_per_sec: The most to copy through any single controller
+ *   per second or 0 for no limit.
+ *
+ * Creates a new scheduler.
+ *
+ * Returns: A #GduCopyScheduler. Free with gdu_copy_scheduler_unref().
+ */
+GduCopyScheduler *
+gdu_copy_scheduler_new (guint64 max_bytes_per_sec)
+{
+  GduCopyScheduler *scheduler;
+
+  scheduler = g_new0 (GduCopyScheduler, 1);
+  scheduler->ref_count = 1;
+  scheduler->max_bytes_per_sec = max_bytes_per_sec;
+  g_mutex_init (&scheduler->lock);
+  scheduler->controllers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  return scheduler;
+}
+
+GduCopyScheduler *
+gdu_copy_scheduler_ref (GduCopyScheduler *scheduler)
+{
+  g_atomic_int_inc (&scheduler->ref_count);
+  return scheduler;
+}
+
+void
+gdu_copy_scheduler_unref (GduCopyScheduler *scheduler)
+{
+  if (g_atomic_int_dec_and_test (&scheduler->ref_count))
+    {
+      g_hash_table_unref (scheduler->controllers);
+      g_mutex_clear (&scheduler->lock);
+      g_free (scheduler);
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+is_pci_address (const gchar *s)
+{
+  /* e.g. 0000:00:1f.2 */
+  return strlen (s) == 12 && s[4] == ':' && s[7] == ':' && s[10] == '.';
+}
+
+/**
+ * gdu_copy_scheduler_get_controller:
+ * @block: A #UDisksBlock.
+ *
+ * Finds the controller @block is attached to. This is the PCI device
+ * closest to it in the sysfs hierarchy, e.g. the SATA controller, the
+ * USB host controller or the NVMe drive itself.
+ *
+ * Returns: An identifier for the controller. Free with g_free().
+ */
+gchar *
+gdu_copy_scheduler_get_controller (UDisksBlock *block)
+{
+  dev_t dev;
+  gchar *sysfs_path;
+  gchar *path;
+  gchar **components = NULL;
+  gchar *ret = NULL;
+  guint n;
+
+  dev = udisks_block_get_device_number (block);
+  sysfs_path = g_strdup_printf ("/sys/dev/block/%u:%u", major (dev), minor (dev));
+  path = realpath (sysfs_path, NULL);
+  if (path == NULL)
+    {
+      /* not much else to go by */
+      ret = sysfs_path;
+      sysfs_path = NULL;
+      goto out;
+    }
+
+  components = g_strsplit (path, "/", -1);
+  for (n = 0; components[n] != NULL; n++)
+    {
+      if (is_pci_address (components[n]))
+        {
+          g_free (ret);
+          ret = g_strdup (components[n]);
+        }
+      else if (ret != NULL)
+        {
+          break;
+        }
+    }
+
+  /* e.g. loop devices - each on its own */
+  if (ret == NULL)
+    ret = g_strdup (path);
+
+ out:
+  g_strfreev (components);
+  free (path);
+  g_free (sysfs_path);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Called when a copy of @num_bytes starts */
+void
+gdu_copy_scheduler_add_job (GduCopyScheduler *scheduler,
+                            guint64           num_bytes)
+{
+  g_mutex_lock (&scheduler->lock);
+  scheduler->total_bytes += num_bytes;
+  g_mutex_unlock (&scheduler->lock);
+}
+
+/* Called when a copy ends, @num_bytes_not_copied is non-zero if it failed */
+void
+gdu_copy_scheduler_finish_job (GduCopyScheduler *scheduler,
+                               guint64           num_bytes_not_copied)
+{
+  g_mutex_lock (&scheduler->lock);
+  scheduler->total_bytes -= MIN (num_bytes_not_copied, scheduler->total_bytes);
+  g_mutex_unlock (&scheduler->lock);
+}
+
+/**
+ * gdu_copy_scheduler_throttle:
+ * @scheduler: A #GduCopyScheduler.
+ * @controller: The controller the data went through, see gdu_copy_scheduler_get_controller().
+ * @num_bytes: The number of bytes copied.
+ * @cancellable: A #GCancellable or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Accounts for @num_bytes copied through @controller, waiting if that
+ * goes over the limit of the controller.
+ *
+ * Returns: %FALSE if @error is set, i.e. if cancelled while waiting.
+ */
+gboolean
+gdu_copy_scheduler_throttle (GduCopyScheduler  *scheduler,
+                             const gchar       *controller,
+                             guint64            num_bytes,
+                             GCancellable      *cancellable,
+                             GError           **error)
+{
+  gint64 *reserved_until;
+  gint64 wait_until;
+  gint64 now;
+
+  g_mutex_lock (&scheduler->lock);
+  scheduler->completed_bytes += num_bytes;
+  if (scheduler->max_bytes_per_sec == 0)
+    {
+      g_mutex_unlock (&scheduler->lock);
+      return TRUE;
+    }
+
+  now = g_get_monotonic_time ();
+  reserved_until = g_hash_table_lookup (scheduler->controllers, controller);
+  if (reserved_until == NULL)
+    {
+      reserved_until = g_new0 (gint64, 1);
+      *reserved_until = now;
+      g_hash_table_insert (scheduler->controllers, g_strdup (controller), reserved_until);
+    }
+  *reserved_until = MAX (*reserved_until, now - MAX_BURST_USEC);
+  *reserved_until += num_bytes * G_USEC_PER_SEC / scheduler->max_bytes_per_sec;
+  wait_until = *reserved_until;
+  g_mutex_unlock (&scheduler->lock);
+
+  while ((now = g_get_monotonic_time ()) < wait_until)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+      g_usleep (MIN (wait_until - now, WAIT_INTERVAL_USEC));
+    }
+  return TRUE;
+}
+
+/* Gets the combined progress of all copies */
+void
+gdu_copy_scheduler_get_progress (GduCopyScheduler *scheduler,
+                                 guint64          *out_completed_bytes,
+                                 guint64          *out_total_bytes)
+{
+  g_mutex_lock (&scheduler->lock);
+  *out_completed_bytes = scheduler->completed_bytes;
+  *out_total_bytes = scheduler->total_bytes;
+  g_mutex_unlock (&scheduler->lock);
+}
@@ -0,0 +1,37 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_COPY_SCHEDULER_H__
+#define __GDU_COPY_SCHEDULER_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+GduCopyScheduler *gdu_copy_scheduler_new            (guint64            max_bytes_per_sec);
+GduCopyScheduler *gdu_copy_scheduler_ref            (GduCopyScheduler  *scheduler);
+void              gdu_copy_scheduler_unref          (GduCopyScheduler  *scheduler);
+gchar            *gdu_copy_scheduler_get_controller (UDisksBlock       *block);
+void              gdu_copy_scheduler_add_job        (GduCopyScheduler  *scheduler,
+                                                     guint64            num_bytes);
+void              gdu_copy_scheduler_finish_job     (GduCopyScheduler  *scheduler,
+                                                     guint64            num_bytes_not_copied);
+gboolean          gdu_copy_scheduler_throttle       (GduCopyScheduler  *scheduler,
+                                                     const gchar       *controller,
+                                                     guint64            num_bytes,
+                                                     GCancellable      *cancellable,
+                                                     GError           **error);
+void              gdu_copy_scheduler_get_progress   (GduCopyScheduler  *scheduler,
+                                                     guint64           *out_completed_bytes,
+                                                     guint64           *out_total_bytes);
+
+G_END_DECLS
+
+#endif /* __GDU_COPY_SCHEDULER_H__ */
@@ -19,7 +19,9 @@
 
 #include <glib-unix.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <linux/fs.h>
+#include <linux/loop.h>
 
 #include <canberra-gtk.h>
 
@@ -31,14 +33,20 @@
 #include "gdulocaljob.h"
 
 #include "gdudvdsupport.h"
+#include "gducopyring.h"
+#include "gduchunksizer.h"
+#include "gducheckpoint.h"
+#include "gdubadblockmap.h"
+#include "gduusedblocks.h"
+#include "gducopyscheduler.h"
+#include "gduimagechecksum.h"
+#include "gduxzcompressor.h"
 
 /* TODOs / ideas for Disk Image creation
  *
- * - Be tolerant of I/O errors like dd_rescue(1), see http://www.gnu.org/s/ddrescue/ddrescue.html
  * - Create images useful for Virtualization, e.g. vdi, vmdk, qcow2. Maybe use libguestfs for
  *   this. See http://libguestfs.org/
  * - Support a Apple DMG-ish format
- * - Sliding buffer size
  * - Update time remaining / speed exactly every 1/10th second instead of when we've read a full buffer
  *
  */
@@ -49,7 +57,9 @@ typedef struct
 {
   volatile gint ref_count;
 
-  GduWindow *window;
+  GduApplication *application;
+  UDisksClient *client;
+  GduWindow *window; /* NULL for unattended copies */
   UDisksObject *object;
   UDisksBlock *block;
   UDisksDrive *drive;
@@ -62,6 +72,12 @@ typedef struct
   GtkWidget *name_entry;
   GtkWidget *folder_label;
   GtkWidget *folder_fcbutton;
+  GtkWidget *sparse_checkbutton;
+  GtkWidget *compress_checkbutton;
+  GtkWidget *direct_io_checkbutton;
+  GtkWidget *checksum_checkbutton;
+  GtkWidget *used_blocks_checkbutton;
+  GtkWidget *resume_checkbutton;
 
   GtkWidget *start_copying_button;
   GtkWidget *cancel_button;
@@ -69,13 +85,27 @@ typedef struct
   GCancellable *cancellable;
   GFile *output_file;
   GFileOutputStream *output_file_stream;
+  GFileIOStream *output_io_stream;
+  GFile *checkpoint_file;
+  gboolean sparse;
+  gboolean compress;
+  gboolean direct_io;
+  gboolean checksum;
+  gboolean used_blocks_only;
+  gboolean resume;
+  gboolean checkpoint_saved;
 
   /* must hold copy_lock when reading/writing these */
   GMutex copy_lock;
   GduEstimator *estimator;
+  GduCheckpoint *checkpoint;
+  GduBadBlockMap *bad_blocks;
 
   gboolean allocating_file;
   gboolean retrieving_dvd_keys;
+  gboolean checking_image;
+  gboolean recovering;
+  gboolean computing_checksum;
   guint64 num_error_bytes;
   gint64 start_time_usec;
   gint64 end_time_usec;
@@ -90,6 +120,11 @@ typedef struct
   guint inhibit_cookie;
 
   GduLocalJob *local_job;
+
+  /* for unattended copies, see gdu_create_disk_image_dialog_run_unattended() */
+  GTask *task;
+  GduCopyScheduler *scheduler;
+  gchar *controller;
 } DialogData;
 
 static const struct {
@@ -101,6 +136,12 @@ static const struct {
   {G_STRUCT_OFFSET (DialogData, name_entry), "name-entry"},
   {G_STRUCT_OFFSET (DialogData, folder_label), "folder-label"},
   {G_STRUCT_OFFSET (DialogData, folder_fcbutton), "folder-fcbutton"},
+  {G_STRUCT_OFFSET (DialogData, sparse_checkbutton), "sparse-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, compress_checkbutton), "compress-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, direct_io_checkbutton), "direct-io-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, checksum_checkbutton), "checksum-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, used_blocks_checkbutton), "used-blocks-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, resume_checkbutton), "resume-checkbutton"},
 
   {G_STRUCT_OFFSET (DialogData, start_copying_button), "start-copying-button"},
   {G_STRUCT_OFFSET (DialogData, cancel_button), "cancel-button"},
@@ -121,7 +162,7 @@ dialog_data_terminate_job (DialogData *data)
 {
   if (data->local_job != NULL)
     {
-      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
+      gdu_application_destroy_local_job (data->application, data->local_job);
       data->local_job = NULL;
     }
 }
@@ -131,7 +172,7 @@ dialog_data_uninhibit (DialogData *data)
 {
   if (data->inhibit_cookie > 0)
     {
-      gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+      gtk_application_uninhibit (GTK_APPLICATION (data->application),
                                  data->inhibit_cookie);
       data->inhibit_cookie = 0;
     }
@@ -153,24 +194,58 @@ dialog_data_hide (DialogData *data)
     }
 }
 
+/* Unattended copies report the outcome through the task instead of
+ * in dialogs. Takes ownership of @error.
+ */
+static void
+dialog_data_return (DialogData *data,
+                    GError     *error)
+{
+  if (data->task == NULL)
+    {
+      g_clear_error (&error);
+      return;
+    }
+  if (error != NULL)
+    g_task_return_error (data->task, error);
+  else
+    g_task_return_boolean (data->task, TRUE);
+  g_clear_object (&data->task);
+}
+
 static void
 dialog_data_unref (DialogData *data)
 {
   if (g_atomic_int_dec_and_test (&data->ref_count))
     {
+      /* cancelled, otherwise it would have been returned already */
+      if (data->task != NULL)
+        dialog_data_return (data, g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                                       _("Operation was cancelled")));
       dialog_data_terminate_job (data);
       dialog_data_uninhibit (data);
       dialog_data_hide (data);
 
       g_clear_object (&data->cancellable);
       g_clear_object (&data->output_file_stream);
-      g_object_unref (data->window);
+      g_clear_object (&data->output_io_stream);
+      g_clear_object (&data->checkpoint_file);
+      if (data->checkpoint != NULL)
+        gdu_checkpoint_free (data->checkpoint);
+      gdu_bad_block_map_free (data->bad_blocks);
+      g_clear_object (&data->window);
+      g_object_unref (data->client);
+      g_object_unref (data->application);
       g_object_unref (data->object);
       g_object_unref (data->block);
       g_clear_object (&data->drive);
       if (data->builder != NULL)
         g_object_unref (data->builder);
       g_clear_object (&data->estimator);
+      g_clear_object (&data->output_file);
+      if (data->scheduler != NULL)
+        gdu_copy_scheduler_unref (data->scheduler);
+      g_free (data->controller);
       g_mutex_clear (&data->copy_lock);
       g_free (data);
     }
@@ -207,14 +282,51 @@ dialog_data_complete_and_unref (DialogData *data)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+/* Returns: TRUE if an interrupted copy to the chosen file can be resumed */
+static gboolean
+can_resume (DialogData *data)
+{
+  const gchar *name;
+  GFile *folder = NULL;
+  GFile *file = NULL;
+  GFile *checkpoint_file = NULL;
+  gboolean ret = FALSE;
+
+  /* the xz stream can't be picked up in the middle */
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->compress_checkbutton)))
+    goto out;
+
+  name = gtk_entry_get_text (GTK_ENTRY (data->name_entry));
+  folder = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (data->folder_fcbutton));
+  if (strlen (name) == 0 || folder == NULL)
+    goto out;
+
+  file = g_file_get_child (folder, name);
+  checkpoint_file = gdu_checkpoint_get_file_for_image (file);
+  ret = g_file_query_exists (checkpoint_file, NULL) && g_file_query_exists (file, NULL);
+
+ out:
+  g_clear_object (&checkpoint_file);
+  g_clear_object (&file);
+  g_clear_object (&folder);
+  return ret;
+}
+
 static void
 create_disk_image_update (DialogData *data)
 {
   gboolean can_proceed = FALSE;
+  gboolean compress;
 
   if (strlen (gtk_entry_get_text (GTK_ENTRY (data->name_entry))) > 0)
     can_proceed = TRUE;
 
+  /* compressed images have no holes */
+  compress = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->compress_checkbutton));
+  gtk_widget_set_sensitive (data->sparse_checkbutton, !compress);
+
+  gtk_widget_set_visible (data->resume_checkbutton, can_resume (data));
+
   gtk_dialog_set_response_sensitive (GTK_DIALOG (data->dialog), GTK_RESPONSE_OK, can_proceed);
 }
 
@@ -227,13 +339,48 @@ on_notify (GObject     *object,
   create_disk_image_update (data);
 }
 
+static void
+on_folder_changed (GtkFileChooser *chooser,
+                   gpointer        user_data)
+{
+  DialogData *data = user_data;
+  create_disk_image_update (data);
+}
+
+static void
+on_compress_toggled (GtkToggleButton *toggle_button,
+                     gpointer         user_data)
+{
+  DialogData *data = user_data;
+  const gchar *name;
+  gchar *new_name = NULL;
+
+  /* Add or remove the .xz suffix to match */
+  name = gtk_entry_get_text (GTK_ENTRY (data->name_entry));
+  if (gtk_toggle_button_get_active (toggle_button))
+    {
+      if (!g_str_has_suffix (name, ".xz"))
+        new_name = g_strdup_printf ("%s.xz", name);
+    }
+  else
+    {
+      if (g_str_has_suffix (name, ".xz"))
+        new_name = g_strndup (name, strlen (name) - 3);
+    }
+
+  if (new_name != NULL)
+    gtk_entry_set_text (GTK_ENTRY (data->name_entry), new_name);
+  g_free (new_name);
+
+  create_disk_image_update (data);
+}
+
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static void
-create_disk_image_populate (DialogData *data)
+static gchar *
+get_proposed_filename (DialogData *data)
 {
-  UDisksObjectInfo *info = NULL;
   gchar *device_name;
   gchar *now_string;
   gchar *proposed_filename = NULL;
@@ -276,19 +423,33 @@ create_disk_image_populate (DialogData *data)
                                            now_string);
     }
 
-  gtk_entry_set_text (GTK_ENTRY (data->name_entry), proposed_filename);
-  g_free (proposed_filename);
   g_free (device_name);
   g_date_time_unref (now);
   g_time_zone_unref (tz);
   g_free (now_string);
+  return proposed_filename;
+}
+
+static void
+create_disk_image_populate (DialogData *data)
+{
+  UDisksObjectInfo *info = NULL;
+  gchar *proposed_filename;
+
+  /* Only offered for filesystems whose free space we can find */
+  gtk_widget_set_visible (data->used_blocks_checkbutton,
+                          gdu_used_blocks_is_supported (udisks_block_get_id_type (data->block)));
+
+  proposed_filename = get_proposed_filename (data);
+  gtk_entry_set_text (GTK_ENTRY (data->name_entry), proposed_filename);
+  g_free (proposed_filename);
 
   gdu_utils_configure_file_chooser_for_disk_images (GTK_FILE_CHOOSER (data->folder_fcbutton),
                                                     FALSE,   /* set file types */
                                                     FALSE);  /* allow_compressed */
 
   /* Source label */
-  info = udisks_client_get_object_info (gdu_window_get_client (data->window), data->object);
+  info = udisks_client_get_object_info (data->client, data->object);
   gtk_label_set_text (GTK_LABEL (data->source_label), udisks_object_info_get_one_liner (info));
   g_clear_object (&info);
 }
@@ -300,6 +461,10 @@ play_read_error_sound (DialogData *data)
 {
   const gchar *sound_message;
 
+  /* unattended copies are quiet */
+  if (data->window == NULL)
+    return;
+
   /* Translators: A descriptive string for the sound played when
    * there's a read error that's being ignored, see
    * CA_PROP_EVENT_DESCRIPTION
@@ -313,6 +478,60 @@ play_read_error_sound (DialogData *data)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+#define HEAT_STRIP_NUM_CELLS 60
+
+/* Shows where on the device the unreadable data is - each cell is
+ * colored by how much of its part of the device couldn't be read.
+ *
+ * Must hold copy_lock.
+ */
+static gchar *
+get_heat_strip_markup (DialogData *data,
+                       guint64     size,
+                       guint64     completed)
+{
+  GString *str;
+  const gchar *prev_color = NULL;
+  guint n;
+
+  str = g_string_new (NULL);
+  for (n = 0; n < HEAT_STRIP_NUM_CELLS; n++)
+    {
+      guint64 offset = size * n / HEAT_STRIP_NUM_CELLS;
+      guint64 length = size * (n + 1) / HEAT_STRIP_NUM_CELLS - offset;
+      guint64 num_bad;
+      const gchar *color;
+
+      /* hard-coded Tango colors, like the error message in update_job() */
+      num_bad = gdu_bad_block_map_count (data->bad_blocks, offset, length, GDU_BLOCK_STATE_BAD);
+      if (num_bad * 2 >= length && num_bad > 0)
+        color = "#a40000";
+      else if (num_bad * 20 >= length && num_bad > 0)
+        color = "#cc0000";
+      else if (num_bad > 0)
+        color = "#ef2929";
+      else if (gdu_bad_block_map_count (data->bad_blocks, offset, length, GDU_BLOCK_STATE_UNTRIED) > 0)
+        color = "#edd400";
+      else if (offset >= completed)
+        color = "#babdb6";
+      else
+        color = "#73d216";
+
+      if (color != prev_color)
+        {
+          if (prev_color != NULL)
+            g_string_append (str, "</span>");
+          g_string_append_printf (str, "<span foreground=\"%s\">", color);
+          prev_color = color;
+        }
+      g_string_append (str, "\u2588"); /* FULL BLOCK */
+    }
+  if (prev_color != NULL)
+    g_string_append (str, "</span>");
+
+  return g_string_free (str, FALSE);
+}
+
 static void
 update_job (DialogData *data,
             gboolean    done)
@@ -323,6 +542,8 @@ update_job (DialogData *data,
   guint64 bytes_per_sec = 0;
   guint64 usec_remaining = 0;
   guint64 num_error_bytes = 0;
+  gboolean recovering;
+  gchar *heat_strip = NULL;
   gdouble progress = 0.0;
   gchar *s2, *s3;
 
@@ -334,7 +555,10 @@ update_job (DialogData *data,
       bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
       bytes_target = gdu_estimator_get_target_bytes (data->estimator);
       num_error_bytes = data->num_error_bytes;
+      if (num_error_bytes > 0)
+        heat_strip = get_heat_strip_markup (data, bytes_target, bytes_completed);
     }
+  recovering = data->recovering;
   data->update_id = 0;
   g_mutex_unlock (&data->copy_lock);
 
@@ -346,19 +570,37 @@ update_job (DialogData *data,
     {
       extra_markup = g_strdup (_("Retrieving DVD keys"));
     }
+  else if (data->checking_image)
+    {
+      extra_markup = g_strdup (_("Checking the interrupted disk image"));
+    }
+  else if (data->computing_checksum)
+    {
+      extra_markup = g_strdup (_("Computing checksum"));
+    }
 
   if (num_error_bytes > 0)
     {
       s2 = g_format_size (num_error_bytes);
-      /* Translators: Shown when there are read errors and we skip some data.
-       *              The first %s is the amount of unreadable data (ex. "512 kB").
-       */
-      s3 = g_strdup_printf (_("%s unreadable (replaced with zeroes)"), s2);
+      if (recovering)
+        {
+          /* Translators: Shown when going back to data that could not be read the first time.
+           *              The %s is the amount of unreadable data (ex. "512 kB").
+           */
+          s3 = g_strdup_printf (_("Retrying %s of unreadable data"), s2);
+        }
+      else
+        {
+          /* Translators: Shown when there are read errors and we skip some data.
+           *              The first %s is the amount of unreadable data (ex. "512 kB").
+           */
+          s3 = g_strdup_printf (_("%s unreadable (replaced with zeroes)"), s2);
+        }
       /* TODO: once https://bugzilla.gnome.org/show_bug.cgi?id=657194 is resolved, use that instead
        * of hard-coding the color
        */
       g_free (extra_markup);
-      extra_markup = g_strdup_printf ("<span foreground=\"#ff0000\">%s</span>", s3);
+      extra_markup = g_strdup_printf ("<span foreground=\"#ff0000\">%s</span>\n%s", s3, heat_strip);
       g_free (s3);
       g_free (s2);
     }
@@ -396,6 +638,7 @@ update_job (DialogData *data,
       data->played_read_error_sound = TRUE;
     }
 
+  g_free (heat_strip);
   g_free (extra_markup);
 }
 
@@ -406,6 +649,10 @@ play_complete_sound (DialogData *data)
 {
   const gchar *sound_message;
 
+  /* unattended copies are quiet */
+  if (data->window == NULL)
+    return;
+
   /* Translators: A descriptive string for the 'complete' sound, see CA_PROP_EVENT_DESCRIPTION */
   sound_message = _("Disk image copying complete");
   ca_gtk_play_for_widget (GTK_WIDGET (data->window), 0,
@@ -435,10 +682,18 @@ on_show_error (gpointer user_data)
   dialog_data_uninhibit (data);
 
   g_assert (data->copy_error != NULL);
-  gdu_utils_show_error (GTK_WINDOW (data->window),
-                        _("Error creating disk image"),
-                        data->copy_error);
-  g_clear_error (&data->copy_error);
+  if (data->task != NULL)
+    {
+      dialog_data_return (data, data->copy_error);
+      data->copy_error = NULL;
+    }
+  else
+    {
+      gdu_utils_show_error (GTK_WINDOW (data->window),
+                            _("Error creating disk image"),
+                            data->copy_error);
+      g_clear_error (&data->copy_error);
+    }
 
   dialog_data_complete_and_unref (data);
 
@@ -462,8 +717,15 @@ on_success (gpointer user_data)
   /* OK, we're done but we had to replace unreadable data with
    * zeroes. Bring up a modal dialog to inform the user of this and
    * allow him to delete the file, if so desired.
+   *
+   * Unattended copies just keep the file - there's a map of the
+   * unreadable data next to it.
    */
-  if (data->num_error_bytes > 0)
+  if (data->task != NULL)
+    {
+      dialog_data_return (data, NULL);
+    }
+  else if (data->num_error_bytes > 0)
     {
       GtkWidget *dialog;
       GError *error = NULL;
@@ -520,30 +782,22 @@ on_success (gpointer user_data)
 /* Note that error on reading is *not* considered an error - instead 0
  * is returned.
  *
- * Error conditions include failure to seek or write to output.
- *
  * Returns: Number of bytes actually read (e.g. not include padding) -1 if @error is set.
  */
 static gssize
-copy_span (int              fd,
-           GOutputStream   *output_stream,
+read_span (int              fd,
            guint64          offset,
            guint64          size,
            guchar          *buffer,
            gboolean         pad_with_zeroes,
            GduDVDSupport   *dvd_support,
-           GCancellable    *cancellable,
            GError         **error)
 {
   gint64 ret = -1;
   ssize_t num_bytes_read;
-  gsize num_bytes_to_write;
 
-  g_return_val_if_fail (-1, buffer != NULL);
-  g_return_val_if_fail (-1, G_IS_OUTPUT_STREAM (output_stream));
-  g_return_val_if_fail (-1, buffer != NULL);
-  g_return_val_if_fail (-1, cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-  g_return_val_if_fail (-1, error == NULL || *error == NULL);
+  g_return_val_if_fail (buffer != NULL, -1);
+  g_return_val_if_fail (error == NULL || *error == NULL, -1);
 
   if (dvd_support != NULL)
     {
@@ -565,6 +819,9 @@ copy_span (int              fd,
         {
           if (errno == EAGAIN || errno == EINTR)
             goto read_again;
+          /* O_DIRECT may not work for this request - not a read error */
+          if (errno == EINVAL && gdu_utils_set_direct_io (fd, FALSE))
+            goto read_again;
         }
       else
         {
@@ -586,14 +843,35 @@ copy_span (int              fd,
       num_bytes_read = 0;
     }
 
-  num_bytes_to_write = num_bytes_read;
   if (pad_with_zeroes && (guint64) num_bytes_read < size)
-    {
-      memset (buffer + num_bytes_read, 0, size - num_bytes_read);
-      num_bytes_to_write = size;
-    }
+    memset (buffer + num_bytes_read, 0, size - num_bytes_read);
 
-  if (!g_seekable_seek (G_SEEKABLE (output_stream),
+  ret = num_bytes_read;
+
+ out:
+  return ret;
+}
+
+/* Error conditions include failure to seek or write to output. */
+static gboolean
+write_span (GOutputStream   *output_stream,
+            guint64          offset,
+            const guchar    *buffer,
+            gsize            size,
+            GCancellable    *cancellable,
+            GError         **error)
+{
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (output_stream), FALSE);
+  g_return_val_if_fail (buffer != NULL, FALSE);
+  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* Streams that can't seek (e.g. when compressing) are written sequentially */
+  if (G_IS_SEEKABLE (output_stream) &&
+      g_seekable_can_seek (G_SEEKABLE (output_stream)) &&
+      !g_seekable_seek (G_SEEKABLE (output_stream),
                         offset,
                         G_SEEK_SET,
                         cancellable,
@@ -605,145 +883,1231 @@ copy_span (int              fd,
       goto out;
     }
 
-  if (!g_output_stream_write_all (G_OUTPUT_STREAM (output_stream),
+  if (!g_output_stream_write_all (output_stream,
                                   buffer,
-                                  num_bytes_to_write,
-                                  G_PRIORITY_DEFAULT,
+                                  size,
+                                  NULL, /* bytes_written */
                                   cancellable,
                                   error))
     {
       g_prefix_error (error,
                       "Error writing %" G_GSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": ",
-                      num_bytes_to_write,
+                      size,
                       offset);
       goto out;
     }
 
-  ret = num_bytes_read;
+  ret = TRUE;
 
  out:
-
   return ret;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static gpointer
-copy_thread_func (gpointer user_data)
+/* The device is read in a separate thread so reading the next chunk
+ * overlaps with writing the previous one to the output file. Chunks
+ * are passed to copy_thread_func() through a GduCopyRing.
+ *
+ * Up to READ_QUEUE_DEPTH chunks are read at the same time through a
+ * GduIOEngine. They may complete in any order but are handed to the
+ * writer in order.
+ */
+
+#define READ_QUEUE_DEPTH 4
+
+/* The largest chunk size GduChunkSizer may pick */
+#define MAX_CHUNK_SIZE (8 * 1024 * 1024)
+
+/* Read errors are handled like ddrescue(1) does it. The first pass
+ * doesn't stall on the kernel's retries for every bad sector: the rest
+ * of a failing chunk is skipped, and so are the following chunks -
+ * exponentially more of them the more errors there are in a row. The
+ * skipped data is marked as untried in the GduBadBlockMap and once
+ * the rest of the device is done copy_thread_func() goes back to it,
+ * see recover_untried_spans().
+ *
+ * When compressing, the disk image can't be patched afterwards so
+ * failing chunks are split up with recover_span() right away instead.
+ */
+
+#define MIN_SKIP_SIZE (1024 * 1024)
+#define MAX_SKIP_SIZE (1024 * 1024 * 1024)
+
+typedef struct
 {
-  DialogData *data = user_data;
-  GduDVDSupport *dvd_support = NULL;
-  guchar *buffer_unaligned = NULL;
-  guchar *buffer = NULL;
-  guint64 block_device_size = 0;
-  long page_size;
-  GError *error = NULL;
-  GError *error2 = NULL;
-  gint64 last_update_usec = -1;
-  gint fd = -1;
-  gint buffer_size;
-  guint64 num_bytes_completed = 0;
+  DialogData *data;
+  GduCopyRing *ring;
+  GduChunkSizer *sizer;
+  gint fd;
+  GduDVDSupport *dvd_support;
+  GduUsedBlocks *used_blocks;
+  guint sector_size;
+  guint64 start;
+  guint64 size;
+  gboolean drop_cache;
+  gboolean skip_errors;
+  guint64 skip_size;
+  guint64 skip_until;
+  GError *error;
+} ReaderData;
 
-  /* default to 1 MiB blocks */
-  buffer_size = (1 * 1024 * 1024);
+typedef struct
+{
+  GduCopyBuffer *buffer;
+  gssize result;
+  gboolean done;
+  gboolean skipped;
+  gboolean unused;
+} PendingRead;
 
-  /* Most OSes put ACLs for logged-in users on /dev/sr* nodes (this is
-   * so CD burning tools etc. work) so see if we can open the device
-   * file ourselves. If so, great, since this avoids a polkit dialog.
-   *
-   * As opposed to udisks' OpenForBackup() we also avoid O_EXCL since
-   * the disc is read-only by its very nature. As a side-effect this
-   * allows creating a disk image of a mounted disc.
-   */
-  if (g_str_has_prefix (udisks_block_get_device (data->block), "/dev/sr"))
-    {
-      const gchar *device_file = udisks_block_get_device (data->block);
-      fd = open (device_file, O_RDONLY);
+static void
+set_block_state (DialogData    *data,
+                 guint64        offset,
+                 guint64        length,
+                 GduBlockState  state)
+{
+  g_mutex_lock (&data->copy_lock);
+  gdu_bad_block_map_set (data->bad_blocks, offset, length, state);
+  data->num_error_bytes = gdu_bad_block_map_get_num_bytes (data->bad_blocks, GDU_BLOCK_STATE_UNTRIED) +
+    gdu_bad_block_map_get_num_bytes (data->bad_blocks, GDU_BLOCK_STATE_BAD);
+  g_mutex_unlock (&data->copy_lock);
+}
 
-      /* Use libdvdcss (if available on the system) on DVDs with UDF
-       * filesystems - otherwise the backup process may fail because
-       * of unreadable/scrambled sectors
-       */
-      if (g_strcmp0 (udisks_block_get_id_usage (data->block), "filesystem") == 0 &&
-          g_strcmp0 (udisks_block_get_id_type (data->block), "udf") == 0 &&
-          g_str_has_prefix (udisks_drive_get_media (data->drive), "optical_dvd"))
-        {
-          g_mutex_lock (&data->copy_lock);
-          data->retrieving_dvd_keys = TRUE;
-          g_mutex_unlock (&data->copy_lock);
-          g_idle_add (on_update_job, dialog_data_ref (data));
+/* Reads what can be read of the span at @offset into @buffer. On
+ * errors the span is split in halves, and so on, until the sectors
+ * that can't be read are found. Those are zeroed and marked bad.
+ *
+ * Returns: FALSE if @error is set, e.g. if cancelled.
+ */
+static gboolean
+recover_span (DialogData     *data,
+              gint            fd,
+              GduDVDSupport  *dvd_support,
+              guint           sector_size,
+              guint64         offset,
+              guint64         size,
+              guchar         *buffer,
+              GError        **error)
+{
+  gssize num_bytes_read;
+  guint64 half;
 
-          dvd_support = gdu_dvd_support_new (device_file, udisks_block_get_size (data->block));
+  if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+    return FALSE;
 
-          g_mutex_lock (&data->copy_lock);
-          data->retrieving_dvd_keys = FALSE;
-          g_mutex_unlock (&data->copy_lock);
-          g_idle_add (on_update_job, dialog_data_ref (data));
-        }
+  num_bytes_read = read_span (fd, offset, size, buffer, TRUE, dvd_support, error);
+  if (num_bytes_read < 0)
+    return FALSE;
+
+  /* only whole sectors are good */
+  if ((guint64) num_bytes_read < size)
+    {
+      num_bytes_read -= num_bytes_read % sector_size;
+      memset (buffer + num_bytes_read, 0, size - num_bytes_read);
     }
+  set_block_state (data, offset, num_bytes_read, GDU_BLOCK_STATE_GOOD);
+  if ((guint64) num_bytes_read == size)
+    return TRUE;
 
-  /* Otherwise, request the fd from udisks */
-  if (fd == -1)
+  offset += num_bytes_read;
+  buffer += num_bytes_read;
+  size -= num_bytes_read;
+
+  if (size <= sector_size)
     {
-      GUnixFDList *fd_list = NULL;
-      GVariant *fd_index = NULL;
-      if (!udisks_block_call_open_for_backup_sync (data->block,
-                                                   g_variant_new ("a{sv}", NULL), /* options */
-                                                   NULL, /* fd_list */
-                                                   &fd_index,
-                                                   &fd_list,
-                                                   NULL, /* cancellable */
-                                                   &error))
-        goto out;
+      set_block_state (data, offset, size, GDU_BLOCK_STATE_BAD);
+      return TRUE;
+    }
 
-      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), &error);
-      if (error != NULL)
-        {
-          g_prefix_error (&error,
-                          "Error extracing fd with handle %d from D-Bus message: ",
-                          g_variant_get_handle (fd_index));
-          goto out;
-        }
-      if (fd_index != NULL)
-        g_variant_unref (fd_index);
-      g_clear_object (&fd_list);
+  half = size / 2;
+  half = MAX (half - half % sector_size, sector_size);
+  return recover_span (data, fd, dvd_support, sector_size, offset, half, buffer, error) &&
+    recover_span (data, fd, dvd_support, sector_size, offset + half, size - half, buffer + half, error);
+}
+
+/* Handles a read once the engine is done with it, see above */
+static gboolean
+complete_read (ReaderData  *reader,
+               PendingRead *p)
+{
+  DialogData *data = reader->data;
+  GduCopyBuffer *buffer = p->buffer;
+  gssize num_bytes_read = p->result;
+  guint64 bad_offset;
+  guint64 bad_length;
+
+  /* free space of the filesystem, see gduusedblocks.c */
+  if (p->unused)
+    {
+      memset (buffer->data, 0, buffer->length);
+      return TRUE;
     }
 
-  g_assert (fd != -1);
+  if (p->skipped)
+    {
+      memset (buffer->data, 0, buffer->length);
+      set_block_state (data, buffer->offset, buffer->length, GDU_BLOCK_STATE_UNTRIED);
+      return TRUE;
+    }
 
-  /* We can't use udisks_block_get_size() because the media may have
-   * changed and udisks may not have noticed. TODO: maybe have a
-   * Block.GetSize() method instead...
+  /* DVDs are read here. Also, the engine doesn't fall back from
+   * O_DIRECT if it doesn't work for a request - read_span() does
    */
-  if (ioctl (fd, BLKGETSIZE64, &block_device_size) != 0)
+  if (reader->dvd_support != NULL ||
+      num_bytes_read == -EINVAL || num_bytes_read == -EINTR || num_bytes_read == -EAGAIN)
     {
-      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
-                           "%s", strerror (errno));
-      g_prefix_error (&error, _("Error determining size of device: "));
-      goto out;
+      num_bytes_read = read_span (reader->fd,
+                                  buffer->offset,
+                                  buffer->length,
+                                  buffer->data,
+                                  TRUE, /* pad_with_zeroes */
+                                  reader->dvd_support,
+                                  &reader->error);
+      if (num_bytes_read < 0)
+        return FALSE;
+    }
+  else if (num_bytes_read < 0)
+    {
+      /* a read error, not an error */
+      num_bytes_read = 0;
     }
 
-  if (block_device_size == 0)
+  if ((gsize) num_bytes_read == buffer->length)
     {
-      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
-                           _("Device is size 0"));
-      goto out;
+      reader->skip_size = MIN_SKIP_SIZE;
+      return TRUE;
     }
 
-  /* If supported, allocate space at once to ensure blocks are laid
-   * out contigously, see http://lwn.net/Articles/226710/
+  /* the read failed somewhere after the data we got */
+  num_bytes_read -= num_bytes_read % reader->sector_size;
+  bad_offset = buffer->offset + num_bytes_read;
+  bad_length = buffer->length - num_bytes_read;
+
+  if (!reader->skip_errors)
+    return recover_span (data,
+                         reader->fd,
+                         reader->dvd_support,
+                         reader->sector_size,
+                         bad_offset,
+                         bad_length,
+                         buffer->data + num_bytes_read,
+                         &reader->error);
+
+  memset (buffer->data + num_bytes_read, 0, bad_length);
+  set_block_state (data, bad_offset, bad_length, GDU_BLOCK_STATE_UNTRIED);
+  reader->skip_until = buffer->offset + buffer->length + reader->skip_size;
+  reader->skip_size = MIN (2 * reader->skip_size, MAX_SKIP_SIZE);
+  return TRUE;
+}
+
+static gpointer
+reader_thread_func (gpointer user_data)
+{
+  ReaderData *reader = user_data;
+  DialogData *data = reader->data;
+  GduIOEngine *engine;
+  PendingRead pending[READ_QUEUE_DEPTH];
+  guint head = 0;
+  guint num_pending = 0;
+  guint64 offset = reader->start;
+
+  /* libdvdcss keeps its own file position so reads of DVDs are done
+   * one at a time through gdu_dvd_support_read()
    */
-  if (G_IS_FILE_DESCRIPTOR_BASED (data->output_file_stream))
+  engine = gdu_io_engine_new (reader->dvd_support != NULL ? 1 : READ_QUEUE_DEPTH);
+
+  /* Read huge (e.g. 1 MiB) blocks and pass them on to the writer
+   * even if they were only partially read.
+   */
+  while (offset < reader->size || num_pending > 0)
     {
-      gint output_fd = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (data->output_file_stream));
-      gint rc;
+      PendingRead *p;
 
-      g_mutex_lock (&data->copy_lock);
-      data->allocating_file = TRUE;
-      g_mutex_unlock (&data->copy_lock);
-      g_idle_add (on_update_job, dialog_data_ref (data));
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, &reader->error))
+        goto fail;
 
-      rc = fallocate (output_fd,
+      /* Keep the queue full */
+      while (offset < reader->size && num_pending < gdu_io_engine_get_queue_depth (engine))
+        {
+          GduCopyBuffer *buffer;
+          gsize chunk_size;
+          guint64 run_length;
+          gboolean unused = FALSE;
+
+          buffer = gdu_copy_ring_acquire_free (reader->ring);
+          if (buffer == NULL)
+            goto out; /* aborted by the writer */
+
+          g_mutex_lock (&data->copy_lock);
+          chunk_size = gdu_chunk_sizer_get_size (reader->sizer);
+          g_mutex_unlock (&data->copy_lock);
+
+          buffer->offset = offset;
+          buffer->length = MIN (chunk_size, buffer->size);
+          if (buffer->length + offset > reader->size)
+            buffer->length = reader->size - offset;
+
+          /* Chunks don't straddle used and free space so the free space
+           * is never read - and it's skipped a full buffer at a time
+           */
+          if (reader->used_blocks != NULL)
+            {
+              unused = !gdu_used_blocks_lookup (reader->used_blocks, offset, &run_length);
+              if (unused)
+                buffer->length = MIN (run_length, buffer->size);
+              else
+                buffer->length = MIN (run_length, buffer->length);
+            }
+
+          p = &pending[(head + num_pending) % READ_QUEUE_DEPTH];
+          p->buffer = buffer;
+          p->result = -1;
+          p->done = FALSE;
+          p->unused = unused;
+          p->skipped = !unused && reader->skip_errors && buffer->offset < reader->skip_until;
+          num_pending++;
+          offset += buffer->length;
+
+          if (p->unused || p->skipped || reader->dvd_support != NULL)
+            {
+              p->done = TRUE;
+            }
+          else if (!gdu_io_engine_submit_read (engine,
+                                               reader->fd,
+                                               buffer->data,
+                                               buffer->length,
+                                               buffer->offset,
+                                               p,
+                                               &reader->error))
+            {
+              gdu_copy_ring_release (reader->ring, buffer);
+              goto fail;
+            }
+        }
+
+      /* Wait for the oldest read to complete */
+      while (!pending[head].done)
+        {
+          gpointer completed;
+          gssize result;
+
+          if (!gdu_io_engine_wait (engine, &completed, &result, &reader->error))
+            goto fail;
+          p = completed;
+          p->result = result;
+          p->done = TRUE;
+        }
+
+      p = &pending[head];
+      if (!complete_read (reader, p))
+        goto fail;
+
+      if (reader->drop_cache)
+        gdu_utils_drop_page_cache (reader->fd, p->buffer->offset, p->buffer->length, FALSE);
+
+      gdu_copy_ring_submit (reader->ring, p->buffer);
+      head = (head + 1) % READ_QUEUE_DEPTH;
+      num_pending--;
+    }
+
+ out:
+  /* Waits for reads still in flight before the buffers go away */
+  gdu_io_engine_free (engine);
+  gdu_copy_ring_finish (reader->ring);
+  return NULL;
+
+ fail:
+  gdu_copy_ring_abort (reader->ring);
+  goto out;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Writes e.g. disk.img.xz.sha256 next to the disk image. The checksum
+ * is of the disk data, so the entry in it is for disk.img
+ */
+static gboolean
+write_checksum_file (DialogData        *data,
+                     GduImageChecksum  *checksum,
+                     GError           **error)
+{
+  GFile *checksum_file;
+  gchar *image_name;
+  gboolean ret;
+
+  checksum_file = gdu_image_checksum_get_file_for_image (data->output_file);
+  image_name = g_file_get_basename (data->output_file);
+  if (data->compress && g_str_has_suffix (image_name, ".xz"))
+    image_name[strlen (image_name) - strlen (".xz")] = '\0';
+
+  ret = gdu_image_checksum_save (checksum,
+                                 checksum_file,
+                                 image_name,
+                                 NULL, /* cancellable */
+                                 error);
+
+  g_free (image_name);
+  g_object_unref (checksum_file);
+  return ret;
+}
+
+/* Writes e.g. disk.img.map next to the disk image, listing where the
+ * read errors were - and what wasn't read yet - in the format used by
+ * ddrescue(1)
+ */
+static gboolean
+write_map_file (DialogData  *data,
+                guint64      size,
+                guint64      num_bytes_completed,
+                GError     **error)
+{
+  GFile *parent;
+  GFile *map_file;
+  gchar *basename;
+  gchar *name;
+  gchar *contents;
+  gboolean ret;
+
+  g_mutex_lock (&data->copy_lock);
+  contents = gdu_bad_block_map_to_mapfile (data->bad_blocks, size, num_bytes_completed);
+  g_mutex_unlock (&data->copy_lock);
+
+  parent = g_file_get_parent (data->output_file);
+  basename = g_file_get_basename (data->output_file);
+  name = g_strdup_printf ("%s.map", basename);
+  map_file = g_file_get_child (parent, name);
+
+  ret = g_file_replace_contents (map_file,
+                                 contents,
+                                 strlen (contents),
+                                 NULL, /* etag */
+                                 FALSE, /* make_backup */
+                                 G_FILE_CREATE_NONE,
+                                 NULL, /* new_etag */
+                                 NULL, /* cancellable */
+                                 error);
+
+  g_object_unref (map_file);
+  g_free (name);
+  g_free (basename);
+  g_object_unref (parent);
+  g_free (contents);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* How often the checkpoint journal is updated */
+#define CHECKPOINT_INTERVAL_USEC (10 * G_USEC_PER_SEC)
+
+static const gchar *
+get_device_serial (DialogData *data)
+{
+  if (data->drive != NULL)
+    return udisks_drive_get_serial (data->drive);
+  return NULL;
+}
+
+/* Records that everything before @offset is in the disk image */
+static gboolean
+write_checkpoint (DialogData        *data,
+                  gint               image_fd,
+                  guint64            offset,
+                  GduImageChecksum  *checksum,
+                  GError           **error)
+{
+  GduCheckpoint *checkpoint = data->checkpoint;
+  gchar *contents = NULL;
+  gsize length;
+  gboolean ret = FALSE;
+
+  /* The journal must never claim data that isn't on disk yet */
+  if (!g_output_stream_flush (G_OUTPUT_STREAM (data->output_file_stream), NULL, error))
+    goto out;
+  if (fdatasync (image_fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", strerror (errno));
+      goto out;
+    }
+
+  g_mutex_lock (&data->copy_lock);
+  checkpoint->offset = offset;
+  if (checksum != NULL)
+    {
+      g_strfreev (checkpoint->checksum_block_digests);
+      checkpoint->checksum_block_size = gdu_image_checksum_get_block_size (checksum);
+      checkpoint->checksum_block_digests = gdu_image_checksum_dup_block_digests (checksum);
+    }
+  contents = gdu_checkpoint_to_data (checkpoint, data->bad_blocks, &length);
+  g_mutex_unlock (&data->copy_lock);
+
+  if (!g_file_replace_contents (data->checkpoint_file,
+                                contents,
+                                length,
+                                NULL, /* etag */
+                                FALSE, /* make_backup */
+                                G_FILE_CREATE_NONE,
+                                NULL, /* new_etag */
+                                NULL, /* cancellable */
+                                error))
+    goto out;
+
+  data->checkpoint_saved = TRUE;
+  ret = TRUE;
+
+ out:
+  g_free (contents);
+  return ret;
+}
+
+/* Hashes the first @size bytes of the disk image file */
+static gboolean
+checksum_image_file (DialogData        *data,
+                     GduImageChecksum  *checksum,
+                     guint64            size,
+                     GError           **error)
+{
+  GFileInputStream *input_stream;
+  guchar *buffer;
+  guint64 offset = 0;
+  gboolean ret = FALSE;
+
+  input_stream = g_file_read (data->output_file, data->cancellable, error);
+  if (input_stream == NULL)
+    return FALSE;
+
+  buffer = g_malloc (MAX_CHUNK_SIZE);
+  while (offset < size)
+    {
+      gsize num_bytes_to_read = MIN (MAX_CHUNK_SIZE, size - offset);
+      gssize num_bytes_read;
+
+      num_bytes_read = g_input_stream_read (G_INPUT_STREAM (input_stream),
+                                            buffer,
+                                            num_bytes_to_read,
+                                            data->cancellable,
+                                            error);
+      if (num_bytes_read < 0)
+        goto out;
+
+      /* a sparse image may not have been extended over its last holes yet */
+      if (num_bytes_read == 0)
+        {
+          memset (buffer, 0, num_bytes_to_read);
+          num_bytes_read = num_bytes_to_read;
+        }
+
+      gdu_image_checksum_update (checksum, buffer, num_bytes_read);
+      offset += num_bytes_read;
+    }
+
+  ret = TRUE;
+
+ out:
+  g_free (buffer);
+  g_object_unref (input_stream);
+  return ret;
+}
+
+/* The state of a GChecksum can't be saved so when resuming, the part
+ * of the disk image that is already there is hashed again. This reads
+ * the local file, not the device, and the block checksums in the
+ * checkpoint tell if the file was changed in the meantime.
+ */
+static gboolean
+checksum_existing_image (DialogData        *data,
+                         GduImageChecksum  *checksum,
+                         GError           **error)
+{
+  GduCheckpoint *checkpoint = data->checkpoint;
+  gchar **digests = NULL;
+  gboolean ret = FALSE;
+  guint n;
+
+  g_mutex_lock (&data->copy_lock);
+  data->checking_image = TRUE;
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+
+  if (!checksum_image_file (data, checksum, checkpoint->offset, error))
+    goto out;
+
+  if (checkpoint->checksum_block_digests != NULL &&
+      checkpoint->checksum_block_size == gdu_image_checksum_get_block_size (checksum))
+    {
+      digests = gdu_image_checksum_dup_block_digests (checksum);
+      for (n = 0; digests[n] != NULL && checkpoint->checksum_block_digests[n] != NULL; n++)
+        {
+          if (g_strcmp0 (digests[n], checkpoint->checksum_block_digests[n]) != 0)
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("The disk image was modified after it was interrupted"));
+              goto out;
+            }
+        }
+    }
+
+  ret = TRUE;
+
+ out:
+  g_strfreev (digests);
+  g_mutex_lock (&data->copy_lock);
+  data->checking_image = FALSE;
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+  return ret;
+}
+
+/* The second pass over the data that was skipped after read errors
+ * the first time around, see complete_read()
+ */
+static gboolean
+recover_untried_spans (DialogData     *data,
+                       gint            fd,
+                       GduDVDSupport  *dvd_support,
+                       guint           sector_size,
+                       GOutputStream  *output_stream,
+                       gint            image_fd,
+                       guint64         checkpoint_offset,
+                       GError        **error)
+{
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  long page_size;
+  gint64 last_checkpoint_usec;
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&data->copy_lock);
+  data->recovering = TRUE;
+  /* the block checksums in the checkpoint won't match anymore */
+  if (data->checkpoint != NULL)
+    {
+      g_strfreev (data->checkpoint->checksum_block_digests);
+      data->checkpoint->checksum_block_digests = NULL;
+    }
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+
+  /* aligned for O_DIRECT */
+  page_size = sysconf (_SC_PAGESIZE);
+  buffer_unaligned = g_new0 (guchar, MAX_CHUNK_SIZE + page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+
+  last_checkpoint_usec = g_get_monotonic_time ();
+  while (TRUE)
+    {
+      GError *recover_error = NULL;
+      guint64 offset;
+      guint64 length;
+      gboolean found;
+
+      g_mutex_lock (&data->copy_lock);
+      found = gdu_bad_block_map_find (data->bad_blocks, GDU_BLOCK_STATE_UNTRIED, &offset, &length);
+      g_mutex_unlock (&data->copy_lock);
+      if (!found)
+        break;
+
+      length = MIN (length, MAX_CHUNK_SIZE);
+      recover_span (data, fd, dvd_support, sector_size, offset, length, buffer, &recover_error);
+
+      /* Even if cancelled half-way, what was recovered is written -
+       * the rest is still zeroes
+       */
+      if (!write_span (output_stream, offset, buffer, length, NULL, error))
+        {
+          g_clear_error (&recover_error);
+          goto out;
+        }
+      if (recover_error != NULL)
+        {
+          g_propagate_error (error, recover_error);
+          goto out;
+        }
+
+      if (data->checkpoint != NULL &&
+          g_get_monotonic_time () - last_checkpoint_usec > CHECKPOINT_INTERVAL_USEC)
+        {
+          if (!write_checkpoint (data, image_fd, checkpoint_offset, NULL, error))
+            {
+              g_prefix_error (error, _("Error writing checkpoint file: "));
+              goto out;
+            }
+          last_checkpoint_usec = g_get_monotonic_time ();
+        }
+    }
+
+  ret = TRUE;
+
+ out:
+  g_free (buffer_unaligned);
+  g_mutex_lock (&data->copy_lock);
+  data->recovering = FALSE;
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* How much copy_file_range() is asked to copy at a time, so progress
+ * is reported and cancellation is honored
+ */
+#define CLONE_CHUNK_SIZE (256 * 1024 * 1024)
+
+/* Copies the part of the backing file the loop device maps, from
+ * @offset in the file, to the disk image in the kernel. Holes in the
+ * backing file are skipped, they are zeroes anyway.
+ *
+ * Returns: FALSE with @error set on error or FALSE without @error if
+ * copy_file_range() doesn't work for these files.
+ */
+static gboolean
+copy_backing_file_range (DialogData  *data,
+                         gint         backing_fd,
+                         guint64      offset,
+                         gint         image_fd,
+                         guint64      size,
+                         GError     **error)
+{
+#if defined(HAVE_COPY_FILE_RANGE)
+  gint64 last_update_usec = -1;
+  guint64 num_bytes_completed = 0;
+  guint64 num_bytes_copied_total = 0;
+  guint64 data_end = 0;
+
+  g_mutex_lock (&data->copy_lock);
+  data->estimator = gdu_estimator_new (size);
+  data->update_id = 0;
+  g_mutex_unlock (&data->copy_lock);
+
+  while (num_bytes_completed < size)
+    {
+      loff_t in_offset;
+      loff_t out_offset;
+      ssize_t num_bytes_copied;
+      gint64 now_usec;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          if (num_bytes_completed > 0)
+            gdu_estimator_add_sample (data->estimator, num_bytes_completed);
+          if (data->update_id == 0)
+            data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+        return FALSE;
+
+      /* Skip to the next data extent once we're through the current one */
+      if (num_bytes_completed >= data_end)
+        {
+          off_t data_start = lseek (backing_fd, offset + num_bytes_completed, SEEK_DATA);
+          off_t hole_start;
+
+          if (data_start == (off_t) -1 && errno == ENXIO)
+            break; /* only a hole left */
+          if (data_start == (off_t) -1 ||
+              (hole_start = lseek (backing_fd, data_start, SEEK_HOLE)) == (off_t) -1)
+            {
+              /* not supported, just copy everything */
+              data_start = offset + num_bytes_completed;
+              hole_start = offset + size;
+            }
+          num_bytes_completed = MIN ((guint64) data_start - offset, size);
+          data_end = MIN ((guint64) hole_start - offset, size);
+          continue;
+        }
+
+      in_offset = offset + num_bytes_completed;
+      out_offset = num_bytes_completed;
+      num_bytes_copied = copy_file_range (backing_fd, &in_offset,
+                                          image_fd, &out_offset,
+                                          MIN (CLONE_CHUNK_SIZE, data_end - num_bytes_completed),
+                                          0);
+      if (num_bytes_copied < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          /* e.g. different filesystems or an older kernel - nothing's been copied yet */
+          if (num_bytes_copied_total == 0 &&
+              (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+            {
+              g_mutex_lock (&data->copy_lock);
+              g_clear_object (&data->estimator);
+              g_mutex_unlock (&data->copy_lock);
+              return FALSE;
+            }
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error copying %" G_GUINT64_FORMAT " bytes from the backing file at offset %" G_GUINT64_FORMAT ": %m",
+                       data_end - num_bytes_completed,
+                       (guint64) in_offset);
+          return FALSE;
+        }
+      if (num_bytes_copied == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Copying from the backing file at offset %" G_GUINT64_FORMAT " returned zero bytes",
+                       (guint64) in_offset);
+          return FALSE;
+        }
+      num_bytes_completed += num_bytes_copied;
+      num_bytes_copied_total += num_bytes_copied;
+    }
+
+  /* The last blocks may have been holes */
+  if (ftruncate (image_fd, size) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", strerror (errno));
+      g_prefix_error (error, _("Error setting size of disk image file: "));
+      return FALSE;
+    }
+
+  /* Like a block copy, a non-sparse image gets all its blocks allocated */
+  if (!data->sparse && fallocate (image_fd, 0, 0, size) != 0 && errno != ENOSYS && errno != EOPNOTSUPP)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno), "%s", strerror (errno));
+      g_prefix_error (error, _("Error allocating space for disk image file: "));
+      return FALSE;
+    }
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Hashes @size bytes at @offset of the backing file, see clone_backing_file() */
+static gboolean
+checksum_backing_file (DialogData        *data,
+                       gint               backing_fd,
+                       guint64            offset,
+                       guint64            size,
+                       GduImageChecksum  *checksum,
+                       GError           **error)
+{
+  guchar *buffer;
+  guint64 num_bytes_completed = 0;
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&data->copy_lock);
+  data->computing_checksum = TRUE;
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+
+  buffer = g_malloc (MAX_CHUNK_SIZE);
+  while (num_bytes_completed < size)
+    {
+      gsize num_bytes_to_read = MIN (MAX_CHUNK_SIZE, size - num_bytes_completed);
+      ssize_t num_bytes_read;
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+        goto out;
+
+      num_bytes_read = pread (backing_fd, buffer, num_bytes_to_read, offset + num_bytes_completed);
+      if (num_bytes_read < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error reading %" G_GSIZE_FORMAT " bytes from the backing file at offset %" G_GUINT64_FORMAT ": %m",
+                       num_bytes_to_read,
+                       offset + num_bytes_completed);
+          goto out;
+        }
+      if (num_bytes_read == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Reading from the backing file at offset %" G_GUINT64_FORMAT " returned zero bytes",
+                       offset + num_bytes_completed);
+          goto out;
+        }
+
+      gdu_image_checksum_update (checksum, buffer, num_bytes_read);
+      num_bytes_completed += num_bytes_read;
+    }
+
+  ret = TRUE;
+
+ out:
+  g_free (buffer);
+  g_mutex_lock (&data->copy_lock);
+  data->computing_checksum = FALSE;
+  g_mutex_unlock (&data->copy_lock);
+  g_idle_add (on_update_job, dialog_data_ref (data));
+  return ret;
+}
+
+/* If the device is a loop device, the part of its backing file it
+ * maps can be copied straight to the disk image instead of through the
+ * block layer. On filesystems with reflinks (e.g. btrfs and XFS) the
+ * disk image then shares its blocks with the backing file and nothing
+ * is copied at all - otherwise copy_file_range() at least keeps the
+ * data in the kernel.
+ *
+ * Returns: FALSE with @error set on error or FALSE without @error if
+ * the device has to be copied the usual way.
+ */
+static gboolean
+clone_backing_file (DialogData         *data,
+                    gint                fd,
+                    gint                image_fd,
+                    guint64             size,
+                    GduImageChecksum  **out_checksum,
+                    GError            **error)
+{
+  UDisksLoop *loop;
+  struct loop_info64 info;
+  struct stat statbuf;
+  gint backing_fd = -1;
+  gboolean ret = FALSE;
+
+  loop = udisks_object_peek_loop (data->object);
+  if (loop == NULL || strlen (udisks_loop_get_backing_file (loop)) == 0)
+    goto out;
+
+  /* The loop device may only map part of the file */
+  memset (&info, 0, sizeof (info));
+  if (ioctl (fd, LOOP_GET_STATUS64, &info) != 0)
+    goto out;
+
+  /* Make sure it's still the same file, e.g. it may have been replaced */
+  backing_fd = open (udisks_loop_get_backing_file (loop), O_RDONLY | O_CLOEXEC);
+  if (backing_fd == -1)
+    goto out;
+  if (fstat (backing_fd, &statbuf) != 0 ||
+      (guint64) statbuf.st_dev != info.lo_device ||
+      (guint64) statbuf.st_ino != info.lo_inode ||
+      (guint64) statbuf.st_size < info.lo_offset + size)
+    goto out;
+
+  /* Anything still cached for the loop device goes to the file first */
+  if (fsync (fd) != 0)
+    goto out;
+
+#if defined(FICLONERANGE)
+  {
+    struct file_clone_range range;
+
+    range.src_fd = backing_fd;
+    range.src_offset = info.lo_offset;
+    range.src_length = size;
+    range.dest_offset = 0;
+    if (ioctl (image_fd, FICLONERANGE, &range) == 0)
+      ret = TRUE;
+  }
+#endif
+
+  if (!ret && !copy_backing_file_range (data, backing_fd, info.lo_offset, image_fd, size, error))
+    goto out;
+
+  /* The image is the same as the backing file, read that */
+  if (data->checksum)
+    {
+      *out_checksum = gdu_image_checksum_new (GDU_IMAGE_CHECKSUM_BLOCK_SIZE);
+      if (!checksum_backing_file (data, backing_fd, info.lo_offset, size, *out_checksum, error))
+        goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  if (backing_fd != -1)
+    close (backing_fd);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Copies from the device to the disk image without the data going
+ * through userspace, see gdukernelcopy.c - for plain copies where
+ * nothing needs to look at the data. Stops at the first problem, e.g.
+ * a read error, and leaves the rest to the usual copy which knows how
+ * to deal with it.
+ *
+ * Returns: FALSE only if canceled or if the checkpoint couldn't be written.
+ */
+static gboolean
+copy_in_kernel (DialogData  *data,
+                gint         fd,
+                gint         image_fd,
+                guint64      size,
+                guint64     *inout_offset,
+                GError     **error)
+{
+  GduKernelCopy *copy;
+  GError *copy_error = NULL;
+  gint64 last_update_usec = -1;
+  gint64 last_checkpoint_usec;
+  guint64 writeback_offset;
+  guint64 offset = *inout_offset;
+  gboolean ret = FALSE;
+
+  copy = gdu_kernel_copy_new (fd, image_fd);
+  writeback_offset = offset;
+  last_checkpoint_usec = g_get_monotonic_time ();
+  while (offset < size)
+    {
+      gssize num_bytes_copied;
+      gint64 now_usec;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          if (offset > *inout_offset)
+            gdu_estimator_add_sample (data->estimator, offset);
+          if (data->update_id == 0)
+            data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, error))
+        goto out;
+
+      num_bytes_copied = gdu_kernel_copy_copy (copy, offset, offset,
+                                               MIN (4 * MAX_CHUNK_SIZE, size - offset),
+                                               &copy_error);
+      if (num_bytes_copied <= 0)
+        {
+          g_clear_error (&copy_error);
+          break;
+        }
+
+      if (data->direct_io)
+        {
+          gdu_utils_drop_page_cache (fd, offset, num_bytes_copied, FALSE);
+          gdu_utils_throttle_writeback (image_fd, &writeback_offset, offset + num_bytes_copied);
+        }
+      offset += num_bytes_copied;
+
+      /* Share the bandwidth of the controller with the other copies */
+      if (data->scheduler != NULL &&
+          !gdu_copy_scheduler_throttle (data->scheduler,
+                                        data->controller,
+                                        num_bytes_copied,
+                                        data->cancellable,
+                                        error))
+        goto out;
+
+      if (data->checkpoint != NULL && now_usec - last_checkpoint_usec > CHECKPOINT_INTERVAL_USEC)
+        {
+          if (!write_checkpoint (data, image_fd, offset, NULL, error))
+            {
+              g_prefix_error (error, _("Error writing checkpoint file: "));
+              goto out;
+            }
+          last_checkpoint_usec = now_usec;
+        }
+    }
+
+  ret = TRUE;
+
+ out:
+  *inout_offset = offset;
+  gdu_kernel_copy_free (copy);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gpointer
+copy_thread_func (gpointer user_data)
+{
+  DialogData *data = user_data;
+  GduDVDSupport *dvd_support = NULL;
+  GduUsedBlocks *used_blocks = NULL;
+  GduCopyRing *ring = NULL;
+  GduChunkSizer *sizer = NULL;
+  GduImageChecksum *checksum = NULL;
+  GduCopyBuffer *buffer;
+  ReaderData reader = {0};
+  GThread *reader_thread = NULL;
+  GOutputStream *output_stream = NULL;
+  guint64 block_device_size = 0;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  gint64 last_update_usec = -1;
+  gint64 last_checkpoint_usec;
+  gint fd = -1;
+  gint image_fd = -1;
+  guint64 writeback_offset = 0;
+  guint64 start_offset = 0;
+  guint64 resume_offset = 0;
+  guint64 num_bytes_completed = 0;
+  gint sector_size = 0;
+  gboolean in_recovery = FALSE;
+  gboolean keep_image = FALSE;
+  guint64 num_scheduled_bytes = 0;
+
+  /* Most OSes put ACLs for logged-in users on /dev/sr* nodes (this is
+   * so CD burning tools etc. work) so see if we can open the device
+   * file ourselves. If so, great, since this avoids a polkit dialog.
+   *
+   * As opposed to udisks' OpenForBackup() we also avoid O_EXCL since
+   * the disc is read-only by its very nature. As a side-effect this
+   * allows creating a disk image of a mounted disc.
+   */
+  if (g_str_has_prefix (udisks_block_get_device (data->block), "/dev/sr"))
+    {
+      const gchar *device_file = udisks_block_get_device (data->block);
+      fd = open (device_file, O_RDONLY);
+
+      /* Use libdvdcss (if available on the system) on DVDs with UDF
+       * filesystems - otherwise the backup process may fail because
+       * of unreadable/scrambled sectors
+       */
+      if (g_strcmp0 (udisks_block_get_id_usage (data->block), "filesystem") == 0 &&
+          g_strcmp0 (udisks_block_get_id_type (data->block), "udf") == 0 &&
+          g_str_has_prefix (udisks_drive_get_media (data->drive), "optical_dvd"))
+        {
+          g_mutex_lock (&data->copy_lock);
+          data->retrieving_dvd_keys = TRUE;
+          g_mutex_unlock (&data->copy_lock);
+          g_idle_add (on_update_job, dialog_data_ref (data));
+
+          dvd_support = gdu_dvd_support_new (device_file, udisks_block_get_size (data->block));
+
+          g_mutex_lock (&data->copy_lock);
+          data->retrieving_dvd_keys = FALSE;
+          g_mutex_unlock (&data->copy_lock);
+          g_idle_add (on_update_job, dialog_data_ref (data));
+        }
+    }
+
+  /* Otherwise, request the fd from udisks */
+  if (fd == -1)
+    {
+      GUnixFDList *fd_list = NULL;
+      GVariant *fd_index = NULL;
+      if (!udisks_block_call_open_for_backup_sync (data->block,
+                                                   g_variant_new ("a{sv}", NULL), /* options */
+                                                   NULL, /* fd_list */
+                                                   &fd_index,
+                                                   &fd_list,
+                                                   NULL, /* cancellable */
+                                                   &error))
+        goto out;
+
+      fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), &error);
+      if (error != NULL)
+        {
+          g_prefix_error (&error,
+                          "Error extracing fd with handle %d from D-Bus message: ",
+                          g_variant_get_handle (fd_index));
+          goto out;
+        }
+      if (fd_index != NULL)
+        g_variant_unref (fd_index);
+      g_clear_object (&fd_list);
+    }
+
+  g_assert (fd != -1);
+
+  /* We can't use udisks_block_get_size() because the media may have
+   * changed and udisks may not have noticed. TODO: maybe have a
+   * Block.GetSize() method instead...
+   */
+  if (ioctl (fd, BLKGETSIZE64, &block_device_size) != 0)
+    {
+      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
+                           "%s", strerror (errno));
+      g_prefix_error (&error, _("Error determining size of device: "));
+      goto out;
+    }
+
+  if (block_device_size == 0)
+    {
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Device is size 0"));
+      goto out;
+    }
+
+  /* the unit read errors are narrowed down to */
+  if (ioctl (fd, BLKSSZGET, &sector_size) != 0 || sector_size < 512)
+    sector_size = 512;
+
+  /* The filesystem is unmounted by now, so its allocation bitmaps are
+   * up to date. If they can't be used, just copy everything.
+   */
+  if (data->used_blocks_only && dvd_support == NULL)
+    {
+      used_blocks = gdu_used_blocks_new_for_fd (fd, block_device_size, &error2);
+      if (used_blocks == NULL)
+        {
+          g_warning ("Error finding the used blocks, copying all of the device: %s (%s, %d)",
+                     error2->message, g_quark_to_string (error2->domain), error2->code);
+          g_clear_error (&error2);
+        }
+    }
+
+  if (G_IS_FILE_DESCRIPTOR_BASED (data->output_file_stream))
+    image_fd = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (data->output_file_stream));
+
+  /* A resumed copy continues where the checkpoint says. Otherwise
+   * start a new checkpoint journal if the disk image is a local file
+   * that can be picked up in the middle, e.g. not compressed.
+   */
+  if (data->resume)
+    {
+      if (data->checkpoint->device_size != block_device_size)
+        {
+          error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                               _("The device has changed since the disk image was interrupted"));
+          goto out;
+        }
+      if (image_fd == -1)
+        {
+          error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                               _("Only local disk images can be resumed"));
+          goto out;
+        }
+      start_offset = data->checkpoint->offset;
+      resume_offset = start_offset;
+      num_bytes_completed = start_offset;
+    }
+  else if (!data->compress && image_fd != -1)
+    {
+      g_mutex_lock (&data->copy_lock);
+      data->checkpoint = gdu_checkpoint_new (block_device_size, get_device_serial (data));
+      g_mutex_unlock (&data->copy_lock);
+    }
+
+  /* A disk image of a file-backed loop device is a copy of the file */
+  if (!data->compress && !data->resume && dvd_support == NULL && image_fd != -1)
+    {
+      if (clone_backing_file (data, fd, image_fd, block_device_size, &checksum, &error))
+        {
+          num_bytes_completed = block_device_size;
+          goto out;
+        }
+      if (error != NULL)
+        goto out;
+    }
+
+  /* If supported, allocate space at once to ensure blocks are laid
+   * out contigously, see http://lwn.net/Articles/226710/
+   *
+   * Not for sparse images, obviously, since that would defeat the
+   * purpose. Nor for compressed images since we don't know the size.
+   */
+  if (!data->sparse && !data->compress && image_fd != -1)
+    {
+      gint rc;
+
+      g_mutex_lock (&data->copy_lock);
+      data->allocating_file = TRUE;
+      g_mutex_unlock (&data->copy_lock);
+      g_idle_add (on_update_job, dialog_data_ref (data));
+
+      rc = fallocate (image_fd,
                       0, /* mode */
                       (off_t) 0,
                       (off_t) block_device_size);
@@ -770,78 +2134,280 @@ copy_thread_func (gpointer user_data)
       g_idle_add (on_update_job, dialog_data_ref (data));
     }
 
-  page_size = sysconf (_SC_PAGESIZE);
-  buffer_unaligned = g_new0 (guchar, buffer_size + page_size);
-  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+  /* Imaging a big disk shouldn't evict everybody else's data from
+   * the page cache. The device is read with O_DIRECT if possible -
+   * otherwise, and for the disk image file which goes through GIO,
+   * we tell the kernel we won't need the pages again.
+   */
+  if (data->direct_io)
+    {
+      if (dvd_support != NULL || !gdu_utils_set_direct_io (fd, TRUE))
+        {
+          posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+          reader.drop_cache = TRUE;
+        }
+    }
+
+  /* Chunks are sized at runtime, see gduchunksizer.c */
+  sizer = gdu_chunk_sizer_new (fd, MAX_CHUNK_SIZE);
+
+  /* Hash the chunks as they go by instead of reading everything again later */
+  if (data->checksum)
+    {
+      checksum = gdu_image_checksum_new (GDU_IMAGE_CHECKSUM_BLOCK_SIZE);
+      if (start_offset > 0 && !checksum_existing_image (data, checksum, &error))
+        goto out;
+    }
 
   g_mutex_lock (&data->copy_lock);
   data->estimator = gdu_estimator_new (block_device_size);
+  if (start_offset > 0)
+    gdu_estimator_add_sample (data->estimator, start_offset);
   data->update_id = 0;
-  data->num_error_bytes = 0;
+  data->num_error_bytes = gdu_bad_block_map_get_num_bytes (data->bad_blocks, GDU_BLOCK_STATE_UNTRIED) +
+    gdu_bad_block_map_get_num_bytes (data->bad_blocks, GDU_BLOCK_STATE_BAD);
   data->start_time_usec = g_get_real_time ();
   g_mutex_unlock (&data->copy_lock);
 
-  /* Read huge (e.g. 1 MiB) blocks and write it to the output
-   * file even if it was only partially read.
+  if (data->scheduler != NULL)
+    {
+      num_scheduled_bytes = block_device_size - start_offset;
+      gdu_copy_scheduler_add_job (data->scheduler, num_scheduled_bytes);
+    }
+
+  /* Plain copies don't need the data in userspace */
+  if (!data->compress && !data->sparse && checksum == NULL && dvd_support == NULL && image_fd != -1)
+    {
+      num_bytes_completed = start_offset;
+      if (!copy_in_kernel (data, fd, image_fd, block_device_size, &num_bytes_completed, &error))
+        goto out;
+      start_offset = num_bytes_completed;
+    }
+
+  /* When compressing, the data goes through the xz encoder on its way
+   * to the file. Since the writer consumes the chunks in order no
+   * seeking is needed on the resulting stream.
    */
-  num_bytes_completed = 0;
-  while (num_bytes_completed < block_device_size)
+  if (data->compress)
     {
-      gssize num_bytes_to_read;
-      gssize num_bytes_read;
-      gint64 now_usec;
+      GduXzCompressor *compressor = gdu_xz_compressor_new ();
+      output_stream = g_converter_output_stream_new (G_OUTPUT_STREAM (data->output_file_stream),
+                                                     G_CONVERTER (compressor));
+      g_filter_output_stream_set_close_base_stream (G_FILTER_OUTPUT_STREAM (output_stream), FALSE);
+      g_object_unref (compressor);
+    }
+  else
+    {
+      output_stream = g_object_ref (data->output_file_stream);
+    }
 
-      num_bytes_to_read = buffer_size;
-      if (num_bytes_to_read + num_bytes_completed > block_device_size)
-        num_bytes_to_read = block_device_size - num_bytes_completed;
+  /* Keep a handful of buffers in flight so the device never waits
+   * for the output file and vice versa - half of them are being read
+   * into at any given time
+   */
+  ring = gdu_copy_ring_new (2 * READ_QUEUE_DEPTH, MAX_CHUNK_SIZE);
+  reader.data = data;
+  reader.ring = ring;
+  reader.sizer = sizer;
+  reader.fd = fd;
+  reader.dvd_support = dvd_support;
+  reader.used_blocks = used_blocks;
+  reader.sector_size = sector_size;
+  reader.start = start_offset;
+  reader.size = block_device_size;
+  reader.skip_errors = !data->compress;
+  reader.skip_size = MIN_SKIP_SIZE;
+  reader_thread = g_thread_new ("create-disk-image-reader-thread",
+                                reader_thread_func,
+                                &reader);
+
+  num_bytes_completed = start_offset;
+  writeback_offset = start_offset;
+  last_checkpoint_usec = g_get_monotonic_time ();
+  while ((buffer = gdu_copy_ring_acquire_filled (ring)) != NULL)
+    {
+      gint64 now_usec;
 
       /* Update GUI - but only every 200 ms and only if last update isn't pending */
       g_mutex_lock (&data->copy_lock);
       now_usec = g_get_monotonic_time ();
       if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
         {
-          if (num_bytes_completed > 0)
-            gdu_estimator_add_sample (data->estimator, num_bytes_completed);
+          if (num_bytes_completed > start_offset)
+            {
+              gdu_estimator_add_sample (data->estimator, num_bytes_completed);
+              gdu_chunk_sizer_update (sizer, data->estimator);
+            }
           if (data->update_id == 0)
             data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
           last_update_usec = now_usec;
         }
       g_mutex_unlock (&data->copy_lock);
 
-      num_bytes_read = copy_span (fd,
-                                  G_OUTPUT_STREAM (data->output_file_stream),
-                                  num_bytes_completed,
-                                  num_bytes_to_read,
-                                  buffer,
-                                  TRUE, /* pad_with_zeroes */
-                                  dvd_support,
-                                  data->cancellable,
-                                  &error);
-      if (num_bytes_read < 0)
+      /* In sparse mode, just leave a hole in the output file for
+       * blocks that are all zeroes
+       */
+      if (!(data->sparse && gdu_utils_is_zeroed (buffer->data, buffer->length)))
+        {
+          if (!write_span (output_stream,
+                           buffer->offset,
+                           buffer->data,
+                           buffer->length,
+                           data->cancellable,
+                           &error))
+            goto out;
+        }
+
+      if (checksum != NULL)
+        gdu_image_checksum_update (checksum, buffer->data, buffer->length);
+
+      /* Share the bandwidth of the controller with the other copies */
+      if (data->scheduler != NULL &&
+          !gdu_copy_scheduler_throttle (data->scheduler,
+                                        data->controller,
+                                        buffer->length,
+                                        data->cancellable,
+                                        &error))
         goto out;
 
-      /*g_print ("read %" G_GUINT64_FORMAT " bytes (requested %" G_GUINT64_FORMAT ") from offset %" G_GUINT64_FORMAT "\n",
-               num_bytes_read,
-               num_bytes_to_read,
-               num_bytes_completed);*/
+      if (data->direct_io && image_fd != -1)
+        gdu_utils_throttle_writeback (image_fd,
+                                      &writeback_offset,
+                                      g_seekable_tell (G_SEEKABLE (data->output_file_stream)));
+
+      num_bytes_completed += buffer->length;
+      gdu_copy_ring_release (ring, buffer);
+
+      if (data->checkpoint != NULL && now_usec - last_checkpoint_usec > CHECKPOINT_INTERVAL_USEC)
+        {
+          if (!write_checkpoint (data, image_fd, num_bytes_completed, checksum, &error))
+            {
+              g_prefix_error (&error, _("Error writing checkpoint file: "));
+              goto out;
+            }
+          last_checkpoint_usec = now_usec;
+        }
+    }
+
+  /* The first pass is done, unless the reader failed */
+  g_thread_join (reader_thread);
+  reader_thread = NULL;
+  if (reader.error != NULL)
+    {
+      error = reader.error;
+      reader.error = NULL;
+      goto out;
+    }
+
+  /* Go back to what was skipped because of read errors */
+  if (gdu_bad_block_map_get_num_bytes (data->bad_blocks, GDU_BLOCK_STATE_UNTRIED) > 0)
+    {
+      guint64 num_error_bytes = data->num_error_bytes;
+
+      in_recovery = TRUE;
+      if (!recover_untried_spans (data,
+                                  fd,
+                                  dvd_support,
+                                  sector_size,
+                                  output_stream,
+                                  image_fd,
+                                  num_bytes_completed,
+                                  &error))
+        goto out;
 
-      if (num_bytes_read < num_bytes_to_read)
+      /* the checksum is of the zeroes that used to be there */
+      if (checksum != NULL && data->num_error_bytes < num_error_bytes)
         {
-          guint64 num_bytes_skipped = num_bytes_to_read - num_bytes_read;
+          gdu_image_checksum_free (checksum);
+          checksum = gdu_image_checksum_new (GDU_IMAGE_CHECKSUM_BLOCK_SIZE);
+
+          g_mutex_lock (&data->copy_lock);
+          data->computing_checksum = TRUE;
+          g_mutex_unlock (&data->copy_lock);
+          g_idle_add (on_update_job, dialog_data_ref (data));
+
+          if (!checksum_image_file (data, checksum, block_device_size, &error))
+            goto out;
+
           g_mutex_lock (&data->copy_lock);
-          data->num_error_bytes += num_bytes_skipped;
+          data->computing_checksum = FALSE;
           g_mutex_unlock (&data->copy_lock);
+          g_idle_add (on_update_job, dialog_data_ref (data));
+        }
+      in_recovery = FALSE;
+    }
+
+  /* Extend the file to the full size in case the last blocks were holes */
+  if (data->sparse && !gdu_copy_ring_is_aborted (ring))
+    {
+      if (!g_seekable_truncate (G_SEEKABLE (data->output_file_stream),
+                                block_device_size,
+                                data->cancellable,
+                                &error))
+        {
+          g_prefix_error (&error, _("Error setting size of disk image file: "));
+          goto out;
         }
-      num_bytes_completed += num_bytes_to_read;
     }
 
  out:
+  if (reader_thread != NULL)
+    {
+      /* no-op if the reader already finished */
+      gdu_copy_ring_abort (ring);
+      g_thread_join (reader_thread);
+      if (error == NULL)
+        error = reader.error;
+      else
+        g_clear_error (&reader.error);
+    }
+  if (ring != NULL)
+    gdu_copy_ring_free (ring);
+  if (sizer != NULL)
+    gdu_chunk_sizer_free (sizer);
+  if (used_blocks != NULL)
+    gdu_used_blocks_free (used_blocks);
   if (dvd_support != NULL)
     gdu_dvd_support_free (dvd_support);
 
   data->end_time_usec = g_get_real_time ();
 
-  /* in either case, close the stream */
+  /* If the copy can be resumed, keep what was copied so far. The
+   * checkpoint of a resumed copy is left alone until the copy got past
+   * it - e.g. the checksum may only be half-way through the image.
+   */
+  if (error != NULL && data->checkpoint_saved)
+    {
+      if ((num_bytes_completed > resume_offset || in_recovery) &&
+          !write_checkpoint (data, image_fd, num_bytes_completed, in_recovery ? NULL : checksum, &error2))
+        {
+          g_warning ("Error updating checkpoint: %s (%s, %d)",
+                     error2->message, g_quark_to_string (error2->domain), error2->code);
+          g_clear_error (&error2);
+        }
+      keep_image = TRUE;
+    }
+
+  /* in either case, close the streams - this also finishes the xz
+   * stream if compressing
+   */
+  if (output_stream != NULL)
+    {
+      if (!g_output_stream_close (output_stream,
+                                  NULL, /* cancellable */
+                                  &error2))
+        {
+          if (error == NULL)
+            {
+              error = error2; error2 = NULL;
+              g_prefix_error (&error, _("Error finishing disk image file: "));
+            }
+          g_clear_error (&error2);
+        }
+      g_clear_object (&output_stream);
+    }
+  if (data->direct_io && image_fd != -1 && error == NULL)
+    gdu_utils_drop_page_cache (image_fd, 0, 0, TRUE);
   if (!g_output_stream_close (G_OUTPUT_STREAM (data->output_file_stream),
                               NULL, /* cancellable */
                               &error2))
@@ -852,6 +2418,30 @@ copy_thread_func (gpointer user_data)
     }
   g_clear_object (&data->output_file_stream);
 
+  if (checksum != NULL)
+    {
+      if (error == NULL && !write_checksum_file (data, checksum, &error))
+        g_prefix_error (&error, _("Error writing checksum file: "));
+      gdu_image_checksum_free (checksum);
+    }
+
+  /* Leave a record of the read errors, so the device can be looked
+   * at without reading it all again
+   */
+  if ((error == NULL || keep_image) && data->num_error_bytes > 0)
+    {
+      if (!write_map_file (data, block_device_size, num_bytes_completed, &error2))
+        {
+          g_warning ("Error writing map file: %s (%s, %d)",
+                     error2->message, g_quark_to_string (error2->domain), error2->code);
+          g_clear_error (&error2);
+        }
+    }
+
+  if (num_scheduled_bytes > 0)
+    gdu_copy_scheduler_finish_job (data->scheduler,
+                                   error != NULL ? block_device_size - num_bytes_completed : 0);
+
   if (error != NULL)
     {
       /* show error in GUI */
@@ -863,7 +2453,7 @@ copy_thread_func (gpointer user_data)
       g_clear_error (&error);
 
       /* Cleanup */
-      if (!g_file_delete (data->output_file, NULL, &error))
+      if (!keep_image && !g_file_delete (data->output_file, NULL, &error))
         {
           g_warning ("Error deleting file: %s (%s, %d)",
                      error->message, g_quark_to_string (error->domain), error->code);
@@ -872,7 +2462,9 @@ copy_thread_func (gpointer user_data)
     }
   else
     {
-      /* success */
+      /* success - the checkpoint isn't needed anymore */
+      if (data->checkpoint_saved)
+        g_file_delete (data->checkpoint_file, NULL, NULL);
       g_idle_add (on_success, dialog_data_ref (data));
     }
   if (fd != -1 )
@@ -881,14 +2473,19 @@ copy_thread_func (gpointer user_data)
         g_warning ("Error closing fd: %m");
     }
 
-  g_free (buffer_unaligned);
-
   dialog_data_unref_in_idle (data); /* unref on main thread */
   return NULL;
 }
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static gboolean
+get_resume (DialogData *data)
+{
+  return gtk_widget_get_visible (data->resume_checkbutton) &&
+    gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->resume_checkbutton));
+}
+
 /* returns TRUE if OK to overwrite or file doesn't exist */
 static gboolean
 check_overwrite (DialogData *data)
@@ -954,46 +2551,106 @@ on_local_job_canceled (GduLocalJob  *job,
     }
 }
 
-static gboolean
-start_copying (DialogData *data)
+/* Takes the options from the dialog */
+static void
+get_options (DialogData *data)
 {
-  gboolean ret = TRUE;
   const gchar *name;
   GFile *folder;
-  GError *error;
 
   name = gtk_entry_get_text (GTK_ENTRY (data->name_entry));
   folder = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (data->folder_fcbutton));
 
-  error = NULL;
+  data->compress = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->compress_checkbutton));
+  data->used_blocks_only = gtk_widget_get_visible (data->used_blocks_checkbutton) &&
+    gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->used_blocks_checkbutton));
+  /* the free space is left as holes */
+  data->sparse = !data->compress &&
+    (data->used_blocks_only || gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->sparse_checkbutton)));
+  data->direct_io = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->direct_io_checkbutton));
+  data->checksum = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->checksum_checkbutton));
+  data->resume = get_resume (data);
   data->output_file = g_file_get_child (folder, name);
-  data->output_file_stream = g_file_replace (data->output_file,
-                                             NULL, /* etag */
-                                             FALSE, /* make_backup */
-                                             G_FILE_CREATE_NONE,
-                                             NULL,
-                                             &error);
+  g_object_unref (folder);
+}
+
+static gboolean
+start_copying (DialogData *data)
+{
+  gboolean ret = TRUE;
+  GFile *folder;
+  GError *error = NULL;
+
+  data->checkpoint_file = gdu_checkpoint_get_file_for_image (data->output_file);
+  if (data->resume)
+    {
+      /* Continue writing to the existing file instead of truncating it */
+      data->checkpoint = gdu_checkpoint_load (data->checkpoint_file, data->bad_blocks, &error);
+      if (data->checkpoint != NULL && g_strcmp0 (data->checkpoint->device_serial, get_device_serial (data)) != 0)
+        {
+          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       _("The interrupted disk image is of a different device"));
+        }
+      else if (data->checkpoint != NULL)
+        {
+          data->output_io_stream = g_file_open_readwrite (data->output_file, NULL, &error);
+          if (data->output_io_stream != NULL)
+            data->output_file_stream = g_object_ref (g_io_stream_get_output_stream (G_IO_STREAM (data->output_io_stream)));
+          data->checkpoint_saved = TRUE;
+        }
+    }
+  else if (data->task != NULL)
+    {
+      /* Nobody to ask about overwriting files */
+      data->output_file_stream = g_file_create (data->output_file,
+                                                G_FILE_CREATE_NONE,
+                                                NULL,
+                                                &error);
+    }
+  else
+    {
+      /* Replacing the disk image makes an old checkpoint useless */
+      g_file_delete (data->checkpoint_file, NULL, NULL);
+      data->output_file_stream = g_file_replace (data->output_file,
+                                                 NULL, /* etag */
+                                                 FALSE, /* make_backup */
+                                                 G_FILE_CREATE_NONE,
+                                                 NULL,
+                                                 &error);
+    }
   if (data->output_file_stream == NULL)
     {
-      gdu_utils_show_error (GTK_WINDOW (data->dialog), _("Error opening file for writing"), error);
-      g_clear_error (&error);
-      g_object_unref (folder);
+      if (data->task != NULL)
+        {
+          g_prefix_error (&error, _("Error opening file for writing: "));
+          dialog_data_return (data, error);
+        }
+      else
+        {
+          gdu_utils_show_error (GTK_WINDOW (data->dialog), _("Error opening file for writing"), error);
+          g_clear_error (&error);
+        }
       dialog_data_complete_and_unref (data);
       ret = FALSE;
       goto out;
     }
 
   /* now that we know the user picked a folder, update file chooser settings */
-  gdu_utils_file_chooser_for_disk_images_set_default_folder (folder);
+  if (data->task == NULL)
+    {
+      folder = g_file_get_parent (data->output_file);
+      gdu_utils_file_chooser_for_disk_images_set_default_folder (folder);
+      g_object_unref (folder);
+    }
 
-  data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+  data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (data->application),
                                                   GTK_WINDOW (data->dialog),
                                                   GTK_APPLICATION_INHIBIT_SUSPEND |
                                                   GTK_APPLICATION_INHIBIT_LOGOUT,
                                                   /* Translators: Reason why suspend/logout is being inhibited */
                                                   C_("create-inhibit-message", "Copying device to disk image"));
 
-  data->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
+  data->local_job = gdu_application_create_local_job (data->application,
                                                       data->object);
   udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-create-disk-image");
   /* Translators: this is the description of the job */
@@ -1011,26 +2668,61 @@ start_copying (DialogData *data)
                 dialog_data_ref (data));
 
  out:
-  g_clear_object (&folder);
   return ret;
 }
 
 static void
-ensure_unused_cb (GduWindow     *window,
+ensure_unused_cb (UDisksClient  *client,
                   GAsyncResult  *res,
                   gpointer       user_data)
 {
   DialogData *data = user_data;
-  if (gdu_window_ensure_unused_finish (window, res, NULL))
+  GError *error = NULL;
+
+  if (gdu_utils_ensure_unused_finish (client, res, &error))
     {
       start_copying (data);
     }
   else
     {
+      dialog_data_return (data, error);
       dialog_data_complete_and_unref (data);
     }
 }
 
+static void
+ensure_unused_and_start_copying (DialogData *data)
+{
+  /* If it's a optical drive, we don't need to try and
+   * manually unmount etc.  everything as we're attempting to
+   * open it O_RDONLY anyway - see copy_thread_func() for
+   * details.
+   */
+  if (g_str_has_prefix (udisks_block_get_device (data->block), "/dev/sr"))
+    {
+      start_copying (data);
+    }
+  else if (data->task != NULL)
+    {
+      /* ... nobody to show errors to, they're returned through the task */
+      gdu_utils_ensure_unused_silently (data->client,
+                                        data->object,
+                                        (GAsyncReadyCallback) ensure_unused_cb,
+                                        NULL, /* GCancellable */
+                                        data);
+    }
+  else
+    {
+      /* ensure the device is unused (e.g. unmounted) before copying data from it... */
+      gdu_utils_ensure_unused (data->client,
+                               GTK_WINDOW (data->window),
+                               data->object,
+                               (GAsyncReadyCallback) ensure_unused_cb,
+                               NULL, /* GCancellable */
+                               data);
+    }
+}
+
 static void
 on_dialog_response (GtkDialog     *dialog,
                     gint           response,
@@ -1041,26 +2733,11 @@ on_dialog_response (GtkDialog     *dialog,
   switch (response)
     {
     case GTK_RESPONSE_OK:
-      if (check_overwrite (data))
+      /* When resuming, the existing file is continued rather than replaced */
+      if (get_resume (data) || check_overwrite (data))
         {
-          /* If it's a optical drive, we don't need to try and
-           * manually unmount etc.  everything as we're attempting to
-           * open it O_RDONLY anyway - see copy_thread_func() for
-           * details.
-           */
-          if (g_str_has_prefix (udisks_block_get_device (data->block), "/dev/sr"))
-            {
-              start_copying (data);
-            }
-          else
-            {
-              /* ensure the device is unused (e.g. unmounted) before copying data from it... */
-              gdu_window_ensure_unused (data->window,
-                                        data->object,
-                                        (GAsyncReadyCallback) ensure_unused_cb,
-                                        NULL, /* GCancellable */
-                                        data);
-            }
+          get_options (data);
+          ensure_unused_and_start_copying (data);
         }
       break;
 
@@ -1075,22 +2752,36 @@ on_dialog_response (GtkDialog     *dialog,
     }
 }
 
-void
-gdu_create_disk_image_dialog_show (GduWindow    *window,
-                                   UDisksObject *object)
+static DialogData *
+dialog_data_new (GduApplication *application,
+                 GduWindow      *window,
+                 UDisksObject   *object)
 {
   DialogData *data;
-  guint n;
 
   data = g_new0 (DialogData, 1);
   data->ref_count = 1;
   g_mutex_init (&data->copy_lock);
-  data->window = g_object_ref (window);
+  data->application = g_object_ref (application);
+  data->client = g_object_ref (gdu_application_get_client (application));
+  data->window = window != NULL ? g_object_ref (window) : NULL;
   data->object = g_object_ref (object);
   data->block = udisks_object_get_block (object);
   g_assert (data->block != NULL);
-  data->drive = udisks_client_get_drive_for_block (gdu_window_get_client (window), data->block);
+  data->drive = udisks_client_get_drive_for_block (data->client, data->block);
   data->cancellable = g_cancellable_new ();
+  data->bad_blocks = gdu_bad_block_map_new ();
+  return data;
+}
+
+void
+gdu_create_disk_image_dialog_show (GduWindow    *window,
+                                   UDisksObject *object)
+{
+  DialogData *data;
+  guint n;
+
+  data = dialog_data_new (gdu_window_get_application (window), window, object);
 
   data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
                                                          "create-disk-image-dialog.ui",
@@ -1102,6 +2793,8 @@ gdu_create_disk_image_dialog_show (GduWindow    *window,
       *p = gtk_builder_get_object (data->builder, widget_mapping[n].name);
     }
   g_signal_connect (data->name_entry, "notify::text", G_CALLBACK (on_notify), data);
+  g_signal_connect (data->compress_checkbutton, "toggled", G_CALLBACK (on_compress_toggled), data);
+  g_signal_connect (data->folder_fcbutton, "selection-changed", G_CALLBACK (on_folder_changed), data);
 
   create_disk_image_populate (data);
   create_disk_image_update (data);
@@ -1120,3 +2813,77 @@ gdu_create_disk_image_dialog_show (GduWindow    *window,
   gtk_editable_select_region (GTK_EDITABLE (data->name_entry), 0,
                               strlen (gtk_entry_get_text (GTK_ENTRY (data->name_entry))) - 4);
 }
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_create_disk_image_dialog_run_unattended:
+ * @application: The #GduApplication.
+ * @object: The #UDisksObject for the block device to create a disk image of.
+ * @folder: The folder to create the disk image in.
+ * @scheduler: (allow-none): A #GduCopyScheduler shared with other copies or %NULL.
+ * @callback: Called when the disk image has been created or on error.
+ * @user_data: User data for @callback.
+ *
+ * Creates a disk image of @object in @folder without showing the
+ * dialog, using the default options and name. Use
+ * gdu_create_disk_image_dialog_run_unattended_finish() in @callback
+ * to get the result. Nothing is shown, not even errors, so this can
+ * be used without a window.
+ */
+void
+gdu_create_disk_image_dialog_run_unattended (GduApplication      *application,
+                                             UDisksObject        *object,
+                                             GFile               *folder,
+                                             GduCopyScheduler    *scheduler,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data)
+{
+  DialogData *data;
+  gchar *name;
+
+  data = dialog_data_new (application, NULL, object);
+  data->task = g_task_new (G_OBJECT (application), NULL, callback, user_data);
+  if (scheduler != NULL)
+    {
+      data->scheduler = gdu_copy_scheduler_ref (scheduler);
+      data->controller = gdu_copy_scheduler_get_controller (data->block);
+    }
+
+  /* the same defaults as in the dialog */
+  data->direct_io = TRUE;
+  name = get_proposed_filename (data);
+  data->output_file = g_file_get_child (folder, name);
+  g_task_set_task_data (data->task, g_object_ref (data->output_file), g_object_unref);
+  g_free (name);
+
+  ensure_unused_and_start_copying (data);
+}
+
+/**
+ * gdu_create_disk_image_dialog_run_unattended_finish:
+ * @application: The #GduApplication.
+ * @res: The #GAsyncResult passed to the callback.
+ * @out_image_file: (allow-none): Return location for the disk image or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Finishes an operation started with gdu_create_disk_image_dialog_run_unattended().
+ *
+ * Returns: %TRUE if the disk image was created, %FALSE if @error is set.
+ */
+gboolean
+gdu_create_disk_image_dialog_run_unattended_finish (GduApplication  *application,
+                                                    GAsyncResult    *res,
+                                                    GFile          **out_image_file,
+                                                    GError         **error)
+{
+  GTask *task = G_TASK (res);
+
+  g_return_val_if_fail (G_IS_TASK (res), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (out_image_file != NULL)
+    *out_image_file = g_object_ref (g_task_get_task_data (task));
+  return g_task_propagate_boolean (task, error);
+}
+
@@ -15,8 +15,18 @@
 
 G_BEGIN_DECLS
 
-void     gdu_create_disk_image_dialog_show (GduWindow    *window,
-                                            UDisksObject *object);
+void     gdu_create_disk_image_dialog_show                  (GduWindow            *window,
+                                                             UDisksObject         *object);
+void     gdu_create_disk_image_dialog_run_unattended        (GduApplication       *application,
+                                                             UDisksObject         *object,
+                                                             GFile                *folder,
+                                                             GduCopyScheduler     *scheduler,
+                                                             GAsyncReadyCallback   callback,
+                                                             gpointer              user_data);
+gboolean gdu_create_disk_image_dialog_run_unattended_finish (GduApplication       *application,
+                                                             GAsyncResult         *res,
+                                                             GFile               **out_image_file,
+                                                             GError              **error);
 
 G_END_DECLS
 
@@ -458,10 +458,8 @@ gdu_dvd_support_read (GduDVDSupport *support,
         }
       else
         {
-          if (lseek (fd, cur_offset, SEEK_SET) == (off_t) -1)
-            goto out;
         read_again:
-          num_bytes_read = read (fd, cur_buffer, num_to_read_in_range);
+          num_bytes_read = pread (fd, cur_buffer, num_to_read_in_range, cur_offset);
           if (num_bytes_read < 0)
             {
               if (errno == EAGAIN || errno == EINTR)
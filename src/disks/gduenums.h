@@ -41,6 +41,13 @@ typedef enum
   GDU_DEVICE_TREE_MODEL_FLAGS_INCLUDE_NONE_ITEM   = (1<<5),
 } GduDeviceTreeModelFlags;
 
+typedef enum
+{
+  GDU_BLOCK_STATE_GOOD,
+  GDU_BLOCK_STATE_UNTRIED,
+  GDU_BLOCK_STATE_BAD
+} GduBlockState;
+
 G_END_DECLS
 
 #endif /* __GDU_ENUMS_H__ */
@@ -227,6 +227,31 @@ gdu_estimator_get_bytes_per_sec (GduEstimator *estimator)
   return estimator->bytes_per_sec;
 }
 
+/* Like gdu_estimator_get_bytes_per_sec() but only considers the last
+ * @num_samples intervals so changes show up quickly.
+ */
+guint64
+gdu_estimator_get_recent_bytes_per_sec (GduEstimator *estimator,
+                                        guint         num_samples)
+{
+  Sample *a;
+  Sample *b;
+
+  g_return_val_if_fail (GDU_IS_ESTIMATOR (estimator), 0);
+  g_return_val_if_fail (num_samples > 0, 0);
+
+  if (estimator->num_samples < 2)
+    return 0;
+
+  num_samples = MIN (num_samples, estimator->num_samples - 1);
+  a = &estimator->samples[estimator->num_samples - 1 - num_samples];
+  b = &estimator->samples[estimator->num_samples - 1];
+  if (b->time_usec <= a->time_usec)
+    return 0;
+
+  return (b->value - a->value) * G_USEC_PER_SEC / (b->time_usec - a->time_usec);
+}
+
 guint64
 gdu_estimator_get_usec_remaining (GduEstimator *estimator)
 {
@@ -27,6 +27,8 @@ guint64        gdu_estimator_get_target_bytes    (GduEstimator    *estimator);
 guint64        gdu_estimator_get_completed_bytes (GduEstimator    *estimator);
 
 guint64        gdu_estimator_get_bytes_per_sec   (GduEstimator    *estimator);
+guint64        gdu_estimator_get_recent_bytes_per_sec (GduEstimator *estimator,
+                                                       guint         num_samples);
 guint64        gdu_estimator_get_usec_remaining  (GduEstimator    *estimator);
 
 G_END_DECLS
@@ -0,0 +1,371 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib/gi18n.h>
+
+#include "gduimagechecksum.h"
+
+/* SHA-256 checksums of disk images, computed on the copy buffers while
+ * the data moves so no extra I/O is needed.
+ *
+ * Besides the checksum of the whole image, one checksum per block of
+ * @block_size bytes is kept so a mismatch can be narrowed down. They
+ * are stored in a sidecar file next to the image, compatible with
+ * sha256sum(1) which ignores the comment lines holding the block
+ * checksums:
+ *
+ *   # block-size 67108864
+ *   # block 3b7e72ed...
+ *   # block 9f86d081...
+ *   e3b0c442...  disk.img
+ *
+ * The checksums are always of the uncompressed disk data, so for
+ * compressed images the entry names the uncompressed file.
+ */
+
+struct GduImageChecksum
+{
+  guint64 block_size;
+
+  GChecksum *checksum;
+  GChecksum *block_checksum;
+  guint64 block_fill;
+
+  /* of gchar* */
+  GPtrArray *block_digests;
+
+  /* set once finished */
+  gchar *digest;
+};
+
+static GduImageChecksum *
+image_checksum_alloc (guint64 block_size)
+{
+  GduImageChecksum *checksum;
+
+  checksum = g_new0 (GduImageChecksum, 1);
+  checksum->block_size = block_size;
+  checksum->block_digests = g_ptr_array_new_with_free_func (g_free);
+  return checksum;
+}
+
+/**
+ * gdu_image_checksum_new:
+ * @block_size: The size of the blocks to keep separate checksums for.
+ *
+ * Creates a new checksum to be fed with the disk data in order using
+ * gdu_image_checksum_update().
+ *
+ * Returns: A #GduImageChecksum. Free with gdu_image_checksum_free().
+ */
+GduImageChecksum *
+gdu_image_checksum_new (guint64 block_size)
+{
+  GduImageChecksum *checksum;
+
+  g_return_val_if_fail (block_size > 0, NULL);
+
+  checksum = image_checksum_alloc (block_size);
+  checksum->checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  checksum->block_checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  return checksum;
+}
+
+void
+gdu_image_checksum_free (GduImageChecksum *checksum)
+{
+  if (checksum->checksum != NULL)
+    g_checksum_free (checksum->checksum);
+  if (checksum->block_checksum != NULL)
+    g_checksum_free (checksum->block_checksum);
+  g_ptr_array_unref (checksum->block_digests);
+  g_free (checksum->digest);
+  g_free (checksum);
+}
+
+guint64
+gdu_image_checksum_get_block_size (GduImageChecksum *checksum)
+{
+  return checksum->block_size;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+void
+gdu_image_checksum_update (GduImageChecksum *checksum,
+                           const guchar     *data,
+                           gsize             length)
+{
+  g_return_if_fail (checksum->digest == NULL);
+
+  while (length > 0)
+    {
+      gsize num_bytes;
+
+      num_bytes = MIN (length, checksum->block_size - checksum->block_fill);
+      g_checksum_update (checksum->checksum, data, num_bytes);
+      g_checksum_update (checksum->block_checksum, data, num_bytes);
+      checksum->block_fill += num_bytes;
+      data += num_bytes;
+      length -= num_bytes;
+
+      if (checksum->block_fill == checksum->block_size)
+        {
+          g_ptr_array_add (checksum->block_digests,
+                           g_strdup (g_checksum_get_string (checksum->block_checksum)));
+          g_checksum_reset (checksum->block_checksum);
+          checksum->block_fill = 0;
+        }
+    }
+}
+
+/* For holes in sparse images and the like */
+void
+gdu_image_checksum_update_zeroes (GduImageChecksum *checksum,
+                                  guint64           length)
+{
+  static const guchar zeroes[64 * 1024] = {0};
+
+  while (length > 0)
+    {
+      gsize num_bytes = MIN (length, sizeof zeroes);
+      gdu_image_checksum_update (checksum, zeroes, num_bytes);
+      length -= num_bytes;
+    }
+}
+
+/**
+ * gdu_image_checksum_get_digest:
+ * @checksum: A #GduImageChecksum.
+ *
+ * Gets the SHA-256 of all data fed to @checksum as a hexadecimal
+ * string. After this, @checksum can't be updated anymore.
+ *
+ * Returns: The digest, owned by @checksum.
+ */
+const gchar *
+gdu_image_checksum_get_digest (GduImageChecksum *checksum)
+{
+  if (checksum->digest == NULL)
+    {
+      if (checksum->block_fill > 0)
+        g_ptr_array_add (checksum->block_digests,
+                         g_strdup (g_checksum_get_string (checksum->block_checksum)));
+      checksum->digest = g_strdup (g_checksum_get_string (checksum->checksum));
+    }
+  return checksum->digest;
+}
+
+/* Returns: The checksums of the blocks completed so far. Free with g_strfreev(). */
+gchar **
+gdu_image_checksum_dup_block_digests (GduImageChecksum *checksum)
+{
+  gchar **ret;
+  guint n;
+
+  ret = g_new0 (gchar *, checksum->block_digests->len + 1);
+  for (n = 0; n < checksum->block_digests->len; n++)
+    ret[n] = g_strdup (checksum->block_digests->pdata[n]);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_image_checksum_save:
+ * @checksum: A #GduImageChecksum.
+ * @file: The sidecar file to write, see gdu_image_checksum_get_file_for_image().
+ * @image_name: The file name to list the checksum for.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Finishes @checksum and writes it to @file.
+ *
+ * Returns: %TRUE if the file was written, %FALSE if @error is set.
+ */
+gboolean
+gdu_image_checksum_save (GduImageChecksum  *checksum,
+                         GFile             *file,
+                         const gchar       *image_name,
+                         GCancellable      *cancellable,
+                         GError           **error)
+{
+  GString *str;
+  const gchar *digest;
+  gboolean ret;
+  guint n;
+
+  digest = gdu_image_checksum_get_digest (checksum);
+
+  str = g_string_new (NULL);
+  g_string_append_printf (str, "# block-size %" G_GUINT64_FORMAT "\n", checksum->block_size);
+  for (n = 0; n < checksum->block_digests->len; n++)
+    g_string_append_printf (str, "# block %s\n", (const gchar *) checksum->block_digests->pdata[n]);
+  g_string_append_printf (str, "%s  %s\n", digest, image_name);
+
+  ret = g_file_replace_contents (file,
+                                 str->str,
+                                 str->len,
+                                 NULL, /* etag */
+                                 FALSE, /* make_backup */
+                                 G_FILE_CREATE_NONE,
+                                 NULL, /* new_etag */
+                                 cancellable,
+                                 error);
+  g_string_free (str, TRUE);
+  return ret;
+}
+
+static gboolean
+is_sha256_digest (const gchar *s)
+{
+  guint n;
+
+  for (n = 0; n < 64; n++)
+    {
+      if (!g_ascii_isxdigit (s[n]))
+        return FALSE;
+    }
+  return s[64] == '\0' || s[64] == ' ';
+}
+
+/**
+ * gdu_image_checksum_load:
+ * @file: A sidecar file written by gdu_image_checksum_save() or sha256sum(1).
+ * @error: Return location for error or %NULL.
+ *
+ * Loads a checksum file. Files written by sha256sum(1) only have the
+ * checksum of the whole image, not the block checksums.
+ *
+ * Returns: A #GduImageChecksum or %NULL if @error is set.
+ */
+GduImageChecksum *
+gdu_image_checksum_load (GFile   *file,
+                         GError **error)
+{
+  GduImageChecksum *checksum = NULL;
+  gchar *contents = NULL;
+  gchar **lines = NULL;
+  guint64 block_size = GDU_IMAGE_CHECKSUM_BLOCK_SIZE;
+  GPtrArray *block_digests;
+  gchar *digest = NULL;
+  guint n;
+
+  block_digests = g_ptr_array_new_with_free_func (g_free);
+
+  if (!g_file_load_contents (file, NULL, &contents, NULL, NULL, error))
+    goto out;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (n = 0; lines[n] != NULL; n++)
+    {
+      const gchar *line = lines[n];
+
+      if (g_str_has_prefix (line, "# block-size "))
+        {
+          block_size = g_ascii_strtoull (line + strlen ("# block-size "), NULL, 10);
+        }
+      else if (g_str_has_prefix (line, "# block ") && is_sha256_digest (line + strlen ("# block ")))
+        {
+          g_ptr_array_add (block_digests, g_strndup (line + strlen ("# block "), 64));
+        }
+      else if (line[0] != '#' && strlen (line) > 66 && is_sha256_digest (line) && digest == NULL)
+        {
+          const gchar *name = line + 66; /* skip the space and the mode character */
+
+          if (g_str_has_suffix (name, ".xz"))
+            {
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           _("The checksum is for the compressed file, not the disk image"));
+              goto out;
+            }
+          digest = g_ascii_strdown (line, 64);
+        }
+    }
+
+  if (digest == NULL || block_size == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("No SHA-256 checksum found"));
+      goto out;
+    }
+
+  checksum = image_checksum_alloc (block_size);
+  checksum->digest = digest;
+  digest = NULL;
+  for (n = 0; n < block_digests->len; n++)
+    g_ptr_array_add (checksum->block_digests, g_ascii_strdown (block_digests->pdata[n], -1));
+
+ out:
+  g_free (digest);
+  g_ptr_array_unref (block_digests);
+  g_strfreev (lines);
+  g_free (contents);
+  return checksum;
+}
+
+/**
+ * gdu_image_checksum_equal:
+ * @checksum: A #GduImageChecksum.
+ * @expected: The #GduImageChecksum to compare against, e.g. one that was loaded.
+ * @out_mismatch_offset: (allow-none): Return location for the offset of the first block that differs.
+ *
+ * Finishes @checksum and compares it to @expected, block by block if
+ * possible.
+ *
+ * Returns: %TRUE if the checksums match.
+ */
+gboolean
+gdu_image_checksum_equal (GduImageChecksum *checksum,
+                          GduImageChecksum *expected,
+                          guint64          *out_mismatch_offset)
+{
+  guint n;
+
+  if (g_strcmp0 (gdu_image_checksum_get_digest (checksum), expected->digest) == 0)
+    return TRUE;
+
+  if (out_mismatch_offset != NULL)
+    {
+      *out_mismatch_offset = 0;
+      if (checksum->block_size == expected->block_size)
+        {
+          for (n = 0; n < checksum->block_digests->len && n < expected->block_digests->len; n++)
+            {
+              if (g_strcmp0 (checksum->block_digests->pdata[n], expected->block_digests->pdata[n]) != 0)
+                break;
+            }
+          *out_mismatch_offset = n * checksum->block_size;
+        }
+    }
+
+  return FALSE;
+}
+
+/* Returns: The sidecar file for @image_file, i.e. with ".sha256" appended */
+GFile *
+gdu_image_checksum_get_file_for_image (GFile *image_file)
+{
+  GFile *parent;
+  GFile *ret;
+  gchar *basename;
+  gchar *name;
+
+  parent = g_file_get_parent (image_file);
+  basename = g_file_get_basename (image_file);
+  name = g_strdup_printf ("%s.sha256", basename);
+  ret = g_file_get_child (parent, name);
+  g_free (name);
+  g_free (basename);
+  g_object_unref (parent);
+  return ret;
+}
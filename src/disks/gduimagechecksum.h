@@ -0,0 +1,44 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_IMAGE_CHECKSUM_H__
+#define __GDU_IMAGE_CHECKSUM_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+#define GDU_IMAGE_CHECKSUM_BLOCK_SIZE (64 * 1024 * 1024)
+
+GduImageChecksum *gdu_image_checksum_new              (guint64            block_size);
+GduImageChecksum *gdu_image_checksum_load             (GFile             *file,
+                                                       GError           **error);
+void              gdu_image_checksum_free             (GduImageChecksum  *checksum);
+guint64           gdu_image_checksum_get_block_size   (GduImageChecksum  *checksum);
+void              gdu_image_checksum_update           (GduImageChecksum  *checksum,
+                                                       const guchar      *data,
+                                                       gsize              length);
+void              gdu_image_checksum_update_zeroes    (GduImageChecksum  *checksum,
+                                                       guint64            length);
+const gchar      *gdu_image_checksum_get_digest       (GduImageChecksum  *checksum);
+gchar           **gdu_image_checksum_dup_block_digests (GduImageChecksum  *checksum);
+gboolean          gdu_image_checksum_save             (GduImageChecksum  *checksum,
+                                                       GFile             *file,
+                                                       const gchar       *image_name,
+                                                       GCancellable      *cancellable,
+                                                       GError           **error);
+gboolean          gdu_image_checksum_equal            (GduImageChecksum  *checksum,
+                                                       GduImageChecksum  *expected,
+                                                       guint64           *out_mismatch_offset);
+GFile            *gdu_image_checksum_get_file_for_image (GFile           *image_file);
+
+G_END_DECLS
+
+#endif /* __GDU_IMAGE_CHECKSUM_H__ */
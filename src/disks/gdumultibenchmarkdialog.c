@@ -0,0 +1,734 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+#include <gio/gunixfdlist.h>
+#include <unistd.h>
+
+#include "gduapplication.h"
+#include "gduwindow.h"
+#include "gdudevicetreemodel.h"
+#include "gdumultibenchmarkdialog.h"
+
+/* Benchmarks several drives at the same time to find out if they are
+ * held back by something they share. Each drive is first read from on
+ * its own and then all of them at the same time, with the same
+ * workload for the same amount of time. If the drives are slower
+ * together than on their own, the controller, the bus or a hub they
+ * are behind is the bottleneck - not the drives.
+ */
+
+/* big sequential reads with a deep queue get the most out of any drive */
+#define WORKLOAD_ID "seqread-1m"
+#define WORKLOAD_QUEUE_DEPTH 32
+
+/* below this fraction of the rate on their own, the drives are slowing each other down */
+#define SATURATION_THRESHOLD 0.9
+
+typedef enum {
+  BM_STATE_NONE,
+  BM_STATE_OPENING_DEVICES,
+  BM_STATE_ALONE,
+  BM_STATE_TOGETHER,
+} BMState;
+
+typedef struct _DialogData DialogData;
+
+typedef struct
+{
+  DialogData *data;
+  UDisksBlock *block;
+  gchar *name;
+  gint fd;
+
+  /* must hold bm_lock when reading/writing these - 0.0 if not measured */
+  gdouble alone_bytes_per_sec;
+  gdouble together_bytes_per_sec;
+
+  /* for the thread reading from the device in the together phase */
+  GThread *thread;
+  GError *error;
+} DeviceData;
+
+struct _DialogData
+{
+  volatile gint ref_count;
+
+  GduWindow *window;
+  GtkBuilder *builder;
+  GduDeviceTreeModel *model;
+
+  GtkWidget *dialog;
+  GtkWidget *drives_treeview;
+  GtkWidget *duration_spinbutton;
+  GtkWidget *results_label;
+
+  GtkWidget *start_benchmark_button;
+  GtkWidget *stop_benchmark_button;
+
+  gboolean closed;
+
+  /* ---- */
+
+  /* set when starting the benchmark */
+  const GduBenchmarkWorkload *bm_workload;
+  gint64 bm_duration_usec;
+
+  /* must hold bm_lock when reading/writing these */
+  GPtrArray *bm_devices; /* of DeviceData */
+  GThread *bm_thread;
+  GCancellable *bm_cancellable;
+  gboolean bm_in_progress;
+  BMState bm_state;
+  guint bm_current_device; /* for BM_STATE_ALONE */
+  GError *bm_error; /* set by benchmark thread on termination */
+  gboolean bm_update_timeout_pending;
+};
+
+G_LOCK_DEFINE_STATIC (bm_lock);
+
+static const struct {
+  goffset offset;
+  const gchar *name;
+} widget_mapping[] = {
+  {G_STRUCT_OFFSET (DialogData, drives_treeview), "drives-treeview"},
+  {G_STRUCT_OFFSET (DialogData, duration_spinbutton), "duration-spinbutton"},
+  {G_STRUCT_OFFSET (DialogData, results_label), "results-label"},
+  {G_STRUCT_OFFSET (DialogData, start_benchmark_button), "start-benchmark-button"},
+  {G_STRUCT_OFFSET (DialogData, stop_benchmark_button), "stop-benchmark-button"},
+  {0, NULL}
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+device_data_free (DeviceData *device)
+{
+  g_clear_object (&device->block);
+  g_free (device->name);
+  g_clear_error (&device->error);
+  g_free (device);
+}
+
+static DialogData *
+dialog_data_ref (DialogData *data)
+{
+  g_atomic_int_inc (&data->ref_count);
+  return data;
+}
+
+static void
+dialog_data_unref (DialogData *data)
+{
+  if (g_atomic_int_dec_and_test (&data->ref_count))
+    {
+      if (data->dialog != NULL)
+        {
+          gtk_widget_hide (data->dialog);
+          gtk_widget_destroy (data->dialog);
+          data->dialog = NULL;
+        }
+
+      g_clear_object (&data->window);
+      g_clear_object (&data->builder);
+      g_clear_object (&data->model);
+
+      g_ptr_array_unref (data->bm_devices);
+      g_clear_object (&data->bm_cancellable);
+      g_clear_error (&data->bm_error);
+
+      g_free (data);
+    }
+}
+
+static void
+dialog_data_close (DialogData *data)
+{
+  g_cancellable_cancel (data->bm_cancellable);
+  data->closed = TRUE;
+  gtk_dialog_response (GTK_DIALOG (data->dialog), GTK_RESPONSE_CANCEL);
+  dialog_data_unref (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gchar *
+format_transfer_rate (gdouble bytes_per_sec)
+{
+  gchar *ret;
+  gchar *s;
+
+  s = g_format_size ((guint64) bytes_per_sec);
+  ret = g_strdup_printf (C_("benchmark-transfer-rate", "%s/s"), s);
+  g_free (s);
+  return ret;
+}
+
+static void
+update_results_label (DialogData *data)
+{
+  GString *str;
+  gdouble total_alone = 0.0;
+  gdouble total_together = 0.0;
+  gboolean all_measured = TRUE;
+  gchar *s, *s2, *s3;
+  guint n;
+
+  str = g_string_new (NULL);
+
+  G_LOCK (bm_lock);
+  switch (data->bm_state)
+    {
+    case BM_STATE_NONE:
+      break;
+
+    case BM_STATE_OPENING_DEVICES:
+      g_string_append_printf (str, "<i>%s</i>\n", C_("multi-benchmark", "Opening Devices…"));
+      break;
+
+    case BM_STATE_ALONE:
+      s = g_markup_escape_text (((DeviceData *) data->bm_devices->pdata[data->bm_current_device])->name, -1);
+      /* Translators: %s is the name of the drive, e.g. "WD Red (/dev/sdb)" */
+      s2 = g_strdup_printf (C_("multi-benchmark", "Reading from %s on its own…"), s);
+      g_string_append_printf (str, "<i>%s</i>\n", s2);
+      g_free (s2);
+      g_free (s);
+      break;
+
+    case BM_STATE_TOGETHER:
+      g_string_append_printf (str, "<i>%s</i>\n", C_("multi-benchmark", "Reading from all drives at the same time…"));
+      break;
+    }
+
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+
+      s = g_markup_escape_text (device->name, -1);
+      s2 = device->alone_bytes_per_sec > 0.0 ? format_transfer_rate (device->alone_bytes_per_sec) : g_strdup ("–");
+      s3 = device->together_bytes_per_sec > 0.0 ? format_transfer_rate (device->together_bytes_per_sec) : g_strdup ("–");
+      /* Translators: The first %s is the name of the drive. The second and third %s are the
+       * transfer rates of the drive when read from on its own and together with the other
+       * selected drives, e.g. "180.1 MB/s"
+       */
+      g_string_append_printf (str, C_("multi-benchmark", "%s\nOn its own: %s, together: %s\n"), s, s2, s3);
+      g_free (s3);
+      g_free (s2);
+      g_free (s);
+
+      total_alone += device->alone_bytes_per_sec;
+      total_together += device->together_bytes_per_sec;
+      if (device->alone_bytes_per_sec == 0.0 || device->together_bytes_per_sec == 0.0)
+        all_measured = FALSE;
+    }
+
+  if (data->bm_devices->len > 1 && all_measured)
+    {
+      s = format_transfer_rate (total_together);
+      s2 = format_transfer_rate (total_alone);
+      /* Translators: The first %s is the aggregate transfer rate of all drives read from at
+       * the same time, the second %s is the sum of the rates of the drives on their own
+       */
+      s3 = g_strdup_printf (C_("multi-benchmark", "All drives together: %s of %s on their own"), s, s2);
+      g_string_append_printf (str, "<b>%s</b>\n", s3);
+      g_free (s3);
+      g_free (s2);
+      g_free (s);
+
+      if (total_together < SATURATION_THRESHOLD * total_alone)
+        {
+          /* Translators: %.0f is a percentage, e.g. 65 */
+          s = g_strdup_printf (C_("multi-benchmark",
+                                  "The drives only reach %.0f%% of their combined rate when used at the same time. "
+                                  "Something they share — like the controller, the bus or a USB hub — is the bottleneck."),
+                               100.0 * total_together / total_alone);
+        }
+      else
+        {
+          s = g_strdup (C_("multi-benchmark",
+                           "The drives don't slow each other down. The rate is limited by the drives themselves."));
+        }
+      g_string_append (str, s);
+      g_free (s);
+    }
+  G_UNLOCK (bm_lock);
+
+  /* no trailing newline */
+  if (str->len > 0 && str->str[str->len - 1] == '\n')
+    g_string_truncate (str, str->len - 1);
+  gtk_label_set_markup (GTK_LABEL (data->results_label), str->len > 0 ? str->str : "–");
+  g_string_free (str, TRUE);
+}
+
+static void
+update_dialog (DialogData *data)
+{
+  GError *error = NULL;
+  gboolean in_progress;
+  GList *blocks;
+
+  G_LOCK (bm_lock);
+  if (data->bm_error != NULL)
+    {
+      error = data->bm_error;
+      data->bm_error = NULL;
+    }
+  in_progress = data->bm_in_progress;
+  G_UNLOCK (bm_lock);
+
+  /* first of all, present an error if something went wrong */
+  if (error != NULL)
+    {
+      if (!data->closed)
+        {
+          if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+            gdu_utils_show_error (GTK_WINDOW (data->dialog), C_("benchmarking", "An error occurred"), error);
+        }
+      g_clear_error (&error);
+    }
+
+  if (in_progress)
+    {
+      gtk_widget_hide (data->start_benchmark_button);
+      gtk_widget_show (data->stop_benchmark_button);
+    }
+  else
+    {
+      gtk_widget_show (data->start_benchmark_button);
+      gtk_widget_hide (data->stop_benchmark_button);
+    }
+  gtk_widget_set_sensitive (data->drives_treeview, !in_progress);
+  gtk_widget_set_sensitive (data->duration_spinbutton, !in_progress);
+
+  blocks = gdu_device_tree_model_get_selected_blocks (data->model);
+  gtk_widget_set_sensitive (data->start_benchmark_button, blocks != NULL);
+  g_list_free_full (blocks, g_object_unref);
+
+  update_results_label (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* called on main / UI thread */
+static gboolean
+bmt_on_timeout (gpointer user_data)
+{
+  DialogData *data = user_data;
+  update_dialog (data);
+  G_LOCK (bm_lock);
+  data->bm_update_timeout_pending = FALSE;
+  G_UNLOCK (bm_lock);
+  dialog_data_unref (data);
+  return FALSE; /* don't run again */
+}
+
+static void
+bmt_schedule_update (DialogData *data)
+{
+  /* rate-limit updates */
+  G_LOCK (bm_lock);
+  if (!data->bm_update_timeout_pending)
+    {
+      g_timeout_add (200, /* ms */
+                     bmt_on_timeout,
+                     dialog_data_ref (data));
+      data->bm_update_timeout_pending = TRUE;
+    }
+  G_UNLOCK (bm_lock);
+}
+
+/* runs in one thread per device, all at the same time */
+static gpointer
+device_thread (gpointer user_data)
+{
+  DeviceData *device = user_data;
+  DialogData *data = device->data;
+  GduBenchmarkWorkloadResult result = {0};
+
+  if (!gdu_benchmark_run_workload (device->fd,
+                                   data->bm_workload,
+                                   WORKLOAD_QUEUE_DEPTH,
+                                   data->bm_duration_usec,
+                                   data->bm_cancellable,
+                                   &result,
+                                   &device->error))
+    {
+      /* no point in carrying on with the others */
+      g_cancellable_cancel (data->bm_cancellable);
+      return NULL;
+    }
+
+  G_LOCK (bm_lock);
+  device->together_bytes_per_sec = result.bytes_per_sec;
+  G_UNLOCK (bm_lock);
+  gdu_latency_histogram_free (result.latency_histogram);
+  return NULL;
+}
+
+static gboolean
+open_device (DialogData  *data,
+             DeviceData  *device,
+             GError     **error)
+{
+  gboolean ret = FALSE;
+  GVariantBuilder options_builder;
+  GVariant *fd_index = NULL;
+  GUnixFDList *fd_list = NULL;
+
+  /* only reading, so the drives can be in use */
+  g_variant_builder_init (&options_builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&options_builder, "{sv}", "writable", g_variant_new_boolean (FALSE));
+  if (!udisks_block_call_open_for_benchmark_sync (device->block,
+                                                  g_variant_builder_end (&options_builder),
+                                                  NULL, /* fd_list */
+                                                  &fd_index,
+                                                  &fd_list,
+                                                  data->bm_cancellable,
+                                                  error))
+    goto out;
+
+  device->fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (device->fd == -1)
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  g_clear_object (&fd_list);
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  return ret;
+}
+
+static gpointer
+benchmark_thread (gpointer user_data)
+{
+  DialogData *data = user_data;
+  GError *error = NULL;
+  guint inhibit_cookie;
+  guint n;
+
+  inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
+                                            GTK_WINDOW (data->dialog),
+                                            GTK_APPLICATION_INHIBIT_SUSPEND |
+                                            GTK_APPLICATION_INHIBIT_LOGOUT,
+                                            /* Translators: Reason why suspend/logout is being inhibited */
+                                            C_("create-inhibit-message", "Benchmarking device"));
+
+  /* open all of them first so we know up front if one can't be used */
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      if (!open_device (data, data->bm_devices->pdata[n], &error))
+        goto out;
+    }
+
+  /* each drive on its own... */
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+      GduBenchmarkWorkloadResult result = {0};
+
+      G_LOCK (bm_lock);
+      data->bm_state = BM_STATE_ALONE;
+      data->bm_current_device = n;
+      G_UNLOCK (bm_lock);
+      bmt_schedule_update (data);
+
+      if (!gdu_benchmark_run_workload (device->fd,
+                                       data->bm_workload,
+                                       WORKLOAD_QUEUE_DEPTH,
+                                       data->bm_duration_usec,
+                                       data->bm_cancellable,
+                                       &result,
+                                       &error))
+        goto out;
+
+      G_LOCK (bm_lock);
+      device->alone_bytes_per_sec = result.bytes_per_sec;
+      G_UNLOCK (bm_lock);
+      gdu_latency_histogram_free (result.latency_histogram);
+    }
+
+  /* ... and all of them together */
+  G_LOCK (bm_lock);
+  data->bm_state = BM_STATE_TOGETHER;
+  G_UNLOCK (bm_lock);
+  bmt_schedule_update (data);
+
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+      device->thread = g_thread_new ("benchmark-device-thread", device_thread, device);
+    }
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+      g_thread_join (device->thread);
+      device->thread = NULL;
+    }
+
+  /* the other threads were cancelled if one of them failed so report the one that did */
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+      if (device->error == NULL)
+        continue;
+      if (error == NULL || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_clear_error (&error);
+          error = device->error;
+          device->error = NULL;
+        }
+      g_clear_error (&device->error);
+    }
+
+ out:
+  for (n = 0; n < data->bm_devices->len; n++)
+    {
+      DeviceData *device = data->bm_devices->pdata[n];
+      if (device->fd != -1)
+        {
+          close (device->fd);
+          device->fd = -1;
+        }
+    }
+
+  if (inhibit_cookie > 0)
+    gtk_application_uninhibit (GTK_APPLICATION (gdu_window_get_application (data->window)), inhibit_cookie);
+
+  G_LOCK (bm_lock);
+  data->bm_in_progress = FALSE;
+  data->bm_thread = NULL;
+  data->bm_state = BM_STATE_NONE;
+  data->bm_error = error;
+  if (error != NULL)
+    {
+      /* the rates together are only meaningful if all drives made it to the end */
+      for (n = 0; n < data->bm_devices->len; n++)
+        ((DeviceData *) data->bm_devices->pdata[n])->together_bytes_per_sec = 0.0;
+    }
+  G_UNLOCK (bm_lock);
+
+  bmt_schedule_update (data);
+
+  dialog_data_unref (data);
+  return NULL;
+}
+
+static void
+abort_benchmark (DialogData *data)
+{
+  g_cancellable_cancel (data->bm_cancellable);
+}
+
+static void
+start_benchmark (DialogData *data)
+{
+  UDisksClient *client = gdu_window_get_client (data->window);
+  GList *blocks;
+  GList *l;
+  gint index;
+
+  g_assert (!data->bm_in_progress);
+  g_assert (data->bm_thread == NULL);
+
+  index = gdu_benchmark_lookup_workload (WORKLOAD_ID);
+  g_assert (index >= 0);
+  data->bm_workload = &gdu_benchmark_get_workloads (NULL)[index];
+  data->bm_duration_usec = gtk_spin_button_get_value (GTK_SPIN_BUTTON (data->duration_spinbutton)) * G_USEC_PER_SEC;
+
+  G_LOCK (bm_lock);
+  g_ptr_array_set_size (data->bm_devices, 0);
+  blocks = gdu_device_tree_model_get_selected_blocks (data->model);
+  for (l = blocks; l != NULL; l = l->next)
+    {
+      UDisksBlock *block = UDISKS_BLOCK (l->data);
+      UDisksObject *object;
+      UDisksObjectInfo *info;
+      DeviceData *device;
+
+      object = UDISKS_OBJECT (g_dbus_interface_dup_object (G_DBUS_INTERFACE (block)));
+      info = udisks_client_get_object_info (client, object);
+
+      device = g_new0 (DeviceData, 1);
+      device->data = data;
+      device->block = g_object_ref (block);
+      device->name = g_strdup (udisks_object_info_get_one_liner (info));
+      device->fd = -1;
+      g_ptr_array_add (data->bm_devices, device);
+
+      g_object_unref (info);
+      g_object_unref (object);
+    }
+  g_list_free_full (blocks, g_object_unref);
+
+  data->bm_in_progress = TRUE;
+  data->bm_state = BM_STATE_OPENING_DEVICES;
+  g_clear_error (&data->bm_error);
+  g_cancellable_reset (data->bm_cancellable);
+  G_UNLOCK (bm_lock);
+
+  data->bm_thread = g_thread_new ("multi-benchmark-thread",
+                                  benchmark_thread,
+                                  dialog_data_ref (data));
+  update_dialog (data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+on_drive_toggled (GtkCellRendererToggle *renderer,
+                  const gchar           *path_string,
+                  gpointer               user_data)
+{
+  DialogData *data = user_data;
+  GtkTreePath *path;
+  GtkTreeIter iter;
+
+  path = gtk_tree_path_new_from_string (path_string);
+  if (gtk_tree_model_get_iter (GTK_TREE_MODEL (data->model), &iter, path))
+    gdu_device_tree_model_toggle_selected (data->model, &iter);
+  gtk_tree_path_free (path);
+
+  update_dialog (data);
+}
+
+/* only devices can be selected, not headings */
+static void
+toggle_cell_func (GtkTreeViewColumn *column,
+                  GtkCellRenderer   *renderer,
+                  GtkTreeModel      *model,
+                  GtkTreeIter       *iter,
+                  gpointer           user_data)
+{
+  UDisksBlock *block = NULL;
+  gboolean selected = FALSE;
+
+  gtk_tree_model_get (model, iter,
+                      GDU_DEVICE_TREE_MODEL_COLUMN_BLOCK, &block,
+                      GDU_DEVICE_TREE_MODEL_COLUMN_SELECTED, &selected,
+                      -1);
+  g_object_set (renderer,
+                "visible", block != NULL,
+                "active", selected,
+                NULL);
+  g_clear_object (&block);
+}
+
+static void
+populate_drives_treeview (DialogData *data)
+{
+  GtkTreeViewColumn *column;
+  GtkCellRenderer *renderer;
+
+  data->model = gdu_device_tree_model_new (gdu_window_get_application (data->window),
+                                           GDU_DEVICE_TREE_MODEL_FLAGS_FLAT |
+                                           GDU_DEVICE_TREE_MODEL_FLAGS_ONE_LINE_NAME |
+                                           GDU_DEVICE_TREE_MODEL_FLAGS_INCLUDE_DEVICE_NAME);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (data->model),
+                                        GDU_DEVICE_TREE_MODEL_COLUMN_SORT_KEY,
+                                        GTK_SORT_ASCENDING);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (data->drives_treeview), GTK_TREE_MODEL (data->model));
+
+  column = gtk_tree_view_column_new ();
+  gtk_tree_view_column_set_expand (column, TRUE);
+  gtk_tree_view_append_column (GTK_TREE_VIEW (data->drives_treeview), column);
+
+  renderer = gtk_cell_renderer_toggle_new ();
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_cell_data_func (column, renderer, toggle_cell_func, NULL, NULL);
+  g_signal_connect (renderer, "toggled", G_CALLBACK (on_drive_toggled), data);
+
+  renderer = gtk_cell_renderer_text_new ();
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_attributes (column,
+                                       renderer,
+                                       "markup", GDU_DEVICE_TREE_MODEL_COLUMN_HEADING_TEXT,
+                                       "visible", GDU_DEVICE_TREE_MODEL_COLUMN_IS_HEADING,
+                                       NULL);
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  g_object_set (G_OBJECT (renderer),
+                "stock-size", GTK_ICON_SIZE_MENU,
+                NULL);
+  gtk_tree_view_column_pack_start (column, renderer, FALSE);
+  gtk_tree_view_column_set_attributes (column,
+                                       renderer,
+                                       "gicon", GDU_DEVICE_TREE_MODEL_COLUMN_ICON,
+                                       NULL);
+
+  renderer = gtk_cell_renderer_text_new ();
+  g_object_set (G_OBJECT (renderer),
+                "ellipsize", PANGO_ELLIPSIZE_MIDDLE,
+                NULL);
+  gtk_tree_view_column_pack_start (column, renderer, TRUE);
+  gtk_tree_view_column_set_attributes (column,
+                                       renderer,
+                                       "markup", GDU_DEVICE_TREE_MODEL_COLUMN_NAME,
+                                       NULL);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+void
+gdu_multi_benchmark_dialog_show (GduWindow *window)
+{
+  DialogData *data;
+  guint n;
+
+  data = g_new0 (DialogData, 1);
+  data->ref_count = 1;
+  data->window = g_object_ref (window);
+  data->bm_cancellable = g_cancellable_new ();
+  data->bm_devices = g_ptr_array_new_with_free_func ((GDestroyNotify) device_data_free);
+
+  data->dialog = GTK_WIDGET (gdu_application_new_widget (gdu_window_get_application (window),
+                                                         "multi-benchmark-dialog.ui",
+                                                         "multi-benchmark-dialog",
+                                                         &data->builder));
+  for (n = 0; widget_mapping[n].name != NULL; n++)
+    {
+      gpointer *p = (gpointer *) ((char *) data + widget_mapping[n].offset);
+      *p = GTK_WIDGET (gtk_builder_get_object (data->builder, widget_mapping[n].name));
+    }
+
+  gtk_window_set_transient_for (GTK_WINDOW (data->dialog), GTK_WINDOW (window));
+
+  populate_drives_treeview (data);
+
+  update_dialog (data);
+
+  while (TRUE)
+    {
+      gint response;
+      response = gtk_dialog_run (GTK_DIALOG (data->dialog));
+
+      if (response < 0)
+        break;
+
+      /* Keep in sync with .ui file */
+      switch (response)
+        {
+        case 0: /* start benchmark */
+          start_benchmark (data);
+          break;
+
+        case 1: /* abort benchmark */
+          abort_benchmark (data);
+          break;
+
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  dialog_data_close (data);
+}
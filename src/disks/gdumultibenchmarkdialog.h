@@ -0,0 +1,22 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_MULTI_BENCHMARK_DIALOG_H__
+#define __GDU_MULTI_BENCHMARK_DIALOG_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+void   gdu_multi_benchmark_dialog_show (GduWindow *window);
+
+G_END_DECLS
+
+#endif /* __GDU_MULTI_BENCHMARK_DIALOG_H__ */
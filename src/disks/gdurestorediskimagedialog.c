@@ -9,9 +9,14 @@
 
 #include "config.h"
 
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <glib/gi18n.h>
 #include <gio/gunixfdlist.h>
 #include <gio/gunixoutputstream.h>
+#include <gio/gfiledescriptorbased.h>
 
 #include <glib-unix.h>
 #include <sys/ioctl.h>
@@ -27,9 +32,19 @@
 #include "gdulocaljob.h"
 #include "gdudevicetreemodel.h"
 #include "gduxzdecompressor.h"
+#include "gduxzinputstream.h"
+#include "gduchunksizer.h"
+#include "gduimagechecksum.h"
+#include "gducopyring.h"
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+typedef enum
+{
+  ZERO_METHOD_NONE,
+  ZERO_METHOD_ZEROOUT
+} ZeroMethod;
+
 typedef struct
 {
   volatile gint ref_count;
@@ -64,6 +79,11 @@ typedef struct
   GtkWidget *selectable_destination_label;
   GtkWidget *selectable_destination_combobox;
 
+  GtkWidget *discard_checkbutton;
+  GtkWidget *direct_io_checkbutton;
+  GtkWidget *verify_checkbutton;
+  GtkWidget *identical_checkbutton;
+
   GtkWidget *start_copying_button;
   GtkWidget *cancel_button;
 
@@ -75,25 +95,65 @@ typedef struct
   GOutputStream *block_stream;
   GInputStream *input_stream;
   guint64 input_size;
+  gboolean discard;
+  gboolean direct_io;
+  GduImageChecksum *expected_checksum;
+
+  /* other drives of the same model and size as @drive */
+  GList *identical_objects;
+
+  /* of Target, the first one is for @object */
+  GPtrArray *targets;
+  GduCopyRing *ring;
 
   guchar *buffer;
   guint64 total_bytes_read;
   guint64 buffer_bytes_written;
   guint64 buffer_bytes_to_write;
 
-  /* must hold copy_lock when reading/writing these */
+  /* must hold copy_lock when reading/writing these and the progress of targets */
   GMutex copy_lock;
-  GduEstimator *estimator;
-  guint update_id;
   GError *copy_error;
 
   guint inhibit_cookie;
 
   gulong response_signal_handler_id;
   gboolean completed;
+} DialogData;
+
+/* A device the disk image is written to. The image is only read
+ * once, each device has its own writer thread, job and progress so
+ * a slow or failing device doesn't hold up the others.
+ */
+typedef struct
+{
+  DialogData *data;
+  guint index;
+
+  UDisksObject *object;
+  UDisksBlock *block;
+  gchar *device_name;
+
+  gint fd;
+  ZeroMethod zero_method;
+  gboolean throttle_writeback;
+  guint64 writeback_offset;
+
+  /* for writing zeroes and verifying, see target_get_buffer() */
+  guchar *buffer_unaligned;
+  guchar *buffer;
+
+  GThread *thread;
+  GCancellable *cancellable;
+  GError *error;
+
+  /* must hold copy_lock when reading/writing these */
+  GduEstimator *estimator;
+  guint update_id;
+  gboolean verifying;
 
   GduLocalJob *local_job;
-} DialogData;
+} Target;
 
 
 static const struct {
@@ -115,6 +175,11 @@ static const struct {
   {G_STRUCT_OFFSET (DialogData, selectable_destination_label), "selectable-destination-label"},
   {G_STRUCT_OFFSET (DialogData, selectable_destination_combobox), "selectable-destination-combobox"},
 
+  {G_STRUCT_OFFSET (DialogData, discard_checkbutton), "discard-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, direct_io_checkbutton), "direct-io-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, verify_checkbutton), "verify-checkbutton"},
+  {G_STRUCT_OFFSET (DialogData, identical_checkbutton), "identical-checkbutton"},
+
   {G_STRUCT_OFFSET (DialogData, start_copying_button), "start-copying-button"},
   {G_STRUCT_OFFSET (DialogData, cancel_button), "cancel-button"},
   {0, NULL}
@@ -122,6 +187,39 @@ static const struct {
 
 /* ---------------------------------------------------------------------------------------------------- */
 
+static Target *
+target_new (DialogData   *data,
+            UDisksObject *object)
+{
+  Target *target;
+
+  target = g_new0 (Target, 1);
+  target->data = data;
+  target->index = data->targets->len;
+  target->object = g_object_ref (object);
+  target->block = udisks_object_get_block (object);
+  target->device_name = udisks_block_dup_preferred_device (target->block);
+  target->fd = -1;
+  target->cancellable = g_cancellable_new ();
+  g_ptr_array_add (data->targets, target);
+  return target;
+}
+
+static void
+target_free (Target *target)
+{
+  g_clear_object (&target->object);
+  g_clear_object (&target->block);
+  g_free (target->device_name);
+  g_free (target->buffer_unaligned);
+  g_clear_object (&target->cancellable);
+  g_clear_error (&target->error);
+  g_clear_object (&target->estimator);
+  g_free (target);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
 static DialogData *
 dialog_data_ref (DialogData *data)
 {
@@ -132,10 +230,16 @@ dialog_data_ref (DialogData *data)
 static void
 dialog_data_terminate_job (DialogData *data)
 {
-  if (data->local_job != NULL)
+  guint n;
+
+  for (n = 0; n < data->targets->len; n++)
     {
-      gdu_application_destroy_local_job (gdu_window_get_application (data->window), data->local_job);
-      data->local_job = NULL;
+      Target *target = g_ptr_array_index (data->targets, n);
+      if (target->local_job != NULL)
+        {
+          gdu_application_destroy_local_job (gdu_window_get_application (data->window), target->local_job);
+          target->local_job = NULL;
+        }
     }
 }
 
@@ -185,7 +289,10 @@ dialog_data_unref (DialogData *data)
       if (data->builder != NULL)
         g_object_unref (data->builder);
       g_free (data->buffer);
-      g_clear_object (&data->estimator);
+      g_list_free_full (data->identical_objects, g_object_unref);
+      g_ptr_array_unref (data->targets);
+      if (data->expected_checksum != NULL)
+        gdu_image_checksum_free (data->expected_checksum);
 
       g_clear_object (&data->cancellable);
       g_clear_object (&data->input_stream);
@@ -250,6 +357,18 @@ restore_disk_image_update (DialogData *data)
   else
     restore_file = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (data->selectable_image_fcbutton));
 
+  /* Can only verify if there's a checksum file next to the image */
+  if (restore_file != NULL)
+    {
+      GFile *checksum_file = gdu_image_checksum_get_file_for_image (restore_file);
+      gtk_widget_set_sensitive (data->verify_checkbutton, g_file_query_exists (checksum_file, NULL));
+      g_object_unref (checksum_file);
+    }
+  else
+    {
+      gtk_widget_set_sensitive (data->verify_checkbutton, FALSE);
+    }
+
   if (restore_file != NULL)
     {
       gboolean is_xz_compressed = FALSE;
@@ -349,6 +468,26 @@ restore_disk_image_update (DialogData *data)
 
   gtk_label_set_text (GTK_LABEL (data->image_size_label), image_size_str != NULL ? image_size_str : "—");
 
+  /* Offer to write the image to the other drives of the same kind too */
+  if (data->identical_objects != NULL)
+    {
+      guint num_identical = g_list_length (data->identical_objects);
+      gchar *label;
+
+      label = g_strdup_printf (dngettext (GETTEXT_PACKAGE,
+                                          "Also restore to %u other _drive of the same model",
+                                          "Also restore to %u other _drives of the same model",
+                                          num_identical),
+                               num_identical);
+      gtk_button_set_label (GTK_BUTTON (data->identical_checkbutton), label);
+      gtk_widget_show (data->identical_checkbutton);
+      g_free (label);
+    }
+  else
+    {
+      gtk_widget_hide (data->identical_checkbutton);
+    }
+
   g_free (restore_warning);
   g_free (restore_error);
   g_clear_object (&restore_file);
@@ -415,6 +554,57 @@ destination_combobox_sensitive_cb (GtkCellLayout   *cell_layout,
   g_clear_object (&block);
 }
 
+/* Finds the other drives of the same model and size as the
+ * destination, e.g. a batch of USB sticks, so they can all be
+ * restored to at once. Only for whole drives and never for system
+ * drives.
+ */
+static GList *
+find_identical_objects (DialogData *data)
+{
+  UDisksClient *client = gdu_window_get_client (data->window);
+  UDisksBlock *whole_block = NULL;
+  GList *objects = NULL;
+  GList *ret = NULL;
+  GList *l;
+
+  if (data->drive == NULL || strlen (udisks_drive_get_model (data->drive)) == 0)
+    goto out;
+
+  whole_block = udisks_client_get_block_for_drive (client, data->drive, FALSE); /* get_physical */
+  if (whole_block != data->block)
+    goto out;
+
+  objects = g_dbus_object_manager_get_objects (udisks_client_get_object_manager (client));
+  for (l = objects; l != NULL; l = l->next)
+    {
+      UDisksObject *object = UDISKS_OBJECT (l->data);
+      UDisksDrive *drive;
+      UDisksBlock *block;
+
+      drive = udisks_object_peek_drive (object);
+      if (drive == NULL || drive == data->drive)
+        continue;
+      if (g_strcmp0 (udisks_drive_get_vendor (drive), udisks_drive_get_vendor (data->drive)) != 0 ||
+          g_strcmp0 (udisks_drive_get_model (drive), udisks_drive_get_model (data->drive)) != 0)
+        continue;
+
+      block = udisks_client_get_block_for_drive (client, drive, FALSE); /* get_physical */
+      if (block == NULL)
+        continue;
+      if (udisks_block_get_size (block) == data->block_size &&
+          !udisks_block_get_read_only (block) &&
+          !udisks_block_get_hint_system (block))
+        ret = g_list_append (ret, g_dbus_interface_dup_object (G_DBUS_INTERFACE (block)));
+      g_object_unref (block);
+    }
+
+ out:
+  g_list_free_full (objects, g_object_unref);
+  g_clear_object (&whole_block);
+  return ret;
+}
+
 static void
 set_destination_object (DialogData *data,
                         UDisksObject *object)
@@ -434,6 +624,8 @@ set_destination_object (DialogData *data,
           /* TODO: use a method call for this so it works on e.g. floppy drives where e.g. we don't know the size */
           data->block_size = udisks_block_get_size (data->block);
         }
+      g_list_free_full (data->identical_objects, g_object_unref);
+      data->identical_objects = find_identical_objects (data);
     }
 }
 
@@ -557,9 +749,11 @@ restore_disk_image_populate (DialogData *data)
 /* ---------------------------------------------------------------------------------------------------- */
 
 static void
-update_job (DialogData *data,
-            gboolean    done)
+update_job (Target   *target,
+            gboolean  done)
 {
+  DialogData *data = target->data;
+  const gchar *extra_markup = NULL;
   guint64 bytes_completed = 0;
   guint64 bytes_target = 0;
   guint64 bytes_per_sec = 0;
@@ -567,20 +761,22 @@ update_job (DialogData *data,
   gdouble progress = 0.0;
 
   g_mutex_lock (&data->copy_lock);
-  if (data->estimator != NULL)
+  if (target->estimator != NULL)
     {
-      bytes_per_sec = gdu_estimator_get_bytes_per_sec (data->estimator);
-      usec_remaining = gdu_estimator_get_usec_remaining (data->estimator);
-      bytes_completed = gdu_estimator_get_completed_bytes (data->estimator);
-      bytes_target = gdu_estimator_get_target_bytes (data->estimator);
+      bytes_per_sec = gdu_estimator_get_bytes_per_sec (target->estimator);
+      usec_remaining = gdu_estimator_get_usec_remaining (target->estimator);
+      bytes_completed = gdu_estimator_get_completed_bytes (target->estimator);
+      bytes_target = gdu_estimator_get_target_bytes (target->estimator);
     }
-  data->update_id = 0;
+  if (target->verifying)
+    extra_markup = _("Verifying data on the device");
+  target->update_id = 0;
   g_mutex_unlock (&data->copy_lock);
 
-  if (data->local_job != NULL)
+  if (target->local_job != NULL)
     {
-      udisks_job_set_bytes (UDISKS_JOB (data->local_job), bytes_target);
-      udisks_job_set_rate (UDISKS_JOB (data->local_job), bytes_per_sec);
+      udisks_job_set_bytes (UDISKS_JOB (target->local_job), bytes_target);
+      udisks_job_set_rate (UDISKS_JOB (target->local_job), bytes_per_sec);
 
       if (done)
         {
@@ -593,12 +789,14 @@ update_job (DialogData *data,
           else
             progress = 0.0;
         }
-      udisks_job_set_progress (UDISKS_JOB (data->local_job), progress);
+      udisks_job_set_progress (UDISKS_JOB (target->local_job), progress);
 
       if (usec_remaining == 0)
-        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), 0);
+        udisks_job_set_expected_end_time (UDISKS_JOB (target->local_job), 0);
       else
-        udisks_job_set_expected_end_time (UDISKS_JOB (data->local_job), usec_remaining + g_get_real_time ());
+        udisks_job_set_expected_end_time (UDISKS_JOB (target->local_job), usec_remaining + g_get_real_time ());
+
+      gdu_local_job_set_extra_markup (target->local_job, extra_markup);
     }
 }
 
@@ -629,12 +827,25 @@ play_complete_sound (DialogData *data)
 static gboolean
 on_update_job (gpointer user_data)
 {
-  DialogData *data = user_data;
-  update_job (data, FALSE);
-  dialog_data_unref (data);
+  Target *target = user_data;
+  update_job (target, FALSE);
+  dialog_data_unref (target->data);
   return FALSE; /* remove source */
 }
 
+/* Schedules an update of the job, if one isn't pending already.
+ * Must hold copy_lock.
+ */
+static void
+target_schedule_update (Target *target)
+{
+  if (target->update_id == 0)
+    {
+      dialog_data_ref (target->data);
+      target->update_id = g_idle_add (on_update_job, target);
+    }
+}
+
 /* ---------------------------------------------------------------------------------------------------- */
 
 static gboolean
@@ -663,8 +874,10 @@ static gboolean
 on_success (gpointer user_data)
 {
   DialogData *data = user_data;
+  guint n;
 
-  update_job (data, TRUE);
+  for (n = 0; n < data->targets->len; n++)
+    update_job (g_ptr_array_index (data->targets, n), TRUE);
 
   play_complete_sound (data);
   dialog_data_uninhibit (data);
@@ -676,110 +889,826 @@ on_success (gpointer user_data)
 
 /* ---------------------------------------------------------------------------------------------------- */
 
-static gpointer
-copy_thread_func (gpointer user_data)
+/* Every device was canceled */
+static gboolean
+on_canceled (gpointer user_data)
 {
   DialogData *data = user_data;
-  guchar *buffer_unaligned = NULL;
-  guchar *buffer = NULL;
-  guint64 block_device_size = 0;
-  long page_size;
+
+  dialog_data_uninhibit (data);
+  dialog_data_complete_and_unref (data);
+
+  dialog_data_unref (data);
+  return FALSE; /* remove source */
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Zeroes @size bytes at @offset on the device without sending the
+ * zeroes. If the device doesn't support it, FALSE is returned,
+ * @method is downgraded and the caller should write the zeroes
+ * instead.
+ */
+static gboolean
+zero_span (gint        fd,
+           guint64     offset,
+           guint64     size,
+           ZeroMethod *method)
+{
+  guint64 range[2];
+
+  /* the ioctl only works on whole 512-byte sectors */
+  if (*method == ZERO_METHOD_NONE || offset % 512 != 0 || size % 512 != 0)
+    return FALSE;
+
+  range[0] = offset;
+  range[1] = size;
+  if (ioctl (fd, BLKZEROOUT, range) != 0)
+    *method = ZERO_METHOD_NONE;
+
+  return *method != ZERO_METHOD_NONE;
+}
+
+/* Synchronously writes all of @buffer to @offset on the device */
+static gboolean
+write_span (gint           fd,
+            const guchar  *buffer,
+            gsize          size,
+            guint64        offset,
+            GError       **error)
+{
+  while (size > 0)
+    {
+      ssize_t num_bytes_written;
+
+      num_bytes_written = pwrite (fd, buffer, size, offset);
+      if (num_bytes_written < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+          /* O_DIRECT doesn't work for unaligned writes, e.g. the end of the image */
+          if (errno == EINVAL && gdu_utils_set_direct_io (fd, FALSE))
+            continue;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error writing %" G_GSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %m",
+                       size,
+                       offset);
+          return FALSE;
+        }
+      buffer += num_bytes_written;
+      offset += num_bytes_written;
+      size -= num_bytes_written;
+    }
+  return TRUE;
+}
+
+/* Like zero_span() but falls back to writing zeroes from @buffer */
+static gboolean
+fill_with_zeroes (gint         fd,
+                  guint64      offset,
+                  guint64      size,
+                  guchar      *buffer,
+                  gsize        buffer_size,
+                  ZeroMethod  *method,
+                  GError     **error)
+{
+  if (zero_span (fd, offset, size, method))
+    return TRUE;
+
+  memset (buffer, 0, buffer_size);
+  while (size > 0)
+    {
+      gsize num_bytes_to_write = MIN (size, buffer_size);
+
+      if (!write_span (fd, buffer, num_bytes_to_write, offset, error))
+        return FALSE;
+      offset += num_bytes_to_write;
+      size -= num_bytes_to_write;
+    }
+  return TRUE;
+}
+
+/* Finds the next data extent at or after @offset in a sparse file.
+ * If there is no more data, both are set to @size.
+ *
+ * Returns: FALSE if SEEK_DATA/SEEK_HOLE is not supported.
+ */
+static gboolean
+find_data (gint      fd,
+           guint64   offset,
+           guint64   size,
+           guint64  *out_data_start,
+           guint64  *out_data_end)
+{
+  off_t data_start;
+  off_t data_end;
+
+  data_start = lseek (fd, offset, SEEK_DATA);
+  if (data_start == (off_t) -1)
+    {
+      if (errno != ENXIO)
+        return FALSE;
+      /* only a hole left */
+      *out_data_start = size;
+      *out_data_end = size;
+      return TRUE;
+    }
+
+  data_end = lseek (fd, data_start, SEEK_HOLE);
+  if (data_end == (off_t) -1)
+    return FALSE;
+
+  *out_data_start = MIN ((guint64) data_start, size);
+  *out_data_end = MIN ((guint64) data_end, size);
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* The disk image is read into a GduCopyRing once and every device has
+ * a writer thread that takes the buffers from there. Each writer keeps
+ * up to WRITE_QUEUE_DEPTH chunks in flight through a GduIOEngine, so
+ * the buffers are written straight from the ring without copying.
+ */
+
+#define WRITE_QUEUE_DEPTH 4
+
+/* The largest chunk size GduChunkSizer may pick */
+#define MAX_CHUNK_SIZE (8 * 1024 * 1024)
+
+/* Enough for the writes in flight and for reading ahead */
+#define RING_SIZE (WRITE_QUEUE_DEPTH + 2)
+
+/* Returns a page-aligned buffer of MAX_CHUNK_SIZE bytes for writing
+ * zeroes and verifying. Only allocated when needed as there may be
+ * many devices.
+ */
+static guchar *
+target_get_buffer (Target *target)
+{
+  if (target->buffer == NULL)
+    {
+      long page_size = sysconf (_SC_PAGESIZE);
+      target->buffer_unaligned = g_new0 (guchar, MAX_CHUNK_SIZE + page_size);
+      target->buffer = (guchar*) (((gintptr) (target->buffer_unaligned + page_size)) & (~(page_size - 1)));
+    }
+  return target->buffer;
+}
+
+/* Waits for one of the writes in flight and makes sure all of it got
+ * written. Returns the buffer so it can be released or NULL if @error is set.
+ */
+static GduCopyBuffer *
+reap_write (GduIOEngine  *engine,
+            gint          fd,
+            GError      **error)
+{
+  GduCopyBuffer *buffer;
+  gpointer user_data;
+  gssize result;
+
+  if (!gdu_io_engine_wait (engine, &user_data, &result, error))
+    return NULL;
+
+  buffer = user_data;
+
+  /* Retried without O_DIRECT below, see write_span(). Another write
+   * that was in flight at the same time may have turned it off already
+   * - either way, write_span() fails if the write doesn't work without
+   * O_DIRECT either.
+   */
+  if (result == -EINVAL)
+    {
+      gdu_utils_set_direct_io (fd, FALSE);
+      result = 0;
+    }
+
+  if (result < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (-result),
+                   "Error writing %" G_GUINT64_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %s",
+                   buffer->length,
+                   buffer->offset,
+                   g_strerror (-result));
+      return NULL;
+    }
+
+  /* Short writes are rare, just finish them synchronously */
+  if ((guint64) result < buffer->length &&
+      !write_span (fd, buffer->data + result, buffer->length - result, buffer->offset + result, error))
+    return NULL;
+
+  return buffer;
+}
+
+/* The fd from OpenForRestore is write-only, so reading back what was
+ * restored needs another one. Both are opened exclusively, so the
+ * first one has to be closed.
+ */
+static gboolean
+reopen_target_for_reading (Target  *target,
+                           GError **error)
+{
+  DialogData *data = target->data;
+  GUnixFDList *fd_list = NULL;
+  GVariant *fd_index = NULL;
+  gboolean ret = FALSE;
+
+  if (fsync (target->fd) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Error syncing device: %m");
+      goto out;
+    }
+  if (close (target->fd) != 0)
+    g_warning ("Error closing fd: %m");
+  target->fd = -1;
+
+  if (!udisks_block_call_open_for_backup_sync (target->block,
+                                               g_variant_new ("a{sv}", NULL), /* options */
+                                               NULL, /* fd_list */
+                                               &fd_index,
+                                               &fd_list,
+                                               target->cancellable,
+                                               error))
+    goto out;
+
+  target->fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (target->fd == -1)
+    {
+      g_prefix_error (error,
+                      "Error extracing fd with handle %d from D-Bus message: ",
+                      g_variant_get_handle (fd_index));
+      goto out;
+    }
+
+  if (data->direct_io)
+    gdu_utils_set_direct_io (target->fd, TRUE);
+
+  ret = TRUE;
+
+ out:
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  return ret;
+}
+
+/* Reads back what was just restored and compares it against the
+ * checksum file. This is the only extra I/O when verifying.
+ */
+static gboolean
+verify_device (Target  *target,
+               GError **error)
+{
+  DialogData *data = target->data;
+  GduImageChecksum *checksum;
+  gint64 last_update_usec = -1;
+  guint64 offset = 0;
+  guint64 mismatch_offset = 0;
+  guchar *buffer;
+  gboolean ret = FALSE;
+
+  if (!reopen_target_for_reading (target, error))
+    return FALSE;
+
+  checksum = gdu_image_checksum_new (gdu_image_checksum_get_block_size (data->expected_checksum));
+  buffer = target_get_buffer (target);
+
+  /* Make sure we're reading from the device, not the page cache */
+  gdu_utils_drop_page_cache (target->fd, 0, 0, FALSE);
+
+  g_mutex_lock (&data->copy_lock);
+  target->verifying = TRUE;
+  g_clear_object (&target->estimator);
+  target->estimator = gdu_estimator_new (data->input_size);
+  g_mutex_unlock (&data->copy_lock);
+
+  while (offset < data->input_size)
+    {
+      gsize num_bytes_to_read;
+      ssize_t num_bytes_read;
+      gint64 now_usec;
+
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          if (offset > 0)
+            gdu_estimator_add_sample (target->estimator, offset);
+          target_schedule_update (target);
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      if (g_cancellable_set_error_if_cancelled (target->cancellable, error))
+        goto out;
+
+      num_bytes_to_read = MIN (MAX_CHUNK_SIZE, data->input_size - offset);
+      num_bytes_read = pread (target->fd, buffer, num_bytes_to_read, offset);
+      if (num_bytes_read < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            continue;
+          /* O_DIRECT doesn't work for unaligned reads, e.g. the end of the image */
+          if (errno == EINVAL && gdu_utils_set_direct_io (target->fd, FALSE))
+            continue;
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": %m",
+                       num_bytes_to_read,
+                       offset);
+          goto out;
+        }
+      if (num_bytes_read == 0)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                       "Reading from offset %" G_GUINT64_FORMAT " returned zero bytes",
+                       offset);
+          goto out;
+        }
+
+      gdu_image_checksum_update (checksum, buffer, num_bytes_read);
+      offset += num_bytes_read;
+    }
+
+  if (!gdu_image_checksum_equal (checksum, data->expected_checksum, &mismatch_offset))
+    {
+      gchar *s = g_strdup_printf ("%" G_GUINT64_FORMAT, mismatch_offset);
+      /* Translators: The %s is the offset in bytes of the first block that differs */
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   _("Data read back from the device does not match the disk image (first difference at offset %s)"),
+                   s);
+      g_free (s);
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  g_mutex_lock (&data->copy_lock);
+  target->verifying = FALSE;
+  g_mutex_unlock (&data->copy_lock);
+  gdu_image_checksum_free (checksum);
+  return ret;
+}
+
+/* Writes the buffers from the ring to one device, then verifies it */
+static gpointer
+write_thread_func (gpointer user_data)
+{
+  Target *target = user_data;
+  DialogData *data = target->data;
+  GduIOEngine *engine;
+  GduCopyBuffer *buffer;
   GError *error = NULL;
-  GError *error2 = NULL;
   gint64 last_update_usec = -1;
-  gint fd = -1;
-  gint buffer_size;
   guint64 num_bytes_completed = 0;
+
+  engine = gdu_io_engine_new (WRITE_QUEUE_DEPTH);
+
+  while (TRUE)
+    {
+      gint64 now_usec;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          if (num_bytes_completed > 0)
+            gdu_estimator_add_sample (target->estimator, num_bytes_completed);
+          target_schedule_update (target);
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      if (g_cancellable_set_error_if_cancelled (target->cancellable, &error))
+        goto out;
+
+      /* Wait for a write to finish if the queue is full */
+      if (gdu_io_engine_get_num_pending (engine) == WRITE_QUEUE_DEPTH)
+        {
+          buffer = reap_write (engine, target->fd, &error);
+          if (buffer == NULL)
+            goto out;
+          if (target->throttle_writeback)
+            gdu_utils_throttle_writeback (target->fd, &target->writeback_offset, buffer->offset + buffer->length);
+          gdu_copy_ring_release (data->ring, buffer);
+        }
+
+      buffer = gdu_copy_ring_acquire_filled_for_consumer (data->ring, target->index);
+      if (buffer == NULL)
+        break;
+
+      /* Holes in the image and, if discarding, blocks of zeroes */
+      if (buffer->hole)
+        {
+          gboolean zeroed;
+          zeroed = fill_with_zeroes (target->fd, buffer->offset, buffer->length,
+                                     target_get_buffer (target), MAX_CHUNK_SIZE,
+                                     &target->zero_method, &error);
+          num_bytes_completed = buffer->offset + buffer->length;
+          gdu_copy_ring_release (data->ring, buffer);
+          if (!zeroed)
+            goto out;
+          continue;
+        }
+
+      if (!gdu_io_engine_submit_write (engine, target->fd, buffer->data, buffer->length, buffer->offset, buffer, &error))
+        {
+          gdu_copy_ring_release (data->ring, buffer);
+          goto out;
+        }
+      num_bytes_completed = buffer->offset + buffer->length;
+    }
+
+  /* The reader failed and reports why */
+  if (gdu_copy_ring_is_aborted (data->ring))
+    goto out;
+
+  /* Wait for the last writes to hit the device */
+  while (gdu_io_engine_get_num_pending (engine) > 0)
+    {
+      buffer = reap_write (engine, target->fd, &error);
+      if (buffer == NULL)
+        goto out;
+      gdu_copy_ring_release (data->ring, buffer);
+    }
+  if (target->throttle_writeback)
+    gdu_utils_drop_page_cache (target->fd, 0, 0, TRUE);
+
+  /* The ring is only finished once the image matched its checksum */
+  if (data->expected_checksum != NULL)
+    {
+      if (!verify_device (target, &error))
+        goto out;
+    }
+
+ out:
+  /* Give back the buffers that are still being written */
+  while (gdu_io_engine_get_num_pending (engine) > 0)
+    {
+      gpointer pending = NULL;
+      if (!gdu_io_engine_wait (engine, &pending, NULL, NULL))
+        break;
+      gdu_copy_ring_release (data->ring, pending);
+    }
+  gdu_io_engine_free (engine);
+
+  /* Don't hold up the other devices */
+  gdu_copy_ring_detach (data->ring, target->index);
+
+  target->error = error;
+  return NULL;
+}
+
+/* Gets the fd for a device from udisks and sets it up for writing */
+static gboolean
+open_target (Target  *target,
+             GError **error)
+{
+  DialogData *data = target->data;
   GUnixFDList *fd_list = NULL;
   GVariant *fd_index = NULL;
-
-  /* default to 1 MiB blocks */
-  buffer_size = (1 * 1024 * 1024);
+  guint64 block_device_size = 0;
+  gboolean ret = FALSE;
 
   /* request the fd from udisks */
-  if (!udisks_block_call_open_for_restore_sync (data->block,
+  if (!udisks_block_call_open_for_restore_sync (target->block,
                                                 g_variant_new ("a{sv}", NULL), /* options */
                                                 NULL, /* fd_list */
                                                 &fd_index,
                                                 &fd_list,
                                                 NULL, /* cancellable */
-                                                &error))
+                                                error))
     goto out;
 
-  fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), &error);
-  if (error != NULL)
+  target->fd = g_unix_fd_list_get (fd_list, g_variant_get_handle (fd_index), error);
+  if (target->fd == -1)
     {
-      g_prefix_error (&error,
+      g_prefix_error (error,
                       "Error extracing fd with handle %d from D-Bus message: ",
                       g_variant_get_handle (fd_index));
       goto out;
     }
-  if (fd_index != NULL)
-    g_variant_unref (fd_index);
-  g_clear_object (&fd_list);
-
-  g_assert (fd != -1);
 
   /* We can't use udisks_block_get_size() because the media may have
    * changed and udisks may not have noticed. TODO: maybe have a
    * Block.GetSize() method instead...
    */
-  if (ioctl (fd, BLKGETSIZE64, &block_device_size) != 0)
+  if (ioctl (target->fd, BLKGETSIZE64, &block_device_size) != 0)
     {
-      error = g_error_new (G_IO_ERROR, g_io_error_from_errno (errno),
-                           "%s", strerror (errno));
-      g_prefix_error (&error, _("Error determining size of device: "));
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "%s", strerror (errno));
+      g_prefix_error (error, _("Error determining size of device: "));
       goto out;
     }
 
   if (block_device_size == 0)
     {
-      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
-                           _("Device is size 0"));
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("Device is size 0"));
       goto out;
     }
-  data->block_size = block_device_size;
 
-  page_size = sysconf (_SC_PAGESIZE);
-  buffer_unaligned = g_new0 (guchar, buffer_size + page_size);
-  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+  /* BLKDISCARD is no use here since BLKDISCARDZEROES always reports 0
+   * since Linux 4.12, so there is no telling whether discarded blocks
+   * read back as zeroes. BLKZEROOUT unmaps the blocks anyway where the
+   * device supports it (e.g. WRITE ZEROES with unmap).
+   */
+  target->zero_method = ZERO_METHOD_ZEROOUT;
+
+  /* Restoring a big image shouldn't evict everybody else's data from
+   * the page cache. The device is written with O_DIRECT if possible,
+   * otherwise writeback is started right away so it runs at a steady
+   * pace.
+   */
+  if (data->direct_io && !gdu_utils_set_direct_io (target->fd, TRUE))
+    target->throttle_writeback = TRUE;
+
+  ret = TRUE;
+
+ out:
+  if (fd_index != NULL)
+    g_variant_unref (fd_index);
+  g_clear_object (&fd_list);
+  return ret;
+}
+
+/* A plain copy of an uncompressed disk image to a single device
+ * doesn't need the data to go through userspace, see gdukernelcopy.c.
+ * This stops at the first problem and leaves the rest to the usual
+ * copy, which knows how to report it.
+ */
+static void
+copy_in_kernel (Target   *target,
+                gint      input_fd,
+                gint      image_fd,
+                guint64  *inout_offset)
+{
+  DialogData *data = target->data;
+  GduKernelCopy *copy;
+  GError *error = NULL;
+  gint64 last_update_usec = -1;
+  guint64 offset = *inout_offset;
+  guint64 data_start = 0;
+  guint64 data_end = 0;
+
+  copy = gdu_kernel_copy_new (input_fd, target->fd);
+  while (offset < data->input_size)
+    {
+      gssize num_bytes_copied;
+      gint64 now_usec;
+
+      /* Update GUI - but only every 200 ms and only if last update isn't pending */
+      g_mutex_lock (&data->copy_lock);
+      now_usec = g_get_monotonic_time ();
+      if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
+        {
+          if (offset > 0)
+            gdu_estimator_add_sample (target->estimator, offset);
+          target_schedule_update (target);
+          last_update_usec = now_usec;
+        }
+      g_mutex_unlock (&data->copy_lock);
+
+      /* the writer reports it */
+      if (g_cancellable_is_cancelled (target->cancellable))
+        break;
+
+      /* Look up the next data extent once we're through the current one */
+      if (offset >= data_end &&
+          !find_data (input_fd, offset, data->input_size, &data_start, &data_end))
+        {
+          data_start = offset;
+          data_end = data->input_size;
+        }
+
+      /* Zero holes on the device in bounded steps */
+      if (offset < data_start)
+        {
+          guint64 num_bytes_to_zero = MIN (data_start - offset, 16 * MAX_CHUNK_SIZE);
+
+          if (!fill_with_zeroes (target->fd, offset, num_bytes_to_zero,
+                                 target_get_buffer (target), MAX_CHUNK_SIZE,
+                                 &target->zero_method, &error))
+            break;
+          offset += num_bytes_to_zero;
+          continue;
+        }
+
+      num_bytes_copied = gdu_kernel_copy_copy (copy, offset, offset,
+                                               MIN (4 * MAX_CHUNK_SIZE, data_end - offset),
+                                               &error);
+      if (num_bytes_copied <= 0)
+        break;
+
+      if (image_fd != -1)
+        gdu_utils_drop_page_cache (image_fd, offset, num_bytes_copied, FALSE);
+      offset += num_bytes_copied;
+      if (target->throttle_writeback)
+        gdu_utils_throttle_writeback (target->fd, &target->writeback_offset, offset);
+    }
+
+  g_clear_error (&error);
+  gdu_kernel_copy_free (copy);
+  *inout_offset = offset;
+}
+
+/* Sets copy_error from the errors of the devices, if any. Devices
+ * that were canceled don't count.
+ */
+static void
+collect_errors (DialogData *data)
+{
+  GString *str = NULL;
+  guint n;
+
+  for (n = 0; n < data->targets->len; n++)
+    {
+      Target *target = g_ptr_array_index (data->targets, n);
+
+      if (target->error == NULL ||
+          (target->error->domain == G_IO_ERROR && target->error->code == G_IO_ERROR_CANCELLED))
+        continue;
+
+      if (data->targets->len == 1)
+        {
+          data->copy_error = g_error_copy (target->error);
+          return;
+        }
+
+      if (str == NULL)
+        str = g_string_new (NULL);
+      else
+        g_string_append_c (str, '\n');
+      g_string_append_printf (str, "%s: %s", target->device_name, target->error->message);
+    }
+
+  if (str != NULL)
+    {
+      data->copy_error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, str->str);
+      g_string_free (str, TRUE);
+    }
+}
+
+/* Reads the disk image into the ring, once for all the devices */
+static gpointer
+copy_thread_func (gpointer user_data)
+{
+  DialogData *data = user_data;
+  GduChunkSizer *sizer = NULL;
+  GduEstimator *estimator = NULL;
+  GduImageChecksum *checksum = NULL;
+  GduCopyBuffer *buffer;
+  guint64 mismatch_offset = 0;
+  GError *error = NULL;
+  GError *error2 = NULL;
+  gint64 last_update_usec = -1;
+  guint64 num_bytes_completed = 0;
+  gint input_fd = -1;
+  guint64 data_start = 0;
+  guint64 data_end = 0;
+  gint image_fd = -1;
+  gint sizer_fd = -1;
+  guint num_succeeded = 0;
+  guint num_canceled = 0;
+  guint n;
 
-  g_mutex_lock (&data->copy_lock);
-  data->estimator = gdu_estimator_new (data->input_size);
-  data->update_id = 0;
   data->start_time_usec = g_get_real_time ();
-  g_mutex_unlock (&data->copy_lock);
 
-  /* Read huge (e.g. 1 MiB) blocks and write it to the output
-   * device even if it was only partially read.
+  /* Open all the devices first, the ones that fail don't get a writer */
+  data->ring = gdu_copy_ring_new_with_consumers (RING_SIZE, MAX_CHUNK_SIZE, data->targets->len);
+  for (n = 0; n < data->targets->len; n++)
+    {
+      Target *target = g_ptr_array_index (data->targets, n);
+
+      if (!open_target (target, &target->error))
+        {
+          gdu_copy_ring_detach (data->ring, target->index);
+          continue;
+        }
+      if (sizer_fd == -1)
+        sizer_fd = target->fd;
+
+      g_mutex_lock (&data->copy_lock);
+      target->estimator = gdu_estimator_new (data->input_size);
+      target->update_id = 0;
+      g_mutex_unlock (&data->copy_lock);
+    }
+  if (sizer_fd == -1)
+    goto out;
+
+  /* If reading straight from a file (e.g. not decompressing) we can
+   * skip the holes of sparse image files
+   */
+  if (G_IS_FILE_DESCRIPTOR_BASED (data->input_stream))
+    input_fd = g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (data->input_stream));
+  else
+    data_end = data->input_size;
+
+  /* Pages of the image file are dropped once we're done with them */
+  if (data->direct_io && input_fd != -1)
+    {
+      image_fd = input_fd;
+      posix_fadvise (image_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+  /* Only the data of a single device can be handed to the kernel -
+   * with several devices it's cheaper to read the image once
+   */
+  if (data->targets->len == 1 && input_fd != -1 && !data->discard && data->expected_checksum == NULL)
+    copy_in_kernel (g_ptr_array_index (data->targets, 0), input_fd, image_fd, &num_bytes_completed);
+
+  for (n = 0; n < data->targets->len; n++)
+    {
+      Target *target = g_ptr_array_index (data->targets, n);
+      if (target->error == NULL)
+        target->thread = g_thread_new ("restore-disk-image-writer", write_thread_func, target);
+    }
+
+  /* Chunks are sized at runtime, see gduchunksizer.c - the ring goes
+   * at the pace of the slowest device so any device will do
    */
-  num_bytes_completed = 0;
+  sizer = gdu_chunk_sizer_new (sizer_fd, MAX_CHUNK_SIZE);
+  estimator = gdu_estimator_new (data->input_size);
+
+  /* Check the image against the checksum file on the fly */
+  if (data->expected_checksum != NULL)
+    checksum = gdu_image_checksum_new (gdu_image_checksum_get_block_size (data->expected_checksum));
+
   while (num_bytes_completed < data->input_size)
     {
       gsize num_bytes_to_read;
       gsize num_bytes_read;
-      ssize_t num_bytes_written;
       gint64 now_usec;
 
-      num_bytes_to_read = buffer_size;
-      if (num_bytes_to_read + num_bytes_completed > data->input_size)
-        num_bytes_to_read = data->input_size - num_bytes_completed;
-
-      /* Update GUI - but only every 200 ms and only if last update isn't pending */
-      g_mutex_lock (&data->copy_lock);
       now_usec = g_get_monotonic_time ();
       if (now_usec - last_update_usec > 200 * G_USEC_PER_SEC / 1000 || last_update_usec < 0)
         {
           if (num_bytes_completed > 0)
-            gdu_estimator_add_sample (data->estimator, num_bytes_completed);
-          if (data->update_id == 0)
-            data->update_id = g_idle_add (on_update_job, dialog_data_ref (data));
+            {
+              gdu_estimator_add_sample (estimator, num_bytes_completed);
+              gdu_chunk_sizer_update (sizer, estimator);
+            }
           last_update_usec = now_usec;
         }
-      g_mutex_unlock (&data->copy_lock);
+
+      if (g_cancellable_set_error_if_cancelled (data->cancellable, &error))
+        goto out;
+
+      /* Look up the next data extent once we're through the current one */
+      if (input_fd != -1 && num_bytes_completed >= data_end)
+        {
+          if (!find_data (input_fd, num_bytes_completed, data->input_size, &data_start, &data_end))
+            {
+              /* not supported, just read everything */
+              input_fd = -1;
+              data_start = num_bytes_completed;
+              data_end = data->input_size;
+            }
+
+          /* the lseek() calls moved the file position under the stream */
+          if (!g_seekable_seek (G_SEEKABLE (data->input_stream),
+                                data_start,
+                                G_SEEK_SET,
+                                data->cancellable,
+                                &error))
+            {
+              g_prefix_error (&error,
+                              "Error seeking to offset %" G_GUINT64_FORMAT ": ",
+                              data_start);
+              goto out;
+            }
+        }
+
+      /* NULL if every device failed or was canceled */
+      buffer = gdu_copy_ring_acquire_free (data->ring);
+      if (buffer == NULL)
+        goto out;
+
+      /* Holes are passed on in bounded steps so progress is reported
+       * and cancellation is honored
+       */
+      if (num_bytes_completed < data_start)
+        {
+          buffer->hole = TRUE;
+          buffer->offset = num_bytes_completed;
+          buffer->length = MIN (data_start - num_bytes_completed, 16 * MAX_CHUNK_SIZE);
+          if (checksum != NULL)
+            gdu_image_checksum_update_zeroes (checksum, buffer->length);
+          num_bytes_completed += buffer->length;
+          gdu_copy_ring_submit (data->ring, buffer);
+          continue;
+        }
+
+      num_bytes_to_read = MIN (gdu_chunk_sizer_get_size (sizer), buffer->size);
+      if (num_bytes_to_read + num_bytes_completed > data_end)
+        num_bytes_to_read = data_end - num_bytes_completed;
 
       if (!g_input_stream_read_all (data->input_stream,
-                                    buffer,
+                                    buffer->data,
                                     num_bytes_to_read,
                                     &num_bytes_read,
                                     data->cancellable,
@@ -789,6 +1718,7 @@ copy_thread_func (gpointer user_data)
                           "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": ",
                           num_bytes_to_read,
                           num_bytes_completed);
+          gdu_copy_ring_release (data->ring, buffer);
           goto out;
         }
       if (num_bytes_read != num_bytes_to_read)
@@ -798,31 +1728,70 @@ copy_thread_func (gpointer user_data)
                        num_bytes_read,
                        num_bytes_completed,
                        num_bytes_to_read);
+          gdu_copy_ring_release (data->ring, buffer);
           goto out;
         }
 
-    copy_write_again:
-      num_bytes_written = write (fd, buffer, num_bytes_read);
-      if (num_bytes_written < 0)
-        {
-          if (errno == EAGAIN || errno == EINTR)
-            goto copy_write_again;
+      if (image_fd != -1)
+        gdu_utils_drop_page_cache (image_fd, num_bytes_completed, num_bytes_read, FALSE);
 
-          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                       "Error writing %" G_GSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %m",
-                       num_bytes_read,
-                       num_bytes_completed);
+      if (checksum != NULL)
+        gdu_image_checksum_update (checksum, buffer->data, num_bytes_read);
+
+      buffer->offset = num_bytes_completed;
+      buffer->length = num_bytes_read;
+
+      /* Don't bother writing zeroes if the devices can zero the range themselves */
+      if (data->discard && gdu_utils_is_zeroed (buffer->data, num_bytes_read))
+        buffer->hole = TRUE;
+
+      num_bytes_completed += num_bytes_read;
+      gdu_copy_ring_submit (data->ring, buffer);
+    }
+
+  /* The writers only verify the devices if the image is good */
+  if (checksum != NULL)
+    {
+      if (!gdu_image_checksum_equal (checksum, data->expected_checksum, &mismatch_offset))
+        {
+          gchar *s = g_strdup_printf ("%" G_GUINT64_FORMAT, mismatch_offset);
+          /* Translators: The %s is the offset in bytes of the first block that differs */
+          g_set_error (&error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       _("The disk image does not match its checksum file (first difference at offset %s)"),
+                       s);
+          g_free (s);
           goto out;
         }
+    }
 
-      /*g_print ("copied %" G_GUINT64_FORMAT " bytes at offset %" G_GUINT64_FORMAT "\n",
-               (guint64) num_bytes_written,
-               num_bytes_completed);*/
+ out:
+  if (error != NULL)
+    gdu_copy_ring_abort (data->ring);
+  else
+    gdu_copy_ring_finish (data->ring);
 
-      num_bytes_completed += num_bytes_written;
+  for (n = 0; n < data->targets->len; n++)
+    {
+      Target *target = g_ptr_array_index (data->targets, n);
+      if (target->thread != NULL)
+        {
+          g_thread_join (target->thread);
+          target->thread = NULL;
+        }
+      /* if reading failed, it failed for every device */
+      if (error != NULL && target->error == NULL)
+        target->error = g_error_copy (error);
     }
+  g_clear_error (&error);
+
+  gdu_copy_ring_free (data->ring);
+  data->ring = NULL;
+  if (sizer != NULL)
+    gdu_chunk_sizer_free (sizer);
+  g_clear_object (&estimator);
+  if (checksum != NULL)
+    gdu_image_checksum_free (checksum);
 
- out:
   data->end_time_usec = g_get_real_time ();
 
   /* in either case, close the stream */
@@ -836,52 +1805,59 @@ copy_thread_func (gpointer user_data)
     }
   g_clear_object (&data->input_stream);
 
-  if (fd != -1 )
+  for (n = 0; n < data->targets->len; n++)
     {
-      if (close (fd) != 0)
-        g_warning ("Error closing fd: %m");
-    }
+      Target *target = g_ptr_array_index (data->targets, n);
 
-  if (error != NULL)
-    {
-      /* show error in GUI */
-      if (!(error->domain == G_IO_ERROR && error->code == G_IO_ERROR_CANCELLED))
+      if (target->fd != -1)
         {
-          data->copy_error = error; error = NULL;
-          g_idle_add (on_show_error, dialog_data_ref (data));
+          if (close (target->fd) != 0)
+            g_warning ("Error closing fd: %m");
+          target->fd = -1;
         }
-      g_clear_error (&error);
 
-      /* Wipe the device */
-      if (!udisks_block_call_format_sync (data->block,
-                                          "empty",
+      if (target->error != NULL)
+        {
+          if (target->error->domain == G_IO_ERROR && target->error->code == G_IO_ERROR_CANCELLED)
+            num_canceled++;
+
+          /* Wipe the device */
+          if (!udisks_block_call_format_sync (target->block,
+                                              "empty",
+                                              g_variant_new ("a{sv}", NULL), /* options */
+                                              NULL, /* cancellable */
+                                              &error2))
+            {
+              g_warning ("Error wiping device on error path: %s (%s, %d)",
+                         error2->message, g_quark_to_string (error2->domain), error2->code);
+              g_clear_error (&error2);
+            }
+        }
+      else
+        {
+          num_succeeded++;
+        }
+
+      /* finally, request that the core OS / kernel rescans the device */
+      if (!udisks_block_call_rescan_sync (target->block,
                                           g_variant_new ("a{sv}", NULL), /* options */
                                           NULL, /* cancellable */
                                           &error2))
         {
-          g_warning ("Error wiping device on error path: %s (%s, %d)",
+          g_warning ("Error rescanning device: %s (%s, %d)",
                      error2->message, g_quark_to_string (error2->domain), error2->code);
           g_clear_error (&error2);
         }
     }
-  else
-    {
-      /* success */
-      g_idle_add (on_success, dialog_data_ref (data));
-    }
-
-  g_free (buffer_unaligned);
 
-  /* finally, request that the core OS / kernel rescans the device */
-  if (!udisks_block_call_rescan_sync (data->block,
-                                      g_variant_new ("a{sv}", NULL), /* options */
-                                      NULL, /* cancellable */
-                                      &error2))
-    {
-      g_warning ("Error rescanning device: %s (%s, %d)",
-                 error2->message, g_quark_to_string (error2->domain), error2->code);
-      g_clear_error (&error2);
-    }
+  /* show errors in GUI */
+  collect_errors (data);
+  if (data->copy_error != NULL)
+    g_idle_add (on_show_error, dialog_data_ref (data));
+  else if (num_succeeded > 0)
+    g_idle_add (on_success, dialog_data_ref (data));
+  else if (num_canceled > 0)
+    g_idle_add (on_canceled, dialog_data_ref (data));
 
   dialog_data_unref_in_idle (data); /* unref on main thread */
   return NULL;
@@ -893,12 +1869,15 @@ static void
 on_local_job_canceled (GduLocalJob  *job,
                        gpointer      user_data)
 {
-  DialogData *data = user_data;
-  if (!data->completed)
+  Target *target = user_data;
+  DialogData *data = target->data;
+
+  /* The other devices carry on */
+  if (!data->completed && target->local_job != NULL)
     {
-      dialog_data_terminate_job (data);
-      dialog_data_complete_and_unref (data);
-      update_job (data, FALSE);
+      g_cancellable_cancel (target->cancellable);
+      gdu_application_destroy_local_job (gdu_window_get_application (data->window), target->local_job);
+      target->local_job = NULL;
     }
 }
 
@@ -909,6 +1888,7 @@ start_copying (DialogData *data)
   gboolean ret = FALSE;
   GFileInfo *info;
   GError *error;
+  guint n;
 
   error = NULL;
   if (data->disk_image_filename != NULL)
@@ -943,21 +1923,47 @@ start_copying (DialogData *data)
   data->input_size = g_file_info_get_size (info);
   if (g_str_has_suffix (g_file_info_get_content_type (info), "-xz-compressed"))
     {
-      GduXzDecompressor *decompressor;
       GInputStream *decompressed_input_stream;
 
       data->input_size = gdu_xz_decompressor_get_uncompressed_size (file);
 
-      decompressor = gdu_xz_decompressor_new ();
-      decompressed_input_stream = g_converter_input_stream_new (G_INPUT_STREAM (data->input_stream),
-                                                                G_CONVERTER (decompressor));
-      g_clear_object (&decompressor);
+      /* Use all cores if the file is made up of several blocks,
+       * otherwise fall back to decoding it as a single stream
+       */
+      decompressed_input_stream = gdu_xz_input_stream_new (file);
+      if (decompressed_input_stream == NULL)
+        {
+          GduXzDecompressor *decompressor;
+          decompressor = gdu_xz_decompressor_new ();
+          decompressed_input_stream = g_converter_input_stream_new (G_INPUT_STREAM (data->input_stream),
+                                                                    G_CONVERTER (decompressor));
+          g_clear_object (&decompressor);
+        }
 
       g_object_unref (data->input_stream);
       data->input_stream = decompressed_input_stream;
     }
   g_object_unref (info);
 
+  data->discard = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->discard_checkbutton));
+  data->direct_io = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->direct_io_checkbutton));
+
+  if (gtk_widget_get_sensitive (data->verify_checkbutton) &&
+      gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->verify_checkbutton)))
+    {
+      GFile *checksum_file = gdu_image_checksum_get_file_for_image (file);
+      error = NULL;
+      data->expected_checksum = gdu_image_checksum_load (checksum_file, &error);
+      g_object_unref (checksum_file);
+      if (data->expected_checksum == NULL)
+        {
+          gdu_utils_show_error (GTK_WINDOW (data->dialog), _("Error reading checksum file"), error);
+          g_error_free (error);
+          dialog_data_complete_and_unref (data);
+          goto out;
+        }
+    }
+
   data->inhibit_cookie = gtk_application_inhibit (GTK_APPLICATION (gdu_window_get_application (data->window)),
                                                   GTK_WINDOW (data->dialog),
                                                   GTK_APPLICATION_INHIBIT_SUSPEND |
@@ -965,16 +1971,22 @@ start_copying (DialogData *data)
                                                   /* Translators: Reason why suspend/logout is being inhibited */
                                                   C_("restore-inhibit-message", "Copying disk image to device"));
 
-  data->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
-                                                      data->object);
-  udisks_job_set_operation (UDISKS_JOB (data->local_job), "x-gdu-restore-disk-image");
-  /* Translators: this is the description of the job */
-  gdu_local_job_set_description (data->local_job, _("Restoring Disk Image"));
-  udisks_job_set_progress_valid (UDISKS_JOB (data->local_job), TRUE);
-  udisks_job_set_cancelable (UDISKS_JOB (data->local_job), TRUE);
-  g_signal_connect (data->local_job, "canceled",
-                    G_CALLBACK (on_local_job_canceled),
-                    data);
+  /* One job per device so each can be followed and canceled on its own */
+  for (n = 0; n < data->targets->len; n++)
+    {
+      Target *target = g_ptr_array_index (data->targets, n);
+
+      target->local_job = gdu_application_create_local_job (gdu_window_get_application (data->window),
+                                                            target->object);
+      udisks_job_set_operation (UDISKS_JOB (target->local_job), "x-gdu-restore-disk-image");
+      /* Translators: this is the description of the job */
+      gdu_local_job_set_description (target->local_job, _("Restoring Disk Image"));
+      udisks_job_set_progress_valid (UDISKS_JOB (target->local_job), TRUE);
+      udisks_job_set_cancelable (UDISKS_JOB (target->local_job), TRUE);
+      g_signal_connect (target->local_job, "canceled",
+                        G_CALLBACK (on_local_job_canceled),
+                        target);
+    }
 
   dialog_data_hide (data);
 
@@ -997,7 +2009,7 @@ ensure_unused_cb (GduWindow     *window,
                   gpointer       user_data)
 {
   DialogData *data = user_data;
-  if (gdu_window_ensure_unused_finish (window, res, NULL))
+  if (gdu_window_ensure_unused_list_finish (window, res, NULL))
     {
       start_copying (data);
     }
@@ -1015,17 +2027,30 @@ on_dialog_response (GtkDialog     *dialog,
   DialogData *data = user_data;
   GList *objects = NULL;
   GFile *folder = NULL;
+  guint n;
 
   if (data->dialog == NULL)
     goto out;
 
-  objects = g_list_append (NULL, data->object);
-
   switch (response)
     {
     case GTK_RESPONSE_OK:
+      target_new (data, data->object);
+      if (gtk_widget_get_visible (data->identical_checkbutton) &&
+          gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON (data->identical_checkbutton)))
+        {
+          GList *l;
+          for (l = data->identical_objects; l != NULL; l = l->next)
+            target_new (data, UDISKS_OBJECT (l->data));
+        }
+      for (n = 0; n < data->targets->len; n++)
+        objects = g_list_append (objects, ((Target *) g_ptr_array_index (data->targets, n))->object);
+
+
       if (!gdu_utils_show_confirmation (GTK_WINDOW (data->dialog),
-                                        _("Are you sure you want to write the disk image to the device?"),
+                                        data->targets->len == 1 ?
+                                          _("Are you sure you want to write the disk image to the device?") :
+                                          _("Are you sure you want to write the disk image to all the devices?"),
                                         _("All existing data will be lost"),
                                         _("_Restore"),
                                         NULL, NULL,
@@ -1039,12 +2064,12 @@ on_dialog_response (GtkDialog     *dialog,
       folder = gtk_file_chooser_get_current_folder_file (GTK_FILE_CHOOSER (data->selectable_image_fcbutton));
       gdu_utils_file_chooser_for_disk_images_set_default_folder (folder);
 
-      /* ensure the device is unused (e.g. unmounted) before copying data to it... */
-      gdu_window_ensure_unused (data->window,
-                                data->object,
-                                (GAsyncReadyCallback) ensure_unused_cb,
-                                NULL, /* GCancellable */
-                                data);
+      /* ensure the devices are unused (e.g. unmounted) before copying data to them... */
+      gdu_window_ensure_unused_list (data->window,
+                                     objects,
+                                     (GAsyncReadyCallback) ensure_unused_cb,
+                                     NULL, /* GCancellable */
+                                     data);
       break;
 
     default: /* explicit fallthrough */
@@ -1068,6 +2093,7 @@ gdu_restore_disk_image_dialog_show (GduWindow    *window,
   data = g_new0 (DialogData, 1);
   data->ref_count = 1;
   g_mutex_init (&data->copy_lock);
+  data->targets = g_ptr_array_new_with_free_func ((GDestroyNotify) target_free);
   data->window = g_object_ref (window);
   set_destination_object (data, object);
   if (object == NULL)
@@ -49,6 +49,36 @@ typedef struct GduLocalJob GduLocalJob;
 struct GduXzDecompressor;
 typedef struct GduXzDecompressor GduXzDecompressor;
 
+struct GduXzCompressor;
+typedef struct GduXzCompressor GduXzCompressor;
+
+struct GduXzInputStream;
+typedef struct GduXzInputStream GduXzInputStream;
+
+struct GduCopyRing;
+typedef struct GduCopyRing GduCopyRing;
+
+struct GduCopyBuffer;
+typedef struct GduCopyBuffer GduCopyBuffer;
+
+struct GduChunkSizer;
+typedef struct GduChunkSizer GduChunkSizer;
+
+struct GduImageChecksum;
+typedef struct GduImageChecksum GduImageChecksum;
+
+struct GduCheckpoint;
+typedef struct GduCheckpoint GduCheckpoint;
+
+struct GduBadBlockMap;
+typedef struct GduBadBlockMap GduBadBlockMap;
+
+struct GduUsedBlocks;
+typedef struct GduUsedBlocks GduUsedBlocks;
+
+struct GduCopyScheduler;
+typedef struct GduCopyScheduler GduCopyScheduler;
+
 G_END_DECLS
 
 #endif /* __GDU_TYPES_H__ */
@@ -0,0 +1,437 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "gduusedblocks.h"
+
+/* Finds out which parts of a device a filesystem actually uses, so
+ * creating a disk image can skip the free space. Only ext2, ext3 and
+ * ext4 are supported for now: their block bitmaps are read straight
+ * from the device, which is fine since the filesystem is unmounted
+ * while the disk image is created.
+ *
+ * The result is a sorted list of extents. Small gaps are not worth a
+ * separate read so extents closer than MIN_GAP_SIZE are merged, and
+ * extents are aligned to ALIGNMENT so they can be read with O_DIRECT.
+ */
+
+#define MIN_GAP_SIZE (1024 * 1024)
+#define ALIGNMENT (64 * 1024)
+
+typedef struct
+{
+  guint64 offset;
+  guint64 length;
+} Extent;
+
+struct GduUsedBlocks
+{
+  guint64 size;
+
+  /* of Extent, sorted by offset */
+  GArray *extents;
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+#define EXT_SUPERBLOCK_OFFSET 1024
+#define EXT_SUPERBLOCK_SIZE   1024
+#define EXT_MAGIC             0xef53
+
+#define EXT_FEATURE_COMPAT_SPARSE_SUPER2     0x0200
+#define EXT_FEATURE_INCOMPAT_RECOVER         0x0004
+#define EXT_FEATURE_INCOMPAT_JOURNAL_DEV     0x0008
+#define EXT_FEATURE_INCOMPAT_META_BG         0x0010
+#define EXT_FEATURE_INCOMPAT_64BIT           0x0080
+#define EXT_FEATURE_RO_COMPAT_SPARSE_SUPER   0x0001
+#define EXT_FEATURE_RO_COMPAT_GDT_CSUM       0x0010
+#define EXT_FEATURE_RO_COMPAT_METADATA_CSUM  0x0400
+
+#define EXT_BG_BLOCK_UNINIT 0x0002
+
+static guint16
+get_le16 (const guchar *buf, gsize offset)
+{
+  guint16 value;
+  memcpy (&value, buf + offset, sizeof value);
+  return GUINT16_FROM_LE (value);
+}
+
+static guint32
+get_le32 (const guchar *buf, gsize offset)
+{
+  guint32 value;
+  memcpy (&value, buf + offset, sizeof value);
+  return GUINT32_FROM_LE (value);
+}
+
+static gboolean
+read_exactly (gint      fd,
+              guint64   offset,
+              guchar   *buffer,
+              gsize     size,
+              GError  **error)
+{
+  gsize num_read = 0;
+
+  while (num_read < size)
+    {
+      ssize_t rc;
+
+      rc = pread (fd, buffer + num_read, size - num_read, offset + num_read);
+      if (rc < 0 && errno == EINTR)
+        continue;
+      if (rc <= 0)
+        {
+          g_set_error (error, G_IO_ERROR, rc < 0 ? g_io_error_from_errno (errno) : G_IO_ERROR_FAILED,
+                       "Error reading filesystem metadata at offset %" G_GUINT64_FORMAT ": %s",
+                       offset + num_read, rc < 0 ? g_strerror (errno) : "Unexpected end of device");
+          return FALSE;
+        }
+      num_read += rc;
+    }
+  return TRUE;
+}
+
+static void
+add_extent (GArray  *extents,
+            guint64  offset,
+            guint64  length)
+{
+  Extent e;
+
+  if (extents->len > 0)
+    {
+      Extent *last = &g_array_index (extents, Extent, extents->len - 1);
+      if (last->offset + last->length == offset)
+        {
+          last->length += length;
+          return;
+        }
+    }
+  e.offset = offset;
+  e.length = length;
+  g_array_append_val (extents, e);
+}
+
+static gboolean
+ext_group_has_super (guint32 group,
+                     gboolean sparse_super)
+{
+  guint32 n;
+
+  if (group <= 1 || !sparse_super)
+    return TRUE;
+  for (n = 3; n <= 7; n += 2)
+    {
+      guint32 power = n;
+      while (power < group)
+        power *= n;
+      if (power == group)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+static gboolean
+ext_get_extents (gint      fd,
+                 guint64   size,
+                 GArray   *extents,
+                 GError  **error)
+{
+  gboolean ret = FALSE;
+  guchar sb[EXT_SUPERBLOCK_SIZE];
+  guchar *gdt = NULL;
+  guchar *bitmap = NULL;
+  guint32 compat, incompat, ro_compat;
+  guint64 block_size;
+  guint64 num_blocks;
+  guint32 first_data_block;
+  guint32 blocks_per_group;
+  guint32 inodes_per_group;
+  guint32 inode_size;
+  guint32 desc_size;
+  guint32 num_groups;
+  guint64 gdt_blocks;
+  guint64 reserved_gdt_blocks;
+  guint64 inode_table_blocks;
+  gboolean has_uninit;
+  guint32 group;
+
+  if (!read_exactly (fd, EXT_SUPERBLOCK_OFFSET, sb, sizeof sb, error))
+    goto out;
+
+  compat = get_le32 (sb, 0x5c);
+  incompat = get_le32 (sb, 0x60);
+  ro_compat = get_le32 (sb, 0x64);
+  if (get_le16 (sb, 0x38) != EXT_MAGIC || get_le32 (sb, 0x18) > 6)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "No ext2, ext3 or ext4 filesystem found");
+      goto out;
+    }
+  /* The bitmaps on disk are only up to date once the journal is replayed */
+  if (incompat & EXT_FEATURE_INCOMPAT_RECOVER)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "The journal of the filesystem needs to be replayed");
+      goto out;
+    }
+  /* With meta_bg the group descriptors are spread out over the device */
+  if (incompat & (EXT_FEATURE_INCOMPAT_JOURNAL_DEV | EXT_FEATURE_INCOMPAT_META_BG))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Unsupported ext filesystem features 0x%x", incompat);
+      goto out;
+    }
+
+  block_size = 1024 << get_le32 (sb, 0x18);
+  num_blocks = get_le32 (sb, 0x04);
+  desc_size = 32;
+  if (incompat & EXT_FEATURE_INCOMPAT_64BIT)
+    {
+      num_blocks |= ((guint64) get_le32 (sb, 0x150)) << 32;
+      desc_size = MAX (get_le16 (sb, 0xfe), 32);
+    }
+  first_data_block = get_le32 (sb, 0x14);
+  blocks_per_group = get_le32 (sb, 0x20);
+  inodes_per_group = get_le32 (sb, 0x28);
+  inode_size = get_le32 (sb, 0x4c) == 0 ? 128 : get_le16 (sb, 0x58);
+  reserved_gdt_blocks = get_le16 (sb, 0xce);
+  if (blocks_per_group == 0 || blocks_per_group > 8 * block_size ||
+      num_blocks <= first_data_block || num_blocks * block_size > size)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "The filesystem superblock is damaged");
+      goto out;
+    }
+
+  num_groups = (num_blocks - first_data_block + blocks_per_group - 1) / blocks_per_group;
+  gdt_blocks = ((guint64) num_groups * desc_size + block_size - 1) / block_size;
+  inode_table_blocks = ((guint64) inodes_per_group * inode_size + block_size - 1) / block_size;
+  has_uninit = (ro_compat & (EXT_FEATURE_RO_COMPAT_GDT_CSUM | EXT_FEATURE_RO_COMPAT_METADATA_CSUM)) != 0;
+
+  gdt = g_malloc (gdt_blocks * block_size);
+  if (!read_exactly (fd, (first_data_block + 1) * block_size, gdt, gdt_blocks * block_size, error))
+    goto out;
+  bitmap = g_malloc (block_size);
+
+  /* the boot block and the superblock */
+  add_extent (extents, 0, (first_data_block + 1) * block_size);
+
+  for (group = 0; group < num_groups; group++)
+    {
+      const guchar *desc = gdt + (gsize) group * desc_size;
+      guint64 group_start = first_data_block + (guint64) group * blocks_per_group;
+      guint64 group_blocks = MIN (blocks_per_group, num_blocks - group_start);
+      guint64 block_bitmap, inode_bitmap, inode_table;
+      guint64 n;
+
+      block_bitmap = get_le32 (desc, 0x00);
+      inode_bitmap = get_le32 (desc, 0x04);
+      inode_table = get_le32 (desc, 0x08);
+      if (desc_size >= 64)
+        {
+          block_bitmap |= ((guint64) get_le32 (desc, 0x20)) << 32;
+          inode_bitmap |= ((guint64) get_le32 (desc, 0x24)) << 32;
+          inode_table |= ((guint64) get_le32 (desc, 0x28)) << 32;
+        }
+
+      /* The group's metadata may live in another group (flex_bg) which
+       * is not necessarily initialized, so always include it
+       */
+      add_extent (extents, block_bitmap * block_size, block_size);
+      add_extent (extents, inode_bitmap * block_size, block_size);
+      add_extent (extents, inode_table * block_size, inode_table_blocks * block_size);
+
+      if (has_uninit && (get_le16 (desc, 0x12) & EXT_BG_BLOCK_UNINIT))
+        {
+          /* No bitmap on disk - only the superblock backup is in use. If
+           * we can't tell where the backups are, take the whole group.
+           */
+          if (compat & EXT_FEATURE_COMPAT_SPARSE_SUPER2)
+            add_extent (extents, group_start * block_size, group_blocks * block_size);
+          else if (ext_group_has_super (group, ro_compat & EXT_FEATURE_RO_COMPAT_SPARSE_SUPER))
+            add_extent (extents, group_start * block_size,
+                        MIN (1 + gdt_blocks + reserved_gdt_blocks, group_blocks) * block_size);
+          continue;
+        }
+
+      if (!read_exactly (fd, block_bitmap * block_size, bitmap, block_size, error))
+        goto out;
+      for (n = 0; n < group_blocks; n++)
+        {
+          /* skip free space a byte at a time */
+          if (n % 8 == 0 && n + 8 <= group_blocks && bitmap[n / 8] == 0)
+            {
+              n += 7;
+              continue;
+            }
+          if (bitmap[n / 8] & (1 << (n % 8)))
+            add_extent (extents, (group_start + n) * block_size, block_size);
+        }
+    }
+
+  ret = TRUE;
+
+ out:
+  g_free (bitmap);
+  g_free (gdt);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Returns: TRUE if gdu_used_blocks_new_for_fd() can handle filesystems of type @fstype */
+gboolean
+gdu_used_blocks_is_supported (const gchar *fstype)
+{
+  return g_strcmp0 (fstype, "ext2") == 0 || g_strcmp0 (fstype, "ext3") == 0 || g_strcmp0 (fstype, "ext4") == 0;
+}
+
+static gint
+compare_extents (gconstpointer a,
+                 gconstpointer b)
+{
+  const Extent *ea = a;
+  const Extent *eb = b;
+  if (ea->offset < eb->offset)
+    return -1;
+  return ea->offset > eb->offset ? 1 : 0;
+}
+
+/**
+ * gdu_used_blocks_new_for_fd:
+ * @fd: A file descriptor for the unmounted block device.
+ * @size: The size of the block device.
+ * @error: Return location for error or %NULL.
+ *
+ * Reads the allocation bitmaps of the filesystem on @fd.
+ *
+ * Returns: A #GduUsedBlocks or %NULL if @error is set, e.g. if the
+ * filesystem is not supported. Free with gdu_used_blocks_free().
+ */
+GduUsedBlocks *
+gdu_used_blocks_new_for_fd (gint      fd,
+                            guint64   size,
+                            GError  **error)
+{
+  GduUsedBlocks *used_blocks;
+  GArray *extents;
+  guint n;
+
+  extents = g_array_new (FALSE, FALSE, sizeof (Extent));
+  if (!ext_get_extents (fd, size, extents, error))
+    {
+      g_array_unref (extents);
+      return NULL;
+    }
+  g_array_sort (extents, compare_extents);
+
+  used_blocks = g_new0 (GduUsedBlocks, 1);
+  used_blocks->size = size;
+  used_blocks->extents = g_array_new (FALSE, FALSE, sizeof (Extent));
+  for (n = 0; n < extents->len; n++)
+    {
+      Extent *e = &g_array_index (extents, Extent, n);
+      guint64 start = e->offset - e->offset % ALIGNMENT;
+      guint64 end = MIN (e->offset + e->length + ALIGNMENT - 1, size);
+
+      end -= end % ALIGNMENT;
+      end = MAX (end, MIN (e->offset + e->length, size));
+      if (used_blocks->extents->len > 0)
+        {
+          Extent *last = &g_array_index (used_blocks->extents, Extent, used_blocks->extents->len - 1);
+          if (start <= last->offset + last->length + MIN_GAP_SIZE)
+            {
+              last->length = MAX (last->offset + last->length, end) - last->offset;
+              continue;
+            }
+        }
+      if (start < end)
+        add_extent (used_blocks->extents, start, end - start);
+    }
+  g_array_unref (extents);
+
+  return used_blocks;
+}
+
+void
+gdu_used_blocks_free (GduUsedBlocks *used_blocks)
+{
+  g_array_unref (used_blocks->extents);
+  g_free (used_blocks);
+}
+
+/**
+ * gdu_used_blocks_lookup:
+ * @used_blocks: A #GduUsedBlocks.
+ * @offset: An offset on the device.
+ * @out_length: Return location for the number of bytes from @offset
+ *   that are used (or unused) as well.
+ *
+ * Checks whether the data at @offset is used by the filesystem.
+ *
+ * Returns: TRUE if it is used, FALSE if it's free space.
+ */
+gboolean
+gdu_used_blocks_lookup (GduUsedBlocks *used_blocks,
+                        guint64        offset,
+                        guint64       *out_length)
+{
+  guint lo = 0;
+  guint hi = used_blocks->extents->len;
+
+  g_return_val_if_fail (offset < used_blocks->size, FALSE);
+
+  /* find the first extent ending after @offset */
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+      Extent *e = &g_array_index (used_blocks->extents, Extent, mid);
+      if (e->offset + e->length <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo == used_blocks->extents->len)
+    {
+      *out_length = used_blocks->size - offset;
+      return FALSE;
+    }
+  else
+    {
+      Extent *e = &g_array_index (used_blocks->extents, Extent, lo);
+      if (e->offset > offset)
+        {
+          *out_length = e->offset - offset;
+          return FALSE;
+        }
+      *out_length = e->offset + e->length - offset;
+      return TRUE;
+    }
+}
+
+/* Returns: The number of bytes that will be copied */
+guint64
+gdu_used_blocks_get_num_bytes (GduUsedBlocks *used_blocks)
+{
+  guint64 ret = 0;
+  guint n;
+
+  for (n = 0; n < used_blocks->extents->len; n++)
+    ret += g_array_index (used_blocks->extents, Extent, n).length;
+  return ret;
+}
@@ -0,0 +1,30 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_USED_BLOCKS_H__
+#define __GDU_USED_BLOCKS_H__
+
+#include <gtk/gtk.h>
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+gboolean       gdu_used_blocks_is_supported  (const gchar    *fstype);
+GduUsedBlocks *gdu_used_blocks_new_for_fd    (gint            fd,
+                                              guint64         size,
+                                              GError        **error);
+void           gdu_used_blocks_free          (GduUsedBlocks  *used_blocks);
+gboolean       gdu_used_blocks_lookup        (GduUsedBlocks  *used_blocks,
+                                              guint64         offset,
+                                              guint64        *out_length);
+guint64        gdu_used_blocks_get_num_bytes (GduUsedBlocks  *used_blocks);
+
+G_END_DECLS
+
+#endif /* __GDU_USED_BLOCKS_H__ */
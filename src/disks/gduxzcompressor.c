@@ -0,0 +1,190 @@
+/* XZ Compressor - based on GduXzDecompressor and GLib's GZLibCompressor
+ *
+ * Copyright (C) 2026 The GNOME Project
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include "gduxzcompressor.h"
+
+#include <string.h>
+
+#include <lzma.h>
+
+/* The multi-threaded encoder splits the input into independently
+ * compressed blocks of this size and records their sizes in the
+ * index at the end of the stream. This is what allows finding the
+ * uncompressed size cheaply and decoding blocks in parallel.
+ */
+#define BLOCK_SIZE (32 * 1024 * 1024)
+
+/* Each encoder thread needs several times BLOCK_SIZE of memory (the
+ * input and output buffers plus the LZMA2 dictionary), around 100 MiB
+ * with the default preset - so use at most this many threads and at
+ * most a quarter of the RAM.
+ */
+#define MAX_THREADS 8
+
+static void gdu_xz_compressor_iface_init          (GConverterIface *iface);
+
+struct GduXzCompressor
+{
+  GObject parent_instance;
+
+  lzma_stream stream;
+};
+
+G_DEFINE_TYPE_WITH_CODE (GduXzCompressor, gdu_xz_compressor, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_CONVERTER,
+                                                gdu_xz_compressor_iface_init))
+
+static void
+gdu_xz_compressor_finalize (GObject *object)
+{
+  GduXzCompressor *compressor = GDU_XZ_COMPRESSOR (object);
+
+  lzma_end (&compressor->stream);
+
+  G_OBJECT_CLASS (gdu_xz_compressor_parent_class)->finalize (object);
+}
+
+static void
+init_lzma (GduXzCompressor *compressor)
+{
+  lzma_mt mt;
+  lzma_ret ret;
+  uint64_t physmem;
+
+  memset (&mt, 0, sizeof mt);
+  mt.threads = CLAMP (g_get_num_processors (), 1, MAX_THREADS);
+  mt.block_size = BLOCK_SIZE;
+  mt.timeout = 0;
+  mt.preset = LZMA_PRESET_DEFAULT;
+  mt.check = LZMA_CHECK_CRC64;
+
+  physmem = lzma_physmem ();
+  while (mt.threads > 1 && physmem > 0 && lzma_stream_encoder_mt_memusage (&mt) > physmem / 4)
+    mt.threads--;
+
+  memset (&compressor->stream, 0, sizeof compressor->stream);
+  ret = lzma_stream_encoder_mt (&compressor->stream, &mt);
+  if (ret != LZMA_OK)
+    g_critical ("Error initalizing lzma encoder: %u", ret);
+}
+
+static void
+gdu_xz_compressor_init (GduXzCompressor *compressor)
+{
+  init_lzma (compressor);
+}
+
+static void
+gdu_xz_compressor_class_init (GduXzCompressorClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->finalize = gdu_xz_compressor_finalize;
+}
+
+GduXzCompressor *
+gdu_xz_compressor_new (void)
+{
+  GduXzCompressor *compressor;
+
+  compressor = g_object_new (GDU_TYPE_XZ_COMPRESSOR,
+                             NULL);
+
+  return compressor;
+}
+
+static void
+gdu_xz_compressor_reset (GConverter *converter)
+{
+  GduXzCompressor *compressor = GDU_XZ_COMPRESSOR (converter);
+  lzma_end (&compressor->stream);
+  init_lzma (compressor);
+}
+
+static GConverterResult
+gdu_xz_compressor_convert (GConverter *converter,
+                           const void *inbuf,
+                           gsize       inbuf_size,
+                           void       *outbuf,
+                           gsize       outbuf_size,
+                           GConverterFlags flags,
+                           gsize      *bytes_read,
+                           gsize      *bytes_written,
+                           GError    **error)
+{
+  GduXzCompressor *compressor = GDU_XZ_COMPRESSOR (converter);
+  lzma_action action;
+  lzma_ret res;
+
+  compressor->stream.next_in = (void *)inbuf;
+  compressor->stream.avail_in = inbuf_size;
+
+  compressor->stream.next_out = outbuf;
+  compressor->stream.avail_out = outbuf_size;
+
+  /* Note that the multi-threaded encoder does not support
+   * LZMA_SYNC_FLUSH, only LZMA_FULL_FLUSH
+   */
+  action = LZMA_RUN;
+  if (flags & G_CONVERTER_INPUT_AT_END)
+    action = LZMA_FINISH;
+  else if (flags & G_CONVERTER_FLUSH)
+    action = LZMA_FULL_FLUSH;
+
+  res = lzma_code (&compressor->stream, action);
+
+  if (res == LZMA_MEM_ERROR)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Not enough memory"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res == LZMA_BUF_ERROR)
+    {
+      /* No progress could be made. We do have output space, so this
+       * should only happen if we have no input but need some.
+       */
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                           _("Need more input"));
+      return G_CONVERTER_ERROR;
+    }
+
+  if (res != LZMA_OK && res != LZMA_STREAM_END)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   _("Internal error"));
+      return G_CONVERTER_ERROR;
+    }
+
+  *bytes_read = inbuf_size - compressor->stream.avail_in;
+  *bytes_written = outbuf_size - compressor->stream.avail_out;
+
+  if (res == LZMA_STREAM_END)
+    {
+      if (action == LZMA_FULL_FLUSH)
+        return G_CONVERTER_FLUSHED;
+      return G_CONVERTER_FINISHED;
+    }
+
+  return G_CONVERTER_CONVERTED;
+}
+
+static void
+gdu_xz_compressor_iface_init (GConverterIface *iface)
+{
+  iface->convert = gdu_xz_compressor_convert;
+  iface->reset = gdu_xz_compressor_reset;
+}
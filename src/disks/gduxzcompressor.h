@@ -0,0 +1,38 @@
+/* XZ Compressor - based on GduXzDecompressor and GLib's GZLibCompressor
+ *
+ * Copyright (C) 2026 The GNOME Project
+ * Copyright (C) 2013 David Zeuthen
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_XZ_COMPRESSOR_H__
+#define __GDU_XZ_COMPRESSOR_H__
+
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+#define GDU_TYPE_XZ_COMPRESSOR         (gdu_xz_compressor_get_type ())
+#define GDU_XZ_COMPRESSOR(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GDU_TYPE_XZ_COMPRESSOR, GduXzCompressor))
+#define GDU_XZ_COMPRESSOR_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), GDU_TYPE_XZ_COMPRESSOR, GduXzCompressorClass))
+#define GDU_IS_XZ_COMPRESSOR(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), GDU_TYPE_XZ_COMPRESSOR))
+#define GDU_IS_XZ_COMPRESSOR_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), GDU_TYPE_XZ_COMPRESSOR))
+#define GDU_XZ_COMPRESSOR_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), GDU_TYPE_XZ_COMPRESSOR, GduXzCompressorClass))
+
+typedef struct GduXzCompressorClass   GduXzCompressorClass;
+
+struct GduXzCompressorClass
+{
+  GObjectClass parent_class;
+};
+
+GType            gdu_xz_compressor_get_type      (void) G_GNUC_CONST;
+GduXzCompressor *gdu_xz_compressor_new           (void);
+
+G_END_DECLS
+
+#endif /* __GDU_XZ_COMPRESSOR_H__ */
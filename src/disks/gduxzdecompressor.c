@@ -170,21 +170,48 @@ gdu_xz_decompressor_iface_init (GConverterIface *iface)
   iface->reset = gdu_xz_decompressor_reset;
 }
 
+/* Decodes the index at the end of the single-stream xz file in @data,
+ * or returns %NULL if it can't be found. Free with lzma_index_end().
+ */
+struct lzma_index_s *
+gdu_xz_decompressor_decode_index (const guint8 *data,
+                                  gsize         length)
+{
+  size_t bufpos = 0;
+  uint64_t memlimit = UINT64_MAX;
+  lzma_index *index_object = NULL;
+  lzma_stream_flags stream_flags;
+  const uint8_t *footer, *index;
+
+  if (length < 12)
+    goto out;
+  footer = data + length - 12;
+  if (lzma_stream_footer_decode (&stream_flags, footer) != LZMA_OK)
+    goto out;
+  if (stream_flags.backward_size > length - 12)
+    goto out;
+  index = footer - stream_flags.backward_size;
+
+  if (lzma_index_buffer_decode (&index_object,
+                                &memlimit,
+                                NULL /* allocator */,
+                                index,
+                                &bufpos,
+                                footer - index) != LZMA_OK)
+    index_object = NULL;
+
+ out:
+  return index_object;
+}
+
 gsize
 gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
 {
   gchar *path = NULL;
   gsize ret = 0;
   GMappedFile *mapped_file = NULL;
-  size_t bufpos = 0;
-  uint64_t memlimit = UINT64_MAX;
   lzma_index *index_object = NULL;
-  lzma_ret res;
   GError *error = NULL;
-  uint8_t *buf;
-  gsize len;
-  lzma_stream_flags stream_flags;
-  uint8_t *footer, *index;
 
   path = g_file_get_path (compressed_file);
   if (path == NULL)
@@ -205,25 +232,9 @@ gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file)
       goto out;
     }
 
-  buf = (uint8_t*) g_mapped_file_get_contents (mapped_file);
-  len = g_mapped_file_get_length (mapped_file);
-
-  if (len < 12)
-    goto out;
-  footer = buf + len - 12;
-  if (lzma_stream_footer_decode (&stream_flags, footer) != LZMA_OK)
-    goto out;
-  if (stream_flags.backward_size > len - 12)
-    goto out;
-  index = footer - stream_flags.backward_size;
-
-  res = lzma_index_buffer_decode (&index_object,
-                                  &memlimit,
-                                  NULL /* allocator */,
-                                  index,
-                                  &bufpos,
-                                  footer - index);
-  if (res != LZMA_OK)
+  index_object = gdu_xz_decompressor_decode_index ((const guint8 *) g_mapped_file_get_contents (mapped_file),
+                                                   g_mapped_file_get_length (mapped_file));
+  if (index_object == NULL)
     goto out;
 
   ret = lzma_index_uncompressed_size (index_object);
@@ -35,6 +35,10 @@ GduXzDecompressor *gdu_xz_decompressor_new           (void);
 
 gsize              gdu_xz_decompressor_get_uncompressed_size (GFile *compressed_file);
 
+struct lzma_index_s;
+struct lzma_index_s *gdu_xz_decompressor_decode_index (const guint8 *data,
+                                                      gsize         length);
+
 G_END_DECLS
 
 #endif /* __GDU_XZ_DECOMPRESSOR_H__ */
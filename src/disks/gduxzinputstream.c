@@ -0,0 +1,437 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <glib/gi18n.h>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <lzma.h>
+
+#include "gduxzinputstream.h"
+#include "gduxzdecompressor.h"
+
+/* A GInputStream returning the decompressed contents of an xz file.
+ *
+ * Files written by a multi-threaded encoder (including our own
+ * GduXzCompressor) consist of many independently compressed blocks
+ * whose location and sizes are listed in the index at the end of the
+ * file. Each block is decoded by a worker in a thread pool, directly
+ * from a memory mapping of the file, and handed out to the reader in
+ * order. Only a limited number of blocks is decoded ahead of the
+ * reader to bound memory use.
+ */
+
+/* The maximum amount of decoded data to keep around */
+#define MAX_BYTES_AHEAD (512 * 1024 * 1024)
+
+typedef struct
+{
+  guint64 compressed_offset;
+  guint64 unpadded_size;
+  guint64 total_size;
+  guint64 uncompressed_size;
+
+  /* must hold lock when reading/writing these */
+  guchar *data;
+  gboolean done;
+  GError *error;
+} Block;
+
+struct GduXzInputStream
+{
+  GInputStream parent_instance;
+
+  GMappedFile *mapped_file;
+  lzma_check check;
+
+  Block *blocks;
+  guint num_blocks;
+  guint num_blocks_ahead;
+
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond cond;
+
+  /* only accessed by the reader */
+  guint current_block;
+  guint64 current_offset;
+  guint next_block_to_schedule;
+};
+
+typedef struct GduXzInputStreamClass GduXzInputStreamClass;
+
+struct GduXzInputStreamClass
+{
+  GInputStreamClass parent_class;
+};
+
+G_DEFINE_TYPE (GduXzInputStream, gdu_xz_input_stream, G_TYPE_INPUT_STREAM)
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+stop_pool (GduXzInputStream *stream)
+{
+  if (stream->pool != NULL)
+    {
+      /* drop blocks not yet started, wait for the ones being decoded */
+      g_thread_pool_free (stream->pool, TRUE, TRUE);
+      stream->pool = NULL;
+    }
+}
+
+static void
+gdu_xz_input_stream_finalize (GObject *object)
+{
+  GduXzInputStream *stream = GDU_XZ_INPUT_STREAM (object);
+  guint n;
+
+  stop_pool (stream);
+
+  for (n = 0; n < stream->num_blocks; n++)
+    {
+      g_free (stream->blocks[n].data);
+      g_clear_error (&stream->blocks[n].error);
+    }
+  g_free (stream->blocks);
+  if (stream->mapped_file != NULL)
+    g_mapped_file_unref (stream->mapped_file);
+  g_cond_clear (&stream->cond);
+  g_mutex_clear (&stream->lock);
+
+  G_OBJECT_CLASS (gdu_xz_input_stream_parent_class)->finalize (object);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+decode_block (GduXzInputStream  *stream,
+              Block             *block,
+              guchar            *out,
+              GError           **error)
+{
+  gboolean ret = FALSE;
+  const guint8 *in;
+  lzma_block lzma_block_options;
+  lzma_filter filters[LZMA_FILTERS_MAX + 1];
+  size_t in_pos;
+  size_t out_pos = 0;
+  guint n;
+
+  in = (const guint8 *) g_mapped_file_get_contents (stream->mapped_file) + block->compressed_offset;
+
+  memset (&lzma_block_options, 0, sizeof lzma_block_options);
+  memset (filters, 0, sizeof filters);
+  filters[0].id = LZMA_VLI_UNKNOWN;
+  lzma_block_options.version = 0;
+  lzma_block_options.check = stream->check;
+  lzma_block_options.filters = filters;
+  lzma_block_options.header_size = lzma_block_header_size_decode (in[0]);
+
+  if (lzma_block_options.header_size > block->total_size ||
+      lzma_block_header_decode (&lzma_block_options, NULL, in) != LZMA_OK ||
+      lzma_block_compressed_size (&lzma_block_options, block->unpadded_size) != LZMA_OK)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           _("Invalid compressed data"));
+      goto out;
+    }
+
+  in_pos = lzma_block_options.header_size;
+  switch (lzma_block_buffer_decode (&lzma_block_options,
+                                    NULL, /* allocator */
+                                    in, &in_pos, block->total_size,
+                                    out, &out_pos, block->uncompressed_size))
+    {
+    case LZMA_OK:
+      break;
+
+    case LZMA_MEM_ERROR:
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Not enough memory"));
+      goto out;
+
+    default:
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           _("Invalid compressed data"));
+      goto out;
+    }
+
+  if (out_pos != block->uncompressed_size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           _("Invalid compressed data"));
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  /* lzma_filters_free() is only available in liblzma >= 5.3 */
+  for (n = 0; n < LZMA_FILTERS_MAX && filters[n].id != LZMA_VLI_UNKNOWN; n++)
+    free (filters[n].options);
+  return ret;
+}
+
+static void
+decode_func (gpointer data,
+             gpointer user_data)
+{
+  GduXzInputStream *stream = GDU_XZ_INPUT_STREAM (user_data);
+  Block *block = data;
+  GError *error = NULL;
+  guchar *out;
+
+  out = g_try_malloc (MAX (block->uncompressed_size, 1));
+  if (out == NULL)
+    {
+      g_set_error_literal (&error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                           _("Not enough memory"));
+    }
+  else if (!decode_block (stream, block, out, &error))
+    {
+      g_free (out);
+      out = NULL;
+    }
+
+  g_mutex_lock (&stream->lock);
+  block->data = out;
+  block->error = error;
+  block->done = TRUE;
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->lock);
+}
+
+static void
+schedule_blocks (GduXzInputStream *stream)
+{
+  while (stream->next_block_to_schedule < stream->num_blocks &&
+         stream->next_block_to_schedule < stream->current_block + stream->num_blocks_ahead)
+    {
+      g_thread_pool_push (stream->pool, &stream->blocks[stream->next_block_to_schedule], NULL);
+      stream->next_block_to_schedule++;
+    }
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* wakes up gdu_xz_input_stream_read() waiting for a block */
+static void
+on_cancelled (GCancellable *cancellable,
+              gpointer      user_data)
+{
+  GduXzInputStream *stream = GDU_XZ_INPUT_STREAM (user_data);
+
+  g_mutex_lock (&stream->lock);
+  g_cond_broadcast (&stream->cond);
+  g_mutex_unlock (&stream->lock);
+}
+
+static gssize
+gdu_xz_input_stream_read (GInputStream  *input_stream,
+                          void          *buffer,
+                          gsize          count,
+                          GCancellable  *cancellable,
+                          GError       **error)
+{
+  GduXzInputStream *stream = GDU_XZ_INPUT_STREAM (input_stream);
+  gssize ret = -1;
+  Block *block;
+  gsize num_bytes;
+  gulong cancelled_id = 0;
+
+  /* skip empty blocks */
+  while (stream->current_block < stream->num_blocks &&
+         stream->blocks[stream->current_block].uncompressed_size == 0)
+    {
+      stream->current_block++;
+      schedule_blocks (stream);
+    }
+
+  if (stream->current_block == stream->num_blocks)
+    {
+      ret = 0; /* EOF */
+      goto out;
+    }
+
+  block = &stream->blocks[stream->current_block];
+
+  /* connect before taking the lock since the handler takes it too, and is
+   * run right away if @cancellable is already cancelled
+   */
+  if (cancellable != NULL)
+    cancelled_id = g_cancellable_connect (cancellable, G_CALLBACK (on_cancelled), stream, NULL);
+  g_mutex_lock (&stream->lock);
+  while (!block->done && !g_cancellable_is_cancelled (cancellable))
+    g_cond_wait (&stream->cond, &stream->lock);
+  g_mutex_unlock (&stream->lock);
+  if (cancellable != NULL)
+    g_cancellable_disconnect (cancellable, cancelled_id);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  if (block->error != NULL)
+    {
+      g_propagate_error (error, g_error_copy (block->error));
+      goto out;
+    }
+
+  num_bytes = MIN (count, block->uncompressed_size - stream->current_offset);
+  memcpy (buffer, block->data + stream->current_offset, num_bytes);
+  stream->current_offset += num_bytes;
+  ret = num_bytes;
+
+  if (stream->current_offset == block->uncompressed_size)
+    {
+      g_mutex_lock (&stream->lock);
+      g_free (block->data);
+      block->data = NULL;
+      g_mutex_unlock (&stream->lock);
+
+      stream->current_block++;
+      stream->current_offset = 0;
+      schedule_blocks (stream);
+    }
+
+ out:
+  return ret;
+}
+
+static gboolean
+gdu_xz_input_stream_close (GInputStream  *input_stream,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  stop_pool (GDU_XZ_INPUT_STREAM (input_stream));
+  return TRUE;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+gdu_xz_input_stream_init (GduXzInputStream *stream)
+{
+  g_mutex_init (&stream->lock);
+  g_cond_init (&stream->cond);
+}
+
+static void
+gdu_xz_input_stream_class_init (GduXzInputStreamClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (klass);
+
+  gobject_class->finalize = gdu_xz_input_stream_finalize;
+
+  input_stream_class->read_fn = gdu_xz_input_stream_read;
+  input_stream_class->close_fn = gdu_xz_input_stream_close;
+}
+
+/**
+ * gdu_xz_input_stream_new:
+ * @compressed_file: A local .xz file.
+ *
+ * Creates a stream decompressing @compressed_file on all processor
+ * cores. This is only possible for files consisting of a single xz
+ * stream split into several blocks, e.g. as produced by xz -T or
+ * #GduXzCompressor.
+ *
+ * Returns: A #GInputStream or %NULL if @compressed_file can't be
+ * decompressed in parallel - use #GduXzDecompressor instead.
+ */
+GInputStream *
+gdu_xz_input_stream_new (GFile *compressed_file)
+{
+  GduXzInputStream *stream = NULL;
+  GMappedFile *mapped_file = NULL;
+  lzma_index *index_object = NULL;
+  lzma_stream_flags stream_flags;
+  lzma_index_iter iter;
+  const guint8 *buf;
+  gsize len;
+  gchar *path;
+  guint64 max_block_size = 0;
+  guint num_threads;
+  guint n;
+
+  path = g_file_get_path (compressed_file);
+  if (path == NULL)
+    goto out;
+
+  mapped_file = g_mapped_file_new (path, FALSE /* writable */, NULL);
+  if (mapped_file == NULL)
+    goto out;
+
+  buf = (const guint8 *) g_mapped_file_get_contents (mapped_file);
+  len = g_mapped_file_get_length (mapped_file);
+  if (len < LZMA_STREAM_HEADER_SIZE ||
+      lzma_stream_header_decode (&stream_flags, buf) != LZMA_OK)
+    goto out;
+
+  index_object = gdu_xz_decompressor_decode_index (buf, len);
+  if (index_object == NULL)
+    goto out;
+
+  /* Concatenated streams or stream padding would make the offsets
+   * in the index wrong and a single block gains nothing
+   */
+  if (lzma_index_stream_count (index_object) != 1 ||
+      lzma_index_file_size (index_object) != len ||
+      lzma_index_block_count (index_object) < 2)
+    goto out;
+
+  stream = g_object_new (GDU_TYPE_XZ_INPUT_STREAM, NULL);
+  stream->mapped_file = g_mapped_file_ref (mapped_file);
+  stream->check = stream_flags.check;
+  stream->num_blocks = lzma_index_block_count (index_object);
+  stream->blocks = g_new0 (Block, stream->num_blocks);
+
+  lzma_index_iter_init (&iter, index_object);
+  for (n = 0; n < stream->num_blocks; n++)
+    {
+      Block *block = &stream->blocks[n];
+      if (lzma_index_iter_next (&iter, LZMA_INDEX_ITER_BLOCK))
+        {
+          g_clear_object (&stream);
+          goto out;
+        }
+      block->compressed_offset = iter.block.compressed_file_offset;
+      block->unpadded_size = iter.block.unpadded_size;
+      block->total_size = iter.block.total_size;
+      block->uncompressed_size = iter.block.uncompressed_size;
+      max_block_size = MAX (max_block_size, block->uncompressed_size);
+    }
+
+  num_threads = MAX (g_get_num_processors (), 1);
+
+  /* Keep all threads busy while the reader drains the oldest block */
+  stream->num_blocks_ahead = 2 * num_threads;
+  if (max_block_size > 0)
+    stream->num_blocks_ahead = MIN (stream->num_blocks_ahead, MAX (MAX_BYTES_AHEAD / max_block_size, 2));
+
+  stream->pool = g_thread_pool_new (decode_func,
+                                    stream,
+                                    num_threads,
+                                    FALSE, /* exclusive */
+                                    NULL);
+  schedule_blocks (stream);
+
+ out:
+  if (index_object != NULL)
+    lzma_index_end (index_object, NULL);
+  if (mapped_file != NULL)
+    g_mapped_file_unref (mapped_file);
+  g_free (path);
+  return G_INPUT_STREAM (stream);
+}
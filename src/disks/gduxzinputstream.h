@@ -0,0 +1,26 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_XZ_INPUT_STREAM_H__
+#define __GDU_XZ_INPUT_STREAM_H__
+
+#include "gdutypes.h"
+
+G_BEGIN_DECLS
+
+#define GDU_TYPE_XZ_INPUT_STREAM         (gdu_xz_input_stream_get_type ())
+#define GDU_XZ_INPUT_STREAM(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GDU_TYPE_XZ_INPUT_STREAM, GduXzInputStream))
+#define GDU_IS_XZ_INPUT_STREAM(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), GDU_TYPE_XZ_INPUT_STREAM))
+
+GType         gdu_xz_input_stream_get_type (void) G_GNUC_CONST;
+GInputStream *gdu_xz_input_stream_new      (GFile *compressed_file);
+
+G_END_DECLS
+
+#endif /* __GDU_XZ_INPUT_STREAM_H__ */
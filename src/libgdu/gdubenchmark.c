@@ -0,0 +1,1927 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <linux/fs.h>
+
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+
+#include "gdubenchmark.h"
+#include "gduioengine.h"
+#include "gdulatencyhistogram.h"
+#include "gduutils.h"
+
+/* The benchmark itself, shared by the benchmark dialog and the
+ * command line. Nothing in here knows about the UI - results are
+ * appended to the GduBenchmark as they come in and whoever runs it
+ * is told through the progress function.
+ */
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* The id is what's used in the saved data so don't change it */
+static const GduBenchmarkWorkload workloads[] = {
+  {"randread-4k", N_("Random 4 KiB Read"), 4096, 100, TRUE},
+  {"randwrite-4k", N_("Random 4 KiB Write"), 4096, 0, TRUE},
+  {"randrw-4k", N_("Random 4 KiB 70% Read, 30% Write"), 4096, 70, TRUE},
+  {"seqread-64k", N_("Sequential 64 KiB Read"), 64 * 1024, 100, FALSE},
+  {"seqread-1m", N_("Sequential 1 MiB Read"), 1024 * 1024, 100, FALSE},
+};
+
+#define WORKLOAD_DURATION_USEC (5 * G_USEC_PER_SEC)
+
+/* Writes go to a pool of WRITE_POOL_SIZE bytes made of extents of
+ * WRITE_POOL_EXTENT_SIZE bytes spread over the device, see
+ * read_write_pool(). The pool has to be much larger than the write
+ * cache of the drive or we'd only be measuring the cache.
+ */
+#define WRITE_POOL_SIZE (256 * 1024 * 1024)
+#define WRITE_POOL_EXTENT_SIZE (1024 * 1024)
+
+/* Good enough for O_DIRECT on any device */
+#define BUFFER_ALIGNMENT 4096
+
+/* The queue depth sweep runs the random read workload for
+ * QUEUE_DEPTH_DURATION_USEC at each of the queue depths below
+ */
+#define QUEUE_DEPTH_WORKLOAD (&workloads[0])
+#define QUEUE_DEPTH_DURATION_USEC (2 * G_USEC_PER_SEC)
+
+static const guint queue_depths[] = {1, 4, 16, 32, 64};
+
+/* The sustained write goes through the device front to back in
+ * windows of SUSTAINED_WRITE_WINDOW_SIZE, each written back as chunks
+ * of SUSTAINED_WRITE_CHUNK_SIZE with SUSTAINED_WRITE_QUEUE_DEPTH in
+ * flight, and takes a sample every SUSTAINED_WRITE_SAMPLE_USEC of
+ * writing
+ */
+#define SUSTAINED_WRITE_WINDOW_SIZE (256 * 1024 * 1024)
+#define SUSTAINED_WRITE_CHUNK_SIZE (8 * 1024 * 1024)
+#define SUSTAINED_WRITE_QUEUE_DEPTH 4
+#define SUSTAINED_WRITE_SAMPLE_USEC (G_USEC_PER_SEC / 4)
+
+/* The transfer rate has collapsed - e.g. because the SLC cache of the
+ * drive is full - once the median of SUSTAINED_WRITE_SMOOTHING samples
+ * and the rate for the rest of the run are both below
+ * SUSTAINED_WRITE_COLLAPSE_RATIO of the best rate seen until then
+ */
+#define SUSTAINED_WRITE_SMOOTHING 5
+#define SUSTAINED_WRITE_COLLAPSE_RATIO 0.7
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Returns: The workloads the benchmark knows about - the index is what goes into GduBenchmark:workloads */
+const GduBenchmarkWorkload *
+gdu_benchmark_get_workloads (guint *out_num_workloads)
+{
+  if (out_num_workloads != NULL)
+    *out_num_workloads = G_N_ELEMENTS (workloads);
+  return workloads;
+}
+
+/* Returns: The index of the workload with @id or -1 if there is no such workload */
+gint
+gdu_benchmark_lookup_workload (const gchar *id)
+{
+  guint n;
+
+  for (n = 0; n < G_N_ELEMENTS (workloads); n++)
+    {
+      if (g_strcmp0 (workloads[n].id, id) == 0)
+        return n;
+    }
+  return -1;
+}
+
+guint
+gdu_benchmark_get_queue_depth_block_size (void)
+{
+  return QUEUE_DEPTH_WORKLOAD->block_size;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+queue_depth_sample_clear (GduBenchmarkQueueDepthSample *sample)
+{
+  g_clear_pointer (&sample->latency_histogram, gdu_latency_histogram_free);
+}
+
+static void
+workload_result_clear (GduBenchmarkWorkloadResult *result)
+{
+  g_clear_pointer (&result->latency_histogram, gdu_latency_histogram_free);
+}
+
+GduBenchmark *
+gdu_benchmark_new (void)
+{
+  GduBenchmark *benchmark;
+
+  benchmark = g_new0 (GduBenchmark, 1);
+  g_mutex_init (&benchmark->lock);
+
+  /* same defaults as the benchmark dialog */
+  benchmark->num_samples = 100;
+  benchmark->sample_size_mib = 10;
+  benchmark->num_access_samples = 1000;
+  benchmark->do_queue_depth = TRUE;
+  benchmark->workload_queue_depth = 32;
+  benchmark->sustained_write_duration_sec = 60;
+
+  benchmark->read_samples = g_array_new (FALSE, /* zero-terminated */
+                                         FALSE, /* clear */
+                                         sizeof (GduBenchmarkSample));
+  benchmark->write_samples = g_array_new (FALSE, /* zero-terminated */
+                                          FALSE, /* clear */
+                                          sizeof (GduBenchmarkSample));
+  benchmark->access_time_samples = g_array_new (FALSE, /* zero-terminated */
+                                                FALSE, /* clear */
+                                                sizeof (GduBenchmarkSample));
+  benchmark->queue_depth_samples = g_array_new (FALSE, /* zero-terminated */
+                                                FALSE, /* clear */
+                                                sizeof (GduBenchmarkQueueDepthSample));
+  g_array_set_clear_func (benchmark->queue_depth_samples, (GDestroyNotify) queue_depth_sample_clear);
+  benchmark->workload_results = g_array_new (FALSE, /* zero-terminated */
+                                             FALSE, /* clear */
+                                             sizeof (GduBenchmarkWorkloadResult));
+  g_array_set_clear_func (benchmark->workload_results, (GDestroyNotify) workload_result_clear);
+  benchmark->sustained_write_samples = g_array_new (FALSE, /* zero-terminated */
+                                                    FALSE, /* clear */
+                                                    sizeof (GduBenchmarkSustainedSample));
+  benchmark->read_latency = gdu_latency_histogram_new ();
+  benchmark->write_latency = gdu_latency_histogram_new ();
+  benchmark->access_time_latency = gdu_latency_histogram_new ();
+
+  return benchmark;
+}
+
+void
+gdu_benchmark_free (GduBenchmark *benchmark)
+{
+  g_array_unref (benchmark->read_samples);
+  g_array_unref (benchmark->write_samples);
+  g_array_unref (benchmark->access_time_samples);
+  g_array_unref (benchmark->queue_depth_samples);
+  g_array_unref (benchmark->workload_results);
+  g_array_unref (benchmark->sustained_write_samples);
+  gdu_latency_histogram_free (benchmark->read_latency);
+  gdu_latency_histogram_free (benchmark->write_latency);
+  gdu_latency_histogram_free (benchmark->access_time_latency);
+  g_free (benchmark->firmware_revision);
+  g_free (benchmark->kernel_version);
+  g_mutex_clear (&benchmark->lock);
+  g_free (benchmark);
+}
+
+void
+gdu_benchmark_lock (GduBenchmark *benchmark)
+{
+  g_mutex_lock (&benchmark->lock);
+}
+
+void
+gdu_benchmark_unlock (GduBenchmark *benchmark)
+{
+  g_mutex_unlock (&benchmark->lock);
+}
+
+/* @func is called from the thread gdu_benchmark_run() is running in, without the lock held */
+void
+gdu_benchmark_set_progress_func (GduBenchmark             *benchmark,
+                                 GduBenchmarkProgressFunc  func,
+                                 gpointer                  user_data)
+{
+  benchmark->progress_func = func;
+  benchmark->progress_user_data = user_data;
+}
+
+/* e.g. from udisks_drive_get_revision() - so a firmware update can be told apart from the drive slowing down */
+void
+gdu_benchmark_set_firmware_revision (GduBenchmark *benchmark,
+                                     const gchar  *revision)
+{
+  g_free (benchmark->firmware_revision);
+  benchmark->firmware_revision = NULL;
+  /* udisks uses the empty string when the revision isn't known */
+  if (revision != NULL && strlen (revision) > 0)
+    benchmark->firmware_revision = g_strdup (revision);
+}
+
+static void
+clear_results (GduBenchmark *benchmark)
+{
+  benchmark->time_benchmarked_usec = 0;
+  g_clear_pointer (&benchmark->kernel_version, g_free);
+  benchmark->size = 0;
+  benchmark->sample_size = 0;
+  g_array_set_size (benchmark->read_samples, 0);
+  g_array_set_size (benchmark->write_samples, 0);
+  g_array_set_size (benchmark->access_time_samples, 0);
+  g_array_set_size (benchmark->queue_depth_samples, 0);
+  benchmark->queue_depth_async = FALSE;
+  g_array_set_size (benchmark->workload_results, 0);
+  g_array_set_size (benchmark->sustained_write_samples, 0);
+  gdu_latency_histogram_reset (benchmark->read_latency);
+  gdu_latency_histogram_reset (benchmark->write_latency);
+  gdu_latency_histogram_reset (benchmark->access_time_latency);
+}
+
+/* Forgets all results */
+void
+gdu_benchmark_clear (GduBenchmark *benchmark)
+{
+  g_mutex_lock (&benchmark->lock);
+  clear_results (benchmark);
+  g_mutex_unlock (&benchmark->lock);
+}
+
+/* Returns: How far the current phase is, from 0.0 to 1.0 - must hold the lock */
+gdouble
+gdu_benchmark_get_phase_progress (GduBenchmark *benchmark)
+{
+  gdouble ret = 0.0;
+
+  switch (benchmark->phase)
+    {
+    case GDU_BENCHMARK_PHASE_NONE:
+      break;
+
+    case GDU_BENCHMARK_PHASE_TRANSFER_RATE:
+      ret = benchmark->read_samples->len / ((gdouble) MAX (benchmark->num_samples, 1));
+      break;
+
+    case GDU_BENCHMARK_PHASE_ACCESS_TIME:
+      ret = benchmark->access_time_samples->len / ((gdouble) MAX (benchmark->num_access_samples, 1));
+      break;
+
+    case GDU_BENCHMARK_PHASE_QUEUE_DEPTH:
+      ret = benchmark->queue_depth_samples->len / ((gdouble) G_N_ELEMENTS (queue_depths));
+      break;
+
+    case GDU_BENCHMARK_PHASE_WORKLOADS:
+      ret = benchmark->workload_results->len / ((gdouble) MAX (g_bit_count (benchmark->workloads), 1));
+      break;
+
+    case GDU_BENCHMARK_PHASE_SUSTAINED_WRITE:
+      if (benchmark->sustained_write_samples->len > 0)
+        {
+          GduBenchmarkSustainedSample *last;
+
+          /* done at the first limit reached - or at the end of the device */
+          last = &g_array_index (benchmark->sustained_write_samples,
+                                 GduBenchmarkSustainedSample,
+                                 benchmark->sustained_write_samples->len - 1);
+          if (benchmark->sustained_write_duration_sec > 0)
+            ret = MAX (ret, last->time_usec / ((gdouble) benchmark->sustained_write_duration_sec * G_USEC_PER_SEC));
+          if (benchmark->sustained_write_size_gib > 0)
+            ret = MAX (ret, last->bytes_written / ((gdouble) benchmark->sustained_write_size_gib * 1024 * 1024 * 1024));
+          ret = MAX (ret, last->bytes_written / ((gdouble) MAX (benchmark->size, 1)));
+          ret = MIN (ret, 1.0);
+        }
+      break;
+    }
+  return ret;
+}
+
+static void
+report_progress (GduBenchmark *benchmark)
+{
+  if (benchmark->progress_func != NULL)
+    benchmark->progress_func (benchmark, benchmark->progress_user_data);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Fills the write pool of a workload, @num_extents extents of
+ * @blocks_per_extent blocks each at random places on the device. Reading
+ * whole extents keeps this quick even on rotational disks. Writes only
+ * ever put back what was read from the same place so the contents of
+ * the device are not changed, even if the benchmark is interrupted.
+ */
+static gboolean
+read_write_pool (GCancellable  *cancellable,
+                 gint           fd,
+                 guint64        disk_size,
+                 guint          block_size,
+                 guint          blocks_per_extent,
+                 guint          num_extents,
+                 GRand         *rand,
+                 guchar        *pool,
+                 guint64       *pool_offsets,
+                 GError       **error)
+{
+  guint64 num_blocks = disk_size / block_size;
+  gsize extent_size = ((gsize) blocks_per_extent) * block_size;
+  guint n;
+
+  for (n = 0; n < num_extents; n++)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      pool_offsets[n] = ((guint64) g_rand_double_range (rand, 0, (gdouble) (num_blocks - blocks_per_extent + 1))) * block_size;
+      if (pread (fd, pool + n * extent_size, extent_size, pool_offsets[n]) != (ssize_t) extent_size)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
+                       (long long int) extent_size,
+                       (long long int) pool_offsets[n]);
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
+typedef struct
+{
+  const GduBenchmarkWorkload *workload;
+  GduIOEngine *engine;
+  gint fd;
+  GRand *rand;
+  guint64 num_blocks;
+  guint64 next_offset;
+
+  /* one buffer per request slot for reads */
+  guchar *buffers;
+
+  /* the data writes put back, see read_write_pool() */
+  guchar *pool;
+  guint64 *pool_offsets;
+  guint pool_blocks_per_extent;
+  guint pool_num_blocks;
+
+  /* per request slot */
+  guint64 *offsets;
+  gboolean *is_write;
+  gint64 *submitted_usec;
+} WorkloadRun;
+
+static gboolean
+workload_submit (WorkloadRun  *run,
+                 guint         slot,
+                 GError      **error)
+{
+  guint block_size = run->workload->block_size;
+
+  run->is_write[slot] = (guint) g_rand_int_range (run->rand, 0, 100) >= run->workload->read_percentage;
+  run->submitted_usec[slot] = g_get_monotonic_time ();
+
+  if (run->is_write[slot])
+    {
+      guint index = g_rand_int_range (run->rand, 0, run->pool_num_blocks);
+      run->offsets[slot] = run->pool_offsets[index / run->pool_blocks_per_extent] +
+        ((guint64) (index % run->pool_blocks_per_extent)) * block_size;
+      return gdu_io_engine_submit_write (run->engine, run->fd,
+                                         run->pool + index * block_size,
+                                         block_size,
+                                         run->offsets[slot],
+                                         GUINT_TO_POINTER (slot),
+                                         error);
+    }
+
+  if (run->workload->random)
+    {
+      run->offsets[slot] = ((guint64) g_rand_double_range (run->rand, 0, (gdouble) run->num_blocks)) * block_size;
+    }
+  else
+    {
+      if (run->next_offset + block_size > run->num_blocks * block_size)
+        run->next_offset = 0;
+      run->offsets[slot] = run->next_offset;
+      run->next_offset += block_size;
+    }
+  return gdu_io_engine_submit_read (run->engine, run->fd,
+                                    run->buffers + slot * block_size,
+                                    block_size,
+                                    run->offsets[slot],
+                                    GUINT_TO_POINTER (slot),
+                                    error);
+}
+
+/* Keeps @queue_depth requests of @workload in flight for @duration_usec */
+static gboolean
+run_workload (GCancellable                *cancellable,
+              gint                         fd,
+              guint64                      disk_size,
+              const GduBenchmarkWorkload  *workload,
+              guint                        queue_depth,
+              gint64                       duration_usec,
+              GRand                       *rand,
+              GduBenchmarkWorkloadResult  *out_result,
+              GError                     **error)
+{
+  gboolean ret = FALSE;
+  WorkloadRun run = {0};
+  guint block_size = workload->block_size;
+  guchar *buffers_unaligned;
+  guchar *pool_unaligned = NULL;
+  guint64 num_completed = 0;
+  gint64 latency_sum_usec = 0;
+  GduLatencyHistogram *latency_histogram;
+  gint64 begin_usec;
+  gint64 now_usec;
+  guint n;
+
+  latency_histogram = gdu_latency_histogram_new ();
+  run.workload = workload;
+  run.engine = gdu_io_engine_new (queue_depth);
+  run.fd = fd;
+  run.rand = rand;
+  run.num_blocks = disk_size / block_size;
+  run.next_offset = ((guint64) g_rand_double_range (rand, 0, (gdouble) run.num_blocks)) * block_size;
+  buffers_unaligned = g_new0 (guchar, queue_depth * block_size + BUFFER_ALIGNMENT);
+  run.buffers = (guchar*) (((gintptr) (buffers_unaligned + BUFFER_ALIGNMENT)) & (~(BUFFER_ALIGNMENT - 1)));
+  run.offsets = g_new0 (guint64, queue_depth);
+  run.is_write = g_new0 (gboolean, queue_depth);
+  run.submitted_usec = g_new0 (gint64, queue_depth);
+
+  if (workload->read_percentage < 100)
+    {
+      guint num_extents;
+
+      /* no larger than the device itself */
+      run.pool_blocks_per_extent = MAX (MIN (WRITE_POOL_EXTENT_SIZE / block_size, run.num_blocks), 1);
+      num_extents = MIN (WRITE_POOL_SIZE / WRITE_POOL_EXTENT_SIZE, run.num_blocks / run.pool_blocks_per_extent);
+      num_extents = MAX (num_extents, 1);
+      run.pool_num_blocks = num_extents * run.pool_blocks_per_extent;
+
+      pool_unaligned = g_malloc (((gsize) run.pool_num_blocks) * block_size + BUFFER_ALIGNMENT);
+      run.pool = (guchar*) (((gintptr) (pool_unaligned + BUFFER_ALIGNMENT)) & (~(BUFFER_ALIGNMENT - 1)));
+      run.pool_offsets = g_new0 (guint64, num_extents);
+      if (!read_write_pool (cancellable, fd, disk_size, block_size,
+                            run.pool_blocks_per_extent, num_extents,
+                            rand, run.pool, run.pool_offsets, error))
+        goto out;
+    }
+
+  begin_usec = now_usec = g_get_monotonic_time ();
+  for (n = 0; n < queue_depth; n++)
+    {
+      if (!workload_submit (&run, n, error))
+        goto out;
+    }
+
+  while (gdu_io_engine_get_num_pending (run.engine) > 0)
+    {
+      gpointer user_data;
+      gssize result;
+
+      if (!gdu_io_engine_wait (run.engine, &user_data, &result, error))
+        goto out;
+      now_usec = g_get_monotonic_time ();
+      n = GPOINTER_TO_UINT (user_data);
+
+      if (result != (gssize) block_size)
+        {
+          errno = result < 0 ? -result : EIO;
+          if (run.is_write[n])
+            g_set_error (error,
+                         G_IO_ERROR,
+                         g_io_error_from_errno (errno),
+                         C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                         (long long int) block_size,
+                         (long long int) run.offsets[n]);
+          else
+            g_set_error (error,
+                         G_IO_ERROR,
+                         g_io_error_from_errno (errno),
+                         C_("benchmarking", "Error reading %lld bytes from offset %lld"),
+                         (long long int) block_size,
+                         (long long int) run.offsets[n]);
+          goto out;
+        }
+      num_completed++;
+      latency_sum_usec += now_usec - run.submitted_usec[n];
+      gdu_latency_histogram_record (latency_histogram, now_usec - run.submitted_usec[n]);
+
+      /* keep the queue full until the time is up */
+      if (now_usec - begin_usec >= duration_usec ||
+          g_cancellable_is_cancelled (cancellable))
+        continue;
+
+      if (!workload_submit (&run, n, error))
+        goto out;
+    }
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    goto out;
+
+  out_result->workload = workload;
+  out_result->queue_depth = queue_depth;
+  out_result->iops = ((gdouble) G_USEC_PER_SEC) * num_completed / MAX (now_usec - begin_usec, 1);
+  out_result->bytes_per_sec = out_result->iops * block_size;
+  out_result->latency = latency_sum_usec / ((gdouble) G_USEC_PER_SEC) / MAX (num_completed, 1);
+  out_result->latency_histogram = latency_histogram;
+  latency_histogram = NULL;
+  out_result->async = gdu_io_engine_is_async (run.engine);
+
+  ret = TRUE;
+
+ out:
+  /* waits for requests still in flight so do this before freeing the buffers */
+  gdu_io_engine_free (run.engine);
+  if (latency_histogram != NULL)
+    gdu_latency_histogram_free (latency_histogram);
+  g_free (run.submitted_usec);
+  g_free (run.is_write);
+  g_free (run.offsets);
+  g_free (run.pool_offsets);
+  g_free (pool_unaligned);
+  g_free (buffers_unaligned);
+  return ret;
+}
+
+/* Adds a sample of @sample_bytes written in @sample_usec to the
+ * sustained write results
+ */
+static void
+add_sustained_write_sample (GduBenchmark                 *benchmark,
+                            GduBenchmarkSustainedSample  *sample,
+                            gint64                        sample_usec,
+                            guint64                       sample_bytes)
+{
+  sample->time_usec += sample_usec;
+  sample->bytes_written += sample_bytes;
+  sample->value = ((gdouble) G_USEC_PER_SEC) * sample_bytes / MAX (sample_usec, 1);
+  g_mutex_lock (&benchmark->lock);
+  g_array_append_val (benchmark->sustained_write_samples, *sample);
+  g_mutex_unlock (&benchmark->lock);
+
+  report_progress (benchmark);
+}
+
+/* Writes to the device from the start until a limit is reached, to
+ * see how the transfer rate holds up once the write cache of the drive
+ * is full. Like the write benchmark, the data is read first and
+ * written back so the contents of the device are not changed.
+ *
+ * Reading each chunk right before writing it would leave the drive
+ * idle between writes, giving it time to flush its cache. Instead a
+ * whole window is read first and then written back in one burst with
+ * SUSTAINED_WRITE_QUEUE_DEPTH chunks in flight. Only the wall time of
+ * the bursts counts.
+ */
+static gboolean
+run_sustained_write (GduBenchmark  *benchmark,
+                     GCancellable  *cancellable,
+                     gint           fd,
+                     guint64        disk_size,
+                     GError       **error)
+{
+  gboolean ret = FALSE;
+  GduIOEngine *engine;
+  guchar *buffer_unaligned;
+  guchar *buffer;
+  guint64 max_bytes;
+  gint64 max_usec;
+  guint64 offset = 0;
+  GduBenchmarkSustainedSample sample = {0};
+  gint64 sample_usec = 0;
+  guint64 sample_bytes = 0;
+  gboolean done = FALSE;
+
+  engine = gdu_io_engine_new (SUSTAINED_WRITE_QUEUE_DEPTH);
+  buffer_unaligned = g_malloc (SUSTAINED_WRITE_WINDOW_SIZE + BUFFER_ALIGNMENT);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + BUFFER_ALIGNMENT)) & (~(BUFFER_ALIGNMENT - 1)));
+
+  max_bytes = disk_size;
+  if (benchmark->sustained_write_size_gib > 0)
+    max_bytes = MIN (max_bytes, ((guint64) benchmark->sustained_write_size_gib) * 1024 * 1024 * 1024);
+  max_usec = ((gint64) benchmark->sustained_write_duration_sec) * G_USEC_PER_SEC;
+
+  while (!done && offset + SUSTAINED_WRITE_CHUNK_SIZE <= max_bytes)
+    {
+      guint64 window_size;
+      guint64 submitted;
+      guint64 pos;
+      gint64 last_usec;
+      gint64 begin_usec;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      /* only whole chunks */
+      window_size = MIN (SUSTAINED_WRITE_WINDOW_SIZE, max_bytes - offset);
+      window_size -= window_size % SUSTAINED_WRITE_CHUNK_SIZE;
+
+      for (pos = 0; pos < window_size; pos += SUSTAINED_WRITE_CHUNK_SIZE)
+        {
+          if (g_cancellable_set_error_if_cancelled (cancellable, error))
+            goto out;
+
+          if (pread (fd, buffer + pos, SUSTAINED_WRITE_CHUNK_SIZE, offset + pos) != SUSTAINED_WRITE_CHUNK_SIZE)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
+                           (long long int) SUSTAINED_WRITE_CHUNK_SIZE,
+                           (long long int) (offset + pos));
+              goto out;
+            }
+        }
+
+      submitted = 0;
+      last_usec = g_get_monotonic_time ();
+      while (TRUE)
+        {
+          gpointer user_data;
+          gssize result;
+          gint64 now_usec;
+
+          /* once a limit is reached, only wait for what is in flight */
+          while (!done &&
+                 submitted < window_size &&
+                 gdu_io_engine_get_num_pending (engine) < SUSTAINED_WRITE_QUEUE_DEPTH)
+            {
+              if (!gdu_io_engine_submit_write (engine, fd,
+                                               buffer + submitted,
+                                               SUSTAINED_WRITE_CHUNK_SIZE,
+                                               offset + submitted,
+                                               GUINT_TO_POINTER (submitted / SUSTAINED_WRITE_CHUNK_SIZE),
+                                               error))
+                goto out;
+              submitted += SUSTAINED_WRITE_CHUNK_SIZE;
+            }
+
+          if (gdu_io_engine_get_num_pending (engine) == 0)
+            break;
+
+          if (!gdu_io_engine_wait (engine, &user_data, &result, error))
+            goto out;
+          now_usec = g_get_monotonic_time ();
+
+          if (result != SUSTAINED_WRITE_CHUNK_SIZE)
+            {
+              errno = result < 0 ? -result : EIO;
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                           (long long int) SUSTAINED_WRITE_CHUNK_SIZE,
+                           (long long int) (offset + ((guint64) GPOINTER_TO_UINT (user_data)) * SUSTAINED_WRITE_CHUNK_SIZE));
+              goto out;
+            }
+          sample_usec += now_usec - last_usec;
+          sample_bytes += SUSTAINED_WRITE_CHUNK_SIZE;
+          last_usec = now_usec;
+
+          if (max_usec > 0 && sample.time_usec + sample_usec >= max_usec)
+            done = TRUE;
+
+          if (sample_usec >= SUSTAINED_WRITE_SAMPLE_USEC)
+            {
+              add_sustained_write_sample (benchmark, &sample, sample_usec, sample_bytes);
+              sample_usec = 0;
+              sample_bytes = 0;
+            }
+        }
+      offset += submitted;
+
+      /* the drive may still be holding some of it in its cache */
+      begin_usec = g_get_monotonic_time ();
+      if (fdatasync (fd) != 0)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error syncing (at offset %lld): %m"),
+                       (long long int) offset);
+          goto out;
+        }
+      sample_usec += g_get_monotonic_time () - begin_usec;
+
+      if (offset + SUSTAINED_WRITE_CHUNK_SIZE > max_bytes)
+        done = TRUE;
+    }
+
+  if (sample_bytes > 0)
+    add_sustained_write_sample (benchmark, &sample, sample_usec, sample_bytes);
+
+  ret = TRUE;
+
+ out:
+  /* waits for writes still in flight so do this before freeing the buffer */
+  gdu_io_engine_free (engine);
+  g_free (buffer_unaligned);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_benchmark_run:
+ * @benchmark: A #GduBenchmark.
+ * @fd: A file descriptor for the device, opened with O_DIRECT and for writing if GduBenchmark:do_write is set.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @error: Return location for error or %NULL.
+ *
+ * Clears the results of @benchmark and benchmarks the device using
+ * the parameters set in @benchmark. This blocks until done, so if
+ * there is a UI, call it from a thread and look at the results from
+ * the progress function set with gdu_benchmark_set_progress_func().
+ *
+ * Returns: %TRUE if the benchmark completed, %FALSE if @error is set.
+ */
+gboolean
+gdu_benchmark_run (GduBenchmark  *benchmark,
+                   gint           fd,
+                   GCancellable  *cancellable,
+                   GError       **error)
+{
+  gboolean ret = FALSE;
+  guchar *buffer_unaligned = NULL;
+  guchar *buffer = NULL;
+  GRand *rand = NULL;
+  struct utsname uts = {{0}};
+  guint n;
+  long page_size;
+  guint64 disk_size;
+
+  gdu_benchmark_clear (benchmark);
+
+  /* We can't use udisks_block_get_size() because the media may have
+   * changed and udisks may not have noticed. TODO: maybe have a
+   * Block.GetSize() method instead...
+   */
+  if (ioctl (fd, BLKGETSIZE64, &disk_size) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error getting size of device: %m"));
+      goto out;
+    }
+
+  page_size = sysconf (_SC_PAGESIZE);
+  if (page_size < 1)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error getting page size: %m\n"));
+      goto out;
+    }
+
+  buffer_unaligned = g_new0 (guchar, benchmark->sample_size_mib * 1024 * 1024 + page_size);
+  buffer = (guchar*) (((gintptr) (buffer_unaligned + page_size)) & (~(page_size - 1)));
+
+  /* transfer rate... */
+  g_mutex_lock (&benchmark->lock);
+  benchmark->size = disk_size;
+  benchmark->sample_size = benchmark->sample_size_mib * 1024 * 1024;
+  benchmark->phase = GDU_BENCHMARK_PHASE_TRANSFER_RATE;
+  g_mutex_unlock (&benchmark->lock);
+  for (n = 0; n < benchmark->num_samples; n++)
+    {
+      gchar *s, *s2;
+      gint64 begin_usec;
+      gint64 end_usec;
+      gint64 offset;
+      ssize_t num_read;
+      GduBenchmarkSample sample = {0};
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      /* figure out offset and align to page-size */
+      offset = n * disk_size / benchmark->num_samples;
+      offset &= ~(page_size - 1);
+
+      if (lseek (fd, offset, SEEK_SET) != offset)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error seeking to offset %lld"),
+                       (long long int) offset);
+          goto out;
+        }
+      if (read (fd, buffer, page_size) != page_size)
+        {
+          s = g_format_size_full (page_size, G_FORMAT_SIZE_LONG_FORMAT);
+          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error pre-reading %s from offset %s"),
+                       s, s2);
+          g_free (s2);
+          g_free (s);
+          goto out;
+        }
+      if (lseek (fd, offset, SEEK_SET) != offset)
+        {
+          s = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error seeking to offset %s"),
+                       s);
+          g_free (s);
+          goto out;
+        }
+      begin_usec = g_get_monotonic_time ();
+      num_read = read (fd, buffer, benchmark->sample_size_mib * 1024 * 1024);
+      if (G_UNLIKELY (num_read < 0))
+        {
+          s = g_format_size_full (benchmark->sample_size_mib * 1024 * 1024, G_FORMAT_SIZE_LONG_FORMAT);
+          s2 = g_format_size_full (offset, G_FORMAT_SIZE_LONG_FORMAT);
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error reading %s from offset %s"),
+                       s, s2);
+          g_free (s2);
+          g_free (s);
+          goto out;
+        }
+      end_usec = g_get_monotonic_time ();
+
+      sample.offset = offset;
+      sample.value = ((gdouble) G_USEC_PER_SEC) * num_read / (end_usec - begin_usec);
+      g_mutex_lock (&benchmark->lock);
+      g_array_append_val (benchmark->read_samples, sample);
+      gdu_latency_histogram_record (benchmark->read_latency, end_usec - begin_usec);
+      g_mutex_unlock (&benchmark->lock);
+
+      report_progress (benchmark);
+
+      if (benchmark->do_write)
+        {
+          ssize_t num_written;
+
+          /* and now write the same block again... */
+          if (lseek (fd, offset, SEEK_SET) != offset)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error seeking to offset %lld"),
+                           (long long int) offset);
+              goto out;
+            }
+          if (read (fd, buffer, page_size) != page_size)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error pre-reading %lld bytes from offset %lld"),
+                           (long long int) page_size,
+                           (long long int) offset);
+              goto out;
+            }
+          if (lseek (fd, offset, SEEK_SET) != offset)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error seeking to offset %lld"),
+                           (long long int) offset);
+              goto out;
+            }
+          begin_usec = g_get_monotonic_time ();
+          num_written = write (fd, buffer, num_read);
+          if (G_UNLIKELY (num_written < 0))
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error writing %lld bytes at offset %lld: %m"),
+                           (long long int) num_read,
+                           (long long int) offset);
+              goto out;
+            }
+          if (num_written != num_read)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Expected to write %lld bytes, only wrote %lld: %m"),
+                           (long long int) num_read,
+                           (long long int) num_written);
+              goto out;
+            }
+          if (fsync (fd) != 0)
+            {
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errno),
+                           C_("benchmarking", "Error syncing (at offset %lld): %m"),
+                           (long long int) offset);
+              goto out;
+            }
+          end_usec = g_get_monotonic_time ();
+
+          sample.offset = offset;
+          sample.value = ((gdouble) G_USEC_PER_SEC) * num_written / (end_usec - begin_usec);
+          g_mutex_lock (&benchmark->lock);
+          g_array_append_val (benchmark->write_samples, sample);
+          gdu_latency_histogram_record (benchmark->write_latency, end_usec - begin_usec);
+          g_mutex_unlock (&benchmark->lock);
+
+          report_progress (benchmark);
+        }
+    }
+
+  /* access time... */
+  g_mutex_lock (&benchmark->lock);
+  benchmark->phase = GDU_BENCHMARK_PHASE_ACCESS_TIME;
+  g_mutex_unlock (&benchmark->lock);
+  rand = g_rand_new_with_seed (42); /* want this to be deterministic (per size) so it's repeatable */
+  for (n = 0; n < benchmark->num_access_samples; n++)
+    {
+      gint64 begin_usec;
+      gint64 end_usec;
+      gint64 offset;
+      ssize_t num_read;
+      GduBenchmarkSample sample = {0};
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        goto out;
+
+      offset = (guint64) g_rand_double_range (rand, 0, (gdouble) disk_size);
+      offset &= ~(page_size - 1);
+
+      if (lseek (fd, offset, SEEK_SET) != offset)
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error seeking to offset %lld: %m"),
+                       (long long int) offset);
+          goto out;
+        }
+
+      begin_usec = g_get_monotonic_time ();
+      num_read = read (fd, buffer, page_size);
+      if (G_UNLIKELY (num_read < 0))
+        {
+          g_set_error (error,
+                       G_IO_ERROR,
+                       g_io_error_from_errno (errno),
+                       C_("benchmarking", "Error reading %lld bytes from offset %lld"),
+                       (long long int) page_size,
+                       (long long int) offset);
+          goto out;
+        }
+      end_usec = g_get_monotonic_time ();
+
+      sample.offset = offset;
+      sample.value = (end_usec - begin_usec) / ((gdouble) G_USEC_PER_SEC);
+      g_mutex_lock (&benchmark->lock);
+      g_array_append_val (benchmark->access_time_samples, sample);
+      gdu_latency_histogram_record (benchmark->access_time_latency, end_usec - begin_usec);
+      g_mutex_unlock (&benchmark->lock);
+
+      report_progress (benchmark);
+    }
+
+  /* queue depth scaling... */
+  if (benchmark->do_queue_depth)
+    {
+      g_mutex_lock (&benchmark->lock);
+      benchmark->phase = GDU_BENCHMARK_PHASE_QUEUE_DEPTH;
+      g_mutex_unlock (&benchmark->lock);
+      g_rand_set_seed (rand, 42);
+      for (n = 0; n < G_N_ELEMENTS (queue_depths); n++)
+        {
+          GduBenchmarkWorkloadResult result = {0};
+          GduBenchmarkQueueDepthSample sample = {0};
+
+          if (!run_workload (cancellable, fd, disk_size,
+                             QUEUE_DEPTH_WORKLOAD,
+                             queue_depths[n],
+                             QUEUE_DEPTH_DURATION_USEC,
+                             rand, &result, error))
+            goto out;
+
+          sample.queue_depth = queue_depths[n];
+          sample.iops = result.iops;
+          sample.bytes_per_sec = result.bytes_per_sec;
+          sample.latency = result.latency;
+          sample.latency_histogram = result.latency_histogram;
+          g_mutex_lock (&benchmark->lock);
+          g_array_append_val (benchmark->queue_depth_samples, sample);
+          benchmark->queue_depth_async = result.async;
+          g_mutex_unlock (&benchmark->lock);
+
+          report_progress (benchmark);
+
+          /* without io_uring, requests are done one at a time so deeper queues won't tell us anything */
+          if (!result.async)
+            break;
+        }
+    }
+
+  /* workloads... */
+  if (benchmark->workloads != 0)
+    {
+      g_mutex_lock (&benchmark->lock);
+      benchmark->phase = GDU_BENCHMARK_PHASE_WORKLOADS;
+      g_mutex_unlock (&benchmark->lock);
+      g_rand_set_seed (rand, 42);
+      for (n = 0; n < G_N_ELEMENTS (workloads); n++)
+        {
+          GduBenchmarkWorkloadResult result = {0};
+
+          if (!(benchmark->workloads & (1 << n)))
+            continue;
+
+          if (!run_workload (cancellable, fd, disk_size,
+                             &workloads[n],
+                             benchmark->workload_queue_depth,
+                             WORKLOAD_DURATION_USEC,
+                             rand, &result, error))
+            goto out;
+
+          g_mutex_lock (&benchmark->lock);
+          g_array_append_val (benchmark->workload_results, result);
+          g_mutex_unlock (&benchmark->lock);
+
+          report_progress (benchmark);
+        }
+    }
+
+  /* sustained write... last since it leaves the write cache of the drive full */
+  if (benchmark->do_write && benchmark->do_sustained_write)
+    {
+      g_mutex_lock (&benchmark->lock);
+      benchmark->phase = GDU_BENCHMARK_PHASE_SUSTAINED_WRITE;
+      g_mutex_unlock (&benchmark->lock);
+      if (!run_sustained_write (benchmark, cancellable, fd, disk_size, error))
+        goto out;
+    }
+
+  if (uname (&uts) != 0)
+    g_warning ("Error getting kernel version: %m");
+
+  g_mutex_lock (&benchmark->lock);
+  benchmark->time_benchmarked_usec = g_get_real_time ();
+  benchmark->kernel_version = uts.release[0] != '\0' ? g_strdup (uts.release) : NULL;
+  g_mutex_unlock (&benchmark->lock);
+
+  ret = TRUE;
+
+ out:
+  if (rand != NULL)
+    g_rand_free (rand);
+  g_free (buffer_unaligned);
+
+  g_mutex_lock (&benchmark->lock);
+  benchmark->phase = GDU_BENCHMARK_PHASE_NONE;
+  if (!ret)
+    clear_results (benchmark);
+  g_mutex_unlock (&benchmark->lock);
+
+  return ret;
+}
+
+/**
+ * gdu_benchmark_run_workload:
+ * @fd: A file descriptor for the device, opened like for gdu_benchmark_run().
+ * @workload: The workload to run, from gdu_benchmark_get_workloads().
+ * @queue_depth: The number of requests to keep in flight.
+ * @duration_usec: For how long to run the workload.
+ * @cancellable: (allow-none): A #GCancellable or %NULL.
+ * @out_result: Return location for the result. Free its latency histogram when done.
+ * @error: Return location for error or %NULL.
+ *
+ * Runs a single workload against the device, outside of a
+ * #GduBenchmark. This is thread-safe, so several devices can be
+ * benchmarked at the same time by calling it from one thread per
+ * device.
+ *
+ * Returns: %TRUE if @out_result was set, %FALSE if @error is set.
+ */
+gboolean
+gdu_benchmark_run_workload (gint                        fd,
+                            const GduBenchmarkWorkload *workload,
+                            guint                       queue_depth,
+                            gint64                      duration_usec,
+                            GCancellable               *cancellable,
+                            GduBenchmarkWorkloadResult *out_result,
+                            GError                    **error)
+{
+  gboolean ret = FALSE;
+  GRand *rand;
+  guint64 disk_size;
+
+  rand = g_rand_new_with_seed (42);
+
+  if (ioctl (fd, BLKGETSIZE64, &disk_size) != 0)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   C_("benchmarking", "Error getting size of device: %m"));
+      goto out;
+    }
+
+  if (!run_workload (cancellable, fd, disk_size, workload, queue_depth, duration_usec, rand, out_result, error))
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  g_rand_free (rand);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* the transfer rate over samples @begin up to but not including @end */
+static gdouble
+sustained_write_rate (GArray *samples,
+                      guint   begin,
+                      guint   end)
+{
+  GduBenchmarkSustainedSample *last = &g_array_index (samples, GduBenchmarkSustainedSample, end - 1);
+  guint64 bytes = last->bytes_written;
+  gint64 usec = last->time_usec;
+
+  if (begin > 0)
+    {
+      GduBenchmarkSustainedSample *before = &g_array_index (samples, GduBenchmarkSustainedSample, begin - 1);
+      bytes -= before->bytes_written;
+      usec -= before->time_usec;
+    }
+  return ((gdouble) G_USEC_PER_SEC) * bytes / MAX (usec, 1);
+}
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  gdouble da = *((const gdouble *) a);
+  gdouble db = *((const gdouble *) b);
+  return da < db ? -1 : (da > db ? 1 : 0);
+}
+
+/**
+ * gdu_benchmark_find_sustained_write_collapse:
+ * @benchmark: A #GduBenchmark.
+ * @out_burst_rate: (out) (allow-none): Return location for the transfer rate before the collapse or %NULL.
+ * @out_sustained_rate: (out) (allow-none): Return location for the transfer rate after the collapse or %NULL.
+ *
+ * Finds the point where the transfer rate of the sustained write
+ * dropped and stayed down, typically because the SLC cache of the
+ * drive was full. The lock must be held.
+ *
+ * Returns: The index of the first sample in
+ * GduBenchmark:sustained_write_samples after the collapse or -1 if
+ * the transfer rate held up.
+ */
+gint
+gdu_benchmark_find_sustained_write_collapse (GduBenchmark *benchmark,
+                                             gdouble      *out_burst_rate,
+                                             gdouble      *out_sustained_rate)
+{
+  GArray *samples = benchmark->sustained_write_samples;
+  gdouble peak = 0.0;
+  gdouble burst_rate = 0.0;
+  gdouble sustained_rate = 0.0;
+  gint ret = -1;
+  guint n;
+
+  /* too few samples to tell a collapse from noise */
+  if (samples->len >= 2 * SUSTAINED_WRITE_SMOOTHING)
+    {
+      for (n = 0; n < samples->len; n++)
+        {
+          gdouble window[SUSTAINED_WRITE_SMOOTHING];
+          gdouble median;
+          guint begin;
+          guint m;
+
+          begin = n >= SUSTAINED_WRITE_SMOOTHING / 2 ? n - SUSTAINED_WRITE_SMOOTHING / 2 : 0;
+          begin = MIN (begin, samples->len - SUSTAINED_WRITE_SMOOTHING);
+          for (m = 0; m < SUSTAINED_WRITE_SMOOTHING; m++)
+            window[m] = g_array_index (samples, GduBenchmarkSustainedSample, begin + m).value;
+          qsort (window, SUSTAINED_WRITE_SMOOTHING, sizeof (gdouble), compare_doubles);
+          median = window[SUSTAINED_WRITE_SMOOTHING / 2];
+
+          if (median > peak)
+            {
+              peak = median;
+              continue;
+            }
+
+          /* a dip is not a collapse - it has to stay down */
+          if (median < SUSTAINED_WRITE_COLLAPSE_RATIO * peak &&
+              sustained_write_rate (samples, n, samples->len) < SUSTAINED_WRITE_COLLAPSE_RATIO * peak)
+            {
+              ret = n;
+              break;
+            }
+        }
+    }
+
+  if (samples->len > 0)
+    {
+      if (ret > 0)
+        {
+          burst_rate = sustained_write_rate (samples, 0, ret);
+          sustained_rate = sustained_write_rate (samples, ret, samples->len);
+        }
+      else
+        {
+          burst_rate = sustained_rate = sustained_write_rate (samples, 0, samples->len);
+        }
+    }
+
+  if (out_burst_rate != NULL)
+    *out_burst_rate = burst_rate;
+  if (out_sustained_rate != NULL)
+    *out_sustained_rate = sustained_rate;
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+samples_from_gvariant (GArray   *array,
+                       GVariant *variant)
+{
+  GVariantIter iter;
+  GduBenchmarkSample sample;
+
+  g_array_set_size (array, 0);
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(td)", &sample.offset, &sample.value))
+    {
+      g_array_append_val (array, sample);
+    }
+}
+
+static void
+queue_depth_samples_from_gvariant (GArray   *array,
+                                   GVariant *variant)
+{
+  GVariantIter iter;
+  GduBenchmarkQueueDepthSample sample;
+
+  g_array_set_size (array, 0);
+
+  sample.latency_histogram = NULL;
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(uddd)",
+                              &sample.queue_depth,
+                              &sample.iops,
+                              &sample.bytes_per_sec,
+                              &sample.latency))
+    {
+      g_array_append_val (array, sample);
+    }
+}
+
+static void
+workload_results_from_gvariant (GArray   *array,
+                                GVariant *variant)
+{
+  GVariantIter iter;
+  const gchar *id;
+  GduBenchmarkWorkloadResult result;
+  gint n;
+
+  g_array_set_size (array, 0);
+
+  result.latency_histogram = NULL;
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(&sudddb)",
+                              &id,
+                              &result.queue_depth,
+                              &result.iops,
+                              &result.bytes_per_sec,
+                              &result.latency,
+                              &result.async))
+    {
+      /* skip workloads we no longer know about */
+      n = gdu_benchmark_lookup_workload (id);
+      if (n < 0)
+        continue;
+      result.workload = &workloads[n];
+      g_array_append_val (array, result);
+    }
+}
+
+static void
+sustained_write_samples_from_gvariant (GArray   *array,
+                                       GVariant *variant)
+{
+  GVariantIter iter;
+  GduBenchmarkSustainedSample sample;
+
+  g_array_set_size (array, 0);
+
+  g_variant_iter_init (&iter, variant);
+  while (g_variant_iter_next (&iter, "(xtd)", &sample.time_usec, &sample.bytes_written, &sample.value))
+    {
+      g_array_append_val (array, sample);
+    }
+}
+
+static void
+latency_histogram_from_gvariant (GduLatencyHistogram *histogram,
+                                 GVariant            *histograms,
+                                 const gchar         *key)
+{
+  GVariant *value;
+  GduLatencyHistogram *loaded;
+
+  gdu_latency_histogram_reset (histogram);
+  value = g_variant_lookup_value (histograms, key, NULL);
+  if (value == NULL)
+    return;
+  loaded = gdu_latency_histogram_new_from_gvariant (value);
+  if (loaded != NULL)
+    {
+      gdu_latency_histogram_merge (histogram, loaded);
+      gdu_latency_histogram_free (loaded);
+    }
+  g_variant_unref (value);
+}
+
+static void
+latency_histograms_from_gvariant (GduBenchmark *benchmark,
+                                  GVariant     *histograms)
+{
+  guint n;
+
+  latency_histogram_from_gvariant (benchmark->read_latency, histograms, "read");
+  latency_histogram_from_gvariant (benchmark->write_latency, histograms, "write");
+  latency_histogram_from_gvariant (benchmark->access_time_latency, histograms, "access-time");
+
+  for (n = 0; n < benchmark->queue_depth_samples->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      gchar *key = g_strdup_printf ("queue-depth-%u", sample->queue_depth);
+      sample->latency_histogram = gdu_latency_histogram_new ();
+      latency_histogram_from_gvariant (sample->latency_histogram, histograms, key);
+      g_free (key);
+    }
+
+  for (n = 0; n < benchmark->workload_results->len; n++)
+    {
+      GduBenchmarkWorkloadResult *result = &g_array_index (benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+      gchar *key = g_strdup_printf ("workload-%s", result->workload->id);
+      result->latency_histogram = gdu_latency_histogram_new ();
+      latency_histogram_from_gvariant (result->latency_histogram, histograms, key);
+      g_free (key);
+    }
+}
+
+static void
+parameters_from_gvariant (GduBenchmark *benchmark,
+                          GVariant     *parameters)
+{
+  const gchar **ids = NULL;
+  guint n;
+
+  g_variant_lookup (parameters, "num-samples", "u", &benchmark->num_samples);
+  g_variant_lookup (parameters, "sample-size-mib", "u", &benchmark->sample_size_mib);
+  g_variant_lookup (parameters, "write", "b", &benchmark->do_write);
+  g_variant_lookup (parameters, "num-access-samples", "u", &benchmark->num_access_samples);
+  g_variant_lookup (parameters, "queue-depth-sweep", "b", &benchmark->do_queue_depth);
+  g_variant_lookup (parameters, "workload-queue-depth", "u", &benchmark->workload_queue_depth);
+  g_variant_lookup (parameters, "sustained-write", "b", &benchmark->do_sustained_write);
+  g_variant_lookup (parameters, "sustained-write-duration-sec", "u", &benchmark->sustained_write_duration_sec);
+  g_variant_lookup (parameters, "sustained-write-size-gib", "u", &benchmark->sustained_write_size_gib);
+  if (g_variant_lookup (parameters, "workloads", "^a&s", &ids))
+    {
+      benchmark->workloads = 0;
+      for (n = 0; ids[n] != NULL; n++)
+        {
+          gint index = gdu_benchmark_lookup_workload (ids[n]);
+          if (index >= 0)
+            benchmark->workloads |= (1 << index);
+        }
+      g_free (ids);
+    }
+}
+
+/* Loads results saved with gdu_benchmark_to_gvariant() */
+gboolean
+gdu_benchmark_set_from_gvariant (GduBenchmark  *benchmark,
+                                 GVariant      *value,
+                                 GError       **error)
+{
+  gboolean ret = FALSE;
+  GVariant *read_samples_variant = NULL;
+  GVariant *write_samples_variant = NULL;
+  GVariant *access_time_samples_variant = NULL;
+  GVariant *queue_depth_samples_variant = NULL;
+  GVariant *workload_results_variant = NULL;
+  GVariant *sustained_write_samples_variant = NULL;
+  GVariant *latency_histograms_variant = NULL;
+  GVariant *parameters_variant = NULL;
+  gboolean queue_depth_async = FALSE;
+  const gchar *kernel_version = NULL;
+  const gchar *firmware_revision = NULL;
+  gint32 version;
+  gint64 timestamp_usec;
+  guint64 device_size;
+  guint64 sample_size;
+
+  if (!g_variant_lookup (value, "version", "i", &version))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No version key");
+      goto out;
+    }
+  if (version != 1)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Cannot decode version %d data", version);
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "timestamp-usec", "x", &timestamp_usec))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No timestamp-usec");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "device-size", "t", &device_size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No device-size");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "read-samples", "@a(td)", &read_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No read-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "write-samples", "@a(td)", &write_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No write-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "access-time-samples", "@a(td)", &access_time_samples_variant))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No access-time-samples");
+      goto out;
+    }
+
+  if (!g_variant_lookup (value, "sample-size", "t", &sample_size))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No sample-size");
+      goto out;
+    }
+
+  /* optional - not in data from older versions */
+  g_variant_lookup (value, "queue-depth-samples", "@a(uddd)", &queue_depth_samples_variant);
+  g_variant_lookup (value, "queue-depth-async", "b", &queue_depth_async);
+  g_variant_lookup (value, "workload-results", "@a(sudddb)", &workload_results_variant);
+  g_variant_lookup (value, "sustained-write-samples", "@a(xtd)", &sustained_write_samples_variant);
+  g_variant_lookup (value, "latency-histograms", "@a{sv}", &latency_histograms_variant);
+  g_variant_lookup (value, "parameters", "@a{sv}", &parameters_variant);
+  g_variant_lookup (value, "kernel-version", "&s", &kernel_version);
+  g_variant_lookup (value, "firmware-revision", "&s", &firmware_revision);
+
+  benchmark->time_benchmarked_usec = timestamp_usec;
+  g_free (benchmark->kernel_version);
+  benchmark->kernel_version = g_strdup (kernel_version);
+  gdu_benchmark_set_firmware_revision (benchmark, firmware_revision);
+  if (parameters_variant != NULL)
+    parameters_from_gvariant (benchmark, parameters_variant);
+  benchmark->size = device_size;
+  benchmark->sample_size = sample_size;
+  samples_from_gvariant (benchmark->read_samples, read_samples_variant);
+  samples_from_gvariant (benchmark->write_samples, write_samples_variant);
+  samples_from_gvariant (benchmark->access_time_samples, access_time_samples_variant);
+  if (queue_depth_samples_variant != NULL)
+    queue_depth_samples_from_gvariant (benchmark->queue_depth_samples, queue_depth_samples_variant);
+  else
+    g_array_set_size (benchmark->queue_depth_samples, 0);
+  benchmark->queue_depth_async = queue_depth_async;
+  if (workload_results_variant != NULL)
+    workload_results_from_gvariant (benchmark->workload_results, workload_results_variant);
+  else
+    g_array_set_size (benchmark->workload_results, 0);
+  if (sustained_write_samples_variant != NULL)
+    sustained_write_samples_from_gvariant (benchmark->sustained_write_samples, sustained_write_samples_variant);
+  else
+    g_array_set_size (benchmark->sustained_write_samples, 0);
+  if (latency_histograms_variant != NULL)
+    {
+      latency_histograms_from_gvariant (benchmark, latency_histograms_variant);
+    }
+  else
+    {
+      gdu_latency_histogram_reset (benchmark->read_latency);
+      gdu_latency_histogram_reset (benchmark->write_latency);
+      gdu_latency_histogram_reset (benchmark->access_time_latency);
+    }
+
+  ret = TRUE;
+ out:
+  if (read_samples_variant != NULL)
+    g_variant_unref (read_samples_variant);
+  if (write_samples_variant != NULL)
+    g_variant_unref (write_samples_variant);
+  if (access_time_samples_variant != NULL)
+    g_variant_unref (access_time_samples_variant);
+  if (queue_depth_samples_variant != NULL)
+    g_variant_unref (queue_depth_samples_variant);
+  if (workload_results_variant != NULL)
+    g_variant_unref (workload_results_variant);
+  if (sustained_write_samples_variant != NULL)
+    g_variant_unref (sustained_write_samples_variant);
+  if (latency_histograms_variant != NULL)
+    g_variant_unref (latency_histograms_variant);
+  if (parameters_variant != NULL)
+    g_variant_unref (parameters_variant);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static GVariant *
+samples_to_gvariant (GArray *array)
+{
+  guint n;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(td)"));
+  for (n = 0; n < array->len; n++)
+    {
+      GduBenchmarkSample *s = &g_array_index (array, GduBenchmarkSample, n);
+      g_variant_builder_add (&builder, "(td)", s->offset, s->value);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+queue_depth_samples_to_gvariant (GArray *array)
+{
+  guint n;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uddd)"));
+  for (n = 0; n < array->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *s = &g_array_index (array, GduBenchmarkQueueDepthSample, n);
+      g_variant_builder_add (&builder, "(uddd)", s->queue_depth, s->iops, s->bytes_per_sec, s->latency);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+workload_results_to_gvariant (GArray *array)
+{
+  guint n;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sudddb)"));
+  for (n = 0; n < array->len; n++)
+    {
+      GduBenchmarkWorkloadResult *r = &g_array_index (array, GduBenchmarkWorkloadResult, n);
+      g_variant_builder_add (&builder, "(sudddb)",
+                             r->workload->id, r->queue_depth, r->iops, r->bytes_per_sec, r->latency, r->async);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+sustained_write_samples_to_gvariant (GArray *array)
+{
+  guint n;
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(xtd)"));
+  for (n = 0; n < array->len; n++)
+    {
+      GduBenchmarkSustainedSample *s = &g_array_index (array, GduBenchmarkSustainedSample, n);
+      g_variant_builder_add (&builder, "(xtd)", s->time_usec, s->bytes_written, s->value);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+latency_histograms_to_gvariant (GduBenchmark *benchmark)
+{
+  GVariantBuilder builder;
+  guint n;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "read", gdu_latency_histogram_to_gvariant (benchmark->read_latency));
+  g_variant_builder_add (&builder, "{sv}", "write", gdu_latency_histogram_to_gvariant (benchmark->write_latency));
+  g_variant_builder_add (&builder, "{sv}", "access-time", gdu_latency_histogram_to_gvariant (benchmark->access_time_latency));
+
+  for (n = 0; n < benchmark->queue_depth_samples->len; n++)
+    {
+      GduBenchmarkQueueDepthSample *sample = &g_array_index (benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+      gchar *key;
+
+      if (sample->latency_histogram == NULL)
+        continue;
+      key = g_strdup_printf ("queue-depth-%u", sample->queue_depth);
+      g_variant_builder_add (&builder, "{sv}", key, gdu_latency_histogram_to_gvariant (sample->latency_histogram));
+      g_free (key);
+    }
+
+  for (n = 0; n < benchmark->workload_results->len; n++)
+    {
+      GduBenchmarkWorkloadResult *result = &g_array_index (benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+      gchar *key;
+
+      if (result->latency_histogram == NULL)
+        continue;
+      key = g_strdup_printf ("workload-%s", result->workload->id);
+      g_variant_builder_add (&builder, "{sv}", key, gdu_latency_histogram_to_gvariant (result->latency_histogram));
+      g_free (key);
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static GVariant *
+parameters_to_gvariant (GduBenchmark *benchmark)
+{
+  GVariantBuilder builder;
+  GVariantBuilder workloads_builder;
+  guint n;
+
+  g_variant_builder_init (&workloads_builder, G_VARIANT_TYPE_STRING_ARRAY);
+  for (n = 0; n < G_N_ELEMENTS (workloads); n++)
+    {
+      if (benchmark->workloads & (1 << n))
+        g_variant_builder_add (&workloads_builder, "s", workloads[n].id);
+    }
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "num-samples", g_variant_new_uint32 (benchmark->num_samples));
+  g_variant_builder_add (&builder, "{sv}", "sample-size-mib", g_variant_new_uint32 (benchmark->sample_size_mib));
+  g_variant_builder_add (&builder, "{sv}", "write", g_variant_new_boolean (benchmark->do_write));
+  g_variant_builder_add (&builder, "{sv}", "num-access-samples", g_variant_new_uint32 (benchmark->num_access_samples));
+  g_variant_builder_add (&builder, "{sv}", "queue-depth-sweep", g_variant_new_boolean (benchmark->do_queue_depth));
+  g_variant_builder_add (&builder, "{sv}", "workloads", g_variant_builder_end (&workloads_builder));
+  g_variant_builder_add (&builder, "{sv}", "workload-queue-depth", g_variant_new_uint32 (benchmark->workload_queue_depth));
+  g_variant_builder_add (&builder, "{sv}", "sustained-write", g_variant_new_boolean (benchmark->do_sustained_write));
+  g_variant_builder_add (&builder, "{sv}", "sustained-write-duration-sec", g_variant_new_uint32 (benchmark->sustained_write_duration_sec));
+  g_variant_builder_add (&builder, "{sv}", "sustained-write-size-gib", g_variant_new_uint32 (benchmark->sustained_write_size_gib));
+  return g_variant_builder_end (&builder);
+}
+
+/* Returns: A floating #GVariant with the results, for saving */
+GVariant *
+gdu_benchmark_to_gvariant (GduBenchmark *benchmark)
+{
+  GVariantBuilder builder;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE_VARDICT);
+  g_variant_builder_add (&builder, "{sv}", "version", g_variant_new_int32 (1));
+  g_variant_builder_add (&builder, "{sv}", "timestamp-usec", g_variant_new_int64 (benchmark->time_benchmarked_usec));
+  g_variant_builder_add (&builder, "{sv}", "parameters", parameters_to_gvariant (benchmark));
+  if (benchmark->kernel_version != NULL)
+    g_variant_builder_add (&builder, "{sv}", "kernel-version", g_variant_new_string (benchmark->kernel_version));
+  if (benchmark->firmware_revision != NULL)
+    g_variant_builder_add (&builder, "{sv}", "firmware-revision", g_variant_new_string (benchmark->firmware_revision));
+  g_variant_builder_add (&builder, "{sv}", "device-size", g_variant_new_uint64 (benchmark->size));
+  g_variant_builder_add (&builder, "{sv}", "sample-size", g_variant_new_uint64 (benchmark->sample_size));
+  g_variant_builder_add (&builder, "{sv}", "read-samples", samples_to_gvariant (benchmark->read_samples));
+  g_variant_builder_add (&builder, "{sv}", "write-samples", samples_to_gvariant (benchmark->write_samples));
+  g_variant_builder_add (&builder, "{sv}", "access-time-samples", samples_to_gvariant (benchmark->access_time_samples));
+  if (benchmark->queue_depth_samples->len > 0)
+    {
+      g_variant_builder_add (&builder, "{sv}", "queue-depth-samples", queue_depth_samples_to_gvariant (benchmark->queue_depth_samples));
+      g_variant_builder_add (&builder, "{sv}", "queue-depth-async", g_variant_new_boolean (benchmark->queue_depth_async));
+    }
+  if (benchmark->workload_results->len > 0)
+    g_variant_builder_add (&builder, "{sv}", "workload-results", workload_results_to_gvariant (benchmark->workload_results));
+  if (benchmark->sustained_write_samples->len > 0)
+    g_variant_builder_add (&builder, "{sv}", "sustained-write-samples", sustained_write_samples_to_gvariant (benchmark->sustained_write_samples));
+  g_variant_builder_add (&builder, "{sv}", "latency-histograms", latency_histograms_to_gvariant (benchmark));
+  return g_variant_builder_end (&builder);
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static void
+json_append_double (GString *str,
+                    gdouble  value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* not printf() since that uses the decimal point of the locale */
+  if (isfinite (value))
+    g_string_append (str, g_ascii_dtostr (buf, sizeof buf, value));
+  else
+    g_string_append (str, "null");
+}
+
+static void
+json_append_latency (GString             *str,
+                     GduLatencyHistogram *histogram)
+{
+  g_string_append_printf (str,
+                          "{\"count\":%" G_GUINT64_FORMAT
+                          ",\"p50_usec\":%" G_GUINT64_FORMAT
+                          ",\"p90_usec\":%" G_GUINT64_FORMAT
+                          ",\"p99_usec\":%" G_GUINT64_FORMAT
+                          ",\"p99_9_usec\":%" G_GUINT64_FORMAT
+                          ",\"max_usec\":%" G_GUINT64_FORMAT "}",
+                          gdu_latency_histogram_get_count (histogram),
+                          gdu_latency_histogram_get_percentile (histogram, 50.0),
+                          gdu_latency_histogram_get_percentile (histogram, 90.0),
+                          gdu_latency_histogram_get_percentile (histogram, 99.0),
+                          gdu_latency_histogram_get_percentile (histogram, 99.9),
+                          gdu_latency_histogram_get_max (histogram));
+}
+
+static void
+json_append_samples (GString             *str,
+                     const gchar         *key,
+                     const gchar         *value_key,
+                     GArray              *array,
+                     GduLatencyHistogram *histogram)
+{
+  gdouble sum = 0.0;
+  guint n;
+
+  g_string_append_printf (str, ",\"%s\":{\"samples\":[", key);
+  for (n = 0; n < array->len; n++)
+    {
+      GduBenchmarkSample *s = &g_array_index (array, GduBenchmarkSample, n);
+      g_string_append_printf (str, "%s{\"offset\":%" G_GUINT64_FORMAT ",\"%s\":",
+                              n > 0 ? "," : "", s->offset, value_key);
+      json_append_double (str, s->value);
+      g_string_append_c (str, '}');
+      sum += s->value;
+    }
+  g_string_append_printf (str, "],\"avg_%s\":", value_key);
+  json_append_double (str, array->len > 0 ? sum / array->len : 0.0);
+  g_string_append (str, ",\"latency\":");
+  json_append_latency (str, histogram);
+  g_string_append_c (str, '}');
+}
+
+/**
+ * gdu_benchmark_append_json:
+ * @benchmark: A #GduBenchmark.
+ * @str: A #GString.
+ *
+ * Appends the parameters and results of @benchmark to @str as a JSON
+ * object, for scripts and CI. Rates are in bytes per second, times
+ * in seconds and latency percentiles in micro-seconds.
+ */
+void
+gdu_benchmark_append_json (GduBenchmark *benchmark,
+                           GString      *str)
+{
+  guint n;
+
+  g_string_append_printf (str,
+                          "{\"timestamp_usec\":%" G_GINT64_FORMAT
+                          ",\"device_size\":%" G_GUINT64_FORMAT
+                          ",\"sample_size\":%" G_GUINT64_FORMAT,
+                          benchmark->time_benchmarked_usec,
+                          benchmark->size,
+                          benchmark->sample_size);
+  g_string_append (str, ",\"kernel_version\":");
+  gdu_utils_append_json_string (str, benchmark->kernel_version);
+  g_string_append (str, ",\"firmware_revision\":");
+  gdu_utils_append_json_string (str, benchmark->firmware_revision);
+
+  g_string_append_printf (str,
+                          ",\"parameters\":{\"num_samples\":%u,\"sample_size_mib\":%u,\"write\":%s"
+                          ",\"num_access_samples\":%u,\"queue_depth_sweep\":%s,\"workload_queue_depth\":%u"
+                          ",\"sustained_write\":%s,\"sustained_write_duration_sec\":%u,\"sustained_write_size_gib\":%u}",
+                          benchmark->num_samples,
+                          benchmark->sample_size_mib,
+                          benchmark->do_write ? "true" : "false",
+                          benchmark->num_access_samples,
+                          benchmark->do_queue_depth ? "true" : "false",
+                          benchmark->workload_queue_depth,
+                          benchmark->do_write && benchmark->do_sustained_write ? "true" : "false",
+                          benchmark->sustained_write_duration_sec,
+                          benchmark->sustained_write_size_gib);
+
+  json_append_samples (str, "read", "bytes_per_sec", benchmark->read_samples, benchmark->read_latency);
+  if (benchmark->write_samples->len > 0)
+    json_append_samples (str, "write", "bytes_per_sec", benchmark->write_samples, benchmark->write_latency);
+  json_append_samples (str, "access_time", "seconds", benchmark->access_time_samples, benchmark->access_time_latency);
+
+  if (benchmark->queue_depth_samples->len > 0)
+    {
+      g_string_append_printf (str, ",\"queue_depth\":{\"block_size\":%u,\"async\":%s,\"samples\":[",
+                              QUEUE_DEPTH_WORKLOAD->block_size,
+                              benchmark->queue_depth_async ? "true" : "false");
+      for (n = 0; n < benchmark->queue_depth_samples->len; n++)
+        {
+          GduBenchmarkQueueDepthSample *s = &g_array_index (benchmark->queue_depth_samples, GduBenchmarkQueueDepthSample, n);
+          g_string_append_printf (str, "%s{\"queue_depth\":%u,\"iops\":", n > 0 ? "," : "", s->queue_depth);
+          json_append_double (str, s->iops);
+          g_string_append (str, ",\"bytes_per_sec\":");
+          json_append_double (str, s->bytes_per_sec);
+          g_string_append (str, ",\"avg_latency_seconds\":");
+          json_append_double (str, s->latency);
+          if (s->latency_histogram != NULL)
+            {
+              g_string_append (str, ",\"latency\":");
+              json_append_latency (str, s->latency_histogram);
+            }
+          g_string_append_c (str, '}');
+        }
+      g_string_append (str, "]}");
+    }
+
+  if (benchmark->workload_results->len > 0)
+    {
+      g_string_append (str, ",\"workloads\":[");
+      for (n = 0; n < benchmark->workload_results->len; n++)
+        {
+          GduBenchmarkWorkloadResult *r = &g_array_index (benchmark->workload_results, GduBenchmarkWorkloadResult, n);
+          g_string_append (str, n > 0 ? ",{\"id\":" : "{\"id\":");
+          gdu_utils_append_json_string (str, r->workload->id);
+          g_string_append (str, ",\"name\":");
+          gdu_utils_append_json_string (str, r->workload->name);
+          g_string_append_printf (str, ",\"block_size\":%u,\"read_percentage\":%u,\"random\":%s,\"queue_depth\":%u,\"async\":%s,\"iops\":",
+                                  r->workload->block_size,
+                                  r->workload->read_percentage,
+                                  r->workload->random ? "true" : "false",
+                                  r->queue_depth,
+                                  r->async ? "true" : "false");
+          json_append_double (str, r->iops);
+          g_string_append (str, ",\"bytes_per_sec\":");
+          json_append_double (str, r->bytes_per_sec);
+          g_string_append (str, ",\"avg_latency_seconds\":");
+          json_append_double (str, r->latency);
+          if (r->latency_histogram != NULL)
+            {
+              g_string_append (str, ",\"latency\":");
+              json_append_latency (str, r->latency_histogram);
+            }
+          g_string_append_c (str, '}');
+        }
+      g_string_append_c (str, ']');
+    }
+
+  if (benchmark->sustained_write_samples->len > 0)
+    {
+      gdouble burst_rate;
+      gdouble sustained_rate;
+      gint collapse;
+
+      g_string_append (str, ",\"sustained_write\":{\"samples\":[");
+      for (n = 0; n < benchmark->sustained_write_samples->len; n++)
+        {
+          GduBenchmarkSustainedSample *s = &g_array_index (benchmark->sustained_write_samples, GduBenchmarkSustainedSample, n);
+          g_string_append_printf (str, "%s{\"time_usec\":%" G_GINT64_FORMAT ",\"bytes_written\":%" G_GUINT64_FORMAT ",\"bytes_per_sec\":",
+                                  n > 0 ? "," : "", s->time_usec, s->bytes_written);
+          json_append_double (str, s->value);
+          g_string_append_c (str, '}');
+        }
+      collapse = gdu_benchmark_find_sustained_write_collapse (benchmark, &burst_rate, &sustained_rate);
+      g_string_append (str, "],\"burst_bytes_per_sec\":");
+      json_append_double (str, burst_rate);
+      g_string_append (str, ",\"sustained_bytes_per_sec\":");
+      json_append_double (str, sustained_rate);
+      /* where it collapsed, i.e. the end of the last sample before that */
+      if (collapse > 0)
+        {
+          GduBenchmarkSustainedSample *s = &g_array_index (benchmark->sustained_write_samples, GduBenchmarkSustainedSample, collapse - 1);
+          g_string_append_printf (str, ",\"collapse\":{\"time_usec\":%" G_GINT64_FORMAT ",\"bytes_written\":%" G_GUINT64_FORMAT "}}",
+                                  s->time_usec, s->bytes_written);
+        }
+      else
+        {
+          g_string_append (str, ",\"collapse\":null}");
+        }
+    }
+
+  g_string_append_c (str, '}');
+}
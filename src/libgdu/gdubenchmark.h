@@ -0,0 +1,140 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2008-2013 Red Hat, Inc.
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: David Zeuthen <zeuthen@gmail.com>
+ */
+
+#ifndef __GDU_BENCHMARK_H__
+#define __GDU_BENCHMARK_H__
+
+#include "libgdutypes.h"
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  const gchar *id;
+  const gchar *name; /* translate with gettext() */
+  guint block_size;
+  guint read_percentage;
+  gboolean random;
+} GduBenchmarkWorkload;
+
+typedef struct
+{
+  guint64 offset;
+  gdouble value;
+} GduBenchmarkSample;
+
+typedef struct
+{
+  guint queue_depth;
+  gdouble iops;
+  gdouble bytes_per_sec;
+  gdouble latency; /* average, in seconds */
+  GduLatencyHistogram *latency_histogram;
+} GduBenchmarkQueueDepthSample;
+
+typedef struct
+{
+  const GduBenchmarkWorkload *workload;
+  guint queue_depth;
+  gdouble iops;
+  gdouble bytes_per_sec;
+  gdouble latency; /* average, in seconds */
+  GduLatencyHistogram *latency_histogram;
+  gboolean async; /* FALSE if requests were not actually queued */
+} GduBenchmarkWorkloadResult;
+
+typedef struct
+{
+  gint64 time_usec; /* time spent writing, up to and including this sample */
+  guint64 bytes_written; /* up to and including this sample */
+  gdouble value; /* transfer rate during this sample, in bytes per second */
+} GduBenchmarkSustainedSample;
+
+typedef void (*GduBenchmarkProgressFunc) (GduBenchmark *benchmark,
+                                          gpointer      user_data);
+
+struct GduBenchmark
+{
+  /* parameters - set before calling gdu_benchmark_run() */
+  guint num_samples;
+  guint sample_size_mib;
+  gboolean do_write;
+  guint num_access_samples;
+  gboolean do_queue_depth;
+  guint workloads; /* bitmask of indexes into gdu_benchmark_get_workloads() */
+  guint workload_queue_depth;
+  gboolean do_sustained_write; /* only if do_write is set */
+  guint sustained_write_duration_sec; /* 0 for no limit */
+  guint sustained_write_size_gib; /* 0 for no limit */
+  gchar *firmware_revision; /* saved with the results, see gdu_benchmark_set_firmware_revision() */
+
+  /* results - while gdu_benchmark_run() is running in another
+   * thread, only look at these with gdu_benchmark_lock() held
+   */
+  GduBenchmarkPhase phase;
+  gint64 time_benchmarked_usec; /* 0 if never benchmarked, otherwise micro-seconds since Epoch */
+  gchar *kernel_version; /* the kernel the benchmark ran on, NULL if unknown */
+  guint64 size;
+  guint64 sample_size;
+  GArray *read_samples;
+  GArray *write_samples;
+  GArray *access_time_samples;
+  GduLatencyHistogram *read_latency;
+  GduLatencyHistogram *write_latency;
+  GduLatencyHistogram *access_time_latency;
+  GArray *queue_depth_samples;
+  gboolean queue_depth_async; /* FALSE if requests were not actually queued */
+  GArray *workload_results;
+  GArray *sustained_write_samples;
+
+  /*< private >*/
+  GMutex lock;
+  GduBenchmarkProgressFunc progress_func;
+  gpointer progress_user_data;
+};
+
+const GduBenchmarkWorkload *gdu_benchmark_get_workloads     (guint                     *out_num_workloads);
+gint                        gdu_benchmark_lookup_workload   (const gchar               *id);
+guint                       gdu_benchmark_get_queue_depth_block_size (void);
+
+GduBenchmark *gdu_benchmark_new                (void);
+void          gdu_benchmark_free               (GduBenchmark              *benchmark);
+void          gdu_benchmark_lock               (GduBenchmark              *benchmark);
+void          gdu_benchmark_unlock             (GduBenchmark              *benchmark);
+void          gdu_benchmark_set_progress_func  (GduBenchmark              *benchmark,
+                                                GduBenchmarkProgressFunc   func,
+                                                gpointer                   user_data);
+void          gdu_benchmark_set_firmware_revision (GduBenchmark           *benchmark,
+                                                   const gchar            *revision);
+void          gdu_benchmark_clear              (GduBenchmark              *benchmark);
+gdouble       gdu_benchmark_get_phase_progress (GduBenchmark              *benchmark);
+gboolean      gdu_benchmark_run                (GduBenchmark              *benchmark,
+                                                gint                       fd,
+                                                GCancellable              *cancellable,
+                                                GError                   **error);
+gboolean      gdu_benchmark_run_workload       (gint                        fd,
+                                                const GduBenchmarkWorkload *workload,
+                                                guint                       queue_depth,
+                                                gint64                      duration_usec,
+                                                GCancellable               *cancellable,
+                                                GduBenchmarkWorkloadResult *out_result,
+                                                GError                    **error);
+gint          gdu_benchmark_find_sustained_write_collapse (GduBenchmark *benchmark,
+                                                          gdouble      *out_burst_rate,
+                                                          gdouble      *out_sustained_rate);
+GVariant     *gdu_benchmark_to_gvariant        (GduBenchmark              *benchmark);
+gboolean      gdu_benchmark_set_from_gvariant  (GduBenchmark              *benchmark,
+                                                GVariant                  *value,
+                                                GError                   **error);
+void          gdu_benchmark_append_json        (GduBenchmark              *benchmark,
+                                                GString                   *str);
+
+G_END_DECLS
+
+#endif /* __GDU_BENCHMARK_H__ */
@@ -0,0 +1,324 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "gdubenchmark.h"
+#include "gdubenchmarkhistory.h"
+
+/* Every benchmark of a device is kept, one file per device, so
+ * earlier runs can be compared with the latest one. Runs are only
+ * ever appended to the file - each is the size as a little-endian
+ * guint64 followed by the serialized a{sv} from
+ * gdu_benchmark_to_gvariant(). If writing a run is interrupted, only
+ * that run is lost - the incomplete record at the end is ignored when
+ * loading and cut off before the next run is appended.
+ *
+ * Before there was a history, only the latest run was kept in a file
+ * of its own. It's moved into the history the first time a run is
+ * added.
+ */
+
+#define RECORD_HEADER_SIZE sizeof (guint64)
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* returns NULL if @id can't be used */
+static gchar *
+get_filename (const gchar *id,
+              const gchar *extension)
+{
+  gchar *ret = NULL;
+  gchar *bench_dir = NULL;
+
+  if (id == NULL || strlen (id) == 0)
+    goto out;
+
+  bench_dir = g_strdup_printf ("%s/gnome-disks/benchmarks", g_get_user_cache_dir ());
+  if (g_mkdir_with_parents (bench_dir, 0777) != 0)
+    {
+      g_warning ("Error creating directory %s: %m", bench_dir);
+      goto out;
+    }
+
+  ret = g_strdup_printf ("%s/%s.%s", bench_dir, id, extension);
+
+ out:
+  g_free (bench_dir);
+  return ret;
+}
+
+/* returns the length of the complete records at the start of @contents */
+static gsize
+get_complete_length (const gchar *contents,
+                     gsize        length)
+{
+  gsize pos = 0;
+
+  while (length - pos >= RECORD_HEADER_SIZE)
+    {
+      guint64 size;
+
+      memcpy (&size, contents + pos, RECORD_HEADER_SIZE);
+      size = GUINT64_FROM_LE (size);
+      if (size > length - pos - RECORD_HEADER_SIZE)
+        break;
+      pos += RECORD_HEADER_SIZE + size;
+    }
+  return pos;
+}
+
+/* takes ownership of @data */
+static GduBenchmark *
+benchmark_from_data (gchar  *data,
+                     gsize   size,
+                     GError **error)
+{
+  GduBenchmark *ret;
+  GVariant *value;
+
+  value = g_variant_new_from_data (G_VARIANT_TYPE_VARDICT,
+                                   data,
+                                   size,
+                                   FALSE,
+                                   g_free, data);
+  g_variant_ref_sink (value);
+
+  ret = gdu_benchmark_new ();
+  if (!gdu_benchmark_set_from_gvariant (ret, value, error))
+    g_clear_pointer (&ret, gdu_benchmark_free);
+
+  g_variant_unref (value);
+  return ret;
+}
+
+static void
+add_benchmark_from_data (GPtrArray   *array,
+                         gchar       *data,
+                         gsize        size,
+                         const gchar *filename)
+{
+  GduBenchmark *benchmark;
+  GError *error = NULL;
+
+  benchmark = benchmark_from_data (data, size, &error);
+  if (benchmark == NULL)
+    {
+      /* skip it, there's no point in losing the other runs over it */
+      g_warning ("Error loading benchmark from %s: %s (%s, %d)",
+                 filename, error->message, g_quark_to_string (error->domain), error->code);
+      g_clear_error (&error);
+      return;
+    }
+  g_ptr_array_add (array, benchmark);
+}
+
+/**
+ * gdu_benchmark_history_load:
+ * @id: The device to load the history of, e.g. from udisks_block_get_id().
+ * @error: Return location for error or %NULL.
+ *
+ * Loads all runs saved with gdu_benchmark_history_append() for @id.
+ * It's not an error if there are none or @id is %NULL or empty.
+ *
+ * Returns: (transfer full): The runs as #GduBenchmark instances,
+ * oldest first, or %NULL if @error is set.
+ */
+GPtrArray *
+gdu_benchmark_history_load (const gchar  *id,
+                            GError      **error)
+{
+  GPtrArray *ret;
+  gchar *filename = NULL;
+  gchar *legacy_filename = NULL;
+  gchar *contents = NULL;
+  gsize length;
+  gsize complete_length;
+  gsize pos;
+  GError *local_error = NULL;
+
+  ret = g_ptr_array_new_with_free_func ((GDestroyNotify) gdu_benchmark_free);
+
+  filename = get_filename (id, "gnome-disks-benchmark-history");
+  if (filename == NULL)
+    goto out;
+
+  if (!g_file_get_contents (filename, &contents, &length, &local_error))
+    {
+      if (!g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_propagate_error (error, local_error);
+          g_clear_pointer (&ret, g_ptr_array_unref);
+          goto out;
+        }
+      g_clear_error (&local_error);
+
+      /* no history yet, but maybe the latest run from before there was one */
+      legacy_filename = get_filename (id, "gnome-disks-benchmark");
+      if (g_file_get_contents (legacy_filename, &contents, &length, NULL))
+        {
+          add_benchmark_from_data (ret, contents, length, legacy_filename);
+          contents = NULL;
+        }
+      goto out;
+    }
+
+  complete_length = get_complete_length (contents, length);
+  pos = 0;
+  while (pos < complete_length)
+    {
+      guint64 size;
+
+      memcpy (&size, contents + pos, RECORD_HEADER_SIZE);
+      size = GUINT64_FROM_LE (size);
+      pos += RECORD_HEADER_SIZE;
+
+      /* copied since serialized GVariant data needs to be aligned */
+      add_benchmark_from_data (ret, g_memdup (contents + pos, size), size, filename);
+      pos += size;
+    }
+  if (complete_length < length)
+    g_warning ("Ignoring %" G_GSIZE_FORMAT " bytes of incomplete data at the end of %s",
+               length - complete_length, filename);
+
+ out:
+  g_free (contents);
+  g_free (legacy_filename);
+  g_free (filename);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+append_record (GFileOutputStream  *stream,
+               gconstpointer       data,
+               gsize               size,
+               GError            **error)
+{
+  gboolean ret;
+  guchar *record;
+  guint64 header;
+
+  /* one write so a record is never split */
+  record = g_malloc (RECORD_HEADER_SIZE + size);
+  header = GUINT64_TO_LE ((guint64) size);
+  memcpy (record, &header, RECORD_HEADER_SIZE);
+  memcpy (record + RECORD_HEADER_SIZE, data, size);
+  ret = g_output_stream_write_all (G_OUTPUT_STREAM (stream), record, RECORD_HEADER_SIZE + size, NULL, NULL, error);
+  g_free (record);
+  return ret;
+}
+
+/**
+ * gdu_benchmark_history_append:
+ * @id: The device to add the run to the history of, e.g. from udisks_block_get_id().
+ * @benchmark: A #GduBenchmark with results.
+ * @error: Return location for error or %NULL.
+ *
+ * Adds the results in @benchmark to the history of @id. Nothing is
+ * saved if @id is %NULL or empty.
+ *
+ * Returns: %TRUE if the run was added or there was nothing to do, %FALSE if @error is set.
+ */
+gboolean
+gdu_benchmark_history_append (const gchar   *id,
+                              GduBenchmark  *benchmark,
+                              GError       **error)
+{
+  gboolean ret = FALSE;
+  gchar *filename = NULL;
+  gchar *legacy_filename = NULL;
+  gchar *legacy_contents = NULL;
+  gsize legacy_length;
+  gchar *contents = NULL;
+  gsize length;
+  gsize complete_length;
+  GFile *file = NULL;
+  GFileOutputStream *stream = NULL;
+  GVariant *value = NULL;
+
+  filename = get_filename (id, "gnome-disks-benchmark-history");
+  if (filename == NULL)
+    {
+      /* all good since we don't want to save data for this device */
+      ret = TRUE;
+      goto out;
+    }
+
+  /* the latest run from before there was a history goes first, see above */
+  if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+    {
+      legacy_filename = get_filename (id, "gnome-disks-benchmark");
+      if (!g_file_get_contents (legacy_filename, &legacy_contents, &legacy_length, NULL))
+        legacy_contents = NULL;
+    }
+  else
+    {
+      /* a run that was cut short would make everything after it unreadable */
+      if (!g_file_get_contents (filename, &contents, &length, error))
+        goto out;
+      complete_length = get_complete_length (contents, length);
+      if (complete_length < length)
+        {
+          g_warning ("Removing %" G_GSIZE_FORMAT " bytes of incomplete data at the end of %s",
+                     length - complete_length, filename);
+          if (truncate (filename, complete_length) != 0)
+            {
+              gint errsv = errno;
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           "Error truncating %s: %s",
+                           filename, g_strerror (errsv));
+              goto out;
+            }
+        }
+    }
+
+  file = g_file_new_for_path (filename);
+  stream = g_file_append_to (file, G_FILE_CREATE_NONE, NULL, error);
+  if (stream == NULL)
+    goto out;
+
+  if (legacy_contents != NULL)
+    {
+      if (!append_record (stream, legacy_contents, legacy_length, error))
+        goto out;
+      if (g_unlink (legacy_filename) != 0)
+        g_warning ("Error removing %s: %m", legacy_filename);
+    }
+
+  value = g_variant_ref_sink (gdu_benchmark_to_gvariant (benchmark));
+  if (!append_record (stream, g_variant_get_data (value), g_variant_get_size (value), error))
+    goto out;
+
+  if (!g_output_stream_close (G_OUTPUT_STREAM (stream), NULL, error))
+    goto out;
+
+  ret = TRUE;
+
+ out:
+  if (value != NULL)
+    g_variant_unref (value);
+  g_clear_object (&stream);
+  g_clear_object (&file);
+  g_free (contents);
+  g_free (legacy_contents);
+  g_free (legacy_filename);
+  g_free (filename);
+  return ret;
+}
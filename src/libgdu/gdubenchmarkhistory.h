@@ -0,0 +1,25 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_BENCHMARK_HISTORY_H__
+#define __GDU_BENCHMARK_HISTORY_H__
+
+#include "libgdutypes.h"
+
+G_BEGIN_DECLS
+
+GPtrArray *gdu_benchmark_history_load   (const gchar   *id,
+                                         GError       **error);
+gboolean   gdu_benchmark_history_append (const gchar   *id,
+                                         GduBenchmark  *benchmark,
+                                         GError       **error);
+
+G_END_DECLS
+
+#endif /* __GDU_BENCHMARK_HISTORY_H__ */
@@ -0,0 +1,493 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+
+#if defined(HAVE_IO_URING)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "gduioengine.h"
+
+/* A small I/O engine for copying large amounts of data to and from
+ * block devices. Up to @queue_depth reads and writes can be in flight
+ * at the same time which is what fast NVMe and RAID devices need to
+ * reach their rated throughput.
+ *
+ * Requests are submitted through io_uring(7) if the kernel supports
+ * it. Otherwise they are carried out synchronously with pread(2) and
+ * pwrite(2) at submission time and simply queued as completed, so
+ * callers don't need to care which one is used.
+ *
+ * liburing is not used since we need just a tiny subset of it - the
+ * raw syscalls and ring layout are stable kernel ABI.
+ */
+
+typedef struct
+{
+  struct iovec iov;
+  gpointer user_data;
+  gssize result;
+} Request;
+
+struct GduIOEngine
+{
+  guint queue_depth;
+  guint num_pending;
+
+  Request *requests;
+  GQueue free_requests;
+
+  /* only used for the synchronous fallback */
+  GQueue completed_requests;
+
+#if defined(HAVE_IO_URING)
+  gint ring_fd;
+  guint num_unsubmitted;
+
+  gpointer sq_ring;
+  gsize sq_ring_size;
+  guint *sq_tail;
+  guint *sq_mask;
+  guint *sq_array;
+  struct io_uring_sqe *sqes;
+  gsize sqes_size;
+
+  gpointer cq_ring;
+  gsize cq_ring_size;
+  guint *cq_head;
+  guint *cq_tail;
+  guint *cq_mask;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+#if defined(HAVE_IO_URING)
+
+static void
+ring_teardown (GduIOEngine *engine)
+{
+  if (engine->sqes != NULL && engine->sqes != MAP_FAILED)
+    munmap (engine->sqes, engine->sqes_size);
+  if (engine->cq_ring != NULL && engine->cq_ring != MAP_FAILED && engine->cq_ring != engine->sq_ring)
+    munmap (engine->cq_ring, engine->cq_ring_size);
+  if (engine->sq_ring != NULL && engine->sq_ring != MAP_FAILED)
+    munmap (engine->sq_ring, engine->sq_ring_size);
+  if (engine->ring_fd != -1)
+    close (engine->ring_fd);
+  engine->sqes = NULL;
+  engine->cq_ring = NULL;
+  engine->sq_ring = NULL;
+  engine->ring_fd = -1;
+}
+
+static gboolean
+ring_setup (GduIOEngine *engine)
+{
+  struct io_uring_params params;
+
+  memset (&params, 0, sizeof params);
+  engine->ring_fd = syscall (__NR_io_uring_setup, engine->queue_depth, &params);
+  if (engine->ring_fd < 0)
+    {
+      /* ENOSYS on older kernels, EPERM if disabled by the admin, ... */
+      engine->ring_fd = -1;
+      goto fail;
+    }
+
+  engine->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (guint);
+  engine->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    engine->sq_ring_size = engine->cq_ring_size = MAX (engine->sq_ring_size, engine->cq_ring_size);
+
+  engine->sq_ring = mmap (NULL, engine->sq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQ_RING);
+  if (engine->sq_ring == MAP_FAILED)
+    goto fail;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      engine->cq_ring = engine->sq_ring;
+    }
+  else
+    {
+      engine->cq_ring = mmap (NULL, engine->cq_ring_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_CQ_RING);
+      if (engine->cq_ring == MAP_FAILED)
+        goto fail;
+    }
+
+  engine->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+  engine->sqes = mmap (NULL, engine->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, engine->ring_fd, IORING_OFF_SQES);
+  if (engine->sqes == MAP_FAILED)
+    goto fail;
+
+  engine->sq_tail = (guint *) ((guchar *) engine->sq_ring + params.sq_off.tail);
+  engine->sq_mask = (guint *) ((guchar *) engine->sq_ring + params.sq_off.ring_mask);
+  engine->sq_array = (guint *) ((guchar *) engine->sq_ring + params.sq_off.array);
+  engine->cq_head = (guint *) ((guchar *) engine->cq_ring + params.cq_off.head);
+  engine->cq_tail = (guint *) ((guchar *) engine->cq_ring + params.cq_off.tail);
+  engine->cq_mask = (guint *) ((guchar *) engine->cq_ring + params.cq_off.ring_mask);
+  engine->cqes = (struct io_uring_cqe *) ((guchar *) engine->cq_ring + params.cq_off.cqes);
+
+  /* The kernel may round up but never down */
+  g_assert (params.sq_entries >= engine->queue_depth);
+
+  return TRUE;
+
+ fail:
+  ring_teardown (engine);
+  return FALSE;
+}
+
+/* Submits queued SQEs and, if @wait is TRUE, waits for at least one completion */
+static gboolean
+ring_enter (GduIOEngine  *engine,
+            gboolean      wait,
+            GError      **error)
+{
+  gint rc;
+
+ again:
+  rc = syscall (__NR_io_uring_enter,
+                engine->ring_fd,
+                engine->num_unsubmitted,
+                wait ? 1 : 0,
+                wait ? IORING_ENTER_GETEVENTS : 0,
+                NULL, 0);
+  if (rc < 0)
+    {
+      if (errno == EINTR)
+        goto again;
+      /* The kernel is short on resources; the SQEs stay queued
+       * and are submitted next time around
+       */
+      if (!wait && (errno == EAGAIN || errno == EBUSY))
+        return TRUE;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "io_uring_enter() failed: %s", strerror (errno));
+      return FALSE;
+    }
+
+  engine->num_unsubmitted -= MIN ((guint) rc, engine->num_unsubmitted);
+  return TRUE;
+}
+
+static gboolean
+ring_submit (GduIOEngine  *engine,
+             guint8        opcode,
+             gint          fd,
+             Request      *request,
+             guint64       offset,
+             GError      **error)
+{
+  struct io_uring_sqe *sqe;
+  guint tail;
+  guint index;
+
+  /* We are the only ones writing the tail */
+  tail = *engine->sq_tail;
+  index = tail & *engine->sq_mask;
+
+  sqe = &engine->sqes[index];
+  memset (sqe, 0, sizeof *sqe);
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->off = offset;
+  sqe->addr = (guint64) (guintptr) &request->iov;
+  sqe->len = 1;
+  sqe->user_data = (guint64) (guintptr) request;
+  engine->sq_array[index] = index;
+
+  __atomic_store_n (engine->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  engine->num_unsubmitted++;
+
+  return ring_enter (engine, FALSE, error);
+}
+
+static gboolean
+ring_reap (GduIOEngine  *engine,
+           Request     **out_request,
+           GError      **error)
+{
+  while (TRUE)
+    {
+      guint head;
+      guint tail;
+
+      head = *engine->cq_head;
+      tail = __atomic_load_n (engine->cq_tail, __ATOMIC_ACQUIRE);
+      if (head != tail)
+        {
+          struct io_uring_cqe *cqe = &engine->cqes[head & *engine->cq_mask];
+          Request *request = (Request *) (guintptr) cqe->user_data;
+          request->result = cqe->res;
+          __atomic_store_n (engine->cq_head, head + 1, __ATOMIC_RELEASE);
+          *out_request = request;
+          return TRUE;
+        }
+
+      if (!ring_enter (engine, TRUE, error))
+        return FALSE;
+    }
+}
+
+#endif /* HAVE_IO_URING */
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_io_engine_new:
+ * @queue_depth: The maximum number of requests in flight.
+ *
+ * Creates a new I/O engine, using io_uring if available.
+ *
+ * Returns: A #GduIOEngine. Free with gdu_io_engine_free().
+ */
+GduIOEngine *
+gdu_io_engine_new (guint queue_depth)
+{
+  GduIOEngine *engine;
+  guint n;
+
+  g_return_val_if_fail (queue_depth > 0, NULL);
+
+  engine = g_new0 (GduIOEngine, 1);
+  engine->queue_depth = queue_depth;
+  engine->requests = g_new0 (Request, queue_depth);
+  g_queue_init (&engine->free_requests);
+  g_queue_init (&engine->completed_requests);
+  for (n = 0; n < queue_depth; n++)
+    g_queue_push_tail (&engine->free_requests, &engine->requests[n]);
+
+#if defined(HAVE_IO_URING)
+  engine->ring_fd = -1;
+  ring_setup (engine);
+#endif
+
+  return engine;
+}
+
+/**
+ * gdu_io_engine_free:
+ * @engine: A #GduIOEngine.
+ *
+ * Waits for all requests still in flight and frees @engine. This
+ * must be done before freeing the buffers passed to it.
+ */
+void
+gdu_io_engine_free (GduIOEngine *engine)
+{
+  while (engine->num_pending > 0)
+    {
+      if (!gdu_io_engine_wait (engine, NULL, NULL, NULL))
+        break;
+    }
+
+#if defined(HAVE_IO_URING)
+  ring_teardown (engine);
+#endif
+
+  g_queue_clear (&engine->completed_requests);
+  g_queue_clear (&engine->free_requests);
+  g_free (engine->requests);
+  g_free (engine);
+}
+
+gboolean
+gdu_io_engine_is_async (GduIOEngine *engine)
+{
+#if defined(HAVE_IO_URING)
+  return engine->ring_fd != -1;
+#else
+  return FALSE;
+#endif
+}
+
+guint
+gdu_io_engine_get_queue_depth (GduIOEngine *engine)
+{
+  return engine->queue_depth;
+}
+
+guint
+gdu_io_engine_get_num_pending (GduIOEngine *engine)
+{
+  return engine->num_pending;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+static gboolean
+submit (GduIOEngine  *engine,
+        gboolean      is_write,
+        gint          fd,
+        gpointer      buffer,
+        gsize         size,
+        guint64       offset,
+        gpointer      user_data,
+        GError      **error)
+{
+  Request *request;
+
+  request = g_queue_pop_head (&engine->free_requests);
+  if (request == NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                   "Queue depth of %u exceeded", engine->queue_depth);
+      return FALSE;
+    }
+
+  request->iov.iov_base = buffer;
+  request->iov.iov_len = size;
+  request->user_data = user_data;
+  request->result = 0;
+
+#if defined(HAVE_IO_URING)
+  if (engine->ring_fd != -1)
+    {
+      if (!ring_submit (engine,
+                        is_write ? IORING_OP_WRITEV : IORING_OP_READV,
+                        fd, request, offset, error))
+        {
+          /* The SQE is already queued so the request is pending */
+          engine->num_pending++;
+          return FALSE;
+        }
+      engine->num_pending++;
+      return TRUE;
+    }
+#endif
+
+  /* Synchronous fallback */
+  do
+    {
+      if (is_write)
+        request->result = pwrite (fd, buffer, size, offset);
+      else
+        request->result = pread (fd, buffer, size, offset);
+    }
+  while (request->result < 0 && (errno == EINTR || errno == EAGAIN));
+  if (request->result < 0)
+    request->result = -errno;
+
+  g_queue_push_tail (&engine->completed_requests, request);
+  engine->num_pending++;
+  return TRUE;
+}
+
+/**
+ * gdu_io_engine_submit_read:
+ * @engine: A #GduIOEngine.
+ * @fd: The file descriptor to read from.
+ * @buffer: Where to store the data. Must remain valid until the request completes.
+ * @size: Number of bytes to read.
+ * @offset: Offset to read from.
+ * @user_data: Returned by gdu_io_engine_wait() when the request completes.
+ * @error: Return location for error or %NULL.
+ *
+ * Submits a read request. At most #GduIOEngine:queue_depth requests
+ * can be pending at any time.
+ *
+ * Returns: %TRUE if the request was submitted, %FALSE if @error is set.
+ */
+gboolean
+gdu_io_engine_submit_read (GduIOEngine  *engine,
+                           gint          fd,
+                           gpointer      buffer,
+                           gsize         size,
+                           guint64       offset,
+                           gpointer      user_data,
+                           GError      **error)
+{
+  return submit (engine, FALSE, fd, buffer, size, offset, user_data, error);
+}
+
+/**
+ * gdu_io_engine_submit_write:
+ *
+ * Like gdu_io_engine_submit_read() but writes @size bytes from @buffer.
+ */
+gboolean
+gdu_io_engine_submit_write (GduIOEngine    *engine,
+                            gint            fd,
+                            gconstpointer   buffer,
+                            gsize           size,
+                            guint64         offset,
+                            gpointer        user_data,
+                            GError        **error)
+{
+  return submit (engine, TRUE, fd, (gpointer) buffer, size, offset, user_data, error);
+}
+
+/**
+ * gdu_io_engine_wait:
+ * @engine: A #GduIOEngine.
+ * @out_user_data: (allow-none): Return location for the @user_data the request was submitted with.
+ * @out_result: (allow-none): Return location for the number of bytes transferred or a negative errno value.
+ * @error: Return location for error or %NULL.
+ *
+ * Waits for a request to complete. Requests may complete in any
+ * order. Note that a request failing or transferring fewer bytes
+ * than asked for is not an error, check @out_result for that.
+ *
+ * Returns: %TRUE if a request completed, %FALSE if @error is set.
+ */
+gboolean
+gdu_io_engine_wait (GduIOEngine  *engine,
+                    gpointer     *out_user_data,
+                    gssize       *out_result,
+                    GError      **error)
+{
+  Request *request = NULL;
+
+  if (engine->num_pending == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No requests pending");
+      return FALSE;
+    }
+
+#if defined(HAVE_IO_URING)
+  if (engine->ring_fd != -1)
+    {
+      if (!ring_reap (engine, &request, error))
+        return FALSE;
+    }
+  else
+#endif
+    {
+      request = g_queue_pop_head (&engine->completed_requests);
+    }
+
+  g_assert (request != NULL);
+  engine->num_pending--;
+
+  if (out_user_data != NULL)
+    *out_user_data = request->user_data;
+  if (out_result != NULL)
+    *out_result = request->result;
+
+  g_queue_push_tail (&engine->free_requests, request);
+  return TRUE;
+}
@@ -0,0 +1,43 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_IO_ENGINE_H__
+#define __GDU_IO_ENGINE_H__
+
+#include "libgdutypes.h"
+
+G_BEGIN_DECLS
+
+GduIOEngine *gdu_io_engine_new             (guint          queue_depth);
+void         gdu_io_engine_free            (GduIOEngine   *engine);
+gboolean     gdu_io_engine_is_async        (GduIOEngine   *engine);
+guint        gdu_io_engine_get_queue_depth (GduIOEngine   *engine);
+guint        gdu_io_engine_get_num_pending (GduIOEngine   *engine);
+gboolean     gdu_io_engine_submit_read     (GduIOEngine   *engine,
+                                            gint           fd,
+                                            gpointer       buffer,
+                                            gsize          size,
+                                            guint64        offset,
+                                            gpointer       user_data,
+                                            GError       **error);
+gboolean     gdu_io_engine_submit_write    (GduIOEngine   *engine,
+                                            gint           fd,
+                                            gconstpointer  buffer,
+                                            gsize          size,
+                                            guint64        offset,
+                                            gpointer       user_data,
+                                            GError       **error);
+gboolean     gdu_io_engine_wait            (GduIOEngine   *engine,
+                                            gpointer      *out_user_data,
+                                            gssize        *out_result,
+                                            GError       **error);
+
+G_END_DECLS
+
+#endif /* __GDU_IO_ENGINE_H__ */
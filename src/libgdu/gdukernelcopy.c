@@ -0,0 +1,225 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib/gi18n.h>
+#include <gio/gio.h>
+
+#include "gdukernelcopy.h"
+
+/* Copies data between two file descriptors without it ever going
+ * through userspace - for plain copies between a block device and a
+ * disk image where nothing needs to look at the data.
+ *
+ * copy_file_range(2) is tried first since it can offload the copy
+ * (e.g. reflinks or server-side copies). It only works between
+ * regular files on most kernels so otherwise the data is spliced
+ * through a pipe with splice(2), which works for block devices too.
+ */
+
+/* The size of the pipe, if the system allows it */
+#define PIPE_SIZE (1024 * 1024)
+
+typedef enum
+{
+  METHOD_COPY_FILE_RANGE,
+  METHOD_SPLICE,
+  METHOD_NONE
+} Method;
+
+struct GduKernelCopy
+{
+  gint in_fd;
+  gint out_fd;
+  Method method;
+  gint pipe_fds[2];
+};
+
+GduKernelCopy *
+gdu_kernel_copy_new (gint in_fd,
+                     gint out_fd)
+{
+  GduKernelCopy *copy;
+
+  copy = g_new0 (GduKernelCopy, 1);
+  copy->in_fd = in_fd;
+  copy->out_fd = out_fd;
+#if defined(HAVE_COPY_FILE_RANGE)
+  copy->method = METHOD_COPY_FILE_RANGE;
+#else
+  copy->method = METHOD_SPLICE;
+#endif
+  copy->pipe_fds[0] = -1;
+  copy->pipe_fds[1] = -1;
+  return copy;
+}
+
+void
+gdu_kernel_copy_free (GduKernelCopy *copy)
+{
+  if (copy->pipe_fds[0] != -1)
+    close (copy->pipe_fds[0]);
+  if (copy->pipe_fds[1] != -1)
+    close (copy->pipe_fds[1]);
+  g_free (copy);
+}
+
+/* Errors that mean the method doesn't work for these files */
+static gboolean
+is_not_supported (gint errsv)
+{
+  return errsv == EINVAL || errsv == EXDEV || errsv == ENOSYS || errsv == EOPNOTSUPP;
+}
+
+static gssize
+copy_with_splice (GduKernelCopy  *copy,
+                  guint64         in_offset,
+                  guint64         out_offset,
+                  gsize           size,
+                  GError        **error)
+{
+  loff_t in_off = in_offset;
+  loff_t out_off = out_offset;
+  ssize_t num_bytes_in_pipe;
+  gsize num_bytes_written = 0;
+
+  if (copy->pipe_fds[0] == -1)
+    {
+      if (pipe2 (copy->pipe_fds, O_CLOEXEC) != 0)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error creating pipe: %m");
+          return -1;
+        }
+      /* a bigger pipe means fewer round trips, but the default is fine too */
+      fcntl (copy->pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+    }
+
+  do
+    num_bytes_in_pipe = splice (copy->in_fd, &in_off, copy->pipe_fds[1], NULL, size, SPLICE_F_MOVE | SPLICE_F_MORE);
+  while (num_bytes_in_pipe < 0 && errno == EINTR);
+  if (num_bytes_in_pipe < 0)
+    {
+      if (is_not_supported (errno))
+        copy->method = METHOD_NONE;
+      g_set_error (error, G_IO_ERROR,
+                   copy->method == METHOD_NONE ? G_IO_ERROR_NOT_SUPPORTED : g_io_error_from_errno (errno),
+                   "Error reading %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": %m",
+                   size,
+                   in_offset);
+      return -1;
+    }
+
+  /* Drain the pipe completely so it's empty for the next call */
+  while (num_bytes_written < (gsize) num_bytes_in_pipe)
+    {
+      ssize_t n;
+
+      n = splice (copy->pipe_fds[0], NULL, copy->out_fd, &out_off,
+                  num_bytes_in_pipe - num_bytes_written, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        {
+          /* the pipe can't be reused with data left in it */
+          close (copy->pipe_fds[0]);
+          close (copy->pipe_fds[1]);
+          copy->pipe_fds[0] = -1;
+          copy->pipe_fds[1] = -1;
+          if (n < 0 && num_bytes_written == 0 && is_not_supported (errno))
+            {
+              copy->method = METHOD_NONE;
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Error writing %" G_GSSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %m",
+                           num_bytes_in_pipe,
+                           out_offset);
+            }
+          else
+            {
+              g_set_error (error, G_IO_ERROR, n < 0 ? g_io_error_from_errno (errno) : G_IO_ERROR_FAILED,
+                           "Error writing %" G_GSSIZE_FORMAT " bytes to offset %" G_GUINT64_FORMAT ": %s",
+                           num_bytes_in_pipe - num_bytes_written,
+                           out_offset + num_bytes_written,
+                           n < 0 ? g_strerror (errno) : "no progress");
+            }
+          return -1;
+        }
+      num_bytes_written += n;
+    }
+
+  return num_bytes_in_pipe;
+}
+
+/**
+ * gdu_kernel_copy_copy:
+ * @copy: A #GduKernelCopy.
+ * @in_offset: Where to copy from.
+ * @out_offset: Where to copy to.
+ * @size: The maximum number of bytes to copy.
+ * @error: Return location for error or %NULL.
+ *
+ * Copies up to @size bytes in the kernel. The file positions of the
+ * file descriptors are not used or changed.
+ *
+ * If the data can't be copied this way, %G_IO_ERROR_NOT_SUPPORTED is
+ * returned and the caller should copy the data itself - that includes
+ * e.g. O_DIRECT file descriptors that don't like the offset. Other
+ * errors (e.g. %G_IO_ERROR_FAILED for an I/O error) may also be worth
+ * retrying the usual way, to narrow down where exactly they happen.
+ *
+ * Returns: The number of bytes copied, which may be less than @size
+ *   but is only 0 at the end of the input. On error -1 is returned
+ *   and @error is set.
+ */
+gssize
+gdu_kernel_copy_copy (GduKernelCopy  *copy,
+                      guint64         in_offset,
+                      guint64         out_offset,
+                      gsize           size,
+                      GError        **error)
+{
+#if defined(HAVE_COPY_FILE_RANGE)
+  if (copy->method == METHOD_COPY_FILE_RANGE)
+    {
+      loff_t in_off = in_offset;
+      loff_t out_off = out_offset;
+      ssize_t num_bytes_copied;
+
+      do
+        num_bytes_copied = copy_file_range (copy->in_fd, &in_off, copy->out_fd, &out_off, size, 0);
+      while (num_bytes_copied < 0 && errno == EINTR);
+      if (num_bytes_copied >= 0)
+        return num_bytes_copied;
+      if (!is_not_supported (errno))
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                       "Error copying %" G_GSIZE_FORMAT " bytes from offset %" G_GUINT64_FORMAT ": %m",
+                       size,
+                       in_offset);
+          return -1;
+        }
+      /* e.g. a block device - try splicing instead */
+      copy->method = METHOD_SPLICE;
+    }
+#endif
+
+  if (copy->method == METHOD_SPLICE)
+    return copy_with_splice (copy, in_offset, out_offset, size, error);
+
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Copying in the kernel is not supported");
+  return -1;
+}
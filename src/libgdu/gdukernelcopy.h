@@ -0,0 +1,28 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_KERNEL_COPY_H__
+#define __GDU_KERNEL_COPY_H__
+
+#include "libgdutypes.h"
+
+G_BEGIN_DECLS
+
+GduKernelCopy *gdu_kernel_copy_new  (gint            in_fd,
+                                     gint            out_fd);
+void           gdu_kernel_copy_free (GduKernelCopy  *copy);
+gssize         gdu_kernel_copy_copy (GduKernelCopy  *copy,
+                                     guint64         in_offset,
+                                     guint64         out_offset,
+                                     gsize           size,
+                                     GError        **error);
+
+G_END_DECLS
+
+#endif /* __GDU_KERNEL_COPY_H__ */
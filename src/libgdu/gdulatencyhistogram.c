@@ -0,0 +1,211 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "gdulatencyhistogram.h"
+
+/* Records latencies in logarithmic buckets, like HdrHistogram does.
+ * Values below 2 * SUB_BUCKETS microseconds get a bucket each; above
+ * that every power of two is split into SUB_BUCKETS linear buckets,
+ * so percentiles are within about 3% of the actual value no matter
+ * if they are microseconds or seconds, in a fixed amount of memory.
+ */
+
+#define SUB_BUCKET_BITS 5
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+/* all values with their most significant bit below this are exact */
+#define LINEAR_BITS (SUB_BUCKET_BITS + 1)
+#define NUM_BUCKETS ((1 << LINEAR_BITS) + (64 - LINEAR_BITS) * SUB_BUCKETS)
+
+struct GduLatencyHistogram
+{
+  guint64 count;
+  guint64 max;
+  guint64 buckets[NUM_BUCKETS];
+};
+
+static guint
+value_to_index (guint64 value)
+{
+  gint msb;
+  guint shift;
+
+  if (value < (1 << LINEAR_BITS))
+    return value;
+
+  msb = g_bit_nth_msf (value >> 32, -1);
+  msb = msb >= 0 ? msb + 32 : g_bit_nth_msf ((guint32) value, -1);
+  shift = msb - SUB_BUCKET_BITS;
+  return (1 << LINEAR_BITS)
+    + (msb - LINEAR_BITS) * SUB_BUCKETS
+    + ((value >> shift) - SUB_BUCKETS);
+}
+
+/* the highest value that ends up in bucket @index */
+static guint64
+index_to_highest_value (guint index)
+{
+  guint exponent;
+  guint64 sub;
+
+  if (index < (1 << LINEAR_BITS))
+    return index;
+
+  exponent = (index - (1 << LINEAR_BITS)) / SUB_BUCKETS + 1;
+  sub = (index - (1 << LINEAR_BITS)) % SUB_BUCKETS + SUB_BUCKETS;
+  return ((sub + 1) << exponent) - 1;
+}
+
+GduLatencyHistogram *
+gdu_latency_histogram_new (void)
+{
+  return g_new0 (GduLatencyHistogram, 1);
+}
+
+void
+gdu_latency_histogram_free (GduLatencyHistogram *histogram)
+{
+  g_free (histogram);
+}
+
+void
+gdu_latency_histogram_reset (GduLatencyHistogram *histogram)
+{
+  memset (histogram, 0, sizeof (GduLatencyHistogram));
+}
+
+void
+gdu_latency_histogram_record (GduLatencyHistogram *histogram,
+                              guint64              value_usec)
+{
+  histogram->buckets[value_to_index (value_usec)]++;
+  histogram->count++;
+  histogram->max = MAX (histogram->max, value_usec);
+}
+
+/* Adds the values recorded in @other to @histogram */
+void
+gdu_latency_histogram_merge (GduLatencyHistogram *histogram,
+                             GduLatencyHistogram *other)
+{
+  guint n;
+
+  for (n = 0; n < NUM_BUCKETS; n++)
+    histogram->buckets[n] += other->buckets[n];
+  histogram->count += other->count;
+  histogram->max = MAX (histogram->max, other->max);
+}
+
+guint64
+gdu_latency_histogram_get_count (GduLatencyHistogram *histogram)
+{
+  return histogram->count;
+}
+
+guint64
+gdu_latency_histogram_get_max (GduLatencyHistogram *histogram)
+{
+  return histogram->max;
+}
+
+/**
+ * gdu_latency_histogram_get_percentile:
+ * @histogram: A #GduLatencyHistogram.
+ * @percentile: The percentile, e.g. 99.9.
+ *
+ * Gets the latency that @percentile percent of the recorded values
+ * are at or below. Like HdrHistogram, the highest value of the
+ * bucket is returned so the result errs on the slow side.
+ *
+ * Returns: The latency in microseconds or 0 if nothing was recorded.
+ */
+guint64
+gdu_latency_histogram_get_percentile (GduLatencyHistogram *histogram,
+                                      gdouble              percentile)
+{
+  guint64 target;
+  guint64 sum = 0;
+  guint n;
+
+  if (histogram->count == 0)
+    return 0;
+
+  target = (guint64) ceil (CLAMP (percentile, 0.0, 100.0) / 100.0 * histogram->count);
+  target = MAX (target, 1);
+  for (n = 0; n < NUM_BUCKETS; n++)
+    {
+      sum += histogram->buckets[n];
+      if (sum >= target)
+        return MIN (index_to_highest_value (n), histogram->max);
+    }
+  return histogram->max;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/**
+ * gdu_latency_histogram_to_gvariant:
+ * @histogram: A #GduLatencyHistogram.
+ *
+ * Serializes @histogram, storing only the buckets in use.
+ *
+ * Returns: A floating #GVariant of type (ta(qt)).
+ */
+GVariant *
+gdu_latency_histogram_to_gvariant (GduLatencyHistogram *histogram)
+{
+  GVariantBuilder builder;
+  guint n;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(qt)"));
+  for (n = 0; n < NUM_BUCKETS; n++)
+    {
+      if (histogram->buckets[n] > 0)
+        g_variant_builder_add (&builder, "(qt)", (guint16) n, histogram->buckets[n]);
+    }
+  return g_variant_new ("(ta(qt))", histogram->max, &builder);
+}
+
+/* Returns: A #GduLatencyHistogram or %NULL if @value isn't valid */
+GduLatencyHistogram *
+gdu_latency_histogram_new_from_gvariant (GVariant *value)
+{
+  GduLatencyHistogram *histogram = NULL;
+  GVariantIter *iter = NULL;
+  guint16 index;
+  guint64 count;
+
+  if (!g_variant_is_of_type (value, G_VARIANT_TYPE ("(ta(qt))")))
+    goto out;
+
+  histogram = gdu_latency_histogram_new ();
+  g_variant_get (value, "(ta(qt))", &histogram->max, &iter);
+  while (g_variant_iter_next (iter, "(qt)", &index, &count))
+    {
+      if (index >= NUM_BUCKETS)
+        {
+          g_clear_pointer (&histogram, gdu_latency_histogram_free);
+          goto out;
+        }
+      histogram->buckets[index] += count;
+      histogram->count += count;
+    }
+
+ out:
+  if (iter != NULL)
+    g_variant_iter_free (iter);
+  return histogram;
+}
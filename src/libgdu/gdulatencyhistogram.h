@@ -0,0 +1,33 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (C) 2026 The GNOME Project
+ *
+ * Licensed under GPL version 2 or later.
+ *
+ * Author: The GNOME Project <https://www.gnome.org/>
+ */
+
+#ifndef __GDU_LATENCY_HISTOGRAM_H__
+#define __GDU_LATENCY_HISTOGRAM_H__
+
+#include "libgdutypes.h"
+
+G_BEGIN_DECLS
+
+GduLatencyHistogram *gdu_latency_histogram_new            (void);
+GduLatencyHistogram *gdu_latency_histogram_new_from_gvariant (GVariant             *value);
+void                 gdu_latency_histogram_free           (GduLatencyHistogram  *histogram);
+void                 gdu_latency_histogram_reset          (GduLatencyHistogram  *histogram);
+void                 gdu_latency_histogram_record         (GduLatencyHistogram  *histogram,
+                                                           guint64               value_usec);
+void                 gdu_latency_histogram_merge          (GduLatencyHistogram  *histogram,
+                                                           GduLatencyHistogram  *other);
+guint64              gdu_latency_histogram_get_count      (GduLatencyHistogram  *histogram);
+guint64              gdu_latency_histogram_get_max        (GduLatencyHistogram  *histogram);
+guint64              gdu_latency_histogram_get_percentile (GduLatencyHistogram  *histogram,
+                                                           gdouble               percentile);
+GVariant            *gdu_latency_histogram_to_gvariant    (GduLatencyHistogram  *histogram);
+
+G_END_DECLS
+
+#endif /* __GDU_LATENCY_HISTOGRAM_H__ */
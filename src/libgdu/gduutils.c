@@ -8,6 +8,10 @@
  */
 
 #include "config.h"
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+
 #include <glib/gi18n.h>
 #include <math.h>
 #include <sys/statvfs.h>
@@ -1352,6 +1356,7 @@ typedef struct
   GTask *task;
   GCancellable *cancellable; /* borrowed ref */
   guint last_mount_point_list_size; /* only for unuse_unmount_cb to check against a race in UDisks */
+  gboolean silent; /* errors are only returned, not shown */
 } UnuseData;
 
 static void
@@ -1370,9 +1375,12 @@ unuse_data_complete (UnuseData    *data,
 {
   if (error != NULL)
     {
-      gdu_utils_show_error (data->parent_window,
-                            error_message,
-                            error);
+      if (data->silent)
+        g_prefix_error (&error, "%s: ", error_message);
+      else
+        gdu_utils_show_error (data->parent_window,
+                              error_message,
+                              error);
       g_task_return_error (data->task, error);
     }
   else
@@ -1542,13 +1550,14 @@ unuse_data_iterate (UnuseData *data)
   g_clear_object (&filesystem_to_unmount);
 }
 
-void
-gdu_utils_ensure_unused_list (UDisksClient         *client,
-                              GtkWindow            *parent_window,
-                              GList                *objects,
-                              GAsyncReadyCallback   callback,
-                              GCancellable         *cancellable,
-                              gpointer              user_data)
+static void
+ensure_unused_list_internal (UDisksClient         *client,
+                             GtkWindow            *parent_window,
+                             gboolean              silent,
+                             GList                *objects,
+                             GAsyncReadyCallback   callback,
+                             GCancellable         *cancellable,
+                             gpointer              user_data)
 {
   UnuseData *data;
 
@@ -1558,6 +1567,7 @@ gdu_utils_ensure_unused_list (UDisksClient         *client,
   data = g_slice_new0 (UnuseData);
   data->client = g_object_ref (client);
   data->parent_window = (parent_window != NULL) ? g_object_ref (parent_window) : NULL;
+  data->silent = silent;
   data->objects = g_list_copy (objects);
   g_list_foreach (data->objects, (GFunc) g_object_ref, NULL);
   data->object_iter = data->objects;
@@ -1570,6 +1580,17 @@ gdu_utils_ensure_unused_list (UDisksClient         *client,
   unuse_data_iterate (data);
 }
 
+void
+gdu_utils_ensure_unused_list (UDisksClient         *client,
+                              GtkWindow            *parent_window,
+                              GList                *objects,
+                              GAsyncReadyCallback   callback,
+                              GCancellable         *cancellable,
+                              gpointer              user_data)
+{
+  ensure_unused_list_internal (client, parent_window, FALSE, objects, callback, cancellable, user_data);
+}
+
 gboolean
 gdu_utils_ensure_unused_list_finish (UDisksClient  *client,
                                      GAsyncResult  *res,
@@ -1605,6 +1626,23 @@ gdu_utils_ensure_unused (UDisksClient         *client,
   g_list_free (objects);
 }
 
+/* Like gdu_utils_ensure_unused() but for when nobody is watching, e.g.
+ * from the command line - errors are not shown in a dialog, only
+ * returned. Use gdu_utils_ensure_unused_finish() to get the result.
+ */
+void
+gdu_utils_ensure_unused_silently (UDisksClient         *client,
+                                  UDisksObject         *object,
+                                  GAsyncReadyCallback   callback,
+                                  GCancellable         *cancellable,
+                                  gpointer              user_data)
+{
+  GList *objects;
+  objects = g_list_append (NULL, object);
+  ensure_unused_list_internal (client, NULL, TRUE, objects, callback, cancellable, user_data);
+  g_list_free (objects);
+}
+
 gboolean
 gdu_utils_ensure_unused_finish (UDisksClient  *client,
                                 GAsyncResult  *res,
@@ -1755,3 +1793,140 @@ gdu_utils_get_default_unit (guint64 size)
     }
 }
 
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Returns TRUE if all @size bytes of @buffer are zero.
+ *
+ * Once the first 16 bytes are known to be zero, comparing the buffer
+ * against itself shifted by 16 bytes can only succeed if the rest is
+ * zero too. This lets the SIMD-optimized memcmp() in libc do the bulk
+ * of the work instead of a byte-wise loop.
+ */
+gboolean
+gdu_utils_is_zeroed (const guchar *buffer,
+                     gsize         size)
+{
+  gsize n;
+
+  for (n = 0; n < 16 && n < size; n++)
+    {
+      if (buffer[n] != 0)
+        return FALSE;
+    }
+
+  if (size <= 16)
+    return TRUE;
+
+  return memcmp (buffer, buffer + 16, size - 16) == 0;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Sets or clears O_DIRECT on @fd so I/O bypasses the page cache.
+ * Callers must then use aligned buffers, offsets and sizes.
+ *
+ * Returns: TRUE if the flag was changed, FALSE if it was already in
+ * the requested state or if the file doesn't support O_DIRECT.
+ */
+gboolean
+gdu_utils_set_direct_io (gint     fd,
+                         gboolean direct_io)
+{
+  gint flags;
+
+  flags = fcntl (fd, F_GETFL);
+  if (flags == -1)
+    return FALSE;
+
+  if (!!(flags & O_DIRECT) == !!direct_io)
+    return FALSE;
+
+  if (direct_io)
+    flags |= O_DIRECT;
+  else
+    flags &= ~O_DIRECT;
+
+  return fcntl (fd, F_SETFL, flags) == 0;
+}
+
+/* Drops the given range from the page cache, e.g. when copying data
+ * that won't be read again, so it doesn't evict everyone else's
+ * working set. If @written is TRUE, waits for the range to be written
+ * back first since dirty pages can't be dropped. A @size of 0 means
+ * until the end of the file.
+ */
+void
+gdu_utils_drop_page_cache (gint     fd,
+                           guint64  offset,
+                           guint64  size,
+                           gboolean written)
+{
+  if (written)
+    sync_file_range (fd, offset, size,
+                     SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise (fd, offset, size, POSIX_FADV_DONTNEED);
+}
+
+/* How far behind the current position pages are dropped by
+ * gdu_utils_throttle_writeback() - leaves writeback enough time to
+ * finish so we rarely have to wait for it.
+ */
+#define WRITEBACK_WINDOW (16 * 1024 * 1024)
+
+/* For sequential writers that don't use O_DIRECT: call this with the
+ * current write @position after each write. Writeback of everything
+ * written since the last call (i.e. from *@inout_offset) is started
+ * right away and pages older than WRITEBACK_WINDOW are dropped, so
+ * data is written out at a steady rate instead of dirty pages piling
+ * up until writeback stalls the system.
+ */
+void
+gdu_utils_throttle_writeback (gint     fd,
+                              guint64 *inout_offset,
+                              guint64  position)
+{
+  guint64 offset = *inout_offset;
+  guint64 drop_start;
+
+  if (position <= offset)
+    return;
+
+  sync_file_range (fd, offset, position - offset, SYNC_FILE_RANGE_WRITE);
+
+  if (position > WRITEBACK_WINDOW)
+    {
+      drop_start = offset > WRITEBACK_WINDOW ? offset - WRITEBACK_WINDOW : 0;
+      gdu_utils_drop_page_cache (fd, drop_start, position - WRITEBACK_WINDOW - drop_start, TRUE);
+    }
+
+  *inout_offset = position;
+}
+
+/* ---------------------------------------------------------------------------------------------------- */
+
+/* Appends @s to @str as a JSON string, or null if @s is %NULL */
+void
+gdu_utils_append_json_string (GString     *str,
+                              const gchar *s)
+{
+  const gchar *p;
+
+  if (s == NULL)
+    {
+      g_string_append (str, "null");
+      return;
+    }
+
+  g_string_append_c (str, '"');
+  for (p = s; *p != '\0'; p++)
+    {
+      if (*p == '"' || *p == '\\')
+        g_string_append_printf (str, "\\%c", *p);
+      else if ((guchar) *p < 0x20)
+        g_string_append_printf (str, "\\u%04x", (guint) *p);
+      else
+        g_string_append_c (str, *p);
+    }
+  g_string_append_c (str, '"');
+}
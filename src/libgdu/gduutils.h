@@ -128,6 +128,11 @@ void gdu_utils_ensure_unused (UDisksClient         *client,
 gboolean gdu_utils_ensure_unused_finish (UDisksClient  *client,
                                          GAsyncResult  *res,
                                          GError       **error);
+void gdu_utils_ensure_unused_silently (UDisksClient         *client,
+                                       UDisksObject         *object,
+                                       GAsyncReadyCallback   callback,
+                                       GCancellable         *cancellable,
+                                       gpointer              user_data);
 
 void gdu_utils_ensure_unused_list (UDisksClient         *client,
                                    GtkWindow            *parent_window,
@@ -184,6 +189,24 @@ static const guint64 unit_sizes[NUM_UNITS] = {
 
 gint gdu_utils_get_default_unit (guint64 size);
 
+gboolean gdu_utils_is_zeroed (const guchar *buffer,
+                              gsize         size);
+
+gboolean gdu_utils_set_direct_io (gint     fd,
+                                  gboolean direct_io);
+
+void gdu_utils_throttle_writeback (gint     fd,
+                                   guint64 *inout_offset,
+                                   guint64  position);
+
+void gdu_utils_drop_page_cache (gint     fd,
+                                guint64  offset,
+                                guint64  size,
+                                gboolean written);
+
+void gdu_utils_append_json_string (GString     *str,
+                                   const gchar *s);
+
 G_END_DECLS
 
 #endif /* __GDU_UTILS_H__ */
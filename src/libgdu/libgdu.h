@@ -13,6 +13,11 @@
 #include "libgdutypes.h"
 #include "libgduenums.h"
 #include "libgduenumtypes.h"
+#include "gdubenchmark.h"
+#include "gdubenchmarkhistory.h"
+#include "gduioengine.h"
+#include "gdukernelcopy.h"
+#include "gdulatencyhistogram.h"
 #include "gduutils.h"
 
 #endif /* __LIB_GDU_H__ */
@@ -21,6 +21,16 @@ typedef enum
   GDU_FORMAT_DURATION_FLAGS_NO_SECONDS           = (1<<1)
 } GduFormatDurationFlags;
 
+typedef enum
+{
+  GDU_BENCHMARK_PHASE_NONE,
+  GDU_BENCHMARK_PHASE_TRANSFER_RATE,
+  GDU_BENCHMARK_PHASE_ACCESS_TIME,
+  GDU_BENCHMARK_PHASE_QUEUE_DEPTH,
+  GDU_BENCHMARK_PHASE_WORKLOADS,
+  GDU_BENCHMARK_PHASE_SUSTAINED_WRITE
+} GduBenchmarkPhase;
+
 G_END_DECLS
 
 #endif /* __LIB_GDU_ENUMS_H__ */
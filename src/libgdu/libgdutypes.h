@@ -17,6 +17,18 @@
 
 G_BEGIN_DECLS
 
+struct GduBenchmark;
+typedef struct GduBenchmark GduBenchmark;
+
+struct GduIOEngine;
+typedef struct GduIOEngine GduIOEngine;
+
+struct GduKernelCopy;
+typedef struct GduKernelCopy GduKernelCopy;
+
+struct GduLatencyHistogram;
+typedef struct GduLatencyHistogram GduLatencyHistogram;
+
 G_END_DECLS
 
 #endif /* __LIB_GDU_TYPES_H__ */